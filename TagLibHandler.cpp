@@ -1,7 +1,10 @@
 #define NOMINMAX
 
+#include <cwctype>
+#include <memory>
+#include <stdexcept>
 #include <string>
-#include <sstream>
+#include <vector>
 
 #include <initguid.h>
 #include <mmdeviceapi.h>
@@ -14,7 +17,14 @@
 #include <tag.h>
 #include <fileref.h>
 
-#include "exttag.h"
+#include <boost/lexical_cast.hpp>
+
+#include "sharedcache.h"
+#include "snapcache.h"
+#include "snapshot.h"
+#include "streamaccessor.h"
+#include "extract.h"
+#include "onepass.h"
 
 //
 // Releases the specified pointer if not NULL
@@ -26,23 +36,113 @@
 		(p) = NULL;         \
 	}
 
-// DLL lifetime management functions
-void DllAddRef();
-void DllRelease();
+// Shared by every store in the process; see snapcache.h.
+static SnapshotCache snapshots(1024);
+// And by every process with the handler loaded; see sharedcache.h.
+static SharedSnapshotCache shared;
 
-const PROPERTYKEY keys[] = {
-	PKEY_Music_AlbumTitle, PKEY_Music_Artist,
-	PKEY_Music_TrackNumber, PKEY_Music_Genre,
-	PKEY_Title, PKEY_Media_Year, PKEY_Audio_ChannelCount,
-	PKEY_Media_Duration, PKEY_Audio_EncodingBitrate,
-	PKEY_Audio_SampleRate, PKEY_Rating, PKEY_Music_AlbumArtist,
-	PKEY_Music_Composer, PKEY_Music_Conductor,
-	PKEY_Media_Publisher, PKEY_Media_SubTitle,
-	PKEY_Media_Producer, PKEY_Music_Mood, PKEY_Copyright,
-	PKEY_Music_PartOfSet,
-	PKEY_Keywords, PKEY_Comment, PKEY_Media_DateReleased
+// takeSnapshot(), with some values from elsewhere than TagLib: read is readStreamedProperty, for a
+//  stream read through once.
+template <typename Source, typename Extra>
+static std::string takeSnapshotWith(const Source &file,
+	HRESULT (*read)(const Source &, const Extra &, REFPROPERTYKEY, PROPVARIANT *), const Extra &extra)
+{
+	std::vector<PROPVARIANT> values(keyCount);
+	for (size_t i = 0; i < keyCount; ++i)
+	{
+		PropVariantInit(&values[i]);
+		if (read(file, extra, keys[i], &values[i]) != S_OK)
+			PropVariantClear(&values[i]);
+	}
+	const std::string ret = encodeSnapshot(keys, &values[0], keyCount);
+	for (size_t i = 0; i < keyCount; ++i)
+		PropVariantClear(&values[i]);
+	return ret;
+}
+
+// On a miss: another process's snapshot, else parse the stream.
+struct StreamLoader : SnapshotCache::Loader
+{
+	StreamLoader(IStream *stream) : stream(stream), size(0), mtime(0) {}
+	IStream *stream;
+	// The stream's name, for its extension, and its size, if it has them.
+	std::wstring name;
+	ULONGLONG size;
+	// Set if the stream can be tied to a file (see fileIdentity()), in this process's cache and in
+	//  every other's; a stream that can't be is parsed, and kept by neither.
+	std::wstring identity;
+	ULONGLONG mtime;
+
+	bool load(std::string &snapshot)
+	{
+		if (!identity.empty() && shared.find(identity, size, mtime, snapshot))
+		{
+			// Any process in the session can write to the segment; don't trust what it left.
+			try
+			{
+				SnapshotReader(snapshot.data(), snapshot.size());
+				return true;
+			}
+			catch (std::invalid_argument &)
+			{
+			}
+		}
+		// Some streams (from a decompressor, or off the network) can't seek; those are read through
+		//  once, keeping the head and the tail.
+		LARGE_INTEGER zero = {};
+		if (FAILED(stream->Seek(zero, STREAM_SEEK_CUR, NULL)))
+		{
+			OnePassAccessor *source = new OnePassAccessor(stream, name);
+			TagLib::FileRef file(source);
+			if (file.isNull())
+				return false;
+			snapshot = takeSnapshotWith(file, readStreamedProperty, *source);
+		}
+		else if (!takeSnapshotFrom(new IStreamAccessor(stream), size, name, snapshot))
+			return false;
+		if (!identity.empty())
+			shared.insert(identity, size, mtime, snapshot);
+		return true;
+	}
 };
 
+static ULONGLONG fileTime(const FILETIME &ft)
+{
+	return (static_cast<ULONGLONG>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+}
+
+// The file a stream is over, as its volume's serial number and its file id, if the stream's name is
+//  its full path and the file there is still the one it was opened on. The shell's streams only give
+//  the file's name, and can't be tied to a file: copies of a file in other folders often match on
+//  name, size and times and have other tags, so those aren't cached at all.
+static bool fileIdentity(const wchar_t *name, ULONGLONG size, ULONGLONG mtime, std::wstring &identity)
+{
+	const bool full = (iswalpha(name[0]) && name[1] == L':' && name[2] == L'\\') || (name[0] == L'\\' && name[1] == L'\\');
+	if (!full)
+		return false;
+	HANDLE h = CreateFile(name, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, 0, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+	BY_HANDLE_FILE_INFORMATION bhfi;
+	const bool ok = GetFileInformationByHandle(h, &bhfi) != FALSE;
+	CloseHandle(h);
+	if (!ok)
+		return false;
+	// Some filesystems, and shares, give every file an id of 0.
+	const ULONGLONG id = (static_cast<ULONGLONG>(bhfi.nFileIndexHigh) << 32) | bhfi.nFileIndexLow;
+	if (!id || ((static_cast<ULONGLONG>(bhfi.nFileSizeHigh) << 32) | bhfi.nFileSizeLow) != size
+		|| fileTime(bhfi.ftLastWriteTime) != mtime)
+		return false;
+	identity = boost::lexical_cast<std::wstring>(bhfi.dwVolumeSerialNumber);
+	identity += L':';
+	identity += boost::lexical_cast<std::wstring>(id);
+	return true;
+}
+
+// DLL lifetime management functions
+void DllAddRef();
+void DllRelease();
 
 // Debug property handler class definition
 class CTagLibPropertyStore :
@@ -104,7 +204,7 @@ protected:
 		
 		PROPVARIANT pv = {};
 		pv.vt = VT_EMPTY;
-		for (size_t i = 0; i < ARRAYSIZE(keys); ++i)
+		for (size_t i = 0; i < keyCount; ++i)
 			_pCache->SetValue(keys[i], pv);
 	}
 
@@ -117,198 +217,18 @@ protected:
 	IStream*             _pStream; // data stream passed in to Initialize, and saved to on Commit
 	IPropertyStoreCache* _pCache;
 	DWORD                _grfMode; // STGM mode passed to Initialize
-	TagLib::FileRef taglibfile;
+	std::string snapshot;
+	std::auto_ptr<SnapshotReader> reader; // of snapshot.
 private:
 
 	long _cRef;
 };
 
-bool operator==(REFPROPERTYKEY left, REFPROPERTYKEY right)
-{
-	return IsEqualPropertyKey(left, right);
-}
-
-struct Dbstr
-{
-	const BSTR val;
-	Dbstr(const std::wstring &str) : val(SysAllocString(str.c_str()))
-	{
-		OutputDebugStr(L"bstr()");
-	}
-
-	~Dbstr()
-	{
-		OutputDebugStr(L"~bstr");
-		SysFreeString(val);
-	}
-
-	operator BSTR()
-	{
-		OutputDebugStr(L"op bstr");
-		return val;
-	}
-};
-
-#define TRY_BSTR(func)                                                \
-	try                                                               \
-	{                                                                 \
-		InitPropVariantFromString(func(taglibfile).c_str(), pPropVar);\
-	}                                                                 \
-	catch (std::domain_error &)                                       \
-	{                                                                 \
-		pPropVar->vt = VT_EMPTY;                                      \
-	}
-
-
 HRESULT CTagLibPropertyStore::GetValue(REFPROPERTYKEY key, PROPVARIANT *pPropVar)
 {
-	try
-	{
-		const TagLib::AudioProperties *ap = taglibfile.audioProperties();
-		const TagLib::Tag *tag = taglibfile.tag();
-
-		// If the tag is empty, treat it as if it doesn't exist.
-		if (tag && tag->isEmpty())
-			tag = NULL;
-
-		if (ap && key == PKEY_Audio_ChannelCount)
-		{
-			pPropVar->uintVal = ap->channels();
-			pPropVar->vt = VT_UI4;
-		}
-		else if (ap && key == PKEY_Media_Duration)
-		{
-			pPropVar->ulVal = ap->length()*10000000;
-			pPropVar->vt = VT_UI8;
-		}
-		else if (ap && key == PKEY_Audio_EncodingBitrate)
-		{
-			pPropVar->uintVal = ap->bitrate()*1024;
-			pPropVar->vt = VT_UI4;
-		}
-		else if (ap && key == PKEY_Audio_SampleRate)
-		{
-			pPropVar->uintVal = ap->sampleRate();
-			pPropVar->vt = VT_UI4;
-		}
-		else if (tag && key == PKEY_Music_AlbumArtist)
-			TRY_BSTR(albumArtist)
-		else if (tag && key == PKEY_Music_AlbumTitle)
-			InitPropVariantFromString(tag->album().toWString().c_str(), pPropVar);
-		else if (tag && key == PKEY_Music_Artist)
-			InitPropVariantFromString(tag->artist().toWString().c_str(), pPropVar);
-		else if (tag && key == PKEY_Music_Genre)
-			InitPropVariantFromString(tag->genre().toWString().c_str(), pPropVar);
-		else if (tag && key == PKEY_Title)
-			InitPropVariantFromString(tag->title().toWString().c_str(), pPropVar);
-		else if (tag && key == PKEY_Music_TrackNumber)
-		{
-			if (tag->track() == 0)
-				pPropVar->vt = VT_EMPTY;
-			else
-			{
-				pPropVar->uintVal = tag->track();
-				pPropVar->vt = VT_UI4;
-			}
-		}
-		else if (tag && key == PKEY_Media_Year)
-		{
-			if (tag->year() == 0)
-				pPropVar->vt = VT_EMPTY;
-			else
-			{
-				pPropVar->uintVal = tag->year();
-				pPropVar->vt = VT_UI4;
-			}
-		}
-		else if (tag && key == PKEY_Rating)
-		{
-			pPropVar->uintVal = rating(taglibfile);
-			pPropVar->vt = VT_UI4;
-		}
-		else if (tag && key == PKEY_Keywords)
-		{
-			const wstrvec_t keys = keywords(taglibfile);
-			if (!keys.empty())
-			{
-				pPropVar->vt = VT_ARRAY | VT_BSTR;
-				SAFEARRAYBOUND aDim[1] = {};
-
-				aDim[0].cElements = keys.size();
-
-				pPropVar->parray = SafeArrayCreate(VT_BSTR, 1, aDim);
-				if (!pPropVar->parray)
-					return E_OUTOFMEMORY;
-
-				long aLong[1] = {};
-				for (wstrvec_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
-				{
-					SafeArrayPutElement(pPropVar->parray, aLong, Dbstr(*it));
-					++aLong[0];
-				}
-			}
-		}
-		else if (tag && key == PKEY_Comment)
-			InitPropVariantFromString(tag->comment().toWString().c_str(), pPropVar);
-		else if (tag && key == PKEY_Media_DateReleased)
-		{
-			SYSTEMTIME date = releasedate(taglibfile);
-			// Attempt to recover in case of failure.:
-			// GetDateFormat, at least in my locale, fails if at least the day, month and year aren't set:
-			if (date.wMonth != 0 && date.wDay != 0)
-			{
-				std::vector<WCHAR> buf;
-#define GDF(x)  GetDateFormat(LOCALE_USER_DEFAULT, DATE_SHORTDATE, &date, NULL, x, static_cast<int>(buf.size()))
-				buf.resize(GDF(NULL));
-				if (GDF(&buf.at(0)))
-				{
-					pPropVar->bstrVal = SysAllocString(&buf.at(0));
-					pPropVar->vt = VT_BSTR;
-				}
-			}
-			else
-				if (int year = tag->year())
-				{
-					std::wstringstream ss; ss << year;
-					InitPropVariantFromString(ss.str().c_str(), pPropVar);
-				}
-		}
-		else if (tag && key == PKEY_Music_Composer)
-			TRY_BSTR(composer)
-		else if (tag && key == PKEY_Music_Conductor)
-			TRY_BSTR(conductor)
-		else if (tag && key == PKEY_Media_SubTitle)
-			TRY_BSTR(subtitle)
-		else if (tag && key == PKEY_Media_Publisher)
-			TRY_BSTR(label)
-		else if (tag && key == PKEY_Media_Producer)
-			TRY_BSTR(producer)
-		else if (tag && key == PKEY_Music_Mood)
-			TRY_BSTR(mood)
-		else if (tag && key == PKEY_Copyright)
-			TRY_BSTR(copyright)
-		else if (tag && key == PKEY_Music_PartOfSet)
-			TRY_BSTR(partofset)
-		else
-			return S_FALSE;
-		return S_OK;
-	}
-	catch (std::exception &e)
-	{
-		OutputDebugStringA(e.what());
-		pPropVar->vt = VT_EMPTY;
-		return ERROR_INTERNAL_ERROR;
-	}
-	catch (...)
-	{
-		// This has only ever been reached when taglib gives us a non-null but invalid tag;
-		//  not reproducable. Worse, the exception is only when wstring's constructor has
-		//  caught it, there's a chance of a complete crash here, otoh, with a non-abort(),
-		//  the app/system may deal gracefully.
-		OutputDebugString(L"TaglibHandler encountered unexpected exception in GetValue");
-		pPropVar->vt = VT_EMPTY;
-		return ERROR_INTERNAL_ERROR;
-	}
+	if (!reader.get())
+		return S_FALSE;
+	return reader->value(key, pPropVar);
 }
 
 HRESULT CTagLibPropertyStore::CreateInstance(REFIID riid, void **ppv)
@@ -330,7 +250,7 @@ HRESULT CTagLibPropertyStore_CreateInstance(REFIID riid, void **ppv)
 
 HRESULT CTagLibPropertyStore::GetCount(__out DWORD *pcProps)
 {
-	*pcProps = ARRAYSIZE(keys);
+	*pcProps = static_cast<DWORD>(keyCount);
 	return S_OK;
 }
 
@@ -358,72 +278,31 @@ HRESULT CTagLibPropertyStore::IsPropertyWritable(REFPROPERTYKEY)
 	return S_FALSE;
 }
 
-struct IStreamAccessor : public TagLib::FileAccessor
-{
-	IStreamAccessor(IStream *stream) : stream(stream) {}
-	IStream *stream;
-	bool isOpen() const
-	{
-		return true;
-	}
-
-	size_t fread(void *pv, size_t s1, size_t s2) const
-	{
-		ULONG read = 0;
-		stream->Read(pv, s1*s2, &read);
-		return read;
-	}
-
-	size_t fwrite(const void *,size_t,size_t)
-	{
-		return 0;
-	}
-
-	int fseek(long distance, int direction)
-	{
-		LARGE_INTEGER dist;
-		dist.QuadPart = distance;
-		return FAILED(stream->Seek(dist, direction, NULL)); // 0 on success.
-	}
-
-	void clearError()
-	{
-		// Uh oh.
-	}
-
-	long tell() const
-	{
-		ULARGE_INTEGER newpos;
-		LARGE_INTEGER dist = {};
-		stream->Seek(dist, STREAM_SEEK_CUR, &newpos);
-		return newpos.QuadPart;
-	}
-
-	int truncate(long length)
-	{
-		return -1; // error
-	}
-
-	TagLib::FileNameHandle name() const
-	{
-		STATSTG a;
-		if (FAILED(stream->Stat(&a, STATFLAG_DEFAULT)))
-			return TagLib::FileName("");
-		return TagLib::FileName(a.pwcsName);
-	}
-
-	bool readOnly() const
-	{
-		return true;
-	}
-};
-
 // Initialize populates the internal value cache with data from the specified stream
 // S_OK | E_UNEXPECTED | ERROR_READ_FAULT | ERROR_FILE_CORRUPT | ERROR_INTERNAL_ERROR
 HRESULT CTagLibPropertyStore::Initialize(IStream *pStream, DWORD grfMode)
 {
-	taglibfile = TagLib::FileRef(new IStreamAccessor(pStream));
-	if (taglibfile.isNull())
+	StreamLoader loader(pStream);
+	STATSTG st = {};
+	if (FAILED(pStream->Stat(&st, STATFLAG_DEFAULT)))
+		st.pwcsName = NULL;
+
+	bool ok;
+	if (st.pwcsName)
+		loader.name = st.pwcsName;
+	loader.size = st.cbSize.QuadPart;
+	const ULONGLONG mtime = fileTime(st.mtime);
+	if (st.pwcsName && mtime && fileIdentity(st.pwcsName, loader.size, mtime, loader.identity))
+	{
+		loader.mtime = mtime;
+		ok = snapshots.get(loader.identity, loader.size, loader.mtime, loader, snapshot);
+	}
+	else
+		ok = loader.load(snapshot);
+	CoTaskMemFree(st.pwcsName);
+
+	if (!ok)
 		return ERROR_FILE_CORRUPT;
+	reader.reset(new SnapshotReader(snapshot.data(), snapshot.size()));
 	return S_OK;
 }
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <climits>
+#include <cstdio>
+
+#include <fileref.h>
+
+// Seek to an offset past what a long can reach, in steps. 0 on success, as fseek.
+inline int seekTo(TagLib::FileAccessor &file, unsigned long long offset)
+{
+	if (offset <= LONG_MAX)
+		return file.fseek(static_cast<long>(offset), SEEK_SET);
+	if (file.fseek(LONG_MAX, SEEK_SET))
+		return -1;
+	for (offset -= LONG_MAX; offset; )
+	{
+		const long step = offset > LONG_MAX ? LONG_MAX : static_cast<long>(offset);
+		if (file.fseek(step, SEEK_CUR))
+			return -1;
+		offset -= step;
+	}
+	return 0;
+}
@@ -0,0 +1,122 @@
+#include "adsstore.h"
+
+#include <cstring>
+
+namespace
+{
+	const char magic[4] = { 'T', 'L', 'H', 'A' };
+	const unsigned version = 2;
+	const size_t headerSize = 32;
+	// Far more than any real snapshot; anything bigger isn't ours.
+	const DWORD maxSize = 1024 * 1024;
+
+	std::wstring streamName(const std::wstring &path)
+	{
+		return path + L":tlh.snapshot";
+	}
+
+	bool current(const std::wstring &path, ULONGLONG size, const FILETIME &mtime)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA fad;
+		return GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &fad)
+			&& ((static_cast<ULONGLONG>(fad.nFileSizeHigh) << 32) | fad.nFileSizeLow) == size
+			&& !CompareFileTime(&fad.ftLastWriteTime, &mtime);
+	}
+
+	// The file's mtime and ChangeTime, through a handle to any of its streams.
+	bool times(HANDLE h, ULONGLONG &mtime, ULONGLONG &ctime)
+	{
+		FILE_BASIC_INFO fbi;
+		if (!GetFileInformationByHandleEx(h, FileBasicInfo, &fbi, sizeof(fbi)))
+			return false;
+		mtime = fbi.LastWriteTime.QuadPart;
+		ctime = fbi.ChangeTime.QuadPart;
+		return true;
+	}
+}
+
+bool loadStreamSnapshot(const std::wstring &path, ULONGLONG size, const FILETIME &mtime, std::string &snapshot)
+{
+	HANDLE h = CreateFile(streamName(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+
+	// One read for the lot; snapshots are small.
+	std::string buf(4096, '\0');
+	DWORD read = 0;
+	bool ok = ReadFile(h, &buf[0], static_cast<DWORD>(buf.size()), &read, NULL) != FALSE;
+	if (ok && read == buf.size())
+	{
+		LARGE_INTEGER li;
+		ok = GetFileSizeEx(h, &li) && li.QuadPart <= maxSize;
+		if (ok)
+		{
+			buf.resize(static_cast<size_t>(li.QuadPart));
+			DWORD more = 0;
+			ok = ReadFile(h, &buf[read], static_cast<DWORD>(buf.size() - read), &more, NULL) != FALSE;
+			read += more;
+		}
+	}
+	ULONGLONG nowTime = 0, nowChange = 0;
+	ok = ok && times(h, nowTime, nowChange);
+	CloseHandle(h);
+	if (!ok || read < headerSize)
+		return false;
+	buf.resize(read);
+
+	ULONGLONG storedSize, storedTime, storedChange;
+	unsigned storedVersion;
+	memcpy(&storedVersion, &buf[4], 4);
+	memcpy(&storedSize, &buf[8], 8);
+	memcpy(&storedTime, &buf[16], 8);
+	memcpy(&storedChange, &buf[24], 8);
+	const ULONGLONG time = (static_cast<ULONGLONG>(mtime.dwHighDateTime) << 32) | mtime.dwLowDateTime;
+	if (memcmp(&buf[0], magic, sizeof(magic)) || storedVersion != version || storedSize != size || storedTime != time
+		|| nowTime != time || storedChange != nowChange)
+		return false;
+
+	snapshot.assign(buf, headerSize, std::string::npos);
+	return true;
+}
+
+bool saveStreamSnapshot(const std::wstring &path, ULONGLONG size, const FILETIME &mtime, const std::string &snapshot)
+{
+	if (!current(path, size, mtime))
+		return false;
+
+	HANDLE h = CreateFile(streamName(path).c_str(), GENERIC_WRITE | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ, NULL,
+		OPEN_ALWAYS, 0, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+
+	// -1 asks for the times not to be updated by anything done through this handle. The ChangeTime
+	//  stored is the one it has from here on, until someone else changes the file; if the mtime has
+	//  already moved on, the file changed after the snapshot was taken.
+	FILE_BASIC_INFO keep = {};
+	keep.LastWriteTime.QuadPart = -1;
+	keep.ChangeTime.QuadPart = -1;
+	const ULONGLONG time = (static_cast<ULONGLONG>(mtime.dwHighDateTime) << 32) | mtime.dwLowDateTime;
+	ULONGLONG nowTime = 0, change = 0;
+	bool ok = SetFileInformationByHandle(h, FileBasicInfo, &keep, sizeof(keep)) && times(h, nowTime, change)
+		&& nowTime == time;
+
+	if (ok)
+	{
+		std::string buf(magic, sizeof(magic));
+		buf.append(reinterpret_cast<const char *>(&version), 4);
+		buf.append(reinterpret_cast<const char *>(&size), 8);
+		buf.append(reinterpret_cast<const char *>(&time), 8);
+		buf.append(reinterpret_cast<const char *>(&change), 8);
+		buf += snapshot;
+
+		DWORD written = 0;
+		ok = WriteFile(h, buf.data(), static_cast<DWORD>(buf.size()), &written, NULL) && written == buf.size()
+			&& SetEndOfFile(h);
+	}
+	CloseHandle(h);
+
+	if (!ok)
+		DeleteFile(streamName(path).c_str());
+	return ok;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+
+// === Snapshots kept with the file itself, in an NTFS alternate data stream. ===
+// This is the nearest Windows has to a user.* extended attribute: "song.mp3:tlh.snapshot" moves and
+//  renames with the file, but is lost on copies to FAT, through most archivers and over some shares,
+//  so it can only ever save work, never be relied upon. It records the size and mtime the snapshot
+//  was taken at, and the file's ChangeTime once it was written, and is ignored once any of them has
+//  changed; ChangeTime moves on with anything done to the file, even by a writer that puts its
+//  mtime back.
+//   "TLHA", u32 version, u64 size, u64 mtime, u64 ChangeTime (FILETIMEs), then the snapshot (snapshot.h).
+// Reading one is an open and a read of the stream, without touching the file's contents.
+
+// If path has a snapshot taken when it was this size and mtime, and it hasn't changed since the
+//  snapshot was stored, put it in snapshot.
+bool loadStreamSnapshot(const std::wstring &path, ULONGLONG size, const FILETIME &mtime, std::string &snapshot);
+
+// Store a snapshot of path, which was taken when it was this size and mtime.
+// Writing a stream would move the file's mtime and ChangeTime on, and the snapshot would be stale
+//  as soon as it was written, so the write is made through a handle that asks for neither to be
+//  updated; nothing is put back, so nothing anyone else does is hidden. The write still sets the
+//  archive bit and adds to the change journal, so backup tools that go by those will see a change.
+// Fails (harmlessly) on volumes without streams, for read-only files, and if the file has changed
+//  since the snapshot was taken.
+bool saveStreamSnapshot(const std::wstring &path, ULONGLONG size, const FILETIME &mtime, const std::string &snapshot);
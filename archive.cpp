@@ -0,0 +1,598 @@
+#define NOMINMAX
+
+#include "archive.h"
+#include "extract.h"
+#include "inflate.h"
+#include "lock.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+namespace
+{
+	unsigned le16(const unsigned char *p) { return p[0] | p[1] << 8; }
+	unsigned le32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | static_cast<unsigned>(p[3]) << 24; }
+	ULONGLONG le64(const unsigned char *p) { return le32(p) | static_cast<ULONGLONG>(le32(p + 4)) << 32; }
+
+	bool readAt(HANDLE h, ULONGLONG at, void *buf, DWORD n)
+	{
+		OVERLAPPED o = {};
+		o.Offset = static_cast<DWORD>(at);
+		o.OffsetHigh = static_cast<DWORD>(at >> 32);
+		DWORD got = 0;
+		return ReadFile(h, buf, n, &got, &o) && got == n;
+	}
+
+	std::wstring decode(const char *s, size_t n, UINT codepage)
+	{
+		if (!n)
+			return std::wstring();
+		std::wstring w(n, 0);
+		int len = MultiByteToWideChar(codepage, MB_ERR_INVALID_CHARS, s, static_cast<int>(n), &w[0], static_cast<int>(n));
+		if (!len) // not valid in that codepage; take what the system makes of it.
+			len = MultiByteToWideChar(CP_ACP, 0, s, static_cast<int>(n), &w[0], static_cast<int>(n));
+		w.resize(len);
+		return w;
+	}
+
+	// Bytes [at, end) of a file, read through in order.
+	struct RangeSource : OnePassAccessor::Source
+	{
+		RangeSource(HANDLE h, ULONGLONG at, ULONGLONG length) : h(h), at(at), end(at + length) {}
+		HANDLE h;
+		ULONGLONG at, end;
+
+		bool read(void *buf, ULONG size, ULONG *got)
+		{
+			*got = 0;
+			const DWORD n = static_cast<DWORD>(std::min<ULONGLONG>(size, end - at));
+			if (!n)
+				return true;
+			OVERLAPPED o = {};
+			o.Offset = static_cast<DWORD>(at);
+			o.OffsetHigh = static_cast<DWORD>(at >> 32);
+			if (!ReadFile(h, buf, n, got, &o) || !*got)
+				return false; // the member runs past the end of the file.
+			at += *got;
+			return true;
+		}
+	};
+
+	// The next `left` bytes of a stream, and then nothing.
+	struct LimitedSource : OnePassAccessor::Source
+	{
+		LimitedSource(OnePassAccessor::Source &in, ULONGLONG left) : in(in), left(left) {}
+		OnePassAccessor::Source &in;
+		ULONGLONG left;
+
+		bool read(void *buf, ULONG size, ULONG *got)
+		{
+			*got = 0;
+			const ULONG n = static_cast<ULONG>(std::min<ULONGLONG>(size, left));
+			if (!n)
+				return true;
+			if (!in.read(buf, n, got) || !*got)
+				return false;
+			left -= *got;
+			return true;
+		}
+	};
+
+	bool readFull(OnePassAccessor::Source &in, void *buf, ULONG n, ULONG *got)
+	{
+		char *p = static_cast<char *>(buf);
+		*got = 0;
+		for (ULONG k; *got < n; *got += k)
+			if (!in.read(p + *got, n - *got, &k) || !k)
+				return false;
+		return true;
+	}
+
+	bool skip(OnePassAccessor::Source &in, ULONGLONG n)
+	{
+		char buf[64 * 1024];
+		for (ULONG got; n; n -= got)
+			if (!readFull(in, buf, static_cast<ULONG>(std::min<ULONGLONG>(n, sizeof(buf))), &got))
+				return false;
+		return true;
+	}
+
+	// A ZIP member's data is after its local header, whose name and extra field can differ in
+	//  length from the central directory's.
+	bool dataOffset(HANDLE h, const Archive::Member &m, ULONGLONG &at)
+	{
+		unsigned char local[30];
+		if (!readAt(h, m.header, local, sizeof(local)) || le32(local) != 0x04034b50)
+			return false;
+		at = m.header + sizeof(local) + le16(local + 26) + le16(local + 28);
+		return true;
+	}
+
+	// Bytes [base, base + length) of a file, as a file of their own. Owns the handle.
+	struct RangeAccessor : public TagLib::FileAccessor
+	{
+		RangeAccessor(HANDLE h, ULONGLONG base, ULONGLONG length, const std::wstring &name)
+			: h(h), base(base), length(length), pos(0), fname(name) {}
+		~RangeAccessor() { CloseHandle(h); }
+
+		HANDLE h;
+		ULONGLONG base, length;
+		mutable ULONGLONG pos;
+		std::wstring fname;
+
+		bool isOpen() const { return true; }
+
+		size_t fread(void *pv, size_t s1, size_t s2) const
+		{
+			if (pos >= length)
+				return 0;
+			const DWORD n = static_cast<DWORD>(std::min<ULONGLONG>(s1 * s2, length - pos));
+			OVERLAPPED o = {};
+			o.Offset = static_cast<DWORD>(base + pos);
+			o.OffsetHigh = static_cast<DWORD>((base + pos) >> 32);
+			DWORD got = 0;
+			if (!ReadFile(h, pv, n, &got, &o))
+				return 0;
+			pos += got;
+			return got;
+		}
+
+		size_t fwrite(const void *, size_t, size_t) { return 0; }
+
+		int fseek(long distance, int direction)
+		{
+			const LONGLONG from = direction == SEEK_SET ? 0 : direction == SEEK_CUR ? static_cast<LONGLONG>(pos) : static_cast<LONGLONG>(length);
+			if (from + distance < 0)
+				return -1;
+			pos = from + distance;
+			return 0;
+		}
+
+		void clearError() {}
+		long tell() const { return static_cast<long>(pos); }
+		int truncate(long) { return -1; }
+		TagLib::FileNameHandle name() const { return TagLib::FileName(fname.c_str()); }
+		bool readOnly() const { return true; }
+
+	private:
+		RangeAccessor(const RangeAccessor &);
+		RangeAccessor &operator=(const RangeAccessor &);
+	};
+
+	// ustar sizes are octal text; GNU writes ones too big for that as base-256, flagged by the top bit.
+	ULONGLONG tarNumber(const unsigned char *p, size_t n)
+	{
+		ULONGLONG v = 0;
+		if (p[0] & 0x80)
+		{
+			v = p[0] & 0x7f;
+			for (size_t i = 1; i < n; ++i)
+				v = v << 8 | p[i];
+			return v;
+		}
+		size_t i = 0;
+		while (i < n && (p[i] == ' ' || !p[i]))
+			++i;
+		for (; i < n && p[i] >= '0' && p[i] <= '7'; ++i)
+			v = v << 3 | (p[i] - '0');
+		return v;
+	}
+
+	bool tarHeader(const unsigned char *block)
+	{
+		// The checksum is of the header with its own field as spaces.
+		unsigned sum = 0;
+		for (size_t i = 0; i < 512; ++i)
+			sum += i >= 148 && i < 156 ? ' ' : block[i];
+		return sum == tarNumber(block + 148, 8);
+	}
+
+	std::string field(const unsigned char *p, size_t n)
+	{
+		return std::string(reinterpret_cast<const char *>(p), std::find(p, p + n, 0) - p);
+	}
+
+	// pax extended headers: records of "length key=value\n"; only path and size matter here.
+	void paxRecords(const std::string &data, std::string &path, ULONGLONG &size)
+	{
+		for (size_t at = 0; at < data.size(); )
+		{
+			const size_t len = strtoul(data.c_str() + at, NULL, 10), space = data.find(' ', at);
+			if (!len || space == std::string::npos || at + len > data.size())
+				return;
+			const std::string record = data.substr(space + 1, at + len - space - 2); // without the newline.
+			const size_t eq = record.find('=');
+			if (eq != std::string::npos)
+			{
+				if (!record.compare(0, eq, "path"))
+					path = record.substr(eq + 1);
+				else if (!record.compare(0, eq, "size"))
+					size = _strtoui64(record.c_str() + eq + 1, NULL, 10);
+			}
+			at += len;
+		}
+	}
+
+	bool walkTar(OnePassAccessor::Source &in, Archive::Visit visit, void *context)
+	{
+		std::string longName, paxPath;
+		ULONGLONG paxSize = ~0ULL;
+		for (;;)
+		{
+			unsigned char block[512];
+			ULONG got;
+			if (!readFull(in, block, sizeof(block), &got))
+				return !got; // some writers leave off the two empty blocks at the end.
+			if (std::count(block, block + sizeof(block), 0) == sizeof(block))
+				return true;
+			if (!tarHeader(block))
+				return false;
+
+			ULONGLONG size = tarNumber(block + 124, 12);
+			const char type = block[156];
+			if (type == 'L' || type == 'x')
+			{
+				// A long name, or pax records, for the member after; kept in memory, so within reason.
+				if (size > 1024 * 1024)
+					return false;
+				std::string data(static_cast<size_t>(size), 0);
+				if ((size && !readFull(in, &data[0], static_cast<ULONG>(size), &got)) || !skip(in, (512 - size % 512) % 512))
+					return false;
+				if (type == 'L')
+					longName = field(reinterpret_cast<const unsigned char *>(data.c_str()), data.size());
+				else
+					paxRecords(data, paxPath, paxSize);
+				continue;
+			}
+
+			std::string name = field(block, 100);
+			if (!memcmp(block + 257, "ustar", 5) && block[345])
+				name = field(block + 345, 155) + "/" + name;
+			if (!longName.empty())
+				name = longName;
+			if (!paxPath.empty())
+				name = paxPath;
+			if (paxSize != ~0ULL)
+				size = paxSize;
+			longName.clear();
+			paxPath.clear();
+			paxSize = ~0ULL;
+
+			Archive::Member m = {};
+			m.name = decode(name.c_str(), name.size(), CP_UTF8);
+			m.size = size;
+			LimitedSource content(in, size);
+			if ((type == '0' || type == '\0' || type == '7') && handledExtension(m.name))
+				visit(context, m, content);
+			// Whatever the visitor didn't read, and the padding to the next block.
+			if (!skip(content, content.left) || !skip(in, (512 - size % 512) % 512))
+				return false;
+		}
+	}
+}
+
+Archive::Archive(const std::wstring &path) : file(path), type(NONE)
+{
+	HANDLE h = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, 0, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return;
+	LARGE_INTEGER size;
+	unsigned char head[512];
+	if (GetFileSizeEx(h, &size) && size.QuadPart >= 4 && readAt(h, 0, head, static_cast<DWORD>(std::min<LONGLONG>(size.QuadPart, sizeof(head)))))
+	{
+		if (head[0] == 'P' && head[1] == 'K' && ((head[2] == 3 && head[3] == 4) || (head[2] == 5 && head[3] == 6)))
+			type = listZip(h, size.QuadPart) ? ZIP : NONE;
+		else if (head[0] == 0x1f && head[1] == 0x8b)
+			type = TGZ;
+		else if (size.QuadPart >= 512 && tarHeader(head))
+			type = TAR;
+	}
+	CloseHandle(h);
+}
+
+// The end of central directory record is the last thing in the file, before a comment of up to 64KB;
+//  archives with more than 65535 members, or bigger than 4GB, have a ZIP64 one just before it.
+bool Archive::listZip(HANDLE h, ULONGLONG size)
+{
+	const DWORD tailSize = static_cast<DWORD>(std::min<ULONGLONG>(size, 22 + 65535));
+	if (tailSize < 22)
+		return false;
+	std::vector<unsigned char> tail(tailSize);
+	if (!readAt(h, size - tailSize, &tail[0], tailSize))
+		return false;
+	size_t eocd = tailSize - 22 + 1;
+	do
+	{
+		if (!eocd--)
+			return false;
+	} while (le32(&tail[eocd]) != 0x06054b50);
+
+	ULONGLONG entries = le16(&tail[eocd + 10]), cdSize = le32(&tail[eocd + 12]), cdOffset = le32(&tail[eocd + 16]);
+	if (eocd >= 20 && le32(&tail[eocd - 20]) == 0x07064b50)
+	{
+		unsigned char z[56];
+		if (!readAt(h, le64(&tail[eocd - 20 + 8]), z, sizeof(z)) || le32(z) != 0x06064b50)
+			return false;
+		entries = le64(z + 32);
+		cdSize = le64(z + 40);
+		cdOffset = le64(z + 48);
+	}
+	if (cdOffset + cdSize > size || cdSize > 256 * 1024 * 1024)
+		return false;
+
+	std::vector<unsigned char> cd(static_cast<size_t>(cdSize) + 1);
+	if (cdSize && !readAt(h, cdOffset, &cd[0], static_cast<DWORD>(cdSize)))
+		return false;
+	size_t at = 0;
+	for (ULONGLONG i = 0; i < entries; ++i)
+	{
+		if (at + 46 > cdSize || le32(&cd[at]) != 0x02014b50)
+			return false;
+		const unsigned char *e = &cd[at];
+		const unsigned flags = le16(e + 8), method = le16(e + 10);
+		const size_t nameLen = le16(e + 28), extraLen = le16(e + 30), commentLen = le16(e + 32);
+		if (at + 46 + nameLen + extraLen + commentLen > cdSize)
+			return false;
+
+		Member m;
+		m.name = decode(reinterpret_cast<const char *>(e + 46), nameLen, flags & 0x800 ? CP_UTF8 : 437);
+		m.packed = le32(e + 20);
+		m.size = le32(e + 24);
+		m.header = le32(e + 42);
+		m.deflated = method == 8;
+
+		// The ZIP64 extra field has the 64-bit values of just those that didn't fit.
+		for (const unsigned char *x = e + 46 + nameLen, *end = x + extraLen; x + 4 <= end; x += 4 + le16(x + 2))
+		{
+			if (le16(x) != 1)
+				continue;
+			const unsigned char *v = x + 4, *vend = std::min(end, v + le16(x + 2));
+			if (m.size == 0xffffffff && v + 8 <= vend)
+				m.size = le64(v), v += 8;
+			if (m.packed == 0xffffffff && v + 8 <= vend)
+				m.packed = le64(v), v += 8;
+			if (m.header == 0xffffffff && v + 8 <= vend)
+				m.header = le64(v);
+		}
+		at += 46 + nameLen + extraLen + commentLen;
+
+		// Encrypted members, and methods other than store and deflate, can't be read.
+		if ((flags & 1) || (method != 0 && method != 8) || !handledExtension(m.name))
+			continue;
+		list.push_back(m);
+	}
+	return true;
+}
+
+TagLib::FileAccessor *Archive::open(const Member &m, const OnePassAccessor **streamed, const OnePassAccessor::Limits &limits) const
+{
+	*streamed = NULL;
+	if (type != ZIP)
+		return NULL;
+	HANDLE h = CreateFile(file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, m.deflated ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return NULL;
+	ULONGLONG data;
+	if (!dataOffset(h, m, data))
+	{
+		CloseHandle(h);
+		return NULL;
+	}
+	if (!m.deflated)
+		return new RangeAccessor(h, data, m.size, m.name);
+
+	RangeSource packed(h, data, m.packed);
+	Inflater inflater(packed);
+	OnePassAccessor *a = new OnePassAccessor(inflater, m.name, limits);
+	CloseHandle(h);
+	*streamed = a;
+	return a;
+}
+
+bool Archive::forEach(Visit visit, void *context) const
+{
+	if (type == NONE)
+		return false;
+	HANDLE h = CreateFile(file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool ok = true;
+	if (type == ZIP)
+		for (std::vector<Member>::const_iterator it = list.begin(); ok && it != list.end(); ++it)
+		{
+			ULONGLONG data;
+			if (!(ok = dataOffset(h, *it, data)))
+				break;
+			RangeSource packed(h, data, it->deflated ? it->packed : it->size);
+			if (it->deflated)
+			{
+				Inflater inflater(packed);
+				visit(context, *it, inflater);
+			}
+			else
+				visit(context, *it, packed);
+		}
+	else
+	{
+		LARGE_INTEGER size = {};
+		GetFileSizeEx(h, &size);
+		RangeSource whole(h, 0, size.QuadPart);
+		if (type == TGZ)
+		{
+			Inflater inflater(whole, true);
+			ok = walkTar(inflater, visit, context);
+		}
+		else
+			ok = walkTar(whole, visit, context);
+	}
+	CloseHandle(h);
+	return ok;
+}
+
+bool readMemberProperties(TagLib::FileAccessor *accessor, const OnePassAccessor *streamed, ULONGLONG size,
+	const std::wstring &name, std::vector<PROPVARIANT> &values)
+{
+	if (!streamed)
+		return readFileProperties(accessor, size, name, values);
+	values.resize(keyCount);
+	for (size_t i = 0; i < keyCount; ++i)
+		PropVariantInit(&values[i]);
+	TagLib::FileRef f(accessor);
+	if (f.isNull())
+		return false;
+	for (size_t i = 0; i < keyCount; ++i)
+		if (readStreamedProperty(f, *streamed, keys[i], &values[i]) != S_OK)
+			PropVariantClear(&values[i]);
+	return true;
+}
+
+// === Scanning on every core. ===
+// A ZIP's workers each take the next member and read it themselves. A TAR can only be read in
+//  order, so the calling thread reads it, a member at a time into a OnePassAccessor, and queues
+//  those for the workers to parse; the queue is short, so memory stays at a few heads and tails.
+
+namespace
+{
+	struct Scan
+	{
+		const Archive *archive;
+		MemberFound found;
+		void *context;
+		volatile LONG next;
+
+		// TAR
+		struct Item
+		{
+			size_t index;
+			Archive::Member m;
+			OnePassAccessor *accessor;
+		};
+		CRITICAL_SECTION cs;
+		CONDITION_VARIABLE ready, room;
+		std::deque<Item> queue;
+		size_t capacity, count;
+		bool finished;
+		bool alone; // no workers could be started; members are parsed as they're read.
+
+		// Read a member, and hand its values to found().
+		void read(size_t index, const Archive::Member &m, TagLib::FileAccessor *accessor, const OnePassAccessor *streamed)
+		{
+			std::vector<PROPVARIANT> values;
+			const bool ok = readMemberProperties(accessor, streamed, m.size, m.name, values);
+			found(context, index, m, ok ? &values : NULL);
+			for (size_t i = 0; i < values.size(); ++i)
+				PropVariantClear(&values[i]);
+		}
+	};
+
+	DWORD WINAPI zipWorker(LPVOID param)
+	{
+		Scan &s = *static_cast<Scan *>(param);
+		const std::vector<Archive::Member> &members = s.archive->members();
+		for (LONG i; (i = InterlockedIncrement(&s.next) - 1) < static_cast<LONG>(members.size()); )
+		{
+			const OnePassAccessor *streamed;
+			TagLib::FileAccessor *accessor = s.archive->open(members[i], &streamed);
+			if (accessor)
+				s.read(i, members[i], accessor, streamed);
+			else
+				s.found(s.context, i, members[i], NULL);
+		}
+		return 0;
+	}
+
+	DWORD WINAPI tarWorker(LPVOID param)
+	{
+		Scan &s = *static_cast<Scan *>(param);
+		for (;;)
+		{
+			Scan::Item item;
+			{
+				Lock lock(s.cs);
+				while (s.queue.empty() && !s.finished)
+					SleepConditionVariableCS(&s.ready, &s.cs, INFINITE);
+				if (s.queue.empty())
+					return 0;
+				item = s.queue.front();
+				s.queue.pop_front();
+				WakeConditionVariable(&s.room);
+			}
+			s.read(item.index, item.m, item.accessor, item.accessor);
+		}
+	}
+
+	void queueMember(void *context, const Archive::Member &m, OnePassAccessor::Source &content)
+	{
+		Scan &s = *static_cast<Scan *>(context);
+		const Scan::Item item = { s.count++, m, new OnePassAccessor(content, m.name) };
+		if (s.alone)
+		{
+			s.read(item.index, item.m, item.accessor, item.accessor);
+			return;
+		}
+		Lock lock(s.cs);
+		while (s.queue.size() >= s.capacity)
+			SleepConditionVariableCS(&s.room, &s.cs, INFINITE);
+		s.queue.push_back(item);
+		WakeConditionVariable(&s.ready);
+	}
+}
+
+bool scanArchive(const std::wstring &path, MemberFound found, void *context, unsigned threads)
+{
+	const Archive archive(path);
+	if (archive.kind() == Archive::NONE)
+		return false;
+	if (!threads)
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		threads = si.dwNumberOfProcessors;
+	}
+	threads = std::min<unsigned>(threads, MAXIMUM_WAIT_OBJECTS);
+
+	Scan s;
+	s.archive = &archive;
+	s.found = found;
+	s.context = context;
+	s.next = 0;
+	s.capacity = threads * 2;
+	s.count = 0;
+	s.finished = false;
+	InitializeCriticalSection(&s.cs);
+	InitializeConditionVariable(&s.ready);
+	InitializeConditionVariable(&s.room);
+
+	const bool zip = archive.kind() == Archive::ZIP;
+	std::vector<HANDLE> workers;
+	for (unsigned i = 0; i < threads; ++i)
+	{
+		HANDLE t = CreateThread(NULL, 0, zip ? zipWorker : tarWorker, &s, 0, NULL);
+		if (t)
+			workers.push_back(t);
+	}
+
+	s.alone = workers.empty();
+
+	bool ok = true;
+	if (!zip)
+	{
+		ok = archive.forEach(queueMember, &s);
+		Lock lock(s.cs);
+		s.finished = true;
+		WakeAllConditionVariable(&s.ready);
+	}
+	if (zip && workers.empty())
+		zipWorker(&s); // nothing to run it on; do it here.
+	if (!workers.empty())
+		WaitForMultipleObjects(static_cast<DWORD>(workers.size()), &workers[0], TRUE, INFINITE);
+	for (size_t i = 0; i < workers.size(); ++i)
+		CloseHandle(workers[i]);
+	DeleteCriticalSection(&s.cs);
+	return ok;
+}
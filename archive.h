@@ -0,0 +1,75 @@
+#pragma once
+
+#include <windows.h>
+#include <fileref.h>
+#include <propsys.h>
+
+#include <string>
+#include <vector>
+
+#include "onepass.h"
+
+// === Audio files inside ZIP and TAR archives, read where they lie. ===
+// Deliveries come as archives, and unpacking one just to read its tags writes every byte twice.
+//  - ZIP: the central directory gives every member's offset. Stored members are read in place, with
+//    all the seeking the readers like, exactly as the same file on disk would be; deflated ones are inflated (inflate.h) through once into a
+//    OnePassAccessor, which keeps the head and the tail.
+//  - TAR, and .tar.gz: there's no index, only a header before each member, so the archive is read
+//    through once, and each member into a OnePassAccessor as it goes by.
+// Only members with names the handler takes (handledExtension) are looked at. What kind of archive
+//  it is comes from its first bytes, not its name.
+
+class Archive
+{
+public:
+	enum Kind { NONE, ZIP, TAR, TGZ };
+
+	struct Member
+	{
+		std::wstring name; // as stored: '/'-separated.
+		ULONGLONG size;    // uncompressed.
+		// ZIP only: the compressed size, where the local header is, and whether it's deflated or stored.
+		ULONGLONG packed, header;
+		bool deflated;
+	};
+
+	// Lists a ZIP's members; a TAR's are only found by reading it through, with forEach().
+	explicit Archive(const std::wstring &path);
+
+	Kind kind() const { return type; }
+	const std::wstring &path() const { return file; }
+	const std::vector<Member> &members() const { return list; }
+
+	// An accessor for one of a ZIP's members, for readMemberProperties() to take; NULL if it can't be
+	//  read. It has its own handle on the archive, so members can be read on many threads at once.
+	//  If it's a OnePassAccessor, streamed is set to it; otherwise to NULL.
+	TagLib::FileAccessor *open(const Member &m, const OnePassAccessor **streamed,
+		const OnePassAccessor::Limits &limits = OnePassAccessor::Limits()) const;
+
+	// Every audio member, in archive order, each with a source over its content that's read through
+	//  before the next. False if the archive turned out to be corrupt or cut short.
+	typedef void (*Visit)(void *context, const Member &m, OnePassAccessor::Source &content);
+	bool forEach(Visit visit, void *context) const;
+
+private:
+	bool listZip(HANDLE h, ULONGLONG size);
+
+	std::wstring file;
+	Kind type;
+	std::vector<Member> list;
+};
+
+// Every key of a member, from the accessor open() gave, which it takes: a stored member, read in
+//  place, as readFileProperties() reads a file on disk; one read through once (a OnePassAccessor, as
+//  streamed is), with TagLib and the streamed duration (readStreamedProperty()). values are one per
+//  keys[], all VT_EMPTY if it couldn't be read. Anything else read through once, as stdin is, goes
+//  the same way.
+bool readMemberProperties(TagLib::FileAccessor *accessor, const OnePassAccessor *streamed, ULONGLONG size,
+	const std::wstring &name, std::vector<PROPVARIANT> &values);
+
+// Every audio member of an archive, read on every core (threads, if not 0), with
+//  readMemberProperties(). found() is called by the workers, for each member, possibly at once;
+//  index is the member's place in the archive, and values is NULL for a member that couldn't be
+//  read. False if it isn't an archive, or is corrupt.
+typedef void (*MemberFound)(void *context, size_t index, const Archive::Member &m, const std::vector<PROPVARIANT> *values);
+bool scanArchive(const std::wstring &path, MemberFound found, void *context, unsigned threads = 0);
@@ -0,0 +1,246 @@
+#include "audiohash.h"
+#include "accessorutil.h"
+#include "fasthash.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const size_t chunk = 1024 * 1024;
+
+	unsigned be32(const unsigned char *p)
+	{
+		return (static_cast<unsigned>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+
+	unsigned le32(const unsigned char *p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned>(p[3]) << 24);
+	}
+
+	// Reads through a big buffer, so that walking a file in small pieces still reads it in big ones.
+	// The accessor's position is always just past the end of what's buffered.
+	class Input
+	{
+	public:
+		Input(TagLib::FileAccessor &file, unsigned long long size)
+			: size(size), hashed(0), file(file), buf(chunk), base(0), pos(0), fill(0) {}
+
+		unsigned long long offset() const { return base + pos; }
+
+		bool seek(unsigned long long off)
+		{
+			if (off >= base && off <= base + fill)
+			{
+				pos = static_cast<size_t>(off - base);
+				return true;
+			}
+			if (off > size || seekTo(file, off))
+				return false;
+			base = off;
+			pos = fill = 0;
+			return true;
+		}
+
+		bool get(void *dst, size_t n)
+		{
+			unsigned char *d = static_cast<unsigned char *>(dst);
+			while (n)
+			{
+				if (pos == fill && !refill())
+					return false;
+				const size_t take = n < fill - pos ? n : fill - pos;
+				memcpy(d, &buf[pos], take);
+				d += take;
+				pos += take;
+				n -= take;
+			}
+			return true;
+		}
+
+		// Hash the next n bytes.
+		bool feed(FastHash &h, unsigned long long n)
+		{
+			while (n)
+			{
+				if (pos == fill && !refill())
+					return false;
+				const size_t take = n < fill - pos ? static_cast<size_t>(n) : fill - pos;
+				h.update(&buf[pos], take);
+				pos += take;
+				n -= take;
+				hashed += take;
+			}
+			return true;
+		}
+
+		const unsigned long long size;
+		unsigned long long hashed;
+
+	private:
+		bool refill()
+		{
+			base += fill;
+			pos = 0;
+			fill = base < size ? file.fread(&buf[0], 1, buf.size()) : 0;
+			return fill != 0;
+		}
+
+		TagLib::FileAccessor &file;
+		std::vector<unsigned char> buf;
+		unsigned long long base;
+		size_t pos, fill;
+	};
+
+	// Where the audio starts, after any ID3v2 tag.
+	unsigned long long id3v2(Input &in)
+	{
+		unsigned char b[10];
+		if (!in.seek(0) || !in.get(b, sizeof(b)) || memcmp(b, "ID3", 3))
+			return 0;
+		unsigned long long end = 10 + ((b[6] & 0x7f) << 21 | (b[7] & 0x7f) << 14 | (b[8] & 0x7f) << 7 | (b[9] & 0x7f));
+		if (b[5] & 0x10)
+			end += 10; // footer.
+		return end;
+	}
+
+	// Where the audio ends, before any ID3v1, Lyrics3v2 and APE tags, in the order they're stacked.
+	unsigned long long tags(Input &in, unsigned long long start)
+	{
+		unsigned long long end = in.size;
+		unsigned char b[32];
+		if (end - start >= 128 && in.seek(end - 128) && in.get(b, 3) && !memcmp(b, "TAG", 3))
+			end -= 128;
+
+		// "LYRICS200", after six digits of size, which doesn't count those 15 bytes.
+		if (end - start >= 15 && in.seek(end - 15) && in.get(b, 15) && !memcmp(b + 6, "LYRICS200", 9))
+		{
+			char digits[7] = {};
+			memcpy(digits, b, 6);
+			const unsigned long long len = strtoul(digits, NULL, 10) + 15;
+			if (len <= end - start)
+				end -= len;
+		}
+
+		if (end - start >= 32 && in.seek(end - 32) && in.get(b, 32) && !memcmp(b, "APETAGEX", 8))
+		{
+			unsigned long long len = le32(b + 12);
+			if (le32(b + 20) & 0x80000000)
+				len += 32; // header.
+			if (len <= end - start)
+				end -= len;
+		}
+		return end;
+	}
+
+	bool flac(Input &in, unsigned long long pos, unsigned long long end, FastHash &h)
+	{
+		for (unsigned i = 0; i < 4096; ++i)
+		{
+			unsigned char b[4];
+			if (!in.seek(pos) || !in.get(b, 4))
+				return false;
+			pos += 4 + ((b[1] << 16) | (b[2] << 8) | b[3]);
+			if (b[0] & 0x80)
+				return pos <= end && in.seek(pos) && in.feed(h, end - pos);
+		}
+		return false;
+	}
+
+	bool ogg(Input &in, unsigned long long pos, unsigned long long end, FastHash &h)
+	{
+		bool audio = false;
+		while (pos < end)
+		{
+			unsigned char b[27], segments[255];
+			if (!in.seek(pos) || !in.get(b, sizeof(b)) || memcmp(b, "OggS", 4) || !in.get(segments, b[26]))
+				return false;
+			unsigned long long body = 0;
+			for (unsigned i = 0; i < b[26]; ++i)
+				body += segments[i];
+
+			// Header pages have a granule position of 0, or -1 where a big comment goes on over several.
+			const unsigned long long granule = le32(b + 6) | (static_cast<unsigned long long>(le32(b + 10)) << 32);
+			audio = audio || (granule && granule != ~0ULL);
+			if (audio && !in.feed(h, body))
+				return false;
+			pos += sizeof(b) + b[26] + body;
+		}
+		return true;
+	}
+
+	bool mp4(Input &in, FastHash &h)
+	{
+		unsigned long long pos = 0;
+		bool any = false;
+		for (unsigned i = 0; i < 4096 && in.size - pos >= 8; ++i)
+		{
+			unsigned char b[16];
+			if (!in.seek(pos) || !in.get(b, 8))
+				return false;
+			unsigned long long len = be32(b), header = 8;
+			if (len == 1)
+			{
+				if (!in.get(b + 8, 8))
+					return false;
+				len = (static_cast<unsigned long long>(be32(b + 8)) << 32) | be32(b + 12);
+				header = 16;
+			}
+			else if (!len)
+				len = in.size - pos;
+			if (len < header || len > in.size - pos)
+				return false;
+
+			if (!memcmp(b + 4, "mdat", 4))
+			{
+				if (!in.feed(h, len - header))
+					return false;
+				any = true;
+			}
+			pos += len;
+		}
+		return any;
+	}
+}
+
+bool audioHash(TagLib::FileAccessor &file, unsigned long long size, AudioHash &out)
+{
+	Input in(file, size);
+	FastHash h;
+	unsigned char b[8];
+
+	const unsigned long long start = id3v2(in);
+	if (!in.seek(start) || !in.get(b, 8))
+		return false;
+
+	bool ok;
+	if (!start && !memcmp(b + 4, "ftyp", 4))
+	{
+		out.format = "mp4";
+		ok = mp4(in, h);
+	}
+	else if (!memcmp(b, "fLaC", 4))
+	{
+		out.format = "flac";
+		ok = flac(in, start + 4, tags(in, start), h);
+	}
+	else if (!memcmp(b, "OggS", 4))
+	{
+		out.format = "ogg";
+		ok = ogg(in, start, size, h);
+	}
+	else if (b[0] == 0xff && (b[1] & 0xe0) == 0xe0)
+	{
+		out.format = "mpeg";
+		const unsigned long long end = tags(in, start);
+		ok = in.seek(start) && in.feed(h, end - start);
+	}
+	else
+		return false;
+
+	out.hash = h.digest();
+	out.bytes = in.hashed;
+	return ok;
+}
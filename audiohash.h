@@ -0,0 +1,22 @@
+#pragma once
+
+#include <fileref.h>
+
+// === Audio hashes: the same for two files holding the same audio, whatever their tags say. ===
+// For finding duplicates across a library. Only the audio is read, in large sequential reads, through
+// FastHash (see fasthash.h):
+//  - MPEG: everything between an ID3v2 tag and any APE, Lyrics3v2 or ID3v1 tag at the end;
+//  - FLAC: everything after the metadata blocks, up to any tags at the end, as MPEG;
+//  - Ogg: the bodies of the pages from the first with a granule position onwards. Headers aren't
+//    included, as their sequence numbers and CRCs change when the comment packet grows;
+//  - MP4: the contents of every mdat box.
+// Open files with FILE_FLAG_SEQUENTIAL_SCAN where there's the choice.
+struct AudioHash
+{
+	unsigned long long hash;
+	unsigned long long bytes;  // of audio hashed.
+	const char *format;        // "mpeg", "flac", "ogg" or "mp4".
+};
+
+// false if the file isn't one of the formats above, or is cut short.
+bool audioHash(TagLib::FileAccessor &file, unsigned long long size, AudioHash &out);
@@ -0,0 +1,149 @@
+#include "bench.h"
+#include "../adsstore.h"
+#include "../extract.h"
+#include "../snapshot.h"
+
+#include <propvarutil.h>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// === Snapshots in alternate data streams, against parsing, with nothing cached. ===
+//
+//   bench streams dir
+//
+// Stores a snapshot with every file under dir that hasn't got one, then reads every key of every
+//  file both ways. Before each pass, the files and their streams are dropped from the cache by
+//  opening them unbuffered, which is the nearest Windows has to dropping the page cache; the
+//  MFT itself stays cached, which flatters both equally.
+
+namespace
+{
+	void find(const std::wstring &dir, std::vector<std::wstring> &files)
+	{
+		WIN32_FIND_DATA fd;
+		HANDLE h = FindFirstFile((dir + L"\\*").c_str(), &fd);
+		if (h == INVALID_HANDLE_VALUE)
+			return;
+		do
+		{
+			const std::wstring name = fd.cFileName;
+			if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				if (name != L"." && name != L"..")
+					find(dir + L"\\" + name, files);
+			}
+			else if (handledExtension(name))
+				files.push_back(dir + L"\\" + name);
+		} while (FindNextFile(h, &fd));
+		FindClose(h);
+	}
+
+	// Opening a file unbuffered makes the cache manager write back and throw away what it holds of it.
+	void evict(const std::wstring &path)
+	{
+		HANDLE h = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+			FILE_FLAG_NO_BUFFERING, NULL);
+		if (h != INVALID_HANDLE_VALUE)
+			CloseHandle(h);
+	}
+
+	void evictAll(const std::vector<std::wstring> &files)
+	{
+		for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+		{
+			evict(*it);
+			evict(*it + L":tlh.snapshot");
+		}
+	}
+
+	bool stamp(const std::wstring &path, ULONGLONG &size, FILETIME &mtime)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA fad;
+		if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &fad))
+			return false;
+		size = (static_cast<ULONGLONG>(fad.nFileSizeHigh) << 32) | fad.nFileSizeLow;
+		mtime = fad.ftLastWriteTime;
+		return true;
+	}
+}
+
+int benchStreams(int argc, wchar_t *argv[])
+{
+	if (argc < 1)
+		return 2;
+	std::vector<std::wstring> files;
+	find(argv[0], files);
+
+	size_t stored = 0, had = 0;
+	for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+	{
+		ULONGLONG size;
+		FILETIME mtime;
+		std::string snap;
+		if (!stamp(*it, size, mtime))
+			continue;
+		if (loadStreamSnapshot(*it, size, mtime, snap))
+			++had;
+		else
+		{
+			const TagLib::FileRef f(it->c_str());
+			if (!f.isNull() && saveStreamSnapshot(*it, size, mtime, takeSnapshot(f)))
+				++stored;
+		}
+	}
+	std::wcout << files.size() << L" files; " << had << L" had snapshots, " << stored << L" stored" << std::endl;
+
+	evictAll(files);
+	double parse;
+	size_t parsed = 0;
+	{
+		Timer t;
+		for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+		{
+			const TagLib::FileRef f(it->c_str());
+			if (f.isNull())
+				continue;
+			++parsed;
+			for (size_t k = 0; k < keyCount; ++k)
+			{
+				PROPVARIANT pv;
+				PropVariantInit(&pv);
+				readProperty(f, keys[k], &pv);
+				PropVariantClear(&pv);
+			}
+		}
+		parse = t.seconds();
+	}
+
+	evictAll(files);
+	double streams;
+	size_t hits = 0;
+	{
+		Timer t;
+		for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+		{
+			ULONGLONG size;
+			FILETIME mtime;
+			std::string snap;
+			if (!stamp(*it, size, mtime) || !loadStreamSnapshot(*it, size, mtime, snap))
+				continue;
+			++hits;
+			const SnapshotReader r(snap.data(), snap.size());
+			for (size_t k = 0; k < keyCount; ++k)
+			{
+				PROPVARIANT pv;
+				r.value(keys[k], &pv);
+				PropVariantClear(&pv);
+			}
+		}
+		streams = t.seconds();
+	}
+
+	std::wcout << L"parse:   " << parsed << L" files, " << parse * 1e6 / std::max<size_t>(parsed, 1) << L" us/file\n"
+		<< L"streams: " << hits << L" hits, " << streams * 1e6 / std::max<size_t>(hits, 1) << L" us/file ("
+		<< parse / streams << L"x)" << std::endl;
+	return 0;
+}
@@ -0,0 +1,54 @@
+#include "bench.h"
+
+#include <iostream>
+#include <string>
+
+// === bench: microbenchmarks for the library parts. ===
+//
+//   bench name [args...]
+//
+// The tools (tlhd, tlhscan) have their own end-to-end benchmarks; these are for the pieces under them.
+
+namespace
+{
+	struct Bench
+	{
+		const wchar_t *name, *args;
+		int (*run)(int argc, wchar_t *argv[]);
+	};
+
+	const Bench benches[] =
+	{
+		{ L"archive", L"archive [dir]", benchArchive },
+		{ L"audiohash", L"file...", benchAudioHash },
+		{ L"cache", L"file [threads] [lookups] [files]", benchCache },
+		{ L"container", L"file... [-n iterations]", benchContainer },
+		{ L"fingerprint", L"file... [-n iterations]", benchFingerprint },
+		{ L"http", L"[-latency ms] [-block KB] [-blocks n] [-gap n] [-speculate KB] file...", benchHttp },
+		{ L"id3", L"[-n count] [file...]", benchId3 },
+		{ L"mpeg", L"file... [-n iterations]", benchMpeg },
+		{ L"ogg", L"file... [-n iterations]", benchOgg },
+		{ L"onepass", L"[-cold] file...", benchOnePass },
+		{ L"prefetch", L"dir [ahead]", benchPrefetch },
+		{ L"roundtrips", L"[-latency ms] [-bandwidth MB/s] [-sleep] [-log] file...", benchRoundTrips },
+		{ L"shared", L"[processes] [rounds] [lookups]", benchShared },
+		{ L"shared-child", L"(started by shared)", benchSharedChild },
+		{ L"snapshot", L"[file] [iterations]", benchSnapshot },
+		{ L"streams", L"dir", benchStreams },
+		{ L"unsync", L"[-mb size] [-n rounds]", benchUnsync },
+		{ L"xiph", L"[-n count] [dir|file...]", benchXiph },
+	};
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+	if (argc > 1)
+		for (size_t i = 0; i < sizeof(benches) / sizeof(*benches); ++i)
+			if (argv[1] == std::wstring(benches[i].name))
+				return benches[i].run(argc - 2, argv + 2);
+
+	std::wcerr << L"usage:" << std::endl;
+	for (size_t i = 0; i < sizeof(benches) / sizeof(*benches); ++i)
+		std::wcerr << L"  bench " << benches[i].name << L" " << benches[i].args << std::endl;
+	return 2;
+}
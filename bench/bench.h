@@ -0,0 +1,42 @@
+#pragma once
+
+#include <windows.h>
+
+// Wall-clock time since construction.
+struct Timer
+{
+	Timer()
+	{
+		QueryPerformanceCounter(&start);
+	}
+
+	double seconds() const
+	{
+		LARGE_INTEGER freq, now;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&now);
+		return static_cast<double>(now.QuadPart - start.QuadPart) / freq.QuadPart;
+	}
+
+	LARGE_INTEGER start;
+};
+
+// Each benchmark gets the arguments after its name, and returns the exit code.
+int benchArchive(int argc, wchar_t *argv[]);
+int benchAudioHash(int argc, wchar_t *argv[]);
+int benchCache(int argc, wchar_t *argv[]);
+int benchContainer(int argc, wchar_t *argv[]);
+int benchFingerprint(int argc, wchar_t *argv[]);
+int benchHttp(int argc, wchar_t *argv[]);
+int benchId3(int argc, wchar_t *argv[]);
+int benchMpeg(int argc, wchar_t *argv[]);
+int benchOgg(int argc, wchar_t *argv[]);
+int benchOnePass(int argc, wchar_t *argv[]);
+int benchPrefetch(int argc, wchar_t *argv[]);
+int benchRoundTrips(int argc, wchar_t *argv[]);
+int benchShared(int argc, wchar_t *argv[]);
+int benchSharedChild(int argc, wchar_t *argv[]);
+int benchSnapshot(int argc, wchar_t *argv[]);
+int benchStreams(int argc, wchar_t *argv[]);
+int benchUnsync(int argc, wchar_t *argv[]);
+int benchXiph(int argc, wchar_t *argv[]);
@@ -0,0 +1,179 @@
+#include "bench.h"
+#include "../snapcache.h"
+#include "../snapshot.h"
+
+#include <fileref.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// === The handler's snapshot cache, from many threads at once. ===
+//
+//   bench cache file [threads] [lookups] [files]
+//
+// Each thread looks up `lookups` files from a set of `files` made-up identities, favouring some
+// over others as a real library would, so it sees hits, misses and evictions. Every miss parses
+// the given file. Then every thread asks for the same new file at the same moment, a few times
+// over, which should cost one parse each time however many threads there are.
+
+namespace
+{
+	struct ParseLoader : SnapshotCache::Loader
+	{
+		ParseLoader(const std::wstring &file) : file(file), loads(0) {}
+		std::wstring file;
+		volatile LONG loads;
+
+		bool load(std::string &snapshot)
+		{
+			InterlockedIncrement(&loads);
+			TagLib::FileRef f(file.c_str());
+			if (f.isNull())
+				return false;
+			snapshot = takeSnapshot(f);
+			return true;
+		}
+	};
+
+	std::wstring identity(unsigned n)
+	{
+		std::wstringstream ss;
+		ss << L"track " << n << L".mp3|128";
+		return ss.str();
+	}
+
+	struct Worker
+	{
+		SnapshotCache *cache;
+		ParseLoader *loader;
+		std::vector<std::wstring> *ids;
+		size_t lookups;
+		unsigned seed;
+		HANDLE go; // for the burst; everyone waits on it, then asks for burst.
+		std::wstring burst;
+	};
+
+	DWORD WINAPI repeated(void *p)
+	{
+		Worker &w = *static_cast<Worker *>(p);
+		std::string snap;
+		unsigned x = w.seed;
+		for (size_t i = 0; i < w.lookups; ++i)
+		{
+			// Squaring a uniform number skews it towards the start of the set.
+			x = x * 1103515245 + 12345;
+			const double u = (x >> 8) / double(1 << 24);
+			w.cache->get((*w.ids)[static_cast<size_t>(u * u * w.ids->size())], 1, 1, *w.loader, snap);
+		}
+		return 0;
+	}
+
+	DWORD WINAPI burst(void *p)
+	{
+		Worker &w = *static_cast<Worker *>(p);
+		std::string snap;
+		WaitForSingleObject(w.go, INFINITE);
+		w.cache->get(w.burst, 1, 1, *w.loader, snap);
+		return 0;
+	}
+
+	void run(std::vector<Worker> &workers, DWORD (WINAPI *what)(void *), HANDLE go)
+	{
+		std::vector<HANDLE> threads;
+		for (size_t i = 0; i < workers.size(); ++i)
+			threads.push_back(CreateThread(NULL, 0, what, &workers[i], 0, NULL));
+		if (go)
+		{
+			Sleep(50); // let them all get to the gate.
+			SetEvent(go);
+		}
+		WaitForMultipleObjects(static_cast<DWORD>(threads.size()), &threads[0], TRUE, INFINITE);
+		for (size_t i = 0; i < threads.size(); ++i)
+			CloseHandle(threads[i]);
+	}
+
+	void report(const SnapshotCache::Stats &s)
+	{
+		const unsigned long long lookups = s.hits + s.misses + s.coalesced;
+		std::wcout << L"  hits " << s.hits << L" (" << 100.0 * s.hits / lookups << L"%), misses " << s.misses
+			<< L", coalesced " << s.coalesced << L", evictions " << s.evictions << std::endl
+			<< L"  contended " << s.contended << L" (" << 100.0 * s.contended / lookups << L"% of lookups)" << std::endl;
+	}
+}
+
+int benchCache(int argc, wchar_t *argv[])
+{
+	if (argc < 1)
+		return 2;
+	const std::wstring file = argv[0];
+	const size_t threads = argc > 1 ? _wtoi(argv[1]) : 8;
+	const size_t lookups = argc > 2 ? _wtoi(argv[2]) : 100000;
+	const unsigned files = argc > 3 ? _wtoi(argv[3]) : 2000;
+
+	ParseLoader loader(file);
+	{
+		std::string snap;
+		if (!loader.load(snap))
+		{
+			std::wcerr << L"can't read " << file << std::endl;
+			return 1;
+		}
+		loader.loads = 0;
+	}
+
+	std::vector<std::wstring> ids;
+	for (unsigned i = 0; i < files; ++i)
+		ids.push_back(identity(i));
+
+	{
+		// Half the set fits.
+		SnapshotCache cache(files / 2);
+		std::vector<Worker> workers(threads);
+		for (size_t i = 0; i < threads; ++i)
+		{
+			Worker w = { &cache, &loader, &ids, lookups, static_cast<unsigned>(i) * 7919 + 1, NULL };
+			workers[i] = w;
+		}
+
+		Timer t;
+		run(workers, repeated, NULL);
+		const double secs = t.seconds();
+		std::wcout << L"repeated, " << threads << L" threads: " << threads * lookups / secs << L" lookups/s, "
+			<< loader.loads << L" parses" << std::endl;
+		report(cache.stats());
+	}
+
+	{
+		// What each of those lookups would have cost without a cache.
+		const size_t fewer = 200;
+		std::string snap;
+		Timer t;
+		for (size_t i = 0; i < fewer; ++i)
+			loader.load(snap);
+		std::wcout << L"uncached: " << fewer / t.seconds() << L" parses/s, per thread" << std::endl;
+	}
+
+	{
+		SnapshotCache cache(files);
+		const unsigned rounds = 20;
+		loader.loads = 0;
+		Timer t;
+		for (unsigned r = 0; r < rounds; ++r)
+		{
+			HANDLE go = CreateEvent(NULL, TRUE, FALSE, NULL);
+			std::vector<Worker> workers(threads);
+			for (size_t i = 0; i < threads; ++i)
+			{
+				Worker w = { &cache, &loader, &ids, 0, 0, go, identity(files + r) };
+				workers[i] = w;
+			}
+			run(workers, burst, go);
+			CloseHandle(go);
+		}
+		std::wcout << L"burst, " << threads << L" threads at once: " << loader.loads << L" parses for "
+			<< rounds << L" new files" << std::endl;
+		report(cache.stats());
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include "bench.h"
+#include "../container.h"
+#include "../fileaccessor.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// === MP4, WAV and AIFF headers, against TagLib. ===
+//
+//   bench container file... [-n iterations]
+//
+// For each file: the time, the bytes read and the reads for TagLib to open it and give its length,
+//  then the same for readContainerInfo(), with the bytes read as a fraction of the file. The bigger
+//  the audio, the smaller that should get: only headers are read, whatever's between them. Then the
+//  tag boxes and chunks it found, which the fingerprint hashes; the handler still has TagLib read
+//  the tags, so this is what the length costs, not what opening the file does.
+
+namespace
+{
+	// Counts what goes through it.
+	struct CountingAccessor : public Win32FileAccessor
+	{
+		CountingAccessor(const std::wstring &path) : Win32FileAccessor(path), read(0), reads(0) {}
+		mutable unsigned long long read, reads;
+
+		size_t fread(void *pv, size_t s1, size_t s2) const
+		{
+			const size_t n = Win32FileAccessor::fread(pv, s1, s2);
+			read += n;
+			++reads;
+			return n;
+		}
+	};
+
+	const wchar_t *const kinds[] = { L"MP4", L"RIFF", L"AIFF" };
+}
+
+int benchContainer(int argc, wchar_t *argv[])
+{
+	std::vector<std::wstring> files;
+	size_t iterations = 20;
+	for (int i = 0; i < argc; ++i)
+		if (argv[i] == std::wstring(L"-n") && i + 1 < argc)
+			iterations = _wtoi(argv[++i]);
+		else
+			files.push_back(argv[i]);
+
+	for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+	{
+		Win32FileAccessor probe(*it);
+		if (!probe.isOpen())
+		{
+			std::wcerr << L"can't read " << *it << std::endl;
+			continue;
+		}
+		const unsigned long long size = probe.size();
+		std::wcout << *it << L": " << size << L" bytes" << std::endl;
+
+		{
+			Timer t;
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				TagLib::FileRef f(new Win32FileAccessor(*it));
+				f.audioProperties();
+			}
+			const double secs = t.seconds();
+
+			CountingAccessor *counted = new CountingAccessor(*it);
+			TagLib::FileRef f(counted); // owns it.
+			const TagLib::AudioProperties *ap = f.isNull() ? NULL : f.audioProperties();
+			std::wcout << L"  TagLib:  " << secs * 1e6 / iterations << L" us, " << counted->read << L" bytes read ("
+				<< 100.0 * counted->read / (size ? size : 1) << L"%) in " << counted->reads << L" reads; "
+				<< (ap ? ap->length() : 0) << L" s" << std::endl;
+		}
+
+		ContainerInfo info;
+		bool ok = false;
+		Timer t;
+		for (size_t i = 0; i < iterations; ++i)
+		{
+			Win32FileAccessor f(*it);
+			ok = readContainerInfo(f, size, info);
+		}
+		const double secs = t.seconds();
+
+		CountingAccessor counted(*it);
+		readContainerInfo(counted, size, info);
+		std::wcout << L"  headers: " << secs * 1e6 / iterations << L" us, " << counted.read << L" bytes read ("
+			<< 100.0 * counted.read / (size ? size : 1) << L"%) in " << counted.reads << L" reads; ";
+		if (!ok)
+		{
+			std::wcout << L"not MP4, RIFF or AIFF" << std::endl;
+			continue;
+		}
+		std::wcout << kinds[info.kind] << L", " << info.duration / 1e7 << L" s, " << info.sampleRate << L" Hz, "
+			<< info.channels << L" channels" << std::endl;
+		for (std::vector<ContainerRegion>::const_iterator r = info.tags.begin(); r != info.tags.end(); ++r)
+			std::wcout << L"    " << std::wstring(r->type, r->type + 4) << L" at " << r->offset << L", "
+				<< r->length << L" bytes" << std::endl;
+	}
+	return 0;
+}
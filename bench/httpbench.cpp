@@ -0,0 +1,130 @@
+#include "bench.h"
+#include "httpserver.h"
+#include "../extract.h"
+#include "../httpaccessor.h"
+
+#include <propvarutil.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// === Reading tags over HTTP range requests. ===
+//
+//   bench http [-latency ms] [-block KB] [-blocks n] [-gap n] [-speculate KB] file...
+//
+// The files are served from loopback by the stand-in store (httpserver.h), which waits 20ms on
+//  each request unless told otherwise, and every key is read from each through an HttpAccessor:
+//  first with every read a request of its own, then with the block cache, coalescing and the
+//  head and tail fetched on opening. Reports the requests, bytes and time each file took both
+//  ways, then the same by format.
+
+namespace
+{
+	struct Totals
+	{
+		Totals() : files(0), requests(0), bytes(0), seconds(0) {}
+		size_t files;
+		ULONGLONG requests, bytes;
+		double seconds;
+	};
+
+	std::wstring extension(const std::wstring &path)
+	{
+		const std::wstring::size_type dot = path.rfind(L'.');
+		return dot == std::wstring::npos ? L"" : path.substr(dot + 1);
+	}
+
+	void print(const std::wstring &what, const Totals &naive, const Totals &cached)
+	{
+		const double n = naive.files ? static_cast<double>(naive.files) : 1;
+		std::wcout << std::setw(8) << what << L": " << std::fixed << std::setprecision(1)
+			<< naive.requests / n << L" -> " << cached.requests / n << L" requests, "
+			<< naive.bytes / n / 1024 << L" -> " << cached.bytes / n / 1024 << L" KB, "
+			<< naive.seconds / n * 1000 << L" -> " << cached.seconds / n * 1000 << L" ms" << std::endl;
+	}
+
+	Totals scan(HttpClient &client, HttpServer &server, size_t file, const HttpAccessor::Options &opts)
+	{
+		Totals t;
+		t.files = 1;
+		const LONG before = server.requests();
+		Timer wall;
+		HttpAccessor *accessor = new HttpAccessor(client, server.url(file), opts);
+		{
+			TagLib::FileRef f(accessor);
+			for (size_t i = 0; !f.isNull() && i < keyCount; ++i)
+			{
+				PROPVARIANT pv;
+				PropVariantInit(&pv);
+				readProperty(f, keys[i], &pv);
+				PropVariantClear(&pv);
+			}
+			t.requests = accessor->stats().requests;
+			t.bytes = accessor->stats().bytes;
+		}
+		t.seconds = wall.seconds();
+
+		// The server's count is the check on the accessor's.
+		if (static_cast<ULONGLONG>(server.requests() - before) != t.requests)
+			std::wcerr << L"  (the server saw " << server.requests() - before << L" requests)" << std::endl;
+		return t;
+	}
+}
+
+int benchHttp(int argc, wchar_t *argv[])
+{
+	DWORD latency = 20;
+	HttpAccessor::Options opts;
+	std::vector<std::wstring> files;
+	for (int i = 0; i < argc; ++i)
+	{
+		const std::wstring arg = argv[i];
+		if (arg == L"-latency" && i + 1 < argc)
+			latency = _wtoi(argv[++i]);
+		else if (arg == L"-block" && i + 1 < argc)
+			opts.block = _wtoi(argv[++i]) * 1024;
+		else if (arg == L"-blocks" && i + 1 < argc)
+			opts.blocks = _wtoi(argv[++i]);
+		else if (arg == L"-gap" && i + 1 < argc)
+			opts.gap = _wtoi(argv[++i]);
+		else if (arg == L"-speculate" && i + 1 < argc)
+			opts.speculate = _wtoi(argv[++i]) * 1024;
+		else
+			files.push_back(arg);
+	}
+
+	HttpServer server(files, latency);
+	HttpClient client;
+	if (!server.ok() || !client.session())
+	{
+		std::wcerr << L"can't start the server" << std::endl;
+		return 1;
+	}
+
+	HttpAccessor::Options naive = opts;
+	naive.naive = true;
+
+	std::map<std::wstring, std::pair<Totals, Totals> > byFormat;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		const Totals a = scan(client, server, i, naive), b = scan(client, server, i, opts);
+		print(files[i], a, b);
+
+		std::pair<Totals, Totals> &sum = byFormat[extension(files[i])];
+		sum.first.files += a.files;
+		sum.first.requests += a.requests;
+		sum.first.bytes += a.bytes;
+		sum.first.seconds += a.seconds;
+		sum.second.files += b.files;
+		sum.second.requests += b.requests;
+		sum.second.bytes += b.bytes;
+		sum.second.seconds += b.seconds;
+	}
+
+	std::wcout << L"by format, per file (naive -> cached):" << std::endl;
+	for (std::map<std::wstring, std::pair<Totals, Totals> >::const_iterator it = byFormat.begin(); it != byFormat.end(); ++it)
+		print(it->first, it->second.first, it->second.second);
+	return 0;
+}
@@ -0,0 +1,255 @@
+#include "httpserver.h"
+#include "../lock.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+	struct Connection
+	{
+		HttpServer *server;
+		SOCKET s;
+	};
+
+	bool sendAll(SOCKET s, const char *p, size_t n)
+	{
+		while (n)
+		{
+			const int sent = send(s, p, static_cast<int>(n), 0);
+			if (sent <= 0)
+				return false;
+			p += sent;
+			n -= sent;
+		}
+		return true;
+	}
+
+	// The value of a header, if the request has it; names are matched without case.
+	std::string headerValue(const std::string &request, const char *name)
+	{
+		const size_t len = strlen(name);
+		for (std::string::size_type line = request.find("\r\n"); line != std::string::npos; line = request.find("\r\n", line + 2))
+			if (!_strnicmp(request.c_str() + line + 2, name, len) && request[line + 2 + len] == ':')
+			{
+				std::string::size_type from = line + 3 + len;
+				while (from < request.size() && request[from] == ' ')
+					++from;
+				return request.substr(from, request.find("\r\n", from) - from);
+			}
+		return std::string();
+	}
+}
+
+HttpServer::HttpServer(const std::vector<std::wstring> &files, DWORD latency)
+	: files(files), latency(latency), started(false), listener(INVALID_SOCKET), port(0), acceptor(NULL), count(0)
+{
+	InitializeCriticalSection(&cs);
+
+	WSADATA wsa;
+	started = !WSAStartup(MAKEWORD(2, 2), &wsa);
+	if (!started)
+		return;
+
+	listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0; // any free one.
+	int len = sizeof(addr);
+	if (listener == INVALID_SOCKET
+		|| bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))
+		|| listen(listener, SOMAXCONN)
+		|| getsockname(listener, reinterpret_cast<sockaddr *>(&addr), &len)
+		|| !(acceptor = CreateThread(NULL, 0, acceptThread, this, 0, NULL)))
+	{
+		if (listener != INVALID_SOCKET)
+			closesocket(listener);
+		listener = INVALID_SOCKET;
+		return;
+	}
+	port = ntohs(addr.sin_port);
+}
+
+HttpServer::~HttpServer()
+{
+	if (acceptor)
+	{
+		// Closing the listener fails the accept; shutting the connections down fails their recv.
+		closesocket(listener);
+		WaitForSingleObject(acceptor, INFINITE);
+		CloseHandle(acceptor);
+	}
+	for (size_t i = 0; i < connections.size(); ++i)
+	{
+		shutdown(connections[i].first, SD_BOTH);
+		WaitForSingleObject(connections[i].second, INFINITE);
+		CloseHandle(connections[i].second);
+		closesocket(connections[i].first);
+	}
+	if (started)
+		WSACleanup();
+	DeleteCriticalSection(&cs);
+}
+
+std::wstring HttpServer::url(size_t file) const
+{
+	// The name's only there for its extension; escape anything that isn't plain.
+	const std::wstring &path = files[file];
+	const std::wstring leaf = path.substr(path.find_last_of(L"\\/") + 1);
+	std::string utf8(leaf.size() * 3 + 1, 0);
+	utf8.resize(WideCharToMultiByte(CP_UTF8, 0, leaf.c_str(), static_cast<int>(leaf.size()), &utf8[0], static_cast<int>(utf8.size()), NULL, NULL));
+
+	std::wostringstream os;
+	os << L"http://127.0.0.1:" << port << L"/" << file << L"/";
+	static const wchar_t hex[] = L"0123456789ABCDEF";
+	for (size_t i = 0; i < utf8.size(); ++i)
+	{
+		const unsigned char c = utf8[i];
+		if (isalnum(c) || c == '.' || c == '-' || c == '_')
+			os << static_cast<wchar_t>(c);
+		else
+			os << L'%' << hex[c >> 4] << hex[c & 15];
+	}
+	return os.str();
+}
+
+DWORD WINAPI HttpServer::acceptThread(LPVOID param)
+{
+	HttpServer &server = *static_cast<HttpServer *>(param);
+	for (SOCKET s; (s = accept(server.listener, NULL, NULL)) != INVALID_SOCKET; )
+	{
+		Connection *c = new Connection;
+		c->server = &server;
+		c->s = s;
+		Lock lock(server.cs);
+		HANDLE thread = CreateThread(NULL, 0, connectionThread, c, 0, NULL);
+		if (thread)
+			server.connections.push_back(std::make_pair(s, thread));
+		else
+		{
+			closesocket(s);
+			delete c;
+		}
+	}
+	return 0;
+}
+
+DWORD WINAPI HttpServer::connectionThread(LPVOID param)
+{
+	const Connection c = *static_cast<Connection *>(param);
+	delete static_cast<Connection *>(param);
+	c.server->serve(c.s);
+	return 0;
+}
+
+// Requests, one after another, until the client goes or asks to close. The socket's closed by
+//  the destructor, after the thread's done with it.
+void HttpServer::serve(SOCKET s)
+{
+	std::string buffer;
+	char chunk[4096];
+	for (;;)
+	{
+		std::string::size_type end;
+		while ((end = buffer.find("\r\n\r\n")) == std::string::npos)
+		{
+			const int got = recv(s, chunk, sizeof(chunk), 0);
+			if (got <= 0)
+				return;
+			buffer.append(chunk, got);
+		}
+		const std::string request = buffer.substr(0, end + 2);
+		buffer.erase(0, end + 4);
+
+		Sleep(latency);
+		InterlockedIncrement(&count);
+		if (!answer(s, request))
+			return;
+	}
+}
+
+bool HttpServer::answer(SOCKET s, const std::string &request)
+{
+	// "GET /<index>/<name> HTTP/1.1"
+	const std::string::size_type slash = request.find(" /");
+	const size_t index = slash == std::string::npos ? files.size() : strtoul(request.c_str() + slash + 2, NULL, 10);
+	const bool head = !request.compare(0, 5, "HEAD ");
+	const bool close = !_stricmp(headerValue(request, "Connection").c_str(), "close");
+
+	HANDLE file = index < files.size()
+		? CreateFile(files[index].c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL)
+		: INVALID_HANDLE_VALUE;
+	LARGE_INTEGER size = {};
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size))
+	{
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		static const char notFound[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+		return sendAll(s, notFound, sizeof(notFound) - 1) && !close;
+	}
+
+	// Only the one range; anything unparseable gets the whole file, which is allowed.
+	const ULONGLONG total = size.QuadPart;
+	ULONGLONG first = 0, last = total ? total - 1 : 0;
+	int status = 200;
+	const std::string range = headerValue(request, "Range");
+	if (!range.compare(0, 6, "bytes=") && range.find(',') == std::string::npos)
+	{
+		const char *spec = range.c_str() + 6;
+		char *dash;
+		const ULONGLONG a = _strtoui64(spec, &dash, 10);
+		if (*dash == '-')
+		{
+			status = 206;
+			if (dash == spec)
+			{
+				const ULONGLONG n = _strtoui64(dash + 1, NULL, 10);
+				first = total - (n < total ? n : total);
+			}
+			else
+			{
+				first = a;
+				if (dash[1])
+				{
+					const ULONGLONG b = _strtoui64(dash + 1, NULL, 10);
+					last = b < last ? b : last;
+				}
+			}
+			if (first >= total || first > last || (dash == spec && first == total))
+				status = 416;
+		}
+	}
+
+	std::ostringstream os;
+	const ULONGLONG length = status == 416 ? 0 : status == 206 ? last - first + 1 : total;
+	os << "HTTP/1.1 " << (status == 200 ? "200 OK" : status == 206 ? "206 Partial Content" : "416 Range Not Satisfiable") << "\r\n"
+		<< "Accept-Ranges: bytes\r\n"
+		<< "Content-Length: " << length << "\r\n";
+	if (status == 206)
+		os << "Content-Range: bytes " << first << "-" << last << "/" << total << "\r\n";
+	else if (status == 416)
+		os << "Content-Range: bytes */" << total << "\r\n";
+	os << "\r\n";
+	const std::string headers = os.str();
+	bool ok = sendAll(s, headers.data(), headers.size());
+
+	LARGE_INTEGER at;
+	at.QuadPart = first;
+	SetFilePointerEx(file, at, NULL, FILE_BEGIN);
+	char buf[64 * 1024];
+	for (ULONGLONG left = head ? 0 : length; ok && left; )
+	{
+		DWORD got = 0;
+		if (!ReadFile(file, buf, static_cast<DWORD>(left < sizeof(buf) ? left : sizeof(buf)), &got, NULL) || !got)
+			ok = false;
+		else
+		{
+			ok = sendAll(s, buf, got);
+			left -= got;
+		}
+	}
+	CloseHandle(file);
+	return ok && !close;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <winsock2.h>
+#include <windows.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// === A stand-in for an object store, on loopback. ===
+// Serves a list of local files over HTTP/1.1 at http://127.0.0.1:port/<index>/<name>, honouring
+//  Range ("bytes=a-b", "bytes=a-", "bytes=-n") and keep-alive, which is all HttpAccessor asks of
+//  a real one. Each request waits `latency` ms before it's answered, to stand in for the distance
+//  to the store, and is counted. A thread per connection; only for benchmarks and tests.
+
+class HttpServer
+{
+public:
+	HttpServer(const std::vector<std::wstring> &files, DWORD latency);
+	~HttpServer();
+
+	bool ok() const { return listener != INVALID_SOCKET; }
+	std::wstring url(size_t file) const;
+	LONG requests() const { return count; }
+
+private:
+	static DWORD WINAPI acceptThread(LPVOID param);
+	static DWORD WINAPI connectionThread(LPVOID param);
+	void serve(SOCKET s);
+	bool answer(SOCKET s, const std::string &request);
+
+	std::vector<std::wstring> files;
+	DWORD latency;
+	bool started;
+	SOCKET listener;
+	USHORT port;
+	HANDLE acceptor;
+	volatile LONG count;
+
+	CRITICAL_SECTION cs;
+	std::vector<std::pair<SOCKET, HANDLE> > connections;
+
+	HttpServer(const HttpServer &);
+	HttpServer &operator=(const HttpServer &);
+};
@@ -0,0 +1,222 @@
+#include "bench.h"
+#include "../extract.h"
+#include "../fileaccessor.h"
+#include "../headerinfo.h"
+#include "../id3scan.h"
+#include "../memaccessor.h"
+
+#include <propvarutil.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// === ID3 tags read natively, against TagLib. ===
+//
+//   bench id3 [-n count] [file...]
+//
+// Without files, a library of count MP3s is made in memory, tagged as tlhscan's synthetic library
+//  is (titles, artists, albums, genres, composers, publishers), alternately ID3v2.3 in Latin-1 and
+//  ID3v2.4 in UTF-16 and UTF-8, each with a 64KB picture, a comment and padding, then a few frames
+//  of audio. Every file is read the handler's way through TagLib (with its header lengths), then
+//  through id3scan, and the times compared, with how many values the two disagree on and how many
+//  files id3scan left to TagLib. Files named are read into memory and used instead.
+
+namespace
+{
+	void be32(std::string &out, size_t n, bool syncsafe)
+	{
+		const unsigned shift = syncsafe ? 7 : 8;
+		for (int i = 3; i >= 0; --i)
+			out += static_cast<char>((n >> (shift * i)) & (syncsafe ? 0x7F : 0xFF));
+	}
+
+	void frame(std::string &out, const char *id, const std::string &body, unsigned version)
+	{
+		out.append(id, 4);
+		be32(out, body.size(), version == 4);
+		out.append(2, '\0');
+		out += body;
+	}
+
+	// Encoded as a frame in that version would be: Latin-1 for 2.3, alternately UTF-16 with a byte
+	//  order mark and UTF-8 for 2.4.
+	std::string text(const std::wstring &s, unsigned version, bool utf16)
+	{
+		std::string ret;
+		if (version == 3)
+		{
+			ret += '\0';
+			for (size_t i = 0; i < s.size(); ++i)
+				ret += static_cast<char>(s[i]);
+		}
+		else if (utf16)
+		{
+			ret += "\x01\xFF\xFE";
+			for (size_t i = 0; i < s.size(); ++i)
+			{
+				ret += static_cast<char>(s[i] & 0xFF);
+				ret += static_cast<char>(s[i] >> 8);
+			}
+		}
+		else
+		{
+			ret += '\x03';
+			for (size_t i = 0; i < s.size(); ++i)
+				ret += static_cast<char>(s[i]);
+		}
+		return ret;
+	}
+
+	std::wstring numbered(const wchar_t *what, size_t n)
+	{
+		std::wstringstream ss;
+		ss << what << L" " << n;
+		return ss.str();
+	}
+
+	std::string synthesise(size_t i)
+	{
+		const size_t album = i / 10;
+		const unsigned version = i % 2 ? 4 : 3;
+		const bool utf16 = i % 4 == 1;
+		std::string frames;
+		frame(frames, "TIT2", text(numbered(L"Track", i), version, utf16), version);
+		frame(frames, "TPE1", text(numbered(L"Artist", album * 7919 % 20000), version, utf16), version);
+		frame(frames, "TPE2", text(numbered(L"Artist", album * 7919 % 20000), version, utf16), version);
+		frame(frames, "TALB", text(numbered(L"Album", album), version, utf16), version);
+		frame(frames, "TCON", text(numbered(L"Genre", album % 300), version, utf16), version);
+		frame(frames, "TRCK", text(numbered(L"", i % 10 + 1).substr(1), version, utf16), version);
+		frame(frames, version == 3 ? "TYER" : "TDRC", text(numbered(L"", 1960 + album % 50).substr(1), version, utf16), version);
+		frame(frames, "TCOM", text(numbered(L"Composer", album * 104729 % 5000), version, utf16), version);
+		frame(frames, "TPUB", text(numbered(L"Publisher", album % 1000), version, utf16), version);
+		std::string comment = version == 3 ? std::string("\0eng\0", 5) : std::string("\x03" "eng\0", 5);
+		comment += "Ripped";
+		frame(frames, "COMM", comment, version);
+		std::string picture("\0image/jpeg\0\x03\0", 14);
+		picture.append(64 * 1024, '\xAB');
+		frame(frames, "APIC", picture, version);
+		frames.append(1024, '\0');
+
+		std::string file("ID3", 3);
+		file += static_cast<char>(version);
+		file.append(2, '\0');
+		be32(file, frames.size(), true);
+		file += frames;
+		// MPEG-1 layer III, 128kbps at 44.1kHz: 417 bytes a frame.
+		for (int f = 0; f < 40; ++f)
+		{
+			file += "\xFF\xFB\x90\x64";
+			file.append(413, '\0');
+		}
+		return file;
+	}
+
+	// Every key, as text, the way the handler would read it through TagLib.
+	bool viaTagLib(const std::string &file, std::vector<std::wstring> &values)
+	{
+		MemoryAccessor *accessor = new MemoryAccessor(file.data(), file.size(), L"x.mp3");
+		TagLib::FileRef f(accessor);
+		if (f.isNull())
+			return false;
+		HeaderInfo header;
+		const bool headers = readHeaderInfo(*accessor, file.size(), L"x.mp3", header);
+		for (size_t i = 0; i < keyCount; ++i)
+		{
+			PROPVARIANT pv;
+			PropVariantInit(&pv);
+			if ((headers ? readHeaderProperty(f, header, keys[i], &pv) : readProperty(f, keys[i], &pv)) == S_OK)
+				values[i] = propertyText(pv);
+			PropVariantClear(&pv);
+		}
+		return true;
+	}
+
+	bool viaId3Scan(const std::string &file, Id3Tags &tags, std::vector<std::wstring> &values)
+	{
+		MemoryAccessor accessor(file.data(), file.size(), L"x.mp3");
+		MpegInfo mpeg;
+		if (!readId3File(accessor, file.size(), L"x.mp3", tags, mpeg))
+			return false;
+		for (size_t i = 0; i < keyCount; ++i)
+		{
+			PROPVARIANT pv;
+			PropVariantInit(&pv);
+			if (readId3Property(tags, mpeg, keys[i], &pv) == S_OK)
+				values[i] = propertyText(pv);
+			PropVariantClear(&pv);
+		}
+		return true;
+	}
+}
+
+int benchId3(int argc, wchar_t *argv[])
+{
+	size_t count = 2000;
+	std::vector<std::string> files;
+	for (int i = 0; i < argc; ++i)
+		if (argv[i] == std::wstring(L"-n") && i + 1 < argc)
+			count = _wtoi(argv[++i]);
+		else
+		{
+			Win32FileAccessor f(argv[i]);
+			std::string data(static_cast<size_t>(f.size()), '\0');
+			if (!f.isOpen() || (!data.empty() && f.fread(&data[0], 1, data.size()) != data.size()))
+			{
+				std::wcerr << L"can't read " << argv[i] << std::endl;
+				continue;
+			}
+			files.push_back(data);
+		}
+	if (files.empty())
+		for (size_t i = 0; i < count; ++i)
+			files.push_back(synthesise(i));
+
+	unsigned long long bytes = 0;
+	for (size_t i = 0; i < files.size(); ++i)
+		bytes += files[i].size();
+	std::wcout << files.size() << L" files, " << bytes / (1024 * 1024) << L" MB" << std::endl;
+
+	std::vector<std::vector<std::wstring> > expected(files.size(), std::vector<std::wstring>(keyCount));
+	size_t failed = 0;
+	{
+		Timer t;
+		for (size_t i = 0; i < files.size(); ++i)
+			failed += !viaTagLib(files[i], expected[i]);
+		std::wcout << L"TagLib:  " << t.seconds() * 1e6 / files.size() << L" us a file";
+		if (failed)
+			std::wcout << L" (" << failed << L" unreadable)";
+		std::wcout << std::endl;
+	}
+
+	std::vector<std::vector<std::wstring> > got(files.size(), std::vector<std::wstring>(keyCount));
+	std::vector<bool> scanned(files.size());
+	{
+		Id3Tags tags; // kept from file to file, as a scan over a library would.
+		Timer t;
+		for (size_t i = 0; i < files.size(); ++i)
+			scanned[i] = viaId3Scan(files[i], tags, got[i]);
+		std::wcout << L"id3scan: " << t.seconds() * 1e6 / files.size() << L" us a file" << std::endl;
+	}
+
+	size_t fallbacks = 0, differing = 0, shown = 0;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		if (!scanned[i])
+		{
+			++fallbacks;
+			continue;
+		}
+		for (size_t k = 0; k < keyCount; ++k)
+			if (got[i][k] != expected[i][k])
+			{
+				++differing;
+				if (shown++ < 10)
+					std::wcout << L"  file " << i << L", key " << k << L": TagLib '" << expected[i][k]
+						<< L"', id3scan '" << got[i][k] << L"'" << std::endl;
+			}
+	}
+	std::wcout << fallbacks << L" left to TagLib, " << differing << L" values differ" << std::endl;
+	return differing ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+#include "bench.h"
+#include "../extract.h"
+#include "../latencystream.h"
+#include "../streamaccessor.h"
+
+#include <propvarutil.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// === Round trips to read every key, over a slow link. ===
+//
+//   bench roundtrips [-latency ms] [-bandwidth MB/s] [-sleep] [-log] file...
+//
+// Each file is read through IStreamAccessor from a LatencyStream (latencystream.h), as the handler
+//  would read it from a network share: 20ms a call and 10MB/s unless told otherwise. Reports the
+//  calls each file needs, the bytes, and the time they'd take, then the same by format. -log prints
+//  every call; -sleep makes the calls really take that long.
+
+namespace
+{
+	struct Totals
+	{
+		Totals() : files(0), reads(0), seeks(0), stats(0), bytes(0), seconds(0) {}
+		size_t files, reads, seeks, stats;
+		ULONGLONG bytes;
+		double seconds;
+	};
+
+	std::wstring extension(const std::wstring &path)
+	{
+		const std::wstring::size_type dot = path.rfind(L'.');
+		return dot == std::wstring::npos ? L"" : path.substr(dot + 1);
+	}
+
+	void print(const std::wstring &what, const Totals &t)
+	{
+		const double n = t.files ? static_cast<double>(t.files) : 1;
+		std::wcout << std::setw(8) << what << L": " << (t.reads + t.seeks + t.stats) / n << L" round trips ("
+			<< t.reads / n << L" reads, " << t.seeks / n << L" seeks, " << t.stats / n << L" stats), "
+			<< t.bytes / n / 1024 << L" KB, " << t.seconds / n * 1000 << L" ms" << std::endl;
+	}
+}
+
+int benchRoundTrips(int argc, wchar_t *argv[])
+{
+	LatencyStream::Link link = { 0.020, 10e6, false };
+	bool logging = false;
+	std::vector<std::wstring> files;
+	for (int i = 0; i < argc; ++i)
+	{
+		const std::wstring arg = argv[i];
+		if (arg == L"-latency" && i + 1 < argc)
+			link.latency = _wtof(argv[++i]) / 1000;
+		else if (arg == L"-bandwidth" && i + 1 < argc)
+			link.bytesPerSec = _wtof(argv[++i]) * 1e6;
+		else if (arg == L"-sleep")
+			link.sleep = true;
+		else if (arg == L"-log")
+			logging = true;
+		else
+			files.push_back(arg);
+	}
+
+	std::map<std::wstring, Totals> byFormat;
+	for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+	{
+		LatencyStream *stream = LatencyStream::open(*it, link);
+		if (!stream)
+		{
+			std::wcerr << L"can't read " << *it << std::endl;
+			continue;
+		}
+
+		Timer wall;
+		{
+			TagLib::FileRef f(new IStreamAccessor(stream));
+			for (size_t i = 0; !f.isNull() && i < keyCount; ++i)
+			{
+				PROPVARIANT pv;
+				PropVariantInit(&pv);
+				readProperty(f, keys[i], &pv);
+				PropVariantClear(&pv);
+			}
+		}
+
+		Totals t;
+		t.files = 1;
+		t.reads = stream->count(LatencyStream::Call::READ);
+		t.seeks = stream->count(LatencyStream::Call::SEEK);
+		t.stats = stream->count(LatencyStream::Call::STAT);
+		t.bytes = stream->bytesRead();
+		t.seconds = stream->simulated();
+		print(*it, t);
+		if (link.sleep)
+			std::wcout << L"  (" << wall.seconds() * 1000 << L" ms on the clock)" << std::endl;
+
+		if (logging)
+		{
+			static const wchar_t *ops[] = { L"read", L"seek", L"stat", L"other" };
+			const std::vector<LatencyStream::Call> &calls = stream->calls();
+			for (std::vector<LatencyStream::Call>::const_iterator c = calls.begin(); c != calls.end(); ++c)
+				std::wcout << L"    " << ops[c->op] << L" @" << c->offset << L" " << c->bytes << std::endl;
+		}
+		stream->Release();
+
+		Totals &sum = byFormat[extension(*it)];
+		++sum.files;
+		sum.reads += t.reads;
+		sum.seeks += t.seeks;
+		sum.stats += t.stats;
+		sum.bytes += t.bytes;
+		sum.seconds += t.seconds;
+	}
+
+	std::wcout << L"by format, per file:" << std::endl;
+	for (std::map<std::wstring, Totals>::const_iterator it = byFormat.begin(); it != byFormat.end(); ++it)
+		print(it->first, it->second);
+	return 0;
+}
@@ -0,0 +1,114 @@
+#include "bench.h"
+#include "../fileaccessor.h"
+#include "../mpegscan.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// === MPEG length and bitrate from the frame headers, against TagLib. ===
+//
+//   bench mpeg file... [-n iterations]
+//
+// For each file: the time and bytes read for TagLib to open it and give its length and bitrate,
+//  then the same for readMpegInfo() at each accuracy, with what each came up with and how. Junk
+//  before the first frame, and VBR files without a Xing header, are the cases that differ. Then the
+//  sync search alone, from memory, over bytes with no sync in them.
+
+namespace
+{
+	// Counts what goes through it.
+	struct CountingAccessor : public Win32FileAccessor
+	{
+		CountingAccessor(const std::wstring &path) : Win32FileAccessor(path), read(0), reads(0) {}
+		mutable unsigned long long read, reads;
+
+		size_t fread(void *pv, size_t s1, size_t s2) const
+		{
+			const size_t n = Win32FileAccessor::fread(pv, s1, s2);
+			read += n;
+			++reads;
+			return n;
+		}
+	};
+
+	const wchar_t *const methods[] = { L"Xing", L"Info", L"VBRI", L"first frame", L"sampled", L"counted" };
+	const wchar_t *const accuracies[] = { L"first frame", L"sampled", L"exact" };
+}
+
+int benchMpeg(int argc, wchar_t *argv[])
+{
+	std::vector<std::wstring> files;
+	size_t iterations = 20;
+	for (int i = 0; i < argc; ++i)
+		if (argv[i] == std::wstring(L"-n") && i + 1 < argc)
+			iterations = _wtoi(argv[++i]);
+		else
+			files.push_back(argv[i]);
+
+	for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+	{
+		Win32FileAccessor probe(*it);
+		if (!probe.isOpen())
+		{
+			std::wcerr << L"can't read " << *it << std::endl;
+			continue;
+		}
+		const unsigned long long size = probe.size();
+		std::wcout << *it << L": " << size << L" bytes" << std::endl;
+
+		{
+			Timer t;
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				TagLib::FileRef f(new Win32FileAccessor(*it));
+				f.audioProperties();
+			}
+			const double secs = t.seconds();
+
+			CountingAccessor *counted = new CountingAccessor(*it);
+			TagLib::FileRef f(counted); // owns it.
+			const TagLib::AudioProperties *ap = f.isNull() ? NULL : f.audioProperties();
+			std::wcout << L"  TagLib:      " << secs * 1e6 / iterations << L" us, " << counted->read << L" bytes read in "
+				<< counted->reads << L" reads; " << (ap ? ap->length() : 0) << L" s, " << (ap ? ap->bitrate() : 0)
+				<< L" kbps" << std::endl;
+		}
+
+		for (int a = MPEG_FIRST_FRAME; a <= MPEG_EXACT; ++a)
+		{
+			MpegInfo info;
+			unsigned long long read = 0;
+			bool ok = false;
+			Timer t;
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				Win32FileAccessor f(*it);
+				ok = readMpegInfo(f, size, info, static_cast<MpegAccuracy>(a), &read);
+			}
+			std::wcout << L"  " << accuracies[a] << L":" << std::wstring(12 - wcslen(accuracies[a]), L' ')
+				<< t.seconds() * 1e6 / iterations << L" us, " << read << L" bytes read; ";
+			if (ok)
+				std::wcout << info.duration() / 1e7 << L" s, " << info.bitrate / 1000.0 << L" kbps, " << info.frames
+					<< L" frames (" << methods[info.method] << L", audio from " << info.start << L")" << std::endl;
+			else
+				std::wcout << L"no frames found" << std::endl;
+		}
+	}
+
+	{
+		// Junk: anything but 0xFF.
+		std::vector<unsigned char> buf(64 * 1024 * 1024);
+		for (size_t i = 0; i < buf.size(); ++i)
+			buf[i] = static_cast<unsigned char>(i * 7 + (i >> 11)) & 0x7F;
+		const size_t rounds = 8;
+		size_t missed = 0;
+		Timer t;
+		for (size_t i = 0; i < rounds; ++i)
+			missed += findMpegSync(&buf[0], &buf[0] + buf.size()) == &buf[0] + buf.size();
+		std::wcout << L"sync search: " << rounds * buf.size() / t.seconds() / 1e9 << L" GB/s"
+			<< (mpegSyncVectorised() ? L" (SSE2)" : L" (plain)") << std::endl;
+		if (missed != rounds)
+			std::wcout << L"  (found one)" << std::endl;
+	}
+	return 0;
+}
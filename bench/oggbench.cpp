@@ -0,0 +1,160 @@
+#include "bench.h"
+#include "../accessorutil.h"
+#include "../fileaccessor.h"
+#include "../oggscan.h"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// === Ogg length from the last page, against walking the pages to it. ===
+//
+//   bench ogg file... [-n iterations]
+//
+// For each file: the time and bytes read for TagLib to open it and give its length, for a forward
+//  walk that reads each page header and seeks over its body, and for readOggInfo(), with the length
+//  each came up with. The walk's cost grows with the file, a header per 4-8KB page; readOggInfo()'s
+//  shouldn't, so the longer the file (hours of audio), the more it wins. Then the page CRC and the
+//  capture pattern search alone, from memory.
+
+namespace
+{
+	// Counts what goes through it.
+	struct CountingAccessor : public Win32FileAccessor
+	{
+		CountingAccessor(const std::wstring &path) : Win32FileAccessor(path), read(0), reads(0) {}
+		mutable unsigned long long read, reads;
+
+		size_t fread(void *pv, size_t s1, size_t s2) const
+		{
+			const size_t n = Win32FileAccessor::fread(pv, s1, s2);
+			read += n;
+			++reads;
+			return n;
+		}
+	};
+
+	unsigned le32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | static_cast<unsigned>(p[3]) << 24; }
+
+	// Page to page from the start, as a reader without the end to hand would: the last granule of the
+	//  first page's stream, and the pages there were.
+	unsigned long long walk(TagLib::FileAccessor &f, unsigned long long size, unsigned long long &pages)
+	{
+		unsigned char h[27 + 255];
+		unsigned long long at = 0, granule = 0;
+		unsigned serial = 0;
+		pages = 0;
+		while (at + 27 <= size && !seekTo(f, at) && f.fread(h, 1, 27) == 27 && !memcmp(h, "OggS", 4)
+			&& f.fread(h + 27, 1, h[26]) == h[26])
+		{
+			unsigned long long body = 0;
+			for (unsigned i = 0; i < h[26]; ++i)
+				body += h[27 + i];
+			const unsigned long long g = le32(h + 6) | static_cast<unsigned long long>(le32(h + 10)) << 32;
+			if (!pages++)
+				serial = le32(h + 14);
+			if (le32(h + 14) == serial && g != ~0ULL)
+				granule = g;
+			at += 27 + h[26] + body;
+		}
+		return granule;
+	}
+}
+
+int benchOgg(int argc, wchar_t *argv[])
+{
+	std::vector<std::wstring> files;
+	size_t iterations = 20;
+	for (int i = 0; i < argc; ++i)
+		if (argv[i] == std::wstring(L"-n") && i + 1 < argc)
+			iterations = _wtoi(argv[++i]);
+		else
+			files.push_back(argv[i]);
+
+	for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+	{
+		Win32FileAccessor probe(*it);
+		if (!probe.isOpen())
+		{
+			std::wcerr << L"can't read " << *it << std::endl;
+			continue;
+		}
+		const unsigned long long size = probe.size();
+		std::wcout << *it << L": " << size << L" bytes" << std::endl;
+
+		{
+			Timer t;
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				TagLib::FileRef f(new Win32FileAccessor(*it));
+				f.audioProperties();
+			}
+			const double secs = t.seconds();
+
+			CountingAccessor *counted = new CountingAccessor(*it);
+			TagLib::FileRef f(counted); // owns it.
+			const TagLib::AudioProperties *ap = f.isNull() ? NULL : f.audioProperties();
+			std::wcout << L"  TagLib:    " << secs * 1e6 / iterations << L" us, " << counted->read << L" bytes read in "
+				<< counted->reads << L" reads; " << (ap ? ap->length() : 0) << L" s" << std::endl;
+		}
+
+		{
+			unsigned long long granule = 0, pages = 0;
+			Timer t;
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				Win32FileAccessor f(*it);
+				granule = walk(f, size, pages);
+			}
+			const double secs = t.seconds();
+
+			CountingAccessor counted(*it);
+			walk(counted, size, pages);
+			std::wcout << L"  walk:      " << secs * 1e6 / iterations << L" us, " << counted.read << L" bytes read in "
+				<< counted.reads << L" reads; granule " << granule << L", " << pages << L" pages" << std::endl;
+		}
+
+		{
+			OggInfo info;
+			unsigned long long read = 0;
+			bool ok = false;
+			Timer t;
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				Win32FileAccessor f(*it);
+				ok = readOggInfo(f, size, info, &read);
+			}
+			std::wcout << L"  last page: " << t.seconds() * 1e6 / iterations << L" us, " << read << L" bytes read; ";
+			if (ok)
+				std::wcout << info.duration() / 1e7 << L" s, granule " << info.granule << L" at " << info.lastPage
+					<< L" (" << info.codec.sampleRate << L" Hz, " << info.codec.channels << L" channels)" << std::endl;
+			else
+				std::wcout << L"no last page found" << std::endl;
+		}
+	}
+
+	{
+		// Anything without "OggS" in it.
+		std::vector<unsigned char> buf(64 * 1024 * 1024);
+		for (size_t i = 0; i < buf.size(); ++i)
+			buf[i] = static_cast<unsigned char>(i * 7 + (i >> 11)) & 0x7F;
+		const size_t rounds = 8;
+
+		unsigned crc = 0;
+		Timer t;
+		for (size_t i = 0; i < rounds; ++i)
+			crc = oggCrc(crc, &buf[0], buf.size());
+		std::wcout << L"page CRC: " << rounds * buf.size() / t.seconds() / 1e9 << L" GB/s (" << crc << L")" << std::endl;
+
+		size_t missed = 0;
+		Timer s;
+		for (size_t i = 0; i < rounds; ++i)
+			missed += findLastOggPage(&buf[0], &buf[0] + buf.size()) == &buf[0] + buf.size();
+		std::wcout << L"capture search: " << rounds * buf.size() / s.seconds() / 1e9 << L" GB/s"
+			<< (oggSearchVectorised() ? L" (SSE2)" : L" (plain)") << std::endl;
+		if (missed != rounds)
+			std::wcout << L"  (found one)" << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,127 @@
+#include "bench.h"
+#include "../extract.h"
+#include "../fileaccessor.h"
+#include "../prefetch.h"
+
+#include <propvarutil.h>
+#include <shlwapi.h> // StrCmpLogicalW
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// === Walking album folders cold, with and without sibling prefetch. ===
+//
+//   bench prefetch dir [ahead]
+//
+// Every folder under dir with tracks in it is read a track at a time, in name order, as a folder
+//  view would, reading every key. Before each pass the files are dropped from the cache. The
+//  last pass visits the same files in a shuffled order, where prefetching can only waste reads,
+//  to show it turning itself off.
+
+namespace
+{
+	struct Logical
+	{
+		bool operator()(const std::wstring &a, const std::wstring &b) const
+		{
+			return StrCmpLogicalW(a.c_str(), b.c_str()) < 0;
+		}
+	};
+
+	// Folder by folder, each in Explorer's order.
+	void albums(const std::wstring &dir, std::vector<std::wstring> &files)
+	{
+		std::vector<std::wstring> tracks, subdirs;
+		WIN32_FIND_DATA fd;
+		HANDLE h = FindFirstFile((dir + L"\\*").c_str(), &fd);
+		if (h == INVALID_HANDLE_VALUE)
+			return;
+		do
+		{
+			const std::wstring name = fd.cFileName;
+			if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				if (name != L"." && name != L"..")
+					subdirs.push_back(name);
+			}
+			else if (handledExtension(name))
+				tracks.push_back(name);
+		} while (FindNextFile(h, &fd));
+		FindClose(h);
+
+		std::sort(tracks.begin(), tracks.end(), Logical());
+		for (std::vector<std::wstring>::const_iterator it = tracks.begin(); it != tracks.end(); ++it)
+			files.push_back(dir + L"\\" + *it);
+		std::sort(subdirs.begin(), subdirs.end(), Logical());
+		for (std::vector<std::wstring>::const_iterator it = subdirs.begin(); it != subdirs.end(); ++it)
+			albums(dir + L"\\" + *it, files);
+	}
+
+	void evict(const std::vector<std::wstring> &files)
+	{
+		for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+		{
+			HANDLE h = CreateFile(it->c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+				FILE_FLAG_NO_BUFFERING, NULL);
+			if (h != INVALID_HANDLE_VALUE)
+				CloseHandle(h);
+		}
+	}
+
+	void walk(const wchar_t *what, const std::vector<std::wstring> &files, Prefetcher *prefetcher)
+	{
+		evict(files);
+		Timer t;
+		for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+		{
+			if (prefetcher)
+				prefetcher->opened(*it);
+			TagLib::FileRef f(new Win32FileAccessor(*it));
+			for (size_t i = 0; !f.isNull() && i < keyCount; ++i)
+			{
+				PROPVARIANT pv;
+				PropVariantInit(&pv);
+				readProperty(f, keys[i], &pv);
+				PropVariantClear(&pv);
+			}
+		}
+		const double secs = t.seconds();
+		std::wcout << what << secs << L"s, " << secs * 1e3 / files.size() << L" ms a file";
+		if (prefetcher)
+		{
+			const Prefetcher::Stats s = prefetcher->stats();
+			std::wcout << L"; prefetched " << s.issued << L", " << s.hits << L" used, " << s.wasted
+				<< L" wasted, paused " << s.pauses << L" times";
+		}
+		std::wcout << std::endl;
+	}
+}
+
+int benchPrefetch(int argc, wchar_t *argv[])
+{
+	if (argc < 1)
+		return 2;
+	const unsigned ahead = argc > 1 ? _wtoi(argv[1]) : 4;
+
+	std::vector<std::wstring> files;
+	albums(argv[0], files);
+	if (files.empty())
+		return 1;
+	std::wcout << files.size() << L" files, " << ahead << L" ahead" << std::endl;
+
+	walk(L"  in order, alone:       ", files, NULL);
+	{
+		Prefetcher p(ahead);
+		walk(L"  in order, prefetching: ", files, &p);
+	}
+
+	std::vector<std::wstring> shuffled = files;
+	std::random_shuffle(shuffled.begin(), shuffled.end());
+	walk(L"  shuffled, alone:       ", shuffled, NULL);
+	{
+		Prefetcher p(ahead);
+		walk(L"  shuffled, prefetching: ", shuffled, &p);
+	}
+	return 0;
+}
@@ -0,0 +1,101 @@
+#include "bench.h"
+#include "../fasthash.h"
+#include "../fileaccessor.h"
+#include "../fingerprint.h"
+#include "../snapshot.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// === Tag fingerprints, against parsing the file again. ===
+//
+//   bench fingerprint file... [-n iterations]
+//
+// For each file, the time and bytes read to take its fingerprint, and the time to parse it and
+// take a snapshot, which is what a cache has to do without one. Then the hash alone, from memory.
+
+namespace
+{
+	// Counts what goes through it.
+	struct CountingAccessor : public Win32FileAccessor
+	{
+		CountingAccessor(const std::wstring &path) : Win32FileAccessor(path), read(0), reads(0) {}
+		mutable unsigned long long read, reads;
+
+		size_t fread(void *pv, size_t s1, size_t s2) const
+		{
+			const size_t n = Win32FileAccessor::fread(pv, s1, s2);
+			read += n;
+			++reads;
+			return n;
+		}
+	};
+}
+
+int benchFingerprint(int argc, wchar_t *argv[])
+{
+	std::vector<std::wstring> files;
+	size_t iterations = 200;
+	for (int i = 0; i < argc; ++i)
+		if (argv[i] == std::wstring(L"-n") && i + 1 < argc)
+			iterations = _wtoi(argv[++i]);
+		else
+			files.push_back(argv[i]);
+
+	for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+	{
+		Win32FileAccessor probe(*it);
+		if (!probe.isOpen())
+		{
+			std::wcerr << L"can't read " << *it << std::endl;
+			continue;
+		}
+		const unsigned long long size = probe.size();
+		std::wcout << *it << L": " << size << L" bytes" << std::endl;
+
+		unsigned long long read = 0, print = 0;
+		{
+			Timer t;
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				Win32FileAccessor f(*it);
+				print = tagFingerprint(f, size, &read);
+			}
+			std::wcout << L"  fingerprint: " << t.seconds() * 1e6 / iterations << L" us, "
+				<< read << L" bytes read (" << std::hex << print << std::dec << L")" << std::endl;
+		}
+		{
+			Timer t;
+			for (size_t i = 0; i < iterations; ++i)
+				takeSnapshot(TagLib::FileRef(new Win32FileAccessor(*it)));
+			const double secs = t.seconds();
+
+			CountingAccessor *counted = new CountingAccessor(*it);
+			TagLib::FileRef f(counted); // owns it.
+			takeSnapshot(f);
+			std::wcout << L"  full parse:  " << secs * 1e6 / iterations << L" us, "
+				<< counted->read << L" bytes read in " << counted->reads << L" reads" << std::endl;
+		}
+	}
+
+	{
+		std::vector<unsigned char> buf(64 * 1024 * 1024);
+		for (size_t i = 0; i < buf.size(); ++i)
+			buf[i] = static_cast<unsigned char>(i * 7 + (i >> 11));
+		const size_t rounds = 8;
+		unsigned long long h = 0;
+		Timer t;
+		for (size_t i = 0; i < rounds; ++i)
+		{
+			FastHash fh(i);
+			fh.update(&buf[0], buf.size());
+			h ^= fh.digest();
+		}
+		std::wcout << L"hash: " << rounds * buf.size() / t.seconds() / 1e9 << L" GB/s"
+			<< (FastHash::vectorised() ? L" (SSE2)" : L" (plain)") << std::endl;
+		if (!h)
+			std::wcout << L"  (zero)" << std::endl;
+	}
+	return 0;
+}
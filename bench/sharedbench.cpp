@@ -0,0 +1,163 @@
+#include "bench.h"
+#include "../sharedcache.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// === The shared-memory snapshot cache, from many processes at once. ===
+//
+//   bench shared [processes] [rounds] [lookups]
+//
+// A stress test first: each round starts `processes` copies of this program, which hammer a
+// deliberately small segment, so the ring wraps constantly, and check every snapshot they get
+// back. Two of them are killed part way through each round. Any wrong snapshot fails the run.
+// Then the cost of hits and inserts on a segment of the real size, from this process alone.
+
+namespace
+{
+	// Made up, but the same for a given file and version wherever it's made.
+	std::string payload(unsigned id, unsigned version)
+	{
+		std::string s;
+		unsigned x = id * 31 + version;
+		const size_t n = 20 + x % 700;
+		for (size_t i = 0; i < n; ++i)
+		{
+			x = x * 1103515245 + 12345;
+			s += static_cast<char>(x >> 16);
+		}
+		return s;
+	}
+
+	std::wstring identity(unsigned id)
+	{
+		std::wstringstream ss;
+		ss << L"file " << id << L".mp3|128";
+		return ss.str();
+	}
+
+	const unsigned smallSlots = 256, smallArena = 64 * 1024;
+
+	std::wstring segmentName(DWORD pid)
+	{
+		std::wstringstream ss;
+		ss << L"Local\\tlh.snapcache.bench." << pid;
+		return ss.str();
+	}
+
+	bool spawn(const std::wstring &args, PROCESS_INFORMATION &pi)
+	{
+		wchar_t self[MAX_PATH];
+		GetModuleFileName(NULL, self, MAX_PATH);
+		std::wstring cmd = L"\"" + std::wstring(self) + L"\" " + args;
+		STARTUPINFO si = { sizeof(si) };
+		return CreateProcess(NULL, &cmd[0], NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi) != FALSE;
+	}
+
+	void report(const SharedSnapshotCache::Stats &s)
+	{
+		std::wcout << L"  hits " << s.hits << L", misses " << s.misses << L", torn " << s.torn
+			<< L", inserts " << s.inserts << L", replaced " << s.replaced << std::endl;
+	}
+}
+
+// One process of the stress test; exits 1 if it was ever given a wrong snapshot.
+int benchSharedChild(int argc, wchar_t *argv[])
+{
+	if (argc < 3)
+		return 2;
+	SharedSnapshotCache cache(argv[0], smallSlots, smallArena);
+	if (!cache.ok())
+		return 3;
+
+	unsigned x = _wtoi(argv[1]);
+	const int lookups = _wtoi(argv[2]);
+	int wrong = 0;
+	for (int i = 0; i < lookups; ++i)
+	{
+		x = x * 1103515245 + 12345;
+		const unsigned id = (x >> 8) % 500, version = (x >> 20) % 3;
+		std::string s;
+		if (cache.find(identity(id), 100 + version, version, s))
+			wrong += s != payload(id, version);
+		else
+			cache.insert(identity(id), 100 + version, version, payload(id, version));
+	}
+	return wrong ? 1 : 0;
+}
+
+int benchShared(int argc, wchar_t *argv[])
+{
+	const unsigned processes = argc > 0 ? _wtoi(argv[0]) : 8;
+	const unsigned rounds = argc > 1 ? _wtoi(argv[1]) : 5;
+	const unsigned lookups = argc > 2 ? _wtoi(argv[2]) : 200000;
+
+	const std::wstring name = segmentName(GetCurrentProcessId());
+	SharedSnapshotCache stress(name.c_str(), smallSlots, smallArena); // keeps it alive between rounds.
+	if (!stress.ok())
+	{
+		std::wcerr << L"can't map " << name << std::endl;
+		return 1;
+	}
+
+	unsigned wrong = 0, killed = 0;
+	Timer t;
+	for (unsigned r = 0; r < rounds; ++r)
+	{
+		std::vector<PROCESS_INFORMATION> children;
+		for (unsigned i = 0; i < processes; ++i)
+		{
+			std::wstringstream args;
+			args << L"shared-child " << name << L" " << r * 100 + i + 1 << L" " << lookups;
+			PROCESS_INFORMATION pi;
+			if (spawn(args.str(), pi))
+				children.push_back(pi);
+		}
+
+		Sleep(100);
+		for (size_t i = 0; i < children.size() && i < 2; ++i, ++killed)
+			TerminateProcess(children[i].hProcess, 9);
+
+		for (size_t i = 0; i < children.size(); ++i)
+		{
+			WaitForSingleObject(children[i].hProcess, INFINITE);
+			DWORD code = 0;
+			GetExitCodeProcess(children[i].hProcess, &code);
+			if (code != 0 && code != 9)
+				++wrong;
+			CloseHandle(children[i].hProcess);
+			CloseHandle(children[i].hThread);
+		}
+	}
+	std::wcout << L"stress, " << processes << L" processes x " << rounds << L" rounds, " << killed << L" killed: "
+		<< (wrong ? L"FAILED, " : L"ok, ") << t.seconds() << L" s" << std::endl;
+	report(stress.stats());
+
+	{
+		SharedSnapshotCache cache((name + L".full").c_str());
+		const unsigned files = 5000;
+		std::vector<std::wstring> ids;
+		std::vector<std::string> snaps;
+		for (unsigned i = 0; i < files; ++i)
+		{
+			ids.push_back(identity(i));
+			snaps.push_back(payload(i, 0) + payload(i, 1)); // about the size of a real one.
+		}
+
+		Timer ti;
+		for (unsigned i = 0; i < files; ++i)
+			cache.insert(ids[i], 100, 0, snaps[i]);
+		std::wcout << L"insert: " << ti.seconds() * 1e9 / files << L" ns" << std::endl;
+
+		std::string s;
+		size_t found = 0;
+		Timer tf;
+		for (unsigned i = 0; i < lookups; ++i)
+			found += cache.find(ids[i % files], 100, 0, s);
+		std::wcout << L"find:   " << tf.seconds() * 1e9 / lookups << L" ns, " << 100.0 * found / lookups << L"% found" << std::endl;
+		report(cache.stats());
+	}
+	return wrong ? 1 : 0;
+}
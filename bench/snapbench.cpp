@@ -0,0 +1,178 @@
+#include "bench.h"
+#include "../extract.h"
+#include "../snapshot.h"
+
+#include <propkey.h>
+#include <propvarutil.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// === Snapshots: encoding, checking and reading, against asking TagLib again. ===
+//
+//   bench snapshot [file] [iterations]
+//
+// Without a file, a made-up but typically-filled set of values is used.
+
+namespace
+{
+	void typical(std::vector<PROPVARIANT> &values)
+	{
+		const PROPERTYKEY numbers[] = { PKEY_Audio_ChannelCount, PKEY_Audio_EncodingBitrate, PKEY_Audio_SampleRate,
+			PKEY_Music_TrackNumber, PKEY_Media_Year, PKEY_Rating };
+
+		for (size_t i = 0; i < keyCount; ++i)
+		{
+			PROPVARIANT &pv = values[i];
+			bool number = false;
+			for (size_t n = 0; n < sizeof(numbers) / sizeof(*numbers); ++n)
+				number = number || IsEqualPropertyKey(keys[i], numbers[n]);
+
+			if (number)
+			{
+				pv.vt = VT_UI4;
+				pv.ulVal = 44100;
+			}
+			else if (IsEqualPropertyKey(keys[i], PKEY_Media_Duration))
+			{
+				pv.vt = VT_UI8;
+				pv.uhVal.QuadPart = 2450000000ULL;
+			}
+			else if (IsEqualPropertyKey(keys[i], PKEY_Media_DateReleased))
+			{
+				pv.vt = VT_BSTR;
+				pv.bstrVal = SysAllocString(L"01/03/1973");
+			}
+			else if (IsEqualPropertyKey(keys[i], PKEY_Keywords))
+			{
+				SAFEARRAYBOUND bound = {};
+				bound.cElements = 3;
+				pv.vt = VT_ARRAY | VT_BSTR;
+				pv.parray = SafeArrayCreate(VT_BSTR, 1, &bound);
+				const wchar_t *words[] = { L"progressive", L"live", L"remastered" };
+				for (long w = 0; w < 3; ++w)
+				{
+					BSTR b = SysAllocString(words[w]);
+					SafeArrayPutElement(pv.parray, &w, b);
+					SysFreeString(b);
+				}
+			}
+			else
+				InitPropVariantFromString(L"The Dark Side of the Moon (Remastered)", &pv);
+		}
+	}
+
+	void report(const wchar_t *what, double secs, size_t ops)
+	{
+		std::wcout << what << secs * 1e9 / ops << L" ns" << std::endl;
+	}
+}
+
+int benchSnapshot(int argc, wchar_t *argv[])
+{
+	const std::wstring file = argc > 0 ? argv[0] : L"";
+	const size_t iterations = argc > 1 ? _wtoi(argv[1]) : 200000;
+
+	std::vector<PROPVARIANT> values(keyCount);
+	for (size_t i = 0; i < keyCount; ++i)
+		PropVariantInit(&values[i]);
+
+	TagLib::FileRef f;
+	if (!file.empty())
+	{
+		f = TagLib::FileRef(file.c_str());
+		if (f.isNull())
+		{
+			std::wcerr << L"can't read " << file << std::endl;
+			return 1;
+		}
+		for (size_t i = 0; i < keyCount; ++i)
+			if (readProperty(f, keys[i], &values[i]) != S_OK)
+				PropVariantClear(&values[i]);
+	}
+	else
+		typical(values);
+
+	std::string snap;
+	{
+		Timer t;
+		for (size_t i = 0; i < iterations; ++i)
+			snap = encodeSnapshot(keys, &values[0], keyCount);
+		const double secs = t.seconds();
+		report(L"encode:            ", secs, iterations);
+		std::wcout << L"  " << snap.size() << L" bytes, " << snap.size() * iterations / secs / (1024 * 1024) << L" MB/s" << std::endl;
+	}
+
+	{
+		Timer t;
+		size_t n = 0;
+		for (size_t i = 0; i < iterations; ++i)
+			n += SnapshotReader(snap.data(), snap.size()).count();
+		report(L"open and check:    ", t.seconds(), iterations);
+	}
+
+	const SnapshotReader r(snap.data(), snap.size());
+	{
+		// What a cache lookup would do: find every key, and touch its value where it lies.
+		Timer t;
+		size_t sum = 0;
+		for (size_t i = 0; i < iterations; ++i)
+			for (size_t k = 0; k < keyCount; ++k)
+			{
+				const int e = r.find(keys[k]);
+				if (e < 0)
+					continue;
+				switch (r.type(e))
+				{
+					case SnapshotReader::U32: sum += r.u32(e); break;
+					case SnapshotReader::U64: sum += static_cast<size_t>(r.u64(e)); break;
+					case SnapshotReader::LIST: sum += r.items(e); break;
+					default: sum += r.text(e)[0];
+				}
+			}
+		report(L"read all in place: ", t.seconds(), iterations);
+		if (!sum)
+			std::wcout << L"  (empty)" << std::endl;
+	}
+
+	{
+		Timer t;
+		for (size_t i = 0; i < iterations; ++i)
+			for (size_t k = 0; k < keyCount; ++k)
+			{
+				PROPVARIANT pv;
+				r.value(keys[k], &pv);
+				PropVariantClear(&pv);
+			}
+		report(L"all to PROPVARIANT:", t.seconds(), iterations);
+	}
+
+	if (!f.isNull())
+	{
+		// The same again from TagLib, with the file already parsed, then from scratch.
+		const size_t fewer = std::max<size_t>(iterations / 100, 1);
+		{
+			Timer t;
+			for (size_t i = 0; i < fewer; ++i)
+				for (size_t k = 0; k < keyCount; ++k)
+				{
+					PROPVARIANT pv;
+					PropVariantInit(&pv);
+					readProperty(f, keys[k], &pv);
+					PropVariantClear(&pv);
+				}
+			report(L"readProperty, all: ", t.seconds(), fewer);
+		}
+		{
+			Timer t;
+			for (size_t i = 0; i < fewer; ++i)
+				takeSnapshot(TagLib::FileRef(file.c_str()));
+			report(L"open file and take:", t.seconds(), fewer);
+		}
+	}
+
+	for (size_t i = 0; i < keyCount; ++i)
+		PropVariantClear(&values[i]);
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include "bench.h"
+#include "../unsync.h"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// === Undoing unsynchronisation, a byte at a time and a block at a time. ===
+//
+//   bench unsync [-mb size] [-n rounds]
+//
+// From memory, in GB/s of tag: text with no FFs in it, where there's nothing to do; a picture, random
+//  bytes unsynchronised the way a tagger would, with a 00 after any FF that comes before a 00 or a
+//  byte from E0, as a JPEG's markers and stuffing would be; and nothing but FF 00 pairs, the worst
+//  case for blocks. Each round decodes a fresh copy, and only the decoding is timed.
+
+namespace
+{
+	// A 00 after any FF that could be taken for a sync, or for a 00 after one.
+	std::vector<unsigned char> unsynchronised(const std::vector<unsigned char> &in)
+	{
+		std::vector<unsigned char> out;
+		out.reserve(in.size() + in.size() / 64);
+		for (size_t i = 0; i < in.size(); ++i)
+		{
+			out.push_back(in[i]);
+			if (in[i] == 0xFF && (i + 1 == in.size() || !in[i + 1] || in[i + 1] >= 0xE0))
+				out.push_back(0);
+		}
+		return out;
+	}
+
+	double rate(size_t (*decode)(unsigned char *, size_t), const std::vector<unsigned char> &in,
+		std::vector<unsigned char> &work, size_t rounds, size_t &length)
+	{
+		double secs = 0;
+		for (size_t i = 0; i < rounds; ++i)
+		{
+			work = in;
+			Timer t;
+			length = decode(&work[0], work.size());
+			secs += t.seconds();
+		}
+		return rounds * in.size() / secs / 1e9;
+	}
+
+	void run(const wchar_t *name, const std::vector<unsigned char> &in, size_t rounds)
+	{
+		std::vector<unsigned char> plain, fast;
+		size_t plainLength = 0, fastLength = 0;
+		const double p = rate(id3UnsyncPlain, in, plain, rounds, plainLength);
+		const double f = rate(id3Unsync, in, fast, rounds, fastLength);
+		std::wcout << name << L": plain " << p << L" GB/s, " << (id3UnsyncVectorised() ? L"SSE2 " : L"plain ")
+			<< f << L" GB/s; " << in.size() - plainLength << L" bytes taken out" << std::endl;
+		if (plainLength != fastLength || memcmp(&plain[0], &fast[0], plainLength))
+			std::wcout << L"  (they differ)" << std::endl;
+	}
+}
+
+int benchUnsync(int argc, wchar_t *argv[])
+{
+	size_t size = 16 * 1024 * 1024, rounds = 10;
+	for (int i = 0; i + 1 < argc; ++i)
+		if (argv[i] == std::wstring(L"-mb"))
+			size = _wtoi(argv[++i]) * 1024 * 1024;
+		else if (argv[i] == std::wstring(L"-n"))
+			rounds = _wtoi(argv[++i]);
+	if (!size || !rounds)
+		return 1;
+
+	std::vector<unsigned char> text(size);
+	for (size_t i = 0; i < size; ++i)
+		text[i] = static_cast<unsigned char>(0x20 + (i * 7 + (i >> 11)) % 0x5F);
+	run(L"no FFs", text, rounds);
+
+	std::vector<unsigned char> picture(size);
+	unsigned seed = 1;
+	for (size_t i = 0; i < size; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		picture[i] = static_cast<unsigned char>(seed >> 16);
+	}
+	run(L"picture", unsynchronised(picture), rounds);
+
+	std::vector<unsigned char> pairs(size);
+	for (size_t i = 0; i < size; ++i)
+		pairs[i] = i & 1 ? 0 : 0xFF;
+	run(L"all pairs", pairs, rounds);
+	return 0;
+}
@@ -0,0 +1,368 @@
+#include "bench.h"
+#include "../extract.h"
+#include "../fileaccessor.h"
+#include "../headerinfo.h"
+#include "../memaccessor.h"
+#include "../oggscan.h"
+#include "../xiphscan.h"
+
+#include <propvarutil.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// === FLAC and Ogg Vorbis comments read natively, against TagLib. ===
+//
+//   bench xiph [-n count] [dir|file...]
+//
+// Without files, a library of count files is made in memory, alternately FLAC and Ogg Vorbis,
+//  commented as tlhscan's synthetic library is (titles, artists, albums, genres, composers,
+//  labels), each with a 64KB picture (a PICTURE block, or a METADATA_BLOCK_PICTURE comment) and a
+//  few hundred KB of audio. Every file is read the handler's way through TagLib (with its header
+//  lengths), then through xiphscan, and the times and the bytes read compared, with how many values
+//  the two disagree on and how many files xiphscan left to TagLib. Directories named are searched
+//  for .flac, .ogg and .oga files, which are read from disk: TagLib's pass warms the cache for xiphscan's,
+//  so the bytes read are the cold comparison.
+
+namespace
+{
+	struct CountingFile : public Win32FileAccessor
+	{
+		CountingFile(const std::wstring &path, unsigned long long &read) : Win32FileAccessor(path), read(read) {}
+		unsigned long long &read;
+
+		size_t fread(void *pv, size_t s1, size_t s2) const
+		{
+			const size_t n = Win32FileAccessor::fread(pv, s1, s2);
+			read += n;
+			return n;
+		}
+	};
+
+	struct CountingMemory : public MemoryAccessor
+	{
+		CountingMemory(const std::string &data, const std::wstring &name, unsigned long long &read)
+			: MemoryAccessor(data.data(), data.size(), name), read(read) {}
+		unsigned long long &read;
+
+		size_t fread(void *pv, size_t s1, size_t s2) const
+		{
+			const size_t n = MemoryAccessor::fread(pv, s1, s2);
+			read += n;
+			return n;
+		}
+	};
+
+	// A file on disk, or one made up, in memory.
+	struct Item
+	{
+		std::wstring name;
+		std::string data;
+		bool disk;
+
+		TagLib::FileAccessor *open(unsigned long long &read) const
+		{
+			if (disk)
+				return new CountingFile(name, read);
+			return new CountingMemory(data, name, read);
+		}
+
+		unsigned long long size(TagLib::FileAccessor &f) const
+		{
+			return disk ? static_cast<Win32FileAccessor &>(f).size() : data.size();
+		}
+	};
+
+	void find(const std::wstring &dir, std::vector<Item> &items)
+	{
+		WIN32_FIND_DATA fd;
+		HANDLE h = FindFirstFile((dir + L"\\*").c_str(), &fd);
+		if (h == INVALID_HANDLE_VALUE)
+			return;
+		do
+		{
+			const std::wstring name = fd.cFileName;
+			if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				if (name != L"." && name != L"..")
+					find(dir + L"\\" + name, items);
+			}
+			else if (flacFileName(name) || (name.size() > 4 && (!_wcsicmp(name.c_str() + name.size() - 4, L".ogg")
+				|| !_wcsicmp(name.c_str() + name.size() - 4, L".oga"))))
+			{
+				Item item = { dir + L"\\" + name, std::string(), true };
+				items.push_back(item);
+			}
+		} while (FindNextFile(h, &fd));
+		FindClose(h);
+	}
+
+	void le32(std::string &out, unsigned n)
+	{
+		for (int i = 0; i < 4; ++i)
+			out += static_cast<char>((n >> (8 * i)) & 0xFF);
+	}
+
+	void be(std::string &out, unsigned long long n, int bytes)
+	{
+		for (int i = bytes - 1; i >= 0; --i)
+			out += static_cast<char>((n >> (8 * i)) & 0xFF);
+	}
+
+	std::string utf8(const std::wstring &s)
+	{
+		return std::string(s.begin(), s.end()); // the names made up are ASCII.
+	}
+
+	std::wstring numbered(const wchar_t *what, size_t n)
+	{
+		std::wstringstream ss;
+		ss << what << L" " << n;
+		return ss.str();
+	}
+
+	std::string commentList(size_t i, bool picture)
+	{
+		const size_t album = i / 10;
+		std::vector<std::string> c;
+		c.push_back("TITLE=" + utf8(numbered(L"Track", i)));
+		c.push_back("ARTIST=" + utf8(numbered(L"Artist", album * 7919 % 20000)));
+		c.push_back("ALBUMARTIST=" + utf8(numbered(L"Artist", album * 7919 % 20000)));
+		c.push_back("ALBUM=" + utf8(numbered(L"Album", album)));
+		c.push_back("GENRE=" + utf8(numbered(L"Genre", album % 300)));
+		c.push_back("TRACKNUMBER=" + utf8(numbered(L"", i % 10 + 1).substr(1)));
+		c.push_back("DATE=" + utf8(numbered(L"", 1960 + album % 50).substr(1)));
+		c.push_back("COMPOSER=" + utf8(numbered(L"Composer", album * 104729 % 5000)));
+		c.push_back("LABEL=" + utf8(numbered(L"Label", album % 1000)));
+		c.push_back("COMMENT=Ripped");
+		c.push_back("ENCODER=reference libFLAC 1.2.1");
+		if (picture)
+			c.push_back("METADATA_BLOCK_PICTURE=" + std::string(64 * 1024, 'Q'));
+
+		std::string out;
+		le32(out, 9);
+		out += "bench 1.0";
+		le32(out, static_cast<unsigned>(c.size()));
+		for (size_t k = 0; k < c.size(); ++k)
+		{
+			le32(out, static_cast<unsigned>(c[k].size()));
+			out += c[k];
+		}
+		return out;
+	}
+
+	void block(std::string &out, unsigned type, const std::string &body, bool last)
+	{
+		out += static_cast<char>(type | (last ? 0x80 : 0));
+		be(out, body.size(), 3);
+		out += body;
+	}
+
+	// 44.1kHz stereo, 16 bits, three minutes.
+	std::string flac(size_t i)
+	{
+		std::string info;
+		be(info, 4096, 2);
+		be(info, 4096, 2);
+		info.append(6, '\0');
+		be(info, 44100ULL << 44 | 1ULL << 41 | 15ULL << 36 | 44100 * 180, 8);
+		info.append(16, '\0');
+
+		std::string file("fLaC");
+		block(file, 0, info, false);
+		block(file, 4, commentList(i, false), false);
+		std::string picture(32, '\0');
+		picture.append(64 * 1024, '\xAB');
+		block(file, 6, picture, false);
+		block(file, 1, std::string(8192, '\0'), true);
+		file += "\xFF\xF8\x69\x18";
+		file.append(300 * 1024, '\x11');
+		return file;
+	}
+
+	// Packets, as pages: each packet's lacing, 255 to a page, the last page's with the granule.
+	void pages(std::string &out, const std::vector<std::string> &packets, unsigned &sequence, unsigned long long granule,
+		unsigned flags)
+	{
+		std::string lacing, body;
+		bool continued = false;
+		for (size_t p = 0; p < packets.size(); ++p)
+		{
+			size_t left = packets[p].size(), at = 0;
+			for (;;)
+			{
+				const size_t chunk = left < 255 ? left : 255;
+				lacing += static_cast<char>(chunk);
+				body.append(packets[p], at, chunk);
+				at += chunk;
+				left -= chunk;
+				const bool ends = chunk < 255;
+				const bool lastSegment = ends && p + 1 == packets.size();
+				if (lacing.size() == 255 || lastSegment)
+				{
+					std::string page("OggS", 4);
+					page += '\0';
+					page += static_cast<char>(flags | (continued ? 1 : 0));
+					const unsigned long long g = lastSegment ? granule : ~0ULL;
+					le32(page, static_cast<unsigned>(g));
+					le32(page, static_cast<unsigned>(g >> 32));
+					le32(page, 0xB1E55);
+					le32(page, sequence++);
+					le32(page, 0);
+					page += static_cast<char>(lacing.size());
+					page += lacing;
+					page += body;
+					const unsigned crc = oggCrc(0, page.data(), page.size());
+					for (int b = 0; b < 4; ++b)
+						page[22 + b] = static_cast<char>((crc >> (8 * b)) & 0xFF);
+					out += page;
+					lacing.clear();
+					body.clear();
+					continued = !ends;
+					flags = 0;
+				}
+				if (ends)
+					break;
+			}
+		}
+	}
+
+	// Vorbis at 128kbps nominal, 44.1kHz stereo, the picture in a comment.
+	std::string vorbis(size_t i)
+	{
+		std::string id("\x01vorbis", 7);
+		le32(id, 0);
+		id += '\x02';
+		le32(id, 44100);
+		le32(id, 0);
+		le32(id, 128000);
+		le32(id, 0);
+		id += "\xB8\x01";
+
+		std::string file;
+		unsigned sequence = 0;
+		std::vector<std::string> packets(1, id);
+		pages(file, packets, sequence, 0, 2);
+		packets[0] = std::string("\x03vorbis", 7) + commentList(i, true) + '\x01';
+		packets.push_back(std::string("\x05vorbis", 7) + std::string(3000, '\x42'));
+		pages(file, packets, sequence, 0, 0);
+		for (unsigned p = 0; p < 75; ++p)
+		{
+			packets.assign(16, std::string(250, '\x55'));
+			pages(file, packets, sequence, 44100ULL * 180 * (p + 1) / 75, p == 74 ? 4 : 0);
+		}
+		return file;
+	}
+
+	// Every key, as text, the way the handler would read it through TagLib.
+	bool viaTagLib(const Item &item, std::vector<std::wstring> &values, unsigned long long &read)
+	{
+		TagLib::FileAccessor *accessor = item.open(read);
+		const unsigned long long size = item.size(*accessor);
+		TagLib::FileRef f(accessor);
+		if (f.isNull())
+			return false;
+		HeaderInfo header;
+		const bool headers = readHeaderInfo(*accessor, size, item.name, header);
+		for (size_t i = 0; i < keyCount; ++i)
+		{
+			PROPVARIANT pv;
+			PropVariantInit(&pv);
+			if ((headers ? readHeaderProperty(f, header, keys[i], &pv) : readProperty(f, keys[i], &pv)) == S_OK)
+				values[i] = propertyText(pv);
+			PropVariantClear(&pv);
+		}
+		return true;
+	}
+
+	bool viaXiphScan(const Item &item, XiphTags &tags, std::vector<std::wstring> &values, unsigned long long &read)
+	{
+		TagLib::FileAccessor *accessor = item.open(read);
+		HeaderInfo header;
+		const bool ok = readXiphFile(*accessor, item.size(*accessor), item.name, tags, header);
+		delete accessor;
+		if (!ok)
+			return false;
+		for (size_t i = 0; i < keyCount; ++i)
+		{
+			PROPVARIANT pv;
+			PropVariantInit(&pv);
+			if (readXiphProperty(tags, header, keys[i], &pv) == S_OK)
+				values[i] = propertyText(pv);
+			PropVariantClear(&pv);
+		}
+		return true;
+	}
+}
+
+int benchXiph(int argc, wchar_t *argv[])
+{
+	size_t count = 2000;
+	std::vector<Item> items;
+	for (int i = 0; i < argc; ++i)
+		if (argv[i] == std::wstring(L"-n") && i + 1 < argc)
+			count = _wtoi(argv[++i]);
+		else if (GetFileAttributes(argv[i]) != INVALID_FILE_ATTRIBUTES
+			&& (GetFileAttributes(argv[i]) & FILE_ATTRIBUTE_DIRECTORY))
+			find(argv[i], items);
+		else
+		{
+			Item item = { argv[i], std::string(), true };
+			items.push_back(item);
+		}
+	if (items.empty())
+		for (size_t i = 0; i < count; ++i)
+		{
+			Item item = { i % 2 ? L"x.ogg" : L"x.flac", i % 2 ? vorbis(i) : flac(i), false };
+			items.push_back(item);
+		}
+	std::wcout << items.size() << L" files" << std::endl;
+
+	std::vector<std::vector<std::wstring> > expected(items.size(), std::vector<std::wstring>(keyCount));
+	size_t failed = 0;
+	unsigned long long read = 0;
+	{
+		Timer t;
+		for (size_t i = 0; i < items.size(); ++i)
+			failed += !viaTagLib(items[i], expected[i], read);
+		std::wcout << L"TagLib:   " << t.seconds() * 1e6 / items.size() << L" us, " << read / items.size()
+			<< L" bytes read a file";
+		if (failed)
+			std::wcout << L" (" << failed << L" unreadable)";
+		std::wcout << std::endl;
+	}
+
+	std::vector<std::vector<std::wstring> > got(items.size(), std::vector<std::wstring>(keyCount));
+	std::vector<bool> scanned(items.size());
+	read = 0;
+	{
+		XiphTags tags; // kept from file to file, as a scan over a library would.
+		Timer t;
+		for (size_t i = 0; i < items.size(); ++i)
+			scanned[i] = viaXiphScan(items[i], tags, got[i], read);
+		std::wcout << L"xiphscan: " << t.seconds() * 1e6 / items.size() << L" us, " << read / items.size()
+			<< L" bytes read a file" << std::endl;
+	}
+
+	size_t fallbacks = 0, differing = 0, shown = 0;
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		if (!scanned[i])
+		{
+			++fallbacks;
+			continue;
+		}
+		for (size_t k = 0; k < keyCount; ++k)
+			if (got[i][k] != expected[i][k])
+			{
+				++differing;
+				if (shown++ < 10)
+					std::wcout << L"  " << items[i].name << L" (" << i << L"), key " << k << L": TagLib '"
+						<< expected[i][k] << L"', xiphscan '" << got[i][k] << L"'" << std::endl;
+			}
+	}
+	std::wcout << fallbacks << L" left to TagLib, " << differing << L" values differ" << std::endl;
+	return differing ? 1 : 0;
+}
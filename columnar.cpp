@@ -0,0 +1,394 @@
+#include "columnar.h"
+#include "extract.h"
+#include "utf8.h"
+
+#include <propkey.h>
+#include <propvarutil.h>
+#include <cstring>
+#include <stdexcept>
+#include <boost/static_assert.hpp>
+
+// The header has 24 bytes per column: the type, then the key as it is in memory.
+BOOST_STATIC_ASSERT(sizeof(PROPERTYKEY) == 20);
+
+namespace
+{
+	const char magic[4] = { 'T', 'L', 'H', 'C' };
+
+	size_t pad8(size_t n)
+	{
+		return (n + 7) & ~static_cast<size_t>(7);
+	}
+
+	void align(std::string &s)
+	{
+		s.resize(pad8(s.size()));
+	}
+
+	template <typename T> void put(std::string &s, T v)
+	{
+		s.append(reinterpret_cast<const char *>(&v), sizeof(v));
+	}
+
+	template <typename T> void putAll(std::string &s, const std::vector<T> &v)
+	{
+		if (!v.empty())
+			s.append(reinterpret_cast<const char *>(&v[0]), v.size() * sizeof(T));
+	}
+
+	void putStrings(std::string &s, const std::vector<unsigned> &ends, const std::string &bytes)
+	{
+		put<unsigned>(s, static_cast<unsigned>(ends.size()));
+		putAll(s, ends);
+		s += bytes;
+		align(s);
+	}
+
+	template <typename T> T at(const unsigned char *p)
+	{
+		return *reinterpret_cast<const T *>(p);
+	}
+}
+
+ColumnWriter::Type columnType(REFPROPERTYKEY key)
+{
+	const PROPERTYKEY u32[] = { PKEY_Audio_ChannelCount, PKEY_Audio_EncodingBitrate, PKEY_Audio_SampleRate,
+		PKEY_Music_TrackNumber, PKEY_Media_Year, PKEY_Rating };
+	for (size_t i = 0; i < sizeof(u32) / sizeof(*u32); ++i)
+		if (IsEqualPropertyKey(key, u32[i]))
+			return ColumnWriter::U32;
+	if (IsEqualPropertyKey(key, PKEY_Media_Duration))
+		return ColumnWriter::U64;
+	if (IsEqualPropertyKey(key, PKEY_Keywords))
+		return ColumnWriter::LIST;
+	// Titles are nearly all different, so a dictionary would only add an index.
+	if (IsEqualPropertyKey(key, PKEY_Title))
+		return ColumnWriter::PLAIN;
+	return ColumnWriter::DICT;
+}
+
+// === Writing. ===
+
+ColumnWriter::ColumnWriter(FILE *out, unsigned rowsPerGroup) : out(out), rowsPerGroup(rowsPerGroup), rows(0), pos(0)
+{
+	cols.resize(keyCount + 1);
+	cols[0].type = PLAIN;
+	for (size_t i = 0; i < keyCount; ++i)
+		cols[i + 1].type = columnType(keys[i]);
+
+	std::string header(magic, sizeof(magic));
+	put<unsigned>(header, version);
+	put<unsigned>(header, static_cast<unsigned>(cols.size()));
+	put<unsigned>(header, 0);
+	const PROPERTYKEY none = {};
+	for (size_t i = 0; i < cols.size(); ++i)
+	{
+		put<unsigned>(header, cols[i].type);
+		put<PROPERTYKEY>(header, i ? keys[i - 1] : none);
+	}
+	align(header);
+	write(header);
+}
+
+void ColumnWriter::write(const void *p, size_t n)
+{
+	fwrite(p, 1, n, out);
+	pos += n;
+}
+
+unsigned ColumnWriter::lookup(Column &col, const std::string &s)
+{
+	boost::unordered_map<std::string, unsigned>::const_iterator it = col.dict.find(s);
+	if (it != col.dict.end())
+		return it->second;
+	const unsigned id = static_cast<unsigned>(col.entries.size());
+	it = col.dict.insert(std::make_pair(s, id)).first;
+	col.entries.push_back(&it->first);
+	return id;
+}
+
+void ColumnWriter::addString(Column &col, const std::string &s)
+{
+	if (col.type == PLAIN)
+	{
+		col.bytes += s;
+		col.ends.push_back(static_cast<unsigned>(col.bytes.size()));
+	}
+	else
+		col.index.push_back(lookup(col, s));
+}
+
+void ColumnWriter::add(const std::wstring &path, const PROPVARIANT *values)
+{
+	const unsigned byte = rows / 8;
+	const unsigned char bit = static_cast<unsigned char>(1 << (rows % 8));
+	if (!(rows % 8))
+		for (std::vector<Column>::iterator it = cols.begin(); it != cols.end(); ++it)
+			it->present.push_back(0);
+
+	cols[0].present[byte] |= bit;
+	addString(cols[0], toUtf8(path));
+
+	for (size_t k = 0; k < keyCount; ++k)
+	{
+		Column &col = cols[k + 1];
+		const PROPVARIANT *pv = values ? &values[k] : NULL;
+		bool has = false;
+		switch (col.type)
+		{
+			case U32:
+				has = pv && pv->vt == VT_UI4;
+				col.u32.push_back(has ? pv->ulVal : 0);
+				break;
+			case U64:
+				has = pv && (pv->vt == VT_UI8 || pv->vt == VT_UI4);
+				col.u64.push_back(!has ? 0 : pv->vt == VT_UI8 ? pv->uhVal.QuadPart : pv->ulVal);
+				break;
+			case PLAIN:
+			case DICT:
+				has = pv && pv->vt != VT_EMPTY;
+				addString(col, has ? toUtf8(propertyText(*pv)) : std::string());
+				break;
+			case LIST:
+				has = pv && pv->vt == (VT_ARRAY | VT_BSTR);
+				if (has)
+				{
+					long lo = 0, hi = -1;
+					SafeArrayGetLBound(pv->parray, 1, &lo);
+					SafeArrayGetUBound(pv->parray, 1, &hi);
+					for (long i = lo; i <= hi; ++i)
+					{
+						BSTR b = NULL;
+						SafeArrayGetElement(pv->parray, &i, &b);
+						col.index.push_back(lookup(col, b ? toUtf8(b) : std::string()));
+						SysFreeString(b);
+					}
+				}
+				col.ends.push_back(static_cast<unsigned>(col.index.size()));
+				break;
+		}
+		if (has)
+			col.present[byte] |= bit;
+	}
+
+	if (++rows == rowsPerGroup)
+		flush();
+}
+
+void ColumnWriter::flush()
+{
+	if (!rows)
+		return;
+
+	std::vector<std::string> chunks(cols.size());
+	for (size_t c = 0; c < cols.size(); ++c)
+	{
+		Column &col = cols[c];
+		std::string &s = chunks[c];
+		s.assign(col.present.begin(), col.present.end());
+		align(s);
+
+		std::vector<unsigned> dictEnds;
+		std::string dictBytes;
+		for (std::vector<const std::string *>::const_iterator it = col.entries.begin(); it != col.entries.end(); ++it)
+		{
+			dictBytes += **it;
+			dictEnds.push_back(static_cast<unsigned>(dictBytes.size()));
+		}
+
+		switch (col.type)
+		{
+			case U32:
+				putAll(s, col.u32);
+				break;
+			case U64:
+				putAll(s, col.u64);
+				break;
+			case PLAIN:
+				putStrings(s, col.ends, col.bytes);
+				break;
+			case DICT:
+				putAll(s, col.index);
+				align(s);
+				putStrings(s, dictEnds, dictBytes);
+				break;
+			case LIST:
+				putAll(s, col.ends);
+				align(s);
+				put<unsigned>(s, static_cast<unsigned>(col.index.size()));
+				putAll(s, col.index);
+				align(s);
+				putStrings(s, dictEnds, dictBytes);
+				break;
+		}
+		align(s);
+
+		col.present.clear();
+		col.u32.clear();
+		col.u64.clear();
+		col.index.clear();
+		col.ends.clear();
+		col.bytes.clear();
+		col.entries.clear();
+		col.dict.clear();
+	}
+
+	groupOffsets.push_back(pos);
+	std::string header;
+	put<unsigned>(header, rows);
+	put<unsigned>(header, 0);
+	unsigned long long offset = 8 + 8 * cols.size();
+	for (size_t c = 0; c < chunks.size(); ++c)
+	{
+		put<unsigned long long>(header, offset);
+		offset += chunks[c].size();
+	}
+	write(header);
+	for (size_t c = 0; c < chunks.size(); ++c)
+		write(chunks[c]);
+	rows = 0;
+}
+
+void ColumnWriter::finish()
+{
+	flush();
+	std::string footer;
+	putAll(footer, groupOffsets);
+	put<unsigned>(footer, static_cast<unsigned>(groupOffsets.size()));
+	footer.append(magic, sizeof(magic));
+	write(footer);
+	fflush(out);
+}
+
+// === Reading. ===
+
+ColumnReader::ColumnReader(const void *data, size_t size)
+	: base(static_cast<const unsigned char *>(data)), size(size), ncols(0), ngroups(0), groupOffsets(NULL)
+{
+	if (size < 24 || memcmp(base, magic, sizeof(magic)) || memcmp(base + size - 4, magic, sizeof(magic)))
+		throw std::invalid_argument("not a column file");
+	if (at<unsigned>(base + 4) != ColumnWriter::version)
+		throw std::invalid_argument("unsupported column file version");
+
+	ncols = at<unsigned>(base + 8);
+	const size_t headerEnd = pad8(16 + 24 * static_cast<size_t>(ncols));
+	ngroups = at<unsigned>(base + size - 8);
+	if (size % 8 || headerEnd + 8 > size || (size - headerEnd - 8) / 8 < ngroups)
+		throw std::invalid_argument("truncated column file");
+
+	const size_t footer = size - 8 - 8 * static_cast<size_t>(ngroups);
+	groupOffsets = reinterpret_cast<const unsigned long long *>(base + footer);
+	for (unsigned g = 0; g < ngroups; ++g)
+	{
+		const unsigned long long go = groupOffsets[g];
+		if (go < headerEnd || go % 8 || go + 8 + 8 * ncols > footer)
+			throw std::invalid_argument("corrupt column file");
+		const unsigned long long *chunks = reinterpret_cast<const unsigned long long *>(base + go + 8);
+		for (unsigned c = 0; c < ncols; ++c)
+			if (chunks[c] % 8 || go + chunks[c] > footer)
+				throw std::invalid_argument("corrupt column file");
+	}
+}
+
+ColumnWriter::Type ColumnReader::type(unsigned c) const
+{
+	return static_cast<ColumnWriter::Type>(at<unsigned>(base + 16 + 24 * c));
+}
+
+PROPERTYKEY ColumnReader::key(unsigned c) const
+{
+	PROPERTYKEY k;
+	memcpy(&k, base + 16 + 24 * c + 4, sizeof(k));
+	return k;
+}
+
+int ColumnReader::find(REFPROPERTYKEY k) const
+{
+	for (unsigned c = 1; c < ncols; ++c)
+		if (IsEqualPropertyKey(key(c), k))
+			return c;
+	return -1;
+}
+
+unsigned ColumnReader::rows(unsigned g) const
+{
+	return at<unsigned>(base + groupOffsets[g]);
+}
+
+const unsigned char *ColumnReader::chunk(unsigned g, unsigned c) const
+{
+	const unsigned char *group = base + groupOffsets[g];
+	return group + at<unsigned long long>(group + 8 + 8 * c);
+}
+
+const unsigned char *ColumnReader::afterBitmap(unsigned g, unsigned c) const
+{
+	return chunk(g, c) + pad8((rows(g) + 7) / 8);
+}
+
+const unsigned char *ColumnReader::dictionaryOf(unsigned g, unsigned c) const
+{
+	const unsigned char *p = afterBitmap(g, c) + pad8(4 * static_cast<size_t>(rows(g)));
+	if (type(c) == ColumnWriter::LIST)
+		p += pad8(4 + 4 * static_cast<size_t>(at<unsigned>(p)));
+	return p;
+}
+
+ColumnReader::Text ColumnReader::string(const unsigned char *strings, unsigned i)
+{
+	const unsigned count = at<unsigned>(strings);
+	const unsigned *ends = reinterpret_cast<const unsigned *>(strings + 4);
+	const unsigned begin = i ? ends[i - 1] : 0;
+	Text t = { reinterpret_cast<const char *>(strings + 4 + 4 * static_cast<size_t>(count)) + begin, ends[i] - begin };
+	return t;
+}
+
+bool ColumnReader::present(unsigned g, unsigned c, unsigned row) const
+{
+	return (chunk(g, c)[row / 8] >> (row % 8)) & 1;
+}
+
+unsigned ColumnReader::u32(unsigned g, unsigned c, unsigned row) const
+{
+	return reinterpret_cast<const unsigned *>(afterBitmap(g, c))[row];
+}
+
+unsigned long long ColumnReader::u64(unsigned g, unsigned c, unsigned row) const
+{
+	return reinterpret_cast<const unsigned long long *>(afterBitmap(g, c))[row];
+}
+
+ColumnReader::Text ColumnReader::text(unsigned g, unsigned c, unsigned row) const
+{
+	if (type(c) == ColumnWriter::PLAIN)
+		return string(afterBitmap(g, c), row);
+	return dictionary(g, c, index(g, c, row));
+}
+
+unsigned ColumnReader::index(unsigned g, unsigned c, unsigned row) const
+{
+	return reinterpret_cast<const unsigned *>(afterBitmap(g, c))[row];
+}
+
+unsigned ColumnReader::dictionarySize(unsigned g, unsigned c) const
+{
+	return at<unsigned>(dictionaryOf(g, c));
+}
+
+ColumnReader::Text ColumnReader::dictionary(unsigned g, unsigned c, unsigned i) const
+{
+	return string(dictionaryOf(g, c), i);
+}
+
+unsigned ColumnReader::items(unsigned g, unsigned c, unsigned row) const
+{
+	const unsigned *ends = reinterpret_cast<const unsigned *>(afterBitmap(g, c));
+	return ends[row] - (row ? ends[row - 1] : 0);
+}
+
+unsigned ColumnReader::item(unsigned g, unsigned c, unsigned row, unsigned i) const
+{
+	const unsigned *ends = reinterpret_cast<const unsigned *>(afterBitmap(g, c));
+	const unsigned char *p = afterBitmap(g, c) + pad8(4 * static_cast<size_t>(rows(g)));
+	return reinterpret_cast<const unsigned *>(p + 4)[(row ? ends[row - 1] : 0) + i];
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <windows.h>
+#include <propsys.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+// === A columnar file of extracted properties, for bulk loading. ===
+// One column for the path, then one for each of keys[], in that order. Rows are written in groups,
+//  so the writer only ever holds one group, and a reader can go straight to any group, column and
+//  row through a mapping of the file without parsing anything.
+//
+// Everything is little-endian, and every section starts on an 8-byte boundary:
+//   header:  "TLHC", u32 version, u32 columns, u32 0,
+//            then per column: u32 type, PROPERTYKEY key (GUID fmtid, u32 pid); the path's key is zero.
+//   groups:  u32 rows, u32 0, u64 offset[columns] of each column's chunk, from the start of the group.
+//   footer:  u64 offset[groups] of each group, from the start of the file, u32 groups, "TLHC".
+//
+// A chunk starts with a bitmap of the rows that have a value (bit i of byte i/8), then:
+//   U32:     u32 value[rows]
+//   U64:     u64 value[rows]
+//   PLAIN:   strings, with one per row
+//   DICT:    u32 index[rows] into the dictionary, then the dictionary as strings
+//   LIST:    u32 end[rows], the running count of items, u32 items, u32 index[items], then the dictionary
+// where strings are u32 count, u32 end[count] (the running byte count), then the UTF-8.
+// Dictionaries are per group; a missing row's value is 0, or the empty string.
+class ColumnWriter
+{
+public:
+	enum Type { U32, U64, PLAIN, DICT, LIST };
+	static const unsigned version = 1;
+
+	ColumnWriter(FILE *out, unsigned rowsPerGroup = 64 * 1024);
+
+	// values are keyCount values, in keys[] order, as readProperty produces them, VT_EMPTY where there's
+	//  nothing; or NULL for a file that couldn't be read.
+	void add(const std::wstring &path, const PROPVARIANT *values);
+
+	// Write out what's left and the footer. Nothing can be added afterwards.
+	void finish();
+
+	// Bytes written so far.
+	unsigned long long size() const { return pos; }
+
+private:
+	struct Column
+	{
+		Type type;
+		std::vector<unsigned char> present;
+		std::vector<unsigned> u32;
+		std::vector<unsigned long long> u64;
+		std::vector<unsigned> index, ends;
+		std::string bytes;
+		boost::unordered_map<std::string, unsigned> dict;
+		std::vector<const std::string *> entries; // the dictionary, by index.
+	};
+
+	void addString(Column &col, const std::string &s);
+	unsigned lookup(Column &col, const std::string &s);
+	void flush();
+	void write(const void *p, size_t n);
+	void write(const std::string &s) { write(s.data(), s.size()); }
+
+	FILE *out;
+	unsigned rowsPerGroup, rows;
+	unsigned long long pos;
+	std::vector<Column> cols;
+	std::vector<unsigned long long> groupOffsets;
+};
+
+// The type a key's column has.
+ColumnWriter::Type columnType(REFPROPERTYKEY key);
+
+// Reads a column file in place; the buffer (usually a MappedFile) must outlive the reader.
+// The layout is checked far enough that nothing below reads outside the buffer for a well-formed
+//  file; a corrupt one gets std::invalid_argument here.
+class ColumnReader
+{
+public:
+	struct Text
+	{
+		const char *data;
+		size_t size;
+		std::string str() const { return std::string(data, size); }
+	};
+
+	ColumnReader(const void *data, size_t size);
+
+	unsigned columns() const { return ncols; }
+	ColumnWriter::Type type(unsigned c) const;
+	PROPERTYKEY key(unsigned c) const;
+	// The column for a key, or -1.
+	int find(REFPROPERTYKEY key) const;
+
+	unsigned groups() const { return ngroups; }
+	unsigned rows(unsigned g) const;
+
+	bool present(unsigned g, unsigned c, unsigned row) const;
+	unsigned u32(unsigned g, unsigned c, unsigned row) const;
+	unsigned long long u64(unsigned g, unsigned c, unsigned row) const;
+
+	// PLAIN and DICT columns.
+	Text text(unsigned g, unsigned c, unsigned row) const;
+
+	// DICT columns, for grouping and counting without comparing strings.
+	unsigned index(unsigned g, unsigned c, unsigned row) const;
+	unsigned dictionarySize(unsigned g, unsigned c) const;
+	Text dictionary(unsigned g, unsigned c, unsigned i) const;
+
+	// LIST columns: item i of a row is dictionary(g, c, item(g, c, row, i)).
+	unsigned items(unsigned g, unsigned c, unsigned row) const;
+	unsigned item(unsigned g, unsigned c, unsigned row, unsigned i) const;
+
+private:
+	const unsigned char *chunk(unsigned g, unsigned c) const;
+	const unsigned char *afterBitmap(unsigned g, unsigned c) const;
+	const unsigned char *dictionaryOf(unsigned g, unsigned c) const;
+	static Text string(const unsigned char *strings, unsigned i);
+
+	const unsigned char *base;
+	size_t size;
+	unsigned ncols, ngroups;
+	const unsigned long long *groupOffsets;
+};
@@ -0,0 +1,319 @@
+#include "container.h"
+#include "accessorutil.h"
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	const unsigned maxBoxes = 4096; // of any one level.
+
+	unsigned be16(const unsigned char *p) { return p[0] << 8 | p[1]; }
+	unsigned be32(const unsigned char *p) { return static_cast<unsigned>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+	ULONGLONG be64(const unsigned char *p) { return static_cast<ULONGLONG>(be32(p)) << 32 | be32(p + 4); }
+	unsigned le16(const unsigned char *p) { return p[0] | p[1] << 8; }
+	unsigned le32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | static_cast<unsigned>(p[3]) << 24; }
+	ULONGLONG le64(const unsigned char *p) { return le32(p) | static_cast<ULONGLONG>(le32(p + 4)) << 32; }
+
+	// count units of 1/rate seconds, in 100ns units, without overflowing on the way.
+	ULONGLONG ticks(ULONGLONG count, ULONGLONG rate)
+	{
+		return count / rate * 10000000 + count % rate * 10000000 / rate;
+	}
+
+	class Reader
+	{
+	public:
+		Reader(TagLib::FileAccessor &file, ULONGLONG size) : file(file), size(size), read(0) {}
+
+		// Exactly n bytes at off, or false.
+		bool readAt(ULONGLONG off, void *buf, size_t n)
+		{
+			if (off > size || size - off < n || seekTo(file, off))
+				return false;
+			const size_t got = file.fread(buf, 1, n);
+			read += got;
+			return got == n;
+		}
+
+		TagLib::FileAccessor &file;
+		const ULONGLONG size;
+		ULONGLONG read;
+
+	private:
+		Reader &operator=(const Reader &);
+	};
+
+	void addTag(ContainerInfo &info, const char *type, ULONGLONG offset, ULONGLONG length)
+	{
+		ContainerRegion t;
+		memcpy(t.type, type, 4);
+		t.offset = offset;
+		t.length = length;
+		info.tags.push_back(t);
+	}
+
+	// --- MP4 ---
+
+	struct Box
+	{
+		char type[4];
+		ULONGLONG offset, length, header;
+
+		ULONGLONG payload() const { return offset + header; }
+		ULONGLONG end() const { return offset + length; }
+		bool is(const char *t) const { return !memcmp(type, t, 4); }
+	};
+
+	// The box at pos; false if there isn't a whole one before end.
+	bool box(Reader &r, ULONGLONG pos, ULONGLONG end, Box &b)
+	{
+		unsigned char h[16];
+		if (end < pos || end - pos < 8 || !r.readAt(pos, h, 8))
+			return false;
+		memcpy(b.type, h + 4, 4);
+		b.offset = pos;
+		b.length = be32(h);
+		b.header = 8;
+		if (b.length == 1)
+		{
+			if (!r.readAt(pos + 8, h + 8, 8))
+				return false;
+			b.length = be64(h + 8);
+			b.header = 16;
+		}
+		else if (!b.length)
+			b.length = end - pos;
+		return b.length >= b.header && b.length <= end - pos;
+	}
+
+	// The first child of parent of that type.
+	bool child(Reader &r, const Box &parent, const char *type, Box &found)
+	{
+		ULONGLONG pos = parent.payload();
+		for (unsigned i = 0; i < maxBoxes && box(r, pos, parent.end(), found); ++i, pos += found.length)
+			if (found.is(type))
+				return true;
+		return false;
+	}
+
+	// mvhd and mdhd start alike: version and flags, two times, then the timescale and duration,
+	//  all of them 64-bit in version 1.
+	bool timing(Reader &r, const Box &b, unsigned &scale, ULONGLONG &duration)
+	{
+		unsigned char p[32];
+		if (b.length - b.header < 20 || !r.readAt(b.payload(), p, 20))
+			return false;
+		if (p[0] == 1)
+		{
+			if (b.length - b.header < 32 || !r.readAt(b.payload() + 20, p + 20, 12))
+				return false;
+			scale = be32(p + 20);
+			duration = be64(p + 24);
+		}
+		else
+		{
+			scale = be32(p + 12);
+			duration = be32(p + 16);
+			if (duration == 0xFFFFFFFF)
+				duration = ~0ULL;
+		}
+		return scale && duration != ~0ULL; // all ones: not known.
+	}
+
+	// A trak: whether it's sound, from hdlr, and if so its length, rate and channels.
+	bool soundTrack(Reader &r, const Box &trak, ContainerInfo &info)
+	{
+		Box mdia, b;
+		if (!child(r, trak, "mdia", mdia))
+			return false;
+		bool sound = false, timed = false;
+		unsigned scale = 0;
+		ULONGLONG duration = 0;
+		Box minf = {};
+		ULONGLONG pos = mdia.payload();
+		for (unsigned i = 0; i < maxBoxes && box(r, pos, mdia.end(), b); ++i, pos += b.length)
+		{
+			unsigned char h[12];
+			if (b.is("hdlr"))
+				sound = b.length - b.header >= 12 && r.readAt(b.payload(), h, 12) && !memcmp(h + 8, "soun", 4);
+			else if (b.is("mdhd"))
+				timed = timing(r, b, scale, duration);
+			else if (b.is("minf"))
+				minf = b;
+		}
+		if (!sound)
+			return false;
+		if (timed)
+			info.duration = ticks(duration, scale);
+		info.sampleRate = scale;
+
+		// The first sample entry: version and flags, the count, its own header, then an audio
+		//  sample entry's fields.
+		Box stbl, stsd;
+		unsigned char s[44];
+		if (minf.length && child(r, minf, "stbl", stbl) && child(r, stbl, "stsd", stsd)
+			&& stsd.length - stsd.header >= sizeof(s) && r.readAt(stsd.payload(), s, sizeof(s)))
+		{
+			info.channels = be16(s + 32);
+			if (be32(s + 40) >> 16)
+				info.sampleRate = be32(s + 40) >> 16;
+		}
+		return true;
+	}
+
+	bool mp4(Reader &r, ContainerInfo &info)
+	{
+		Box b;
+		if (!box(r, 0, r.size, b) || !b.is("ftyp"))
+			return false;
+		info.kind = CONTAINER_MP4;
+
+		for (ULONGLONG pos = 0, i = 0; i < maxBoxes && box(r, pos, r.size, b); ++i, pos += b.length)
+		{
+			if (!b.is("moov"))
+				continue;
+			info.moov = b.offset;
+			info.moovLength = b.length;
+
+			bool sound = false;
+			unsigned scale;
+			ULONGLONG duration, movie = 0;
+			Box c;
+			ULONGLONG child = b.payload();
+			for (unsigned j = 0; j < maxBoxes && box(r, child, b.end(), c); ++j, child += c.length)
+			{
+				if (c.is("mvhd") && timing(r, c, scale, duration))
+					movie = ticks(duration, scale);
+				else if (c.is("trak") && !sound)
+					sound = soundTrack(r, c, info);
+				else if (c.is("udta") || c.is("meta"))
+					addTag(info, c.type, c.offset, c.length);
+			}
+			if (!info.duration)
+				info.duration = movie;
+			break;
+		}
+		return true;
+	}
+
+	// --- RIFF and AIFF ---
+
+	// Chunks are padded to an even length; the size doesn't count the pad byte.
+	ULONGLONG padded(ULONGLONG size)
+	{
+		return size + (size & 1);
+	}
+
+	bool riff(Reader &r, ContainerInfo &info)
+	{
+		unsigned char h[12];
+		if (!r.readAt(0, h, 12) || (memcmp(h, "RIFF", 4) && memcmp(h, "RF64", 4)) || memcmp(h + 8, "WAVE", 4))
+			return false;
+		info.kind = CONTAINER_RIFF;
+
+		// RF64 puts the real sizes, too big for a chunk header, in ds64.
+		ULONGLONG bigData = 0, data = 0;
+		unsigned byteRate = 0;
+		ULONGLONG pos = 12;
+		for (unsigned i = 0; i < maxBoxes && r.readAt(pos, h, 8); ++i)
+		{
+			ULONGLONG size = le32(h + 4);
+			unsigned char p[24];
+			if (!memcmp(h, "ds64", 4) && size >= 24 && r.readAt(pos + 8, p, 24))
+				bigData = le64(p + 8);
+			else if (!memcmp(h, "fmt ", 4) && size >= 16 && r.readAt(pos + 8, p, 16))
+			{
+				info.channels = le16(p + 2);
+				info.sampleRate = le32(p + 4);
+				byteRate = le32(p + 8);
+			}
+			else if (!memcmp(h, "data", 4))
+			{
+				if (size == 0xFFFFFFFF && bigData)
+					size = bigData;
+				// Still being written, or cut short: the audio runs to the end.
+				if (size > r.size - pos - 8)
+					size = r.size - pos - 8;
+				data = size;
+			}
+			else if (!memcmp(h, "LIST", 4) || !memcmp(h, "ID3 ", 4) || !memcmp(h, "id3 ", 4))
+				addTag(info, reinterpret_cast<const char *>(h), pos, 8 + size);
+			pos += 8 + padded(size);
+		}
+		if (byteRate)
+		{
+			info.duration = ticks(data, byteRate);
+			info.bitrate = byteRate * 8;
+		}
+		return true;
+	}
+
+	// An 80-bit IEEE 754 extended float, as COMM has its rate in.
+	double extended(const unsigned char *p)
+	{
+		const int exponent = (p[0] & 0x7F) << 8 | p[1];
+		return ldexp(static_cast<double>(static_cast<LONGLONG>(be64(p + 2) >> 1)), exponent - 16383 - 62);
+	}
+
+	bool aiff(Reader &r, ContainerInfo &info)
+	{
+		unsigned char h[18];
+		if (!r.readAt(0, h, 12) || memcmp(h, "FORM", 4) || (memcmp(h + 8, "AIFF", 4) && memcmp(h + 8, "AIFC", 4)))
+			return false;
+		info.kind = CONTAINER_AIFF;
+		const bool compressed = !memcmp(h + 8, "AIFC", 4);
+
+		static const char *const tagChunks[] = { "ID3 ", "id3 ", "NAME", "AUTH", "(c) ", "ANNO" };
+		ULONGLONG pos = 12;
+		for (unsigned i = 0; i < maxBoxes && r.readAt(pos, h, 8); ++i)
+		{
+			const ULONGLONG size = be32(h + 4);
+			if (!memcmp(h, "COMM", 4) && size >= 18 && r.readAt(pos + 8, h, 18))
+			{
+				info.channels = be16(h);
+				const double rate = extended(h + 8);
+				if (rate >= 1 && rate < UINT_MAX)
+				{
+					info.sampleRate = static_cast<unsigned>(rate + 0.5);
+					info.duration = static_cast<ULONGLONG>(be32(h + 2) * 1e7 / rate);
+					// A sample rate that passes can still give a bit rate no unsigned holds; then there's none.
+					const double bps = rate * info.channels * be16(h + 6);
+					if (!compressed && bps < UINT_MAX)
+						info.bitrate = static_cast<unsigned>(bps);
+				}
+			}
+			else
+				for (size_t t = 0; t < sizeof(tagChunks) / sizeof(*tagChunks); ++t)
+					if (!memcmp(h, tagChunks[t], 4))
+						addTag(info, tagChunks[t], pos, 8 + size);
+			pos += 8 + padded(size);
+		}
+		return true;
+	}
+}
+
+bool containerFileName(const std::wstring &name)
+{
+	const std::wstring::size_type dot = name.rfind(L'.');
+	const wchar_t *ext = dot == std::wstring::npos ? L"" : name.c_str() + dot + 1;
+	static const wchar_t *containers[] = { L"m4a", L"m4b", L"m4p", L"mp4", L"3g2", L"wav", L"aif", L"aiff" };
+	for (size_t i = 0; i < sizeof(containers) / sizeof(*containers); ++i)
+		if (!_wcsicmp(ext, containers[i]))
+			return true;
+	return false;
+}
+
+bool readContainerInfo(TagLib::FileAccessor &file, ULONGLONG size, ContainerInfo &info, ULONGLONG *bytesRead)
+{
+	Reader r(file, size);
+	info.duration = 0;
+	info.sampleRate = info.channels = info.bitrate = 0;
+	info.moov = info.moovLength = 0;
+	info.tags.clear();
+	const bool ok = mp4(r, info) || riff(r, info) || aiff(r, info);
+	if (bytesRead)
+		*bytesRead = r.read;
+	return ok;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <windows.h>
+#include <fileref.h>
+
+#include <string>
+#include <vector>
+
+// === MP4, RIFF (WAV) and AIFF: the boxes and chunks around the audio, without the audio. ===
+// Tags can come after gigabytes of mdat or data. Only box and chunk headers are read; payloads are
+//  seeked over, and so is everything else that isn't asked for:
+//  - MP4: moov's mvhd, and in each trak, mdia's hdlr and mdhd, and the first stsd entry. The length
+//    is the sound track's, in its own timescale, else the movie's. moov's udta and meta are tags;
+//  - RIFF: fmt and data, or RF64's ds64, for the length. LIST and ID3 chunks are tags;
+//  - AIFF and AIFC: COMM for the length. ID3, NAME, AUTH, (c) and ANNO chunks are tags.
+// The format is found from the bytes, not the extension.
+// The tag boxes and chunks are found, not read: the tag fingerprint hashes them (fingerprint.h), but
+//  the handler's values still come from TagLib, which opens the whole file for them. What the walk
+//  gives the handler is the length and the bitrate (headerinfo.h), in place of TagLib's.
+
+enum ContainerKind { CONTAINER_MP4, CONTAINER_RIFF, CONTAINER_AIFF };
+
+// A box or chunk, header and all.
+struct ContainerRegion
+{
+	char type[4];
+	ULONGLONG offset, length;
+};
+
+struct ContainerInfo
+{
+	ContainerKind kind;
+	ULONGLONG duration;           // in 100ns units; 0 if there was nothing to tell it from.
+	unsigned sampleRate, channels;
+	unsigned bitrate;             // bits per second: RIFF's byte rate, or AIFF's for PCM. 0 for MP4.
+	ULONGLONG moov, moovLength;   // MP4: 0 if there's no moov.
+	std::vector<ContainerRegion> tags;
+};
+
+// Whether the name's extension is one of the containers'.
+bool containerFileName(const std::wstring &name);
+
+// False if the file doesn't start like one of the three, or its first header is broken. A
+//  container cut short still gives what came before the cut.
+bool readContainerInfo(TagLib::FileAccessor &file, ULONGLONG size, ContainerInfo &info, ULONGLONG *bytesRead = NULL);
@@ -0,0 +1,326 @@
+#define NOMINMAX
+
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include <initguid.h>
+#include <propsys.h>     // Property System APIs and interfaces
+#include <propkey.h>     // System PROPERTYKEY definitions
+#include <propvarutil.h> // PROPVARIANT and VARIANT helper APIs
+
+#include <tag.h>
+#include <fileref.h>
+
+#include "extract.h"
+#include "exttag.h"
+#include "headerinfo.h"
+#include "id3scan.h"
+#include "xiphscan.h"
+
+const PROPERTYKEY keys[] = {
+	PKEY_Music_AlbumTitle, PKEY_Music_Artist,
+	PKEY_Music_TrackNumber, PKEY_Music_Genre,
+	PKEY_Title, PKEY_Media_Year, PKEY_Audio_ChannelCount,
+	PKEY_Media_Duration, PKEY_Audio_EncodingBitrate,
+	PKEY_Audio_SampleRate, PKEY_Rating, PKEY_Music_AlbumArtist,
+	PKEY_Music_Composer, PKEY_Music_Conductor,
+	PKEY_Media_Publisher, PKEY_Media_SubTitle,
+	PKEY_Media_Producer, PKEY_Music_Mood, PKEY_Copyright,
+	PKEY_Music_PartOfSet,
+	PKEY_Keywords, PKEY_Comment, PKEY_Media_DateReleased
+};
+
+const size_t keyCount = ARRAYSIZE(keys);
+
+// As in setup.cpp.
+const wchar_t *const handledExtensions[] = { L"ogg", L"flac", L"oga", L"mp3", L"mpc", L"wv", L"spx", L"tta", L"wma",
+	L"asf", L"m4a", L"m4b", L"m4p", L"3g2", L"mp4", L"aif", L"aiff", L"wav" };
+
+const size_t handledExtensionCount = ARRAYSIZE(handledExtensions);
+
+bool handledExtension(const std::wstring &path)
+{
+	const std::wstring::size_type dot = path.rfind(L'.');
+	if (dot == std::wstring::npos || path.find_first_of(L"\\/", dot) != std::wstring::npos)
+		return false;
+	const std::wstring ext = path.substr(dot + 1);
+	for (size_t i = 0; i < handledExtensionCount; ++i)
+		if (!_wcsicmp(ext.c_str(), handledExtensions[i]))
+			return true;
+	return false;
+}
+
+bool operator==(REFPROPERTYKEY left, REFPROPERTYKEY right)
+{
+	return IsEqualPropertyKey(left, right);
+}
+
+struct Dbstr
+{
+	const BSTR val;
+	Dbstr(const std::wstring &str) : val(SysAllocString(str.c_str()))
+	{
+		OutputDebugStr(L"bstr()");
+	}
+
+	~Dbstr()
+	{
+		OutputDebugStr(L"~bstr");
+		SysFreeString(val);
+	}
+
+	operator BSTR()
+	{
+		OutputDebugStr(L"op bstr");
+		return val;
+	}
+};
+
+#define TRY_BSTR(func)                                                \
+	try                                                               \
+	{                                                                 \
+		InitPropVariantFromString(func(taglibfile).c_str(), pPropVar);\
+	}                                                                 \
+	catch (std::domain_error &)                                       \
+	{                                                                 \
+		pPropVar->vt = VT_EMPTY;                                      \
+	}
+
+
+HRESULT keywordsValue(const wstrvec_t &keys, PROPVARIANT *pPropVar)
+{
+	if (keys.empty())
+		return S_OK;
+	pPropVar->vt = VT_ARRAY | VT_BSTR;
+	SAFEARRAYBOUND aDim[1] = {};
+
+	aDim[0].cElements = keys.size();
+
+	pPropVar->parray = SafeArrayCreate(VT_BSTR, 1, aDim);
+	if (!pPropVar->parray)
+		return E_OUTOFMEMORY;
+
+	long aLong[1] = {};
+	for (wstrvec_t::const_iterator it = keys.begin(); it != keys.end(); ++it)
+	{
+		SafeArrayPutElement(pPropVar->parray, aLong, Dbstr(*it));
+		++aLong[0];
+	}
+	return S_OK;
+}
+
+void releaseDateValue(SYSTEMTIME date, unsigned year, PROPVARIANT *pPropVar)
+{
+	// Attempt to recover in case of failure.:
+	// GetDateFormat, at least in my locale, fails if at least the day, month and year aren't set:
+	if (date.wMonth != 0 && date.wDay != 0)
+	{
+		std::vector<WCHAR> buf;
+#define GDF(x)  GetDateFormat(LOCALE_USER_DEFAULT, DATE_SHORTDATE, &date, NULL, x, static_cast<int>(buf.size()))
+		buf.resize(GDF(NULL));
+		if (GDF(&buf.at(0)))
+		{
+			pPropVar->bstrVal = SysAllocString(&buf.at(0));
+			pPropVar->vt = VT_BSTR;
+		}
+	}
+	else
+		if (year)
+		{
+			std::wstringstream ss; ss << year;
+			InitPropVariantFromString(ss.str().c_str(), pPropVar);
+		}
+}
+
+HRESULT readProperty(const TagLib::FileRef &taglibfile, REFPROPERTYKEY key, PROPVARIANT *pPropVar)
+{
+	try
+	{
+		const TagLib::AudioProperties *ap = taglibfile.audioProperties();
+		const TagLib::Tag *tag = taglibfile.tag();
+
+		// If the tag is empty, treat it as if it doesn't exist.
+		if (tag && tag->isEmpty())
+			tag = NULL;
+
+		if (ap && key == PKEY_Audio_ChannelCount)
+		{
+			pPropVar->uintVal = ap->channels();
+			pPropVar->vt = VT_UI4;
+		}
+		else if (ap && key == PKEY_Media_Duration)
+		{
+			pPropVar->uhVal.QuadPart = static_cast<ULONGLONG>(ap->length()) * 10000000;
+			pPropVar->vt = VT_UI8;
+		}
+		else if (ap && key == PKEY_Audio_EncodingBitrate)
+		{
+			pPropVar->uintVal = ap->bitrate()*1000;
+			pPropVar->vt = VT_UI4;
+		}
+		else if (ap && key == PKEY_Audio_SampleRate)
+		{
+			pPropVar->uintVal = ap->sampleRate();
+			pPropVar->vt = VT_UI4;
+		}
+		else if (tag && key == PKEY_Music_AlbumArtist)
+			TRY_BSTR(albumArtist)
+		else if (tag && key == PKEY_Music_AlbumTitle)
+			InitPropVariantFromString(tag->album().toWString().c_str(), pPropVar);
+		else if (tag && key == PKEY_Music_Artist)
+			InitPropVariantFromString(tag->artist().toWString().c_str(), pPropVar);
+		else if (tag && key == PKEY_Music_Genre)
+			InitPropVariantFromString(tag->genre().toWString().c_str(), pPropVar);
+		else if (tag && key == PKEY_Title)
+			InitPropVariantFromString(tag->title().toWString().c_str(), pPropVar);
+		else if (tag && key == PKEY_Music_TrackNumber)
+		{
+			if (tag->track() == 0)
+				pPropVar->vt = VT_EMPTY;
+			else
+			{
+				pPropVar->uintVal = tag->track();
+				pPropVar->vt = VT_UI4;
+			}
+		}
+		else if (tag && key == PKEY_Media_Year)
+		{
+			if (tag->year() == 0)
+				pPropVar->vt = VT_EMPTY;
+			else
+			{
+				pPropVar->uintVal = tag->year();
+				pPropVar->vt = VT_UI4;
+			}
+		}
+		else if (tag && key == PKEY_Rating)
+		{
+			pPropVar->uintVal = rating(taglibfile);
+			pPropVar->vt = VT_UI4;
+		}
+		else if (tag && key == PKEY_Keywords)
+			return keywordsValue(keywords(taglibfile), pPropVar);
+		else if (tag && key == PKEY_Comment)
+			InitPropVariantFromString(tag->comment().toWString().c_str(), pPropVar);
+		else if (tag && key == PKEY_Media_DateReleased)
+			releaseDateValue(releasedate(taglibfile), tag->year(), pPropVar);
+		else if (tag && key == PKEY_Music_Composer)
+			TRY_BSTR(composer)
+		else if (tag && key == PKEY_Music_Conductor)
+			TRY_BSTR(conductor)
+		else if (tag && key == PKEY_Media_SubTitle)
+			TRY_BSTR(subtitle)
+		else if (tag && key == PKEY_Media_Publisher)
+			TRY_BSTR(label)
+		else if (tag && key == PKEY_Media_Producer)
+			TRY_BSTR(producer)
+		else if (tag && key == PKEY_Music_Mood)
+			TRY_BSTR(mood)
+		else if (tag && key == PKEY_Copyright)
+			TRY_BSTR(copyright)
+		else if (tag && key == PKEY_Music_PartOfSet)
+			TRY_BSTR(partofset)
+		else
+			return S_FALSE;
+		return S_OK;
+	}
+	catch (std::exception &e)
+	{
+		OutputDebugStringA(e.what());
+		pPropVar->vt = VT_EMPTY;
+		return ERROR_INTERNAL_ERROR;
+	}
+	catch (...)
+	{
+		// This has only ever been reached when taglib gives us a non-null but invalid tag;
+		//  not reproducable. Worse, the exception is only when wstring's constructor has
+		//  caught it, there's a chance of a complete crash here, otoh, with a non-abort(),
+		//  the app/system may deal gracefully.
+		OutputDebugString(L"TaglibHandler encountered unexpected exception in GetValue");
+		pPropVar->vt = VT_EMPTY;
+		return ERROR_INTERNAL_ERROR;
+	}
+}
+
+// Every key from source, with extra, into values.
+template <typename Source, typename Extra>
+static void readAll(const Source &source, HRESULT (*read)(const Source &, const Extra &, REFPROPERTYKEY, PROPVARIANT *),
+	const Extra &extra, std::vector<PROPVARIANT> &values)
+{
+	for (size_t i = 0; i < keyCount; ++i)
+		if (read(source, extra, keys[i], &values[i]) != S_OK)
+			PropVariantClear(&values[i]);
+}
+
+bool readFileProperties(TagLib::FileAccessor *accessor, ULONGLONG size, const std::wstring &name,
+	std::vector<PROPVARIANT> &values)
+{
+	values.resize(keyCount);
+	for (size_t i = 0; i < keyCount; ++i)
+		PropVariantInit(&values[i]);
+
+	Id3Tags tags;
+	MpegInfo mpeg;
+	if (readId3File(*accessor, size, name, tags, mpeg))
+	{
+		delete accessor;
+		readAll(tags, readId3Property, mpeg, values);
+		return true;
+	}
+	XiphTags comments;
+	HeaderInfo lengths;
+	if (readXiphFile(*accessor, size, name, comments, lengths))
+	{
+		delete accessor;
+		readAll(comments, readXiphProperty, lengths, values);
+		return true;
+	}
+
+	TagLib::FileRef file(accessor);
+	if (file.isNull())
+		return false;
+	// MPEG lengths from the Xing or VBRI header, where TagLib would guess from the first frame, Ogg's
+	//  from the last page, where TagLib would walk every page to it, and FLAC's from STREAMINFO, to
+	//  the sample rather than the second.
+	HeaderInfo header;
+	if (readHeaderInfo(*accessor, size, name, header))
+		readAll(file, readHeaderProperty, header, values);
+	else
+		for (size_t i = 0; i < keyCount; ++i)
+			if (readProperty(file, keys[i], &values[i]) != S_OK)
+				PropVariantClear(&values[i]);
+	return true;
+}
+
+std::wstring propertyText(REFPROPVARIANT pv)
+{
+	std::wstringstream ss;
+	switch (pv.vt)
+	{
+		case VT_UI4: ss << pv.ulVal; break;
+		case VT_UI8: ss << pv.uhVal.QuadPart; break;
+		case VT_LPWSTR: if (pv.pwszVal) ss << pv.pwszVal; break;
+		case VT_BSTR: if (pv.bstrVal) ss << pv.bstrVal; break;
+		case VT_ARRAY | VT_BSTR:
+			{
+				long lo = 0, hi = -1;
+				SafeArrayGetLBound(pv.parray, 1, &lo);
+				SafeArrayGetUBound(pv.parray, 1, &hi);
+				for (long i = lo; i <= hi; ++i)
+				{
+					BSTR b = NULL;
+					if (SUCCEEDED(SafeArrayGetElement(pv.parray, &i, &b)))
+					{
+						if (i != lo)
+							ss << L"; ";
+						if (b)
+							ss << b;
+						SysFreeString(b);
+					}
+				}
+			}
+			break;
+	}
+	return ss.str();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <fileref.h>
+#include <propsys.h>
+
+#include <string>
+#include <vector>
+
+#include "exttag.h"
+
+// The properties the handler offers, in the order GetAt reports them.
+extern const PROPERTYKEY keys[];
+extern const size_t keyCount;
+
+// Read one property from an opened file; this is the whole of IPropertyStore::GetValue,
+//  shared so tools outside of the shell can extract exactly what the handler would.
+// S_OK | S_FALSE (not a key we handle, or nothing to read it from) | E_OUTOFMEMORY | ERROR_INTERNAL_ERROR
+HRESULT readProperty(const TagLib::FileRef &taglibfile, REFPROPERTYKEY key, PROPVARIANT *pPropVar);
+
+// Every key, one per keys[], as the handler reads a file: MP3s, FLACs and Oggs with tags id3scan or
+//  xiphscan reads as TagLib would without TagLib, and the rest with TagLib, with the lengths from
+//  headerinfo.h where it has them. VT_EMPTY where there's nothing to read, and all of them, with false,
+//  if TagLib can't read the file either. Takes the accessor, as a FileRef does.
+bool readFileProperties(TagLib::FileAccessor *accessor, ULONGLONG size, const std::wstring &name,
+	std::vector<PROPVARIANT> &values);
+
+// How readProperty gives keywords and a release date (the year alone, if the date has no month
+//  and day), for readers other than TagLib's to give them the same way.
+HRESULT keywordsValue(const wstrvec_t &keywords, PROPVARIANT *pPropVar);
+void releaseDateValue(SYSTEMTIME date, unsigned year, PROPVARIANT *pPropVar);
+
+// Render a value produced by readProperty as text, as a tool would print it:
+//  numbers in decimal, strings as-is and multiple values joined with "; ".
+std::wstring propertyText(REFPROPVARIANT pv);
+
+// The extensions setup registers the handler for, without the dot.
+extern const wchar_t *const handledExtensions[];
+extern const size_t handledExtensionCount;
+
+// Whether the path has one of them.
+bool handledExtension(const std::wstring &path);
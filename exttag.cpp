@@ -10,9 +10,11 @@
 #include <apetag.h>
 #include <id3v1tag.h>
 #include <id3v2tag.h>
+#include <popularimeterframe.h>
 #include <textidentificationframe.h>
 #include <unknownframe.h>
 #include <xiphcomment.h>
+#include <flacfile.h>
 #include <mpegfile.h>
 
 using namespace TagLib;
@@ -24,7 +26,7 @@ using namespace TagLib;
 //  - These take the fileref's tag, and attempt to cast it to all of the TAG_CLASSES
 //  - If an cast succeeds, it calls the worker function for the type (ie. readrating(APE::TAG..))
 //  - If the tag is none of the tag types, it's probably a tag union:
-//    - They will then attempt to cast the fileref's file to an MPEG file.
+//    - They will then attempt to cast the fileref's file to an MPEG or a FLAC file.
 //    - A splitter is defined that will take all the possible tag types from this file, and upcast+return them.
 //
 // Basically, all of the useful functionality is rooted in the ie. readrating() functions, the rest is support.
@@ -47,12 +49,22 @@ using namespace TagLib;
 		def;												         \
 	}
 
+// The same for a FLAC::File, whose tag() is a union too: its Vorbis comment, then its ID3v2 tag.
+#define FILE_SPLITTER_FLAC(ret, func, def)                                   \
+	ret func(FLAC::File *file)                                               \
+	{                                                                        \
+		RETURN_IF_UPCAST(func, const Ogg::XiphComment, file->xiphComment()); \
+		RETURN_IF_UPCAST(func, const ID3v2::Tag,       file->ID3v2Tag()   ); \
+		def;                                                                 \
+	}
+
 // Inner body of the tag foreach loop; return_if_upcast all of the classes in order.
 #define UPCAST_CALL_N_RETURN_TAG(r, data, elem) RETURN_IF_UPCAST(data, elem, tag)
 
 // Generate the exposed functions and the stuff they require.
 #define READER_FUNC(ret, name, def)                                               \
 	FILE_SPLITTER_MPEG(ret, read##name, def);                                     \
+	FILE_SPLITTER_FLAC(ret, read##name, def);                                     \
 	ret name(const TagLib::FileRef &fileref)                                      \
 	{                                                                             \
 		const TagLib::Tag *tag = fileref.tag();                                   \
@@ -60,6 +72,7 @@ using namespace TagLib;
 		                                                                          \
 		TagLib::File *file = fileref.file();                                      \
 		RETURN_IF_UPCAST(read##name, MPEG::File, file);                           \
+		RETURN_IF_UPCAST(read##name, FLAC::File, file);                           \
 		                                                                          \
 		def;                                                                      \
 	}
@@ -90,6 +103,8 @@ const tlstrvec_t readTXXXStrings(const ID3v2::Tag *tag, const String &name)
 	for (ID3v2::FrameList::ConstIterator it = fl.begin(); it != fl.end(); ++it)
 	{
 		const ID3v2::TextIdentificationFrame *tif = dynamic_cast<const ID3v2::TextIdentificationFrame *>(*it);
+		if (!tif)
+			continue;
 		const StringList sl = tif->fieldList();
 		if (sl.size() >= 2)
 			if (is_iequal(sl[0].toWString(), name.toWString()))
@@ -175,6 +190,11 @@ unsigned char readrating(const ASF::Tag *tag)
 		{                                                                       \
 			const ByteVector &s = fr->data();
 
+#define FOR_EACH_ID3_FRAME_POPM {                                               \
+	const ID3v2::FrameList &fl = tag->frameListMap()["POPM"];                   \
+	for (ID3v2::FrameList::ConstIterator it = fl.begin(); it != fl.end(); ++it) \
+		if (ID3v2::PopularimeterFrame *fr = dynamic_cast<ID3v2::PopularimeterFrame *>(*it))
+
 #define FOR_EACH_ID3_FRAME_TIF(name) {                                          \
 	const ID3v2::FrameList &fl = tag->frameListMap()[name];                     \
 	for (ID3v2::FrameList::ConstIterator it = fl.begin(); it != fl.end(); ++it) \
@@ -191,6 +211,11 @@ unsigned char readrating(const ID3v2::Tag *tag)
     // Counter         $xx xx xx xx (xx ...)
 	// The rating is 1-255 where 1 is worst and 255 is best. 0 is unknown.
 
+	// TagLib parses POPM itself since 1.6; before, it was left as an unknown frame.
+	FOR_EACH_ID3_FRAME_POPM
+			return static_cast<unsigned char>(fr->rating()*100/255.f);
+	}
+
 	FOR_EACH_ID3_FRAME_UNKNOWN("POPM")
 			// Locate the null byte.
 			ByteVector::ConstIterator sp = std::find(s.begin(), s.end(), 0);
@@ -289,6 +314,8 @@ wstrvec_t readkeywords(const ID3v2::Tag *tag)
 	for (ID3v2::FrameList::ConstIterator it = fl.begin(); it != fl.end(); ++it)
 	{
 		const ID3v2::TextIdentificationFrame *tif = dynamic_cast<const ID3v2::TextIdentificationFrame *>(*it);
+		if (!tif)
+			continue;
 		const StringList sl = tif->fieldList();
 		if (sl.size() >= 2)
 			if (is_iequal(sl[0].toWString(), L"keywords"))
@@ -329,9 +356,14 @@ SYSTEMTIME parseDate(const wstrvec_t &vec)
 			}
 		}
 
-	// Abandon, and just go with the year.
+	// Abandon, and just go with the year; only the leading digits, as it's free text.
 	SYSTEMTIME ret = {};
-	ret.wYear = boost::lexical_cast<int>(vec.at(0));
+	const std::wstring &first = vec.at(0);
+	size_t digits = 0;
+	while (digits < first.size() && digits < 4 && iswdigit(first[digits]))
+		++digits;
+	if (digits)
+		ret.wYear = boost::lexical_cast<int>(first.substr(0, digits));
 	return ret;
 }
 
@@ -402,8 +434,11 @@ SYSTEMTIME readreleasedate(const ID3v2::Tag *tag)
 	for (tlstrvec_t::const_iterator yit = years.begin(); yit != years.end(); ++yit, ++dit)
 	{
 		const std::wstring day = dit->toWString();
-		// This could throw if the TDAT tag is misformed.
-		composed.push_back(yit->toWString() + L"-" + day.substr(2,2) + L"-" + day.substr(0,2));
+		// A misformed TDAT can't be rearranged, keep just the year from this pair.
+		if (day.size() != 4)
+			composed.push_back(yit->toWString());
+		else
+			composed.push_back(yit->toWString() + L"-" + day.substr(2,2) + L"-" + day.substr(0,2));
 	}
 	return parseDate(composed);
 }
@@ -519,11 +554,11 @@ std::wstring readproducer(const ASF::Tag *tag)
 std::wstring readproducer(const ID3v2::Tag *tag)
 {
 	const ID3v2::FrameList &fl = tag->frameListMap()["TIPL"]; // Involved People
-	for (TagLib::uint i = 0; i < fl.size(); i+=2)
+	for (TagLib::uint i = 0; i + 1 < fl.size(); i+=2)
 		if (ID3v2::TextIdentificationFrame *fr = dynamic_cast<ID3v2::TextIdentificationFrame *>(fl[i]))
 			if (fr->toString() == L"producer")
-				return dynamic_cast<ID3v2::TextIdentificationFrame *>(fl[i+1])
-					->toString().toWString();
+				if (ID3v2::TextIdentificationFrame *val = dynamic_cast<ID3v2::TextIdentificationFrame *>(fl[i+1]))
+					return val->toString().toWString();
 	throw std::domain_error("no id3v2");
 }
 
@@ -16,6 +16,12 @@ wstrvec_t keywords(const TagLib::FileRef &fileref);
 // Order by completeness (ie. yyyy-mm-dd is better than yyyy), 
 //  then by order of apperance in the tag. Pick the first.
 SYSTEMTIME releasedate(const TagLib::FileRef &fileref);
+
+// The best date of those given, as releasedate() picks it.
+SYSTEMTIME parseDate(const wstrvec_t &dates);
+
+// A rating as a tag gives it (1-5 stars, 0-99, or 0-255) on the 0-99 scale above.
+unsigned char normaliseRating(int rating);
 std::wstring composer(const TagLib::FileRef &fileref);
 std::wstring conductor(const TagLib::FileRef &fileref);
 std::wstring subtitle(const TagLib::FileRef &fileref);
@@ -0,0 +1,178 @@
+#include "../inflate.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// === Deflate. ===
+// Inflater has to give exactly what zlib wrote, for each kind of block, however the input arrives
+//  and however much is asked for at a time; and corrupt or cut short input has to end in false,
+//  not in made-up bytes. The vectors were made with zlib, apart from the copy from 32768 bytes
+//  back, which zlib never writes, and the bad code lengths, both made by hand.
+
+namespace
+{
+	int failures;
+
+#define CHECK(x) do { if (!(x)) { ++failures; std::cout << __FILE__ << ":" << __LINE__ << ": " #x << std::endl; } } while (0)
+
+	const unsigned char stored[] =
+	{
+		0x01, 0x11, 0x00, 0xee, 0xff, 0x53, 0x74, 0x6f, 0x72, 0x65, 0x64, 0x2c, 0x20, 0x61, 0x73, 0x20,
+		0x69, 0x74, 0x20, 0x69, 0x73, 0x2e,
+	};
+	const unsigned char fixed[] =
+	{
+		0x4b, 0xcb, 0xac, 0x48, 0x4d, 0x51, 0x48, 0xce, 0x4f, 0x49, 0x2d, 0xd6, 0x51, 0x48, 0xc3, 0xc1,
+		0x01, 0x00,
+	};
+	const unsigned char dynamic[] =
+	{
+		0xb5, 0xca, 0x4b, 0x1a, 0x82, 0x20, 0x18, 0x46, 0xe1, 0xad, 0x7c, 0x2b, 0x68, 0x01, 0x39, 0xaa,
+		0xb4, 0x7b, 0x51, 0x96, 0xdd, 0x66, 0x88, 0xa4, 0x28, 0xf2, 0x17, 0x68, 0x45, 0xab, 0xef, 0xd1,
+		0x3d, 0x34, 0x3d, 0xef, 0x09, 0xbd, 0xe1, 0xb5, 0x12, 0x48, 0x35, 0x89, 0xca, 0x41, 0x70, 0x6b,
+		0x3d, 0x9a, 0x42, 0x2a, 0x0b, 0x7a, 0x1b, 0x08, 0xca, 0x24, 0xb4, 0x34, 0x79, 0x53, 0xb8, 0x61,
+		0xd7, 0xf1, 0x6c, 0x95, 0xa8, 0x90, 0xda, 0x4e, 0xef, 0xf4, 0x41, 0xd9, 0xd6, 0x0f, 0x07, 0x7a,
+		0x49, 0xdb, 0xb3, 0xe6, 0x5f, 0x8f, 0x8c, 0xf2, 0xe0, 0x8f, 0xf3, 0x71, 0x1e, 0x61, 0x9f, 0x2c,
+		0x26, 0x2b, 0x8c, 0x63, 0x76, 0xde, 0x62, 0xca, 0x2e, 0x58, 0x26, 0x9b, 0xdd, 0x01, 0xec, 0x14,
+		0xc5, 0x3d, 0xaf, 0x47, 0xb7, 0x2b, 0x42, 0x36, 0x1b, 0xfc, 0x00,
+	};
+	const unsigned char farCopy[] =
+	{
+		0x1b, 0xbd, 0xff, 0x1f, 0x00,
+	};
+	const unsigned char gzipped[] =
+	{
+		0x1f, 0x8b, 0x08, 0x1c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x04, 0x00, 0x61, 0x62, 0x01, 0x02,
+		0x6e, 0x61, 0x6d, 0x65, 0x2e, 0x74, 0x61, 0x72, 0x00, 0x61, 0x20, 0x63, 0x6f, 0x6d, 0x6d, 0x65,
+		0x6e, 0x74, 0x00, 0x4b, 0xaf, 0xca, 0x2c, 0xd0, 0x51, 0x28, 0xcf, 0x2c, 0xc9, 0x50, 0x48, 0x2d,
+		0x4b, 0x2d, 0xaa, 0x54, 0xc8, 0x2f, 0x28, 0xc9, 0xcc, 0xcf, 0x4b, 0xcc, 0x51, 0x48, 0xcb, 0x4c,
+		0xcd, 0x49, 0x01, 0x00, 0x86, 0x64, 0x4b, 0x8b, 0x1f, 0x00, 0x00, 0x00,
+	};
+	const unsigned char overSubscribed[] =
+	{
+		0x05, 0xe0, 0x93, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x00,
+	};
+
+	// Hands out the bytes a few at a time, as a network read might.
+	struct MemorySource : OnePassAccessor::Source
+	{
+		MemorySource(const unsigned char *p, size_t n, size_t step) : p(p), n(n), step(step) {}
+		const unsigned char *p;
+		size_t n, step;
+
+		bool read(void *buf, ULONG size, ULONG *got)
+		{
+			*got = static_cast<ULONG>(std::min(std::min(n, step), static_cast<size_t>(size)));
+			memcpy(buf, p, *got);
+			p += *got;
+			n -= *got;
+			return true;
+		}
+	};
+
+	// Everything, asked for `chunk` bytes at a time; false if the inflater said so.
+	bool inflate(const unsigned char *p, size_t n, bool gzip, std::string &out, size_t step = 64 * 1024, ULONG chunk = 4096)
+	{
+		MemorySource source(p, n, step);
+		Inflater inflater(source, gzip);
+		std::vector<char> buf(chunk);
+		out.clear();
+		for (;;)
+		{
+			ULONG got = 0;
+			if (!inflater.read(&buf[0], chunk, &got))
+				return false;
+			if (!got)
+				return inflater.produced() == out.size();
+			out.append(&buf[0], got);
+		}
+	}
+
+	// The same bytes, whatever the steps in and the chunks out.
+	void gives(const unsigned char *p, size_t n, bool gzip, const std::string &expected)
+	{
+		static const size_t steps[] = { 1, 5, 64 * 1024 };
+		static const ULONG chunks[] = { 1, 7, 4096 };
+		for (size_t i = 0; i < 3; ++i)
+			for (size_t j = 0; j < 3; ++j)
+			{
+				std::string out;
+				CHECK(inflate(p, n, gzip, out, steps[i], chunks[j]) && out == expected);
+			}
+	}
+
+	void readsBlocks()
+	{
+		gives(stored, sizeof(stored), false, "Stored, as it is.");
+		gives(fixed, sizeof(fixed), false, "fixed codes, fixed codes, fixed codes");
+		std::string fox;
+		for (int i = 0; i < 3; ++i)
+			fox += "the quick brown fox jumps over the lazy dog; ";
+		gives(dynamic, sizeof(dynamic), false, "Dynamic blocks carry their own code lengths: " + fox
+			+ "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG.");
+	}
+
+	void copiesFromTheWholeWindow()
+	{
+		// A stored block of 32768 bytes, then a fixed one with one copy: 258 bytes from 32768 back.
+		std::vector<unsigned char> in;
+		const unsigned char header[] = { 0x00, 0x00, 0x80, 0xff, 0x7f };
+		in.insert(in.end(), header, header + sizeof(header));
+		std::string expected;
+		for (unsigned i = 0; i < 32768; ++i)
+			expected += static_cast<char>((i * 7 + (i >> 8)) & 0xff);
+		in.insert(in.end(), expected.begin(), expected.end());
+		in.insert(in.end(), farCopy, farCopy + sizeof(farCopy));
+		expected += expected.substr(0, 258);
+		gives(&in[0], in.size(), false, expected);
+
+		// The copy alone reaches back before the start.
+		std::string out;
+		CHECK(!inflate(farCopy, sizeof(farCopy), false, out));
+	}
+
+	void skipsGzipHeaders()
+	{
+		gives(gzipped, sizeof(gzipped), true, "gzip, with every optional field");
+		std::string out;
+		CHECK(!inflate(gzipped, sizeof(gzipped), false, out));
+		CHECK(!inflate(dynamic, sizeof(dynamic), true, out));
+	}
+
+	void refusesDamage()
+	{
+		std::string out;
+		// Cut short anywhere, in the gzip header, a block header, a stored block or the codes.
+		for (size_t n = 0; n < sizeof(dynamic); ++n)
+			CHECK(!inflate(dynamic, n, false, out));
+		for (size_t n = 0; n < sizeof(stored); ++n)
+			CHECK(!inflate(stored, n, false, out));
+		for (size_t n = 0; n < 40; ++n)
+			CHECK(!inflate(gzipped, n, true, out));
+
+		// More code-length codes of one bit than one bit can hold.
+		CHECK(!inflate(overSubscribed, sizeof(overSubscribed), false, out));
+
+		// A stored block whose length and its complement don't agree; a block of the reserved type.
+		unsigned char bad[sizeof(stored)];
+		memcpy(bad, stored, sizeof(stored));
+		bad[3] ^= 1;
+		CHECK(!inflate(bad, sizeof(bad), false, out));
+		const unsigned char reserved[] = { 0x07, 0x00 };
+		CHECK(!inflate(reserved, sizeof(reserved), false, out));
+	}
+}
+
+int inflateTests()
+{
+	failures = 0;
+	readsBlocks();
+	copiesFromTheWholeWindow();
+	skipsGzipHeaders();
+	refusesDamage();
+	std::cout << "inflate: " << (failures ? "FAILED" : "ok") << std::endl;
+	return failures;
+}
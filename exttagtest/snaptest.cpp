@@ -0,0 +1,303 @@
+#include "../snapshot.h"
+
+#include <propvarutil.h>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+// === Snapshot compatibility. ===
+// The fixtures are snapshots as earlier versions wrote them, byte for byte; every reader of the
+//  same major has to take them, and every later major refuse them. Add one whenever the version
+//  goes up, and never change one.
+
+namespace
+{
+	// Written by 1.0: a U32, a U64, a STRING, a BSTRING and a LIST of three, one of them empty.
+	const unsigned char v1_0[] =
+	{
+		0x54, 0x4c, 0x48, 0x53, 0x01, 0x00, 0x20, 0x00, 0x05, 0x00, 0x00, 0x00, 0x0a, 0x01, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0xd3, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x80, 0xbd, 0xd3, 0x24, 0x22, 0x02, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x03, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0xb0, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0xc6, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x05, 0x00, 0x00, 0x00, 0x05, 0x00, 0x03, 0x00, 0xdc, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x50, 0x00, 0x69, 0x00, 0x6e, 0x00, 0x6b, 0x00, 0x20, 0x00, 0x46, 0x00, 0x6c, 0x00, 0x6f, 0x00,
+		0x79, 0x00, 0x64, 0x00, 0x00, 0x00, 0x30, 0x00, 0x31, 0x00, 0x2f, 0x00, 0x30, 0x00, 0x33, 0x00,
+		0x2f, 0x00, 0x31, 0x00, 0x39, 0x00, 0x37, 0x00, 0x33, 0x00, 0x00, 0x00, 0xf4, 0x00, 0x00, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0xfe, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0x70, 0x00, 0x72, 0x00, 0x6f, 0x00, 0x67, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x72, 0x00, 0x6f, 0x00, 0x63, 0x00, 0x6b, 0x00, 0x00, 0x00,
+	};
+
+	// As 1.1 might write it: 8 more bytes on every entry, and an entry of a type 1.0 doesn't know.
+	const unsigned char v1_1[] =
+	{
+		0x54, 0x4c, 0x48, 0x53, 0x01, 0x01, 0x28, 0x00, 0x06, 0x00, 0x00, 0x00, 0x5a, 0x01, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0xd3, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77,
+		0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00,
+		0x80, 0xbd, 0xd3, 0x24, 0x22, 0x02, 0x00, 0x00, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x06, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0xef, 0xbe, 0xad, 0xde, 0x00, 0x00, 0x00, 0x00,
+		0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77,
+		0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x03, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+		0x00, 0x01, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x16, 0x01, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00,
+		0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77,
+		0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x05, 0x00, 0x00, 0x00, 0x05, 0x00, 0x03, 0x00,
+		0x2c, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+		0x50, 0x00, 0x69, 0x00, 0x6e, 0x00, 0x6b, 0x00, 0x20, 0x00, 0x46, 0x00, 0x6c, 0x00, 0x6f, 0x00,
+		0x79, 0x00, 0x64, 0x00, 0x00, 0x00, 0x30, 0x00, 0x31, 0x00, 0x2f, 0x00, 0x30, 0x00, 0x33, 0x00,
+		0x2f, 0x00, 0x31, 0x00, 0x39, 0x00, 0x37, 0x00, 0x33, 0x00, 0x00, 0x00, 0x44, 0x01, 0x00, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0x4e, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x50, 0x01, 0x00, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0x70, 0x00, 0x72, 0x00, 0x6f, 0x00, 0x67, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x72, 0x00, 0x6f, 0x00, 0x63, 0x00, 0x6b, 0x00, 0x00, 0x00,
+	};
+
+	// Written by 2.0, after EncodingBitrate went from TagLib's kbps times 1024 to bits per second:
+	//  1.0's bytes under the new major, which no reader takes for 1.0's.
+	const unsigned char v2_0[] =
+	{
+		0x54, 0x4c, 0x48, 0x53, 0x02, 0x00, 0x20, 0x00, 0x05, 0x00, 0x00, 0x00, 0x0a, 0x01, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0xd3, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x80, 0xbd, 0xd3, 0x24, 0x22, 0x02, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x03, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0xb0, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0xc6, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x05, 0x00, 0x00, 0x00, 0x05, 0x00, 0x03, 0x00, 0xdc, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x50, 0x00, 0x69, 0x00, 0x6e, 0x00, 0x6b, 0x00, 0x20, 0x00, 0x46, 0x00, 0x6c, 0x00, 0x6f, 0x00,
+		0x79, 0x00, 0x64, 0x00, 0x00, 0x00, 0x30, 0x00, 0x31, 0x00, 0x2f, 0x00, 0x30, 0x00, 0x33, 0x00,
+		0x2f, 0x00, 0x31, 0x00, 0x39, 0x00, 0x37, 0x00, 0x33, 0x00, 0x00, 0x00, 0xf4, 0x00, 0x00, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0xfe, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0x70, 0x00, 0x72, 0x00, 0x6f, 0x00, 0x67, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x72, 0x00, 0x6f, 0x00, 0x63, 0x00, 0x6b, 0x00, 0x00, 0x00,
+	};
+
+	// As 2.1 might write it: 1.1's, under the new major.
+	const unsigned char v2_1[] =
+	{
+		0x54, 0x4c, 0x48, 0x53, 0x02, 0x01, 0x28, 0x00, 0x06, 0x00, 0x00, 0x00, 0x5a, 0x01, 0x00, 0x00,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0xd3, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77,
+		0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00,
+		0x80, 0xbd, 0xd3, 0x24, 0x22, 0x02, 0x00, 0x00, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x06, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0xef, 0xbe, 0xad, 0xde, 0x00, 0x00, 0x00, 0x00,
+		0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77,
+		0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x03, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+		0x00, 0x01, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+		0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x16, 0x01, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00,
+		0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0x44, 0x33, 0x22, 0x11, 0x66, 0x55, 0x88, 0x77,
+		0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00, 0x05, 0x00, 0x00, 0x00, 0x05, 0x00, 0x03, 0x00,
+		0x2c, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab, 0xab,
+		0x50, 0x00, 0x69, 0x00, 0x6e, 0x00, 0x6b, 0x00, 0x20, 0x00, 0x46, 0x00, 0x6c, 0x00, 0x6f, 0x00,
+		0x79, 0x00, 0x64, 0x00, 0x00, 0x00, 0x30, 0x00, 0x31, 0x00, 0x2f, 0x00, 0x30, 0x00, 0x33, 0x00,
+		0x2f, 0x00, 0x31, 0x00, 0x39, 0x00, 0x37, 0x00, 0x33, 0x00, 0x00, 0x00, 0x44, 0x01, 0x00, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0x4e, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x50, 0x01, 0x00, 0x00,
+		0x04, 0x00, 0x00, 0x00, 0x70, 0x00, 0x72, 0x00, 0x6f, 0x00, 0x67, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x72, 0x00, 0x6f, 0x00, 0x63, 0x00, 0x6b, 0x00, 0x00, 0x00,
+	};
+
+	PROPERTYKEY testKey(DWORD pid)
+	{
+		const PROPERTYKEY k = { { 0x11223344, 0x5566, 0x7788, { 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x00 } }, pid };
+		return k;
+	}
+
+	// The fixtures are byte arrays; a snapshot needs the alignment of its strings.
+	std::vector<WCHAR> aligned(const unsigned char *p, size_t size)
+	{
+		std::vector<WCHAR> ret(size / 2 + 1);
+		memcpy(&ret[0], p, size);
+		return ret;
+	}
+
+	int failures;
+
+#define CHECK(x) do { if (!(x)) { ++failures; std::cout << __FILE__ << ":" << __LINE__ << ": " #x << std::endl; } } while (0)
+
+	bool refused(const void *p, size_t size)
+	{
+		try
+		{
+			SnapshotReader r(p, size);
+			return false;
+		}
+		catch (std::invalid_argument &)
+		{
+			return true;
+		}
+	}
+
+	// What the 1.0 and 2.0 fixtures hold, wherever they turn up.
+	void checkValues(const SnapshotReader &r)
+	{
+		CHECK(r.u32(r.find(testKey(1))) == 2003);
+		CHECK(r.u64(r.find(testKey(2))) == 2345670000000ULL);
+		CHECK(std::wstring(r.text(r.find(testKey(3)))) == L"Pink Floyd");
+		CHECK(r.length(r.find(testKey(3))) == 10);
+		CHECK(r.type(r.find(testKey(4))) == SnapshotReader::BSTRING);
+		CHECK(std::wstring(r.text(r.find(testKey(4)))) == L"01/03/1973");
+
+		const int list = r.find(testKey(5));
+		CHECK(r.items(list) == 3);
+		CHECK(std::wstring(r.item(list, 0)) == L"prog");
+		CHECK(std::wstring(r.item(list, 1)) == L"");
+		CHECK(std::wstring(r.item(list, 2)) == L"rock");
+
+		PROPVARIANT pv;
+		CHECK(r.value(testKey(3), &pv) == S_OK && pv.vt == VT_LPWSTR && std::wstring(pv.pwszVal) == L"Pink Floyd");
+		PropVariantClear(&pv);
+		CHECK(r.value(testKey(4), &pv) == S_OK && pv.vt == VT_BSTR && SysStringLen(pv.bstrVal) == 10);
+		PropVariantClear(&pv);
+		CHECK(r.value(testKey(5), &pv) == S_OK && pv.vt == (VT_ARRAY | VT_BSTR));
+		PropVariantClear(&pv);
+		CHECK(r.value(testKey(99), &pv) == S_FALSE && pv.vt == VT_EMPTY);
+	}
+
+	void readsVersion2_0()
+	{
+		const std::vector<WCHAR> buf = aligned(v2_0, sizeof(v2_0));
+		const SnapshotReader r(&buf[0], sizeof(v2_0));
+		CHECK(r.count() == 5);
+		CHECK(r.minorVersion() == 0);
+		CHECK(r.size() == sizeof(v2_0));
+		checkValues(r);
+	}
+
+	void readsVersion2_1()
+	{
+		const std::vector<WCHAR> buf = aligned(v2_1, sizeof(v2_1));
+		const SnapshotReader r(&buf[0], sizeof(v2_1));
+		CHECK(r.count() == 6);
+		CHECK(r.minorVersion() == 1);
+		checkValues(r);
+
+		// The entry it doesn't know is there, but has no value.
+		const int unknown = r.find(testKey(6));
+		CHECK(unknown >= 0 && r.type(unknown) == 0);
+		PROPVARIANT pv;
+		CHECK(r.value(testKey(6), &pv) == S_FALSE && pv.vt == VT_EMPTY);
+	}
+
+	// The encoder still writes 2.0 exactly as it was, so older readers of 2.x can read what we write.
+	void writesVersion2_0()
+	{
+		PROPERTYKEY keys[5];
+		PROPVARIANT values[5];
+		for (int i = 0; i < 5; ++i)
+		{
+			keys[i] = testKey(i + 1);
+			PropVariantInit(&values[i]);
+		}
+		values[0].vt = VT_UI4;
+		values[0].ulVal = 2003;
+		values[1].vt = VT_UI8;
+		values[1].uhVal.QuadPart = 2345670000000ULL;
+		InitPropVariantFromString(L"Pink Floyd", &values[2]);
+		values[3].vt = VT_BSTR;
+		values[3].bstrVal = SysAllocString(L"01/03/1973");
+		SAFEARRAYBOUND bound = {};
+		bound.cElements = 3;
+		values[4].vt = VT_ARRAY | VT_BSTR;
+		values[4].parray = SafeArrayCreate(VT_BSTR, 1, &bound);
+		const wchar_t *words[] = { L"prog", L"", L"rock" };
+		for (long i = 0; i < 3; ++i)
+		{
+			BSTR b = SysAllocString(words[i]);
+			SafeArrayPutElement(values[4].parray, &i, b);
+			SysFreeString(b);
+		}
+
+		const std::string s = encodeSnapshot(keys, values, 5);
+		CHECK(s.size() == sizeof(v2_0) && !memcmp(s.data(), v2_0, s.size()));
+
+		// And what's read back makes the same values again.
+		const std::vector<WCHAR> buf = aligned(reinterpret_cast<const unsigned char *>(s.data()), s.size());
+		const SnapshotReader r(&buf[0], s.size());
+		PROPVARIANT back[5];
+		for (int i = 0; i < 5; ++i)
+			r.value(keys[i], &back[i]);
+		const std::string again = encodeSnapshot(keys, back, 5);
+		CHECK(again == s);
+
+		for (int i = 0; i < 5; ++i)
+		{
+			PropVariantClear(&values[i]);
+			PropVariantClear(&back[i]);
+		}
+	}
+
+	// 1.x's bitrates are in other units; caches, streams and shared memory holding them parse again.
+	void refusesVersion1()
+	{
+		const std::vector<WCHAR> a = aligned(v1_0, sizeof(v1_0)), b = aligned(v1_1, sizeof(v1_1));
+		CHECK(refused(&a[0], sizeof(v1_0)));
+		CHECK(refused(&b[0], sizeof(v1_1)));
+	}
+
+	void refusesOtherMajors()
+	{
+		std::vector<WCHAR> buf = aligned(v2_0, sizeof(v2_0));
+		reinterpret_cast<unsigned char *>(&buf[0])[4] = 3;
+		CHECK(refused(&buf[0], sizeof(v2_0)));
+		reinterpret_cast<unsigned char *>(&buf[0])[4] = 0;
+		CHECK(refused(&buf[0], sizeof(v2_0)));
+	}
+
+	// Anything cut short is refused, and anything damaged is either refused or stays in bounds.
+	void refusesDamage()
+	{
+		for (size_t len = 0; len < sizeof(v2_1); ++len)
+		{
+			const std::vector<WCHAR> buf = aligned(v2_1, len);
+			CHECK(refused(&buf[0], len));
+		}
+
+		for (size_t i = 0; i < sizeof(v2_1); ++i)
+			for (int bit = 0; bit < 8; ++bit)
+			{
+				std::vector<WCHAR> buf = aligned(v2_1, sizeof(v2_1));
+				reinterpret_cast<unsigned char *>(&buf[0])[i] ^= 1 << bit;
+				try
+				{
+					const SnapshotReader r(&buf[0], sizeof(v2_1));
+					for (size_t e = 0; e < r.count(); ++e)
+					{
+						PROPVARIANT pv;
+						r.value(r.key(e), &pv);
+						PropVariantClear(&pv);
+					}
+				}
+				catch (std::invalid_argument &)
+				{
+				}
+			}
+	}
+}
+
+int snapshotTests()
+{
+	failures = 0;
+	readsVersion2_0();
+	readsVersion2_1();
+	writesVersion2_0();
+	refusesVersion1();
+	refusesOtherMajors();
+	refusesDamage();
+	std::cout << "snapshot: " << (failures ? "FAILED" : "ok") << std::endl;
+	return failures;
+}
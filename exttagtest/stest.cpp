@@ -2,6 +2,10 @@
 #include <windows.h>
 #include <iostream>
 
+int inflateTests();
+int snapshotTests();
+int unsyncTests();
+
 #if 0
 int main()
 {
@@ -45,7 +49,7 @@ int main()
 }
 #endif
 
-#if 1
+#if 0
 int main()
 {
 	SYSTEMTIME s = {};
@@ -56,3 +60,11 @@ int main()
 }
 
 #endif
+
+#if 1
+int main()
+{
+	const int failures = snapshotTests() + unsyncTests() + inflateTests();
+	return failures ? 1 : 0;
+}
+#endif
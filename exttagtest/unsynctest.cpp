@@ -0,0 +1,109 @@
+#include "../unsync.h"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// === Unsynchronisation. ===
+// id3Unsync() has to give exactly what the byte-at-a-time decoder does, whichever way it's done on
+//  this machine: the same bytes and the same length, for pairs on and across the block edges.
+
+namespace
+{
+	int failures;
+
+#define CHECK(x) do { if (!(x)) { ++failures; std::cout << __FILE__ << ":" << __LINE__ << ": " #x << std::endl; } } while (0)
+
+	unsigned seed = 1;
+
+	unsigned next()
+	{
+		seed = seed * 1103515245 + 12345;
+		return seed >> 16;
+	}
+
+	// Both decoders on a copy of the n bytes at p; whether they agree.
+	bool same(const unsigned char *p, size_t n)
+	{
+		std::vector<unsigned char> a(p, p + n), b(p, p + n);
+		a.push_back(0x5A);
+		b.push_back(0x5A);
+		const size_t plain = id3UnsyncPlain(&a[0], n), fast = id3Unsync(&b[0], n);
+		return plain == fast && !memcmp(&a[0], &b[0], plain) && b[n] == 0x5A;
+	}
+
+	void decodes(const char *in, size_t n, const char *out, size_t m)
+	{
+		std::vector<unsigned char> p(in, in + n);
+		p.push_back(0);
+		CHECK(id3Unsync(&p[0], n) == m && !memcmp(&p[0], out, m));
+	}
+
+	void undoesPairs()
+	{
+		decodes("", 0, "", 0);
+		decodes("\xFF", 1, "\xFF", 1);
+		decodes("\xFF\x00", 2, "\xFF", 1);
+		decodes("\xFF\x00\x00", 3, "\xFF\x00", 2);
+		decodes("\xFF\xFF\x00", 3, "\xFF\xFF", 2);
+		decodes("\xFF\x00\xFF\x00", 4, "\xFF\xFF", 2);
+		decodes("\x00\xFF\xE0", 3, "\x00\xFF\xE0", 3);
+	}
+
+	void agreesAtEdges()
+	{
+		// A pair, or a run of FFs and 00s, at every place in and around the first few blocks.
+		unsigned char buf[80];
+		for (size_t at = 0; at < 64; ++at)
+			for (size_t run = 1; run <= 4; ++run)
+			{
+				for (size_t i = 0; i < sizeof buf; ++i)
+					buf[i] = static_cast<unsigned char>(i | 1);
+				for (size_t i = 0; i < run && at + i < sizeof buf; ++i)
+					buf[at + i] = 0xFF;
+				for (size_t i = 0; i < run && at + run + i < sizeof buf; ++i)
+					buf[at + run + i] = 0;
+				for (size_t n = at; n <= sizeof buf; n += 7)
+					CHECK(same(buf, n));
+				CHECK(same(buf, sizeof buf));
+			}
+	}
+
+	void agreesOnNoise()
+	{
+		// Mostly FF and 00, some of everything else, at every length up to a few blocks.
+		std::vector<unsigned char> buf(300);
+		for (int round = 0; round < 2000; ++round)
+		{
+			const unsigned odds = round % 4 + 1;
+			for (size_t i = 0; i < buf.size(); ++i)
+			{
+				const unsigned r = next();
+				buf[i] = static_cast<unsigned char>(r % 8 < odds ? (r & 8 ? 0xFF : 0) : r >> 4);
+			}
+			const size_t n = next() % (buf.size() + 1);
+			CHECK(same(&buf[0], n));
+		}
+	}
+
+	void leavesCleanBuffers()
+	{
+		// No FFs: nothing changes.
+		std::vector<unsigned char> buf(1000), copy;
+		for (size_t i = 0; i < buf.size(); ++i)
+			buf[i] = static_cast<unsigned char>(next() % 255);
+		copy = buf;
+		CHECK(id3Unsync(&buf[0], buf.size()) == buf.size() && buf == copy);
+	}
+}
+
+int unsyncTests()
+{
+	failures = 0;
+	undoesPairs();
+	agreesAtEdges();
+	agreesOnNoise();
+	leavesCleanBuffers();
+	std::cout << "unsync: " << (failures ? "FAILED" : "ok") << (id3UnsyncVectorised() ? " (sse2)" : "") << std::endl;
+	return failures;
+}
@@ -0,0 +1,201 @@
+#include "fasthash.h"
+
+#include <windows.h>
+#include <emmintrin.h>
+#include <cstring>
+
+namespace
+{
+	typedef unsigned long long u64;
+
+	const u64 P1 = 0x9E3779B185EBCA87ULL, P2 = 0xC2B2AE3D27D4EB4FULL, P3 = 0x165667B19E3779F9ULL, P4 = 0x85EBCA77C2B2AE63ULL;
+	const unsigned SCRAMBLE = 0x9E3779B1;
+	const unsigned STRIPES_PER_SCRAMBLE = 16;
+
+	// Mixed into the data as it's folded, and into the lanes when they're scrambled.
+	const u64 fold[8] = {
+		0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+		0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL };
+	const u64 scramble[8] = {
+		0xCB00C391BB52283CULL, 0xA32E531B8B65D088ULL, 0x4EF90DA297486471ULL, 0xD8ACDEA946EF1938ULL,
+		0x3F349CE33F76FAA8ULL, 0x1D4F0BC7C7BBDCF9ULL, 0x3159B4CD4BE0518AULL, 0x647378D9C97E9FC8ULL };
+
+	inline u64 rotl(u64 x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline u64 load64(const unsigned char *p)
+	{
+		u64 v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	// One stripe, a lane at a time; the reference for the SSE2 version.
+	void stripePlain(u64 *acc, const unsigned char *p)
+	{
+		u64 d[8];
+		for (int l = 0; l < 8; ++l)
+			d[l] = load64(p + 8 * l);
+		for (int l = 0; l < 8; ++l)
+		{
+			const u64 dk = d[l] ^ fold[l];
+			acc[l] += (dk & 0xFFFFFFFF) * (dk >> 32) + d[l ^ 1];
+		}
+	}
+
+	void scramblePlain(u64 *acc)
+	{
+		for (int l = 0; l < 8; ++l)
+		{
+			u64 a = acc[l];
+			a ^= a >> 47;
+			a ^= scramble[l];
+			acc[l] = a * SCRAMBLE;
+		}
+	}
+
+	void stripesPlain(u64 *acc, unsigned &n, const unsigned char *p, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i, p += 64)
+		{
+			stripePlain(acc, p);
+			if (++n == STRIPES_PER_SCRAMBLE)
+			{
+				scramblePlain(acc);
+				n = 0;
+			}
+		}
+	}
+
+	// The same, two lanes to a register.
+	void stripesSse2(u64 *lanes, unsigned &n, const unsigned char *p, size_t count)
+	{
+		__m128i acc[4], f[4], s[4];
+		for (int j = 0; j < 4; ++j)
+		{
+			acc[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lanes + 2 * j));
+			f[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(fold + 2 * j));
+			s[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(scramble + 2 * j));
+		}
+		const __m128i prime = _mm_set1_epi32(static_cast<int>(SCRAMBLE));
+
+		for (size_t i = 0; i < count; ++i, p += 64)
+		{
+			for (int j = 0; j < 4; ++j)
+			{
+				const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * j));
+				const __m128i dk = _mm_xor_si128(d, f[j]);
+				// Low half of each lane times its high half.
+				const __m128i prod = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+				const __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+				acc[j] = _mm_add_epi64(acc[j], _mm_add_epi64(prod, swapped));
+			}
+			if (++n == STRIPES_PER_SCRAMBLE)
+			{
+				for (int j = 0; j < 4; ++j)
+				{
+					__m128i a = _mm_xor_si128(acc[j], _mm_srli_epi64(acc[j], 47));
+					a = _mm_xor_si128(a, s[j]);
+					// A 64-bit multiply by a 32-bit prime, from two 32x32->64 ones.
+					const __m128i lo = _mm_mul_epu32(a, prime);
+					const __m128i hi = _mm_mul_epu32(_mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+					acc[j] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+				}
+				n = 0;
+			}
+		}
+
+		for (int j = 0; j < 4; ++j)
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(lanes + 2 * j), acc[j]);
+	}
+
+	bool detectSse2()
+	{
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+		return true;
+#else
+		return IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) != FALSE;
+#endif
+	}
+
+	const bool sse2 = detectSse2();
+}
+
+FastHash::FastHash(unsigned long long seed) : total(0), n(0), buffered(0)
+{
+	for (int l = 0; l < 8; ++l)
+		acc[l] = (l & 1 ? P2 : P3) * (l + 1) + seed;
+}
+
+bool FastHash::vectorised()
+{
+	return sse2;
+}
+
+void FastHash::stripes(const unsigned char *p, size_t count)
+{
+	if (sse2)
+		stripesSse2(acc, n, p, count);
+	else
+		stripesPlain(acc, n, p, count);
+}
+
+void FastHash::update(const void *data, size_t size)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	total += size;
+
+	if (buffered)
+	{
+		const size_t take = size < 64 - buffered ? size : 64 - buffered;
+		memcpy(buf + buffered, p, take);
+		buffered += take;
+		p += take;
+		size -= take;
+		if (buffered < 64)
+			return;
+		stripes(buf, 1);
+		buffered = 0;
+	}
+
+	stripes(p, size / 64);
+	p += size & ~static_cast<size_t>(63);
+	buffered = size & 63;
+	memcpy(buf, p, buffered);
+}
+
+void FastHash::update(unsigned long long value)
+{
+	unsigned char b[8];
+	for (int i = 0; i < 8; ++i)
+		b[i] = static_cast<unsigned char>(value >> (8 * i));
+	update(b, sizeof(b));
+}
+
+unsigned long long FastHash::digest() const
+{
+	u64 lanes[8];
+	memcpy(lanes, acc, sizeof(lanes));
+	if (buffered)
+	{
+		unsigned char last[64] = {};
+		memcpy(last, buf, buffered);
+		unsigned scrambles = n;
+		stripesPlain(lanes, scrambles, last, 1);
+	}
+
+	u64 h = total * P1;
+	for (int l = 0; l < 8; ++l)
+	{
+		h ^= rotl(lanes[l] * P2, 31) * P1;
+		h = rotl(h, 27) * P1 + P4;
+	}
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+// === A fast 64-bit hash, for fingerprints and content hashes rather than tables. ===
+// Built like XXH3: 64-byte stripes are folded into eight 64-bit lanes with a 32x32->64 multiply
+// each, and the lanes are scrambled every 1KB. The lanes map onto SSE2 registers directly, and
+// SSE2 is used when the CPU has it. The plain version gives identical results, so hashes
+// can be compared between machines. It is not XXH3, and not for anything an attacker controls.
+//
+// Incremental: feeding the same bytes in any number of pieces gives the same hash.
+class FastHash
+{
+public:
+	explicit FastHash(unsigned long long seed = 0);
+
+	void update(const void *data, size_t size);
+	void update(unsigned long long value); // little-endian, 8 bytes.
+	unsigned long long digest() const;
+
+	// Whether update() is using SSE2 on this machine.
+	static bool vectorised();
+
+private:
+	void stripes(const unsigned char *p, size_t n);
+
+	unsigned long long acc[8];
+	unsigned long long total;
+	unsigned n; // stripes since the last scramble.
+	unsigned char buf[64];
+	size_t buffered;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <windows.h>
+#include <fileref.h>
+#include <string>
+
+// A read-only TagLib::FileAccessor over a file on disk, through Win32 rather than the CRT, so that
+// callers choose how it's opened. isOpen() is false if it couldn't be.
+struct Win32FileAccessor : public TagLib::FileAccessor
+{
+	Win32FileAccessor(const std::wstring &path, DWORD flags = 0) : path(path)
+	{
+		file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, flags, NULL);
+	}
+
+	~Win32FileAccessor()
+	{
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+	}
+
+	HANDLE file;
+	std::wstring path;
+
+	// The whole size, which tell() can't give past 2GB. 0 if unknown.
+	ULONGLONG size() const
+	{
+		LARGE_INTEGER li;
+		return GetFileSizeEx(file, &li) ? li.QuadPart : 0;
+	}
+
+	bool isOpen() const
+	{
+		return file != INVALID_HANDLE_VALUE;
+	}
+
+	size_t fread(void *pv, size_t s1, size_t s2) const
+	{
+		DWORD read = 0;
+		if (!ReadFile(file, pv, static_cast<DWORD>(s1*s2), &read, NULL))
+			return 0;
+		return read;
+	}
+
+	size_t fwrite(const void *,size_t,size_t)
+	{
+		return 0;
+	}
+
+	int fseek(long distance, int direction)
+	{
+		LARGE_INTEGER dist;
+		dist.QuadPart = distance;
+		return !SetFilePointerEx(file, dist, NULL, direction); // SEEK_* match FILE_BEGIN etc.; 0 on success.
+	}
+
+	void clearError()
+	{
+	}
+
+	long tell() const
+	{
+		LARGE_INTEGER dist = {}, pos;
+		if (!SetFilePointerEx(file, dist, &pos, FILE_CURRENT))
+			return -1;
+		return static_cast<long>(pos.QuadPart);
+	}
+
+	int truncate(long)
+	{
+		return -1; // error
+	}
+
+	TagLib::FileNameHandle name() const
+	{
+		return TagLib::FileName(path.c_str());
+	}
+
+	bool readOnly() const
+	{
+		return true;
+	}
+
+private:
+	Win32FileAccessor(const Win32FileAccessor &);
+	Win32FileAccessor &operator=(const Win32FileAccessor &);
+};
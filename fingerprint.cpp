@@ -0,0 +1,173 @@
+#include "fingerprint.h"
+#include "accessorutil.h"
+#include "container.h"
+#include "fasthash.h"
+
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const unsigned long long whole = 64 * 1024; // regions bigger than this are sampled.
+	const unsigned maxBlocks = 4096;            // FLAC metadata blocks.
+
+	unsigned le32(const unsigned char *p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned>(p[3]) << 24);
+	}
+
+	class Fingerprint
+	{
+	public:
+		Fingerprint(TagLib::FileAccessor &file, unsigned long long size) : file(file), size(size), read(0)
+		{
+			h.update(size);
+		}
+
+		// Exactly n bytes at off, or false.
+		bool readAt(unsigned long long off, void *buf, size_t n)
+		{
+			if (off > size || size - off < n || seekTo(file, off))
+				return false;
+			const size_t got = file.fread(buf, 1, n);
+			read += got;
+			return got == n;
+		}
+
+		void region(unsigned long long off, unsigned long long len)
+		{
+			if (off > size)
+				off = size;
+			if (len > size - off)
+				len = size - off;
+			h.update(off);
+			h.update(len);
+			if (len <= whole)
+				hash(off, static_cast<size_t>(len));
+			else
+			{
+				hash(off, static_cast<size_t>(whole / 2));
+				hash(off + len - whole / 2, static_cast<size_t>(whole / 2));
+			}
+		}
+
+		// Where and how big something is, without its contents.
+		void place(unsigned long long off, unsigned long long len)
+		{
+			h.update(off);
+			h.update(len);
+		}
+
+		unsigned long long digest() const { return h.digest(); }
+
+		TagLib::FileAccessor &file;
+		const unsigned long long size;
+		unsigned long long read;
+
+	private:
+		void hash(unsigned long long off, size_t len)
+		{
+			buf.resize(len);
+			if (len && readAt(off, &buf[0], len))
+				h.update(&buf[0], len);
+		}
+
+		FastHash h;
+		std::vector<unsigned char> buf;
+	};
+
+	// Returns where it ends, or 0 if there isn't one.
+	unsigned long long id3v2(Fingerprint &f)
+	{
+		unsigned char b[10];
+		if (!f.readAt(0, b, sizeof(b)) || memcmp(b, "ID3", 3))
+			return 0;
+		unsigned long long end = 10 + ((b[6] & 0x7f) << 21 | (b[7] & 0x7f) << 14 | (b[8] & 0x7f) << 7 | (b[9] & 0x7f));
+		if (b[5] & 0x10)
+			end += 10; // footer.
+		f.region(0, end);
+		return end;
+	}
+
+	bool flac(Fingerprint &f, unsigned long long pos)
+	{
+		unsigned char b[4];
+		if (!f.readAt(pos, b, 4) || memcmp(b, "fLaC", 4))
+			return false;
+		pos += 4;
+		for (unsigned i = 0; i < maxBlocks && f.readAt(pos, b, 4); ++i)
+		{
+			const unsigned type = b[0] & 0x7f;
+			const unsigned long long len = 4 + ((b[1] << 16) | (b[2] << 8) | b[3]);
+			if (type == 1) // PADDING
+				f.place(pos, len);
+			else
+				f.region(pos, len);
+			pos += len;
+			if ((b[0] & 0x80) || type == 127)
+				break;
+		}
+		return true;
+	}
+
+	// MP4, RIFF or AIFF: where the tags are, from the box and chunk headers.
+	bool container(Fingerprint &f)
+	{
+		ContainerInfo info;
+		unsigned long long read;
+		const bool found = readContainerInfo(f.file, f.size, info, &read);
+		f.read += read;
+		if (!found)
+			return false;
+		if (info.kind == CONTAINER_MP4 && info.moovLength)
+			f.place(info.moov, info.moovLength);
+		for (std::vector<ContainerRegion>::const_iterator it = info.tags.begin(); it != info.tags.end(); ++it)
+			f.region(it->offset, it->length);
+		return true;
+	}
+
+	void tail(Fingerprint &f)
+	{
+		unsigned long long end = f.size;
+		unsigned char b[128];
+		if (f.size >= 128)
+		{
+			f.region(f.size - 128, 128);
+			if (f.readAt(f.size - 128, b, 3) && !memcmp(b, "TAG", 3))
+				end -= 128;
+		}
+
+		if (end >= 32 && f.readAt(end - 32, b, 32) && !memcmp(b, "APETAGEX", 8))
+		{
+			// The size counts the items and footer; the header, if there is one, is on top.
+			unsigned long long len = le32(b + 12);
+			if (le32(b + 20) & 0x80000000)
+				len += 32;
+			if (len <= end)
+				f.region(end - len, len);
+		}
+	}
+}
+
+unsigned long long tagFingerprint(TagLib::FileAccessor &file, unsigned long long size, unsigned long long *bytesRead)
+{
+	Fingerprint f(file, size);
+	const unsigned long long start = id3v2(f);
+
+	if (!flac(f, start) && !container(f) && !start)
+	{
+		// MPEG audio with no ID3v2 has nothing at the start to look at.
+		unsigned char b[2];
+		if (!f.readAt(0, b, 2) || b[0] != 0xff || (b[1] & 0xe0) != 0xe0)
+		{
+			f.region(0, whole);
+			if (size > whole)
+				f.region(size - whole, whole);
+		}
+	}
+	tail(f);
+
+	if (bytesRead)
+		*bytesRead = f.read;
+	return f.digest();
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <fileref.h>
+
+// === Tag fingerprints: a hash of just the parts of a file that hold its tags. ===
+// For checking a cached snapshot when size and mtime can't be trusted: network shares, restored
+// backups, and taggers that put the mtime back. It takes a few KB of reads, where re-parsing takes
+// a full open.
+//
+// The regions, found from the bytes rather than the extension:
+//  - an ID3v2 tag at the start, header and body;
+//  - the last 128 bytes (ID3v1), and an APE tag, with its header, before them or at the end;
+//  - FLAC metadata blocks, after any ID3v2. Padding counts only by its place and size;
+//  - MP4: the moov box's place and size, and every udta and meta box directly inside it;
+//  - RIFF and AIFF: their tag chunks (LIST, ID3, and AIFF's text chunks); see container.h;
+//  - anything else (Ogg, ASF...): the first and last 64KB.
+// Each region counts with its offset and length. One over 64KB is sampled: its first and last
+// 32KB. A change that keeps every size and only touches the middle of a big picture is missed.
+//
+// The file's size is part of it too. Two files with the same fingerprint almost certainly have the
+// same tags; the audio isn't looked at.
+unsigned long long tagFingerprint(TagLib::FileAccessor &file, unsigned long long size, unsigned long long *bytesRead = NULL);
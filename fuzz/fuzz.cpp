@@ -0,0 +1,304 @@
+#include "../exttag.h"
+#include "../extract.h"
+#include "../headerinfo.h"
+#include "../inflate.h"
+#include "../memaccessor.h"
+#include "../xiphscan.h"
+
+#include <windows.h>
+#include <propvarutil.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <new>
+
+// Drives arbitrary bytes through TagLib and every exttag.h reader, through readFileProperties() as
+//  the handler reads a file, and through readXiphFile() on its own; once per extension the handler
+//  is registered for (handledExtensions, as setup.cpp's), as the readers and FileRef pick the parser
+//  from the name. Then through the inflater archive members and .tar.gz are read with, as raw
+//  deflate and as gzip.
+//
+// Build with TLH_LIBFUZZER defined (clang-cl -fsanitize=fuzzer) for coverage-guided fuzzing;
+//  there, libFuzzer's own -timeout= and -rss_limit_mb= are the ceilings.
+// Otherwise, this is a regression runner over a corpus:
+//   fuzz [-t max-ms] [-m max-bytes] [-o fixture-dir] file-or-dir...
+// Every input is timed and has its heap use measured; anything over half of a ceiling is copied
+//  into the fixture directory, and anything over a ceiling fails the run.
+
+// Calls the reader, swallowing the domain_error that means "not present".
+// Anything else escaping is a bug, and is left to crash the fuzzer.
+#define EXERCISE(func) try { func(f); } catch (std::domain_error &) {}
+
+static void exercise(const TagLib::FileRef &f)
+{
+	if (f.isNull())
+		return;
+
+	if (const TagLib::AudioProperties *ap = f.audioProperties())
+	{
+		ap->channels(); ap->length(); ap->bitrate(); ap->sampleRate();
+	}
+
+	const TagLib::Tag *tag = f.tag();
+	if (!tag || tag->isEmpty())
+		return;
+
+	tag->album().toWString(); tag->artist().toWString(); tag->genre().toWString();
+	tag->title().toWString(); tag->comment().toWString(); tag->track(); tag->year();
+
+	EXERCISE(rating)
+	EXERCISE(albumArtist)
+	EXERCISE(keywords)
+	EXERCISE(releasedate)
+	EXERCISE(composer)
+	EXERCISE(conductor)
+	EXERCISE(subtitle)
+	EXERCISE(label)
+	EXERCISE(producer)
+	EXERCISE(mood)
+	EXERCISE(copyright)
+	EXERCISE(partofset)
+}
+
+static void clear(std::vector<PROPVARIANT> &values)
+{
+	for (size_t i = 0; i < values.size(); ++i)
+		PropVariantClear(&values[i]);
+	values.clear();
+}
+
+// The input, for the inflater, a few bytes at a time so that its refills are exercised too.
+struct FuzzSource : OnePassAccessor::Source
+{
+	FuzzSource(const unsigned char *p, size_t n) : p(p), n(n) {}
+	const unsigned char *p;
+	size_t n;
+
+	bool read(void *buf, ULONG size, ULONG *got)
+	{
+		*got = static_cast<ULONG>(std::min(std::min(n, static_cast<size_t>(7)), static_cast<size_t>(size)));
+		memcpy(buf, p, *got);
+		p += *got;
+		n -= *got;
+		return true;
+	}
+};
+
+// Inflates everything there is, to nowhere; deflate can't grow anything more than about 1032 times.
+static void inflate(const unsigned char *data, size_t size, bool gzip)
+{
+	FuzzSource source(data, size);
+	Inflater inflater(source, gzip);
+	char buf[4096];
+	ULONG got;
+	while (inflater.read(buf, sizeof(buf), &got) && got)
+		;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	for (size_t i = 0; i < handledExtensionCount; ++i)
+	{
+		const std::wstring name = std::wstring(L"fuzz.") + handledExtensions[i];
+		TagLib::FileRef f(new MemoryAccessor(data, size, name));
+		exercise(f);
+
+		std::vector<PROPVARIANT> values;
+		readFileProperties(new MemoryAccessor(data, size, name), size, name, values);
+		clear(values);
+
+		MemoryAccessor accessor(data, size, name);
+		XiphTags tags;
+		HeaderInfo header;
+		if (readXiphFile(accessor, size, name, tags, header))
+		{
+			values.resize(keyCount);
+			for (size_t k = 0; k < keyCount; ++k)
+			{
+				PropVariantInit(&values[k]);
+				readXiphProperty(tags, header, keys[k], &values[k]);
+			}
+			clear(values);
+		}
+	}
+	inflate(data, size, false);
+	inflate(data, size, true);
+	return 0;
+}
+
+#ifndef TLH_LIBFUZZER
+
+// === Heap accounting. ===
+// Every allocation carries its size in a header, so the live and peak totals are exact.
+// The runner is single threaded, so plain counters are fine.
+
+static size_t allocLive = 0, allocPeak = 0, allocCount = 0;
+
+union AllocHeader
+{
+	size_t size;
+	double align; // keep the payload aligned as malloc's would be.
+	char pad[16];
+};
+
+static void *countedAlloc(size_t size)
+{
+	AllocHeader *h = static_cast<AllocHeader *>(malloc(sizeof(AllocHeader) + size));
+	if (!h)
+		throw std::bad_alloc();
+	h->size = size;
+	allocLive += size;
+	++allocCount;
+	if (allocLive > allocPeak)
+		allocPeak = allocLive;
+	return h + 1;
+}
+
+static void countedFree(void *p)
+{
+	if (!p)
+		return;
+	AllocHeader *h = static_cast<AllocHeader *>(p) - 1;
+	allocLive -= h->size;
+	free(h);
+}
+
+void *operator new(size_t size) { return countedAlloc(size); }
+void *operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void *p) { countedFree(p); }
+void operator delete[](void *p) { countedFree(p); }
+
+struct Result
+{
+	double ms;
+	size_t peak;
+	size_t allocs;
+};
+
+static Result run(const std::vector<unsigned char> &buf)
+{
+	LARGE_INTEGER freq, start, end;
+	QueryPerformanceFrequency(&freq);
+
+	allocPeak = allocLive;
+	const size_t base = allocLive, baseCount = allocCount;
+
+	QueryPerformanceCounter(&start);
+	LLVMFuzzerTestOneInput(buf.empty() ? NULL : &buf[0], buf.size());
+	QueryPerformanceCounter(&end);
+
+	Result r;
+	r.ms = (end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+	r.peak = allocPeak - base;
+	r.allocs = allocCount - baseCount;
+	return r;
+}
+
+static bool readFile(const std::wstring &path, std::vector<unsigned char> &buf)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in)
+		return false;
+	buf.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return true;
+}
+
+static void saveFixture(const std::wstring &dir, const wchar_t *why, const std::wstring &path,
+	const std::vector<unsigned char> &buf)
+{
+	const size_t slash = path.find_last_of(L"\\/");
+	const std::wstring leaf = slash == std::wstring::npos ? path : path.substr(slash + 1);
+	const std::wstring out = dir + L"\\" + why + L"-" + leaf;
+	std::ofstream o(out.c_str(), std::ios::binary);
+	if (!buf.empty())
+		o.write(reinterpret_cast<const char *>(&buf[0]), buf.size());
+	std::wcout << L"  saved " << out << std::endl;
+}
+
+static void collect(const std::wstring &path, std::vector<std::wstring> &files)
+{
+	const DWORD attr = GetFileAttributes(path.c_str());
+	if (attr == INVALID_FILE_ATTRIBUTES)
+		return;
+	if (!(attr & FILE_ATTRIBUTE_DIRECTORY))
+	{
+		files.push_back(path);
+		return;
+	}
+
+	WIN32_FIND_DATA fd;
+	HANDLE h = FindFirstFile((path + L"\\*").c_str(), &fd);
+	if (h == INVALID_HANDLE_VALUE)
+		return;
+	do
+		if (wcscmp(fd.cFileName, L".") && wcscmp(fd.cFileName, L".."))
+			collect(path + L"\\" + fd.cFileName, files);
+	while (FindNextFile(h, &fd));
+	FindClose(h);
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+	double maxMs = 1000;
+	size_t maxBytes = 64 << 20;
+	std::wstring fixtures = L"fixtures";
+	std::vector<std::wstring> files;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::wstring arg = argv[i];
+		if (arg == L"-t" && i + 1 < argc)
+			maxMs = _wtof(argv[++i]);
+		else if (arg == L"-m" && i + 1 < argc)
+			maxBytes = _wtoi64(argv[++i]);
+		else if (arg == L"-o" && i + 1 < argc)
+			fixtures = argv[++i];
+		else
+			collect(arg, files);
+	}
+
+	if (files.empty())
+	{
+		std::wcerr << L"usage: fuzz [-t max-ms] [-m max-bytes] [-o fixture-dir] file-or-dir..." << std::endl;
+		return 2;
+	}
+
+	CreateDirectory(fixtures.c_str(), NULL);
+
+	int failures = 0;
+	Result worst = {};
+	for (std::vector<std::wstring>::const_iterator it = files.begin(); it != files.end(); ++it)
+	{
+		std::vector<unsigned char> buf;
+		if (!readFile(*it, buf))
+			continue;
+
+		const Result r = run(buf);
+		if (r.ms > worst.ms) worst.ms = r.ms;
+		if (r.peak > worst.peak) worst.peak = r.peak;
+		if (r.allocs > worst.allocs) worst.allocs = r.allocs;
+
+		const bool slow = r.ms > maxMs, large = r.peak > maxBytes;
+		if (slow || large || r.ms > maxMs / 2 || r.peak > maxBytes / 2)
+		{
+			std::wcout << (slow || large ? L"FAIL " : L"warn ") << *it << L": " << r.ms << L"ms, "
+				<< r.peak << L" bytes peak, " << r.allocs << L" allocations" << std::endl;
+			if (r.ms > maxMs / 2)
+				saveFixture(fixtures, L"slow", *it, buf);
+			if (r.peak > maxBytes / 2)
+				saveFixture(fixtures, L"large", *it, buf);
+		}
+		if (slow || large)
+			++failures;
+	}
+
+	std::wcout << files.size() << L" inputs; worst " << worst.ms << L"ms, " << worst.peak << L" bytes peak, "
+		<< worst.allocs << L" allocations; " << failures << L" over the ceiling" << std::endl;
+	return failures ? 1 : 0;
+}
+
+#endif
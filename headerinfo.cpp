@@ -0,0 +1,75 @@
+#include "headerinfo.h"
+#include "container.h"
+#include "extract.h"
+#include "mpegscan.h"
+#include "oggscan.h"
+#include "xiphscan.h"
+
+#include <propkey.h>
+
+bool readHeaderInfo(TagLib::FileAccessor &file, ULONGLONG size, const std::wstring &name, HeaderInfo &info,
+	ULONGLONG *bytesRead)
+{
+	if (bytesRead)
+		*bytesRead = 0;
+	if (mpegFileName(name))
+	{
+		MpegInfo mpeg;
+		if (!readMpegInfo(file, size, mpeg, MPEG_SAMPLED, bytesRead))
+			return false;
+		info.duration = mpeg.duration();
+		info.bitrate = mpeg.bitrate;
+		return true;
+	}
+	if (oggFileName(name))
+	{
+		OggInfo ogg;
+		if (!readOggInfo(file, size, ogg, bytesRead))
+			return false;
+		info.duration = ogg.duration();
+		info.bitrate = 0; // TagLib's, from the identification header, stands.
+		return true;
+	}
+	if (flacFileName(name))
+	{
+		// TagLib's is in whole seconds.
+		FlacInfo flac;
+		if (!readFlacInfo(file, size, flac, bytesRead))
+			return false;
+		info.duration = flac.duration();
+		info.bitrate = flac.bitrate();
+		return true;
+	}
+	if (containerFileName(name))
+	{
+		ContainerInfo container;
+		if (!readContainerInfo(file, size, container, bytesRead) || !container.duration)
+			return false;
+		info.duration = container.duration;
+		info.bitrate = container.bitrate;
+		return true;
+	}
+	return false;
+}
+
+HRESULT readHeaderProperty(const TagLib::FileRef &file, const HeaderInfo &info, REFPROPERTYKEY key, PROPVARIANT *pv)
+{
+	const HRESULT hr = readProperty(file, key, pv);
+	if (file.isNull())
+		return hr;
+	if (IsEqualPropertyKey(key, PKEY_Media_Duration))
+	{
+		PropVariantClear(pv);
+		pv->uhVal.QuadPart = info.duration;
+		pv->vt = VT_UI8;
+		return S_OK;
+	}
+	if (IsEqualPropertyKey(key, PKEY_Audio_EncodingBitrate) && info.bitrate)
+	{
+		PropVariantClear(pv);
+		pv->uintVal = info.bitrate;
+		pv->vt = VT_UI4;
+		return S_OK;
+	}
+	return hr;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <windows.h>
+#include <fileref.h>
+#include <propsys.h>
+
+#include <string>
+
+// === Lengths from the formats' own headers, where TagLib's would be a guess or a long read. ===
+// MPEG from the Xing or VBRI header (mpegscan.h), Ogg from the last page (oggscan.h), FLAC from
+//  STREAMINFO (xiphscan.h), and MP4, WAV and AIFF from their box and chunk headers (container.h);
+//  the name's extension says which is tried. Only the length and bitrate come from these; the tags
+//  are TagLib's, or id3scan's or xiphscan's, and for MP4, WAV and AIFF always TagLib's.
+
+struct HeaderInfo
+{
+	ULONGLONG duration; // in 100ns units.
+	unsigned bitrate;   // average, in bits per second; 0 if not known.
+};
+
+// False if the name isn't one of those formats', or its headers couldn't be read.
+bool readHeaderInfo(TagLib::FileAccessor &file, ULONGLONG size, const std::wstring &name, HeaderInfo &info,
+	ULONGLONG *bytesRead = NULL);
+
+// readProperty(), with PKEY_Media_Duration, and PKEY_Audio_EncodingBitrate where known, from info.
+HRESULT readHeaderProperty(const TagLib::FileRef &file, const HeaderInfo &info, REFPROPERTYKEY key, PROPVARIANT *pv);
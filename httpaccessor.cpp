@@ -0,0 +1,320 @@
+#include "httpaccessor.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cwctype>
+#include <sstream>
+
+namespace
+{
+	const ULONGLONG suffix = ~0ULL;
+
+	double now()
+	{
+		LARGE_INTEGER freq, t;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&t);
+		return static_cast<double>(t.QuadPart) / freq.QuadPart;
+	}
+
+	std::wstring header(HINTERNET req, DWORD which)
+	{
+		wchar_t buf[128];
+		DWORD len = sizeof(buf);
+		if (!WinHttpQueryHeaders(req, which, WINHTTP_HEADER_NAME_BY_INDEX, buf, &len, WINHTTP_NO_HEADER_INDEX))
+			return std::wstring();
+		return std::wstring(buf, len / sizeof(wchar_t));
+	}
+
+	// "bytes first-last/total", or "bytes */total" on a 416. A total of "*", not known, is no use
+	//  to a reader that needs the length, and is taken as a failure.
+	bool contentRange(const std::wstring &s, ULONGLONG &first, ULONGLONG &total)
+	{
+		const std::wstring::size_type sp = s.find(L' '), slash = s.find(L'/');
+		if (sp == std::wstring::npos || slash == std::wstring::npos || !iswdigit(s.c_str()[slash + 1]))
+			return false;
+		first = _wcstoui64(s.c_str() + sp + 1, NULL, 10);
+		total = _wcstoui64(s.c_str() + slash + 1, NULL, 10);
+		return true;
+	}
+}
+
+HttpClient::HttpClient()
+	: handle(WinHttpOpen(L"tlh/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0))
+{
+}
+
+HttpClient::~HttpClient()
+{
+	if (handle)
+		WinHttpCloseHandle(handle);
+}
+
+HttpAccessor::HttpAccessor(HttpClient &client, const std::wstring &url, const Options &options)
+	: client(client), url(url), port(0), secure(false), opts(options), length(0), opened(false), pos(0)
+{
+	const Stats zero = {};
+	st = zero;
+	if (!opts.block)
+		opts.block = 16 * 1024;
+
+	URL_COMPONENTS uc = {};
+	uc.dwStructSize = sizeof(uc);
+	uc.dwHostNameLength = uc.dwUrlPathLength = uc.dwExtraInfoLength = static_cast<DWORD>(-1);
+	if (!client.session() || !WinHttpCrackUrl(url.c_str(), 0, 0, &uc))
+		return;
+	host.assign(uc.lpszHostName, uc.dwHostNameLength);
+	path.assign(uc.lpszUrlPath, uc.dwUrlPathLength);
+	leaf = path.substr(path.rfind(L'/') + 1); // TagLib goes by the extension.
+	path.append(uc.lpszExtraInfo, uc.dwExtraInfoLength);
+	port = uc.nPort;
+	secure = uc.nScheme == INTERNET_SCHEME_HTTPS;
+
+	const double start = now();
+	if (opts.naive || !opts.speculate)
+	{
+		// Just the size.
+		Fetch f = { this, 0, opts.naive ? 1 : opts.block };
+		opened = fetch(f);
+		length = f.total;
+		if (!opts.naive)
+			keep(f);
+		++st.requests;
+		st.bytes += f.data.size();
+	}
+	else
+	{
+		Fetch head = { this, 0, opts.speculate }, tail = { this, suffix, opts.speculate };
+		HANDLE thread = CreateThread(NULL, 0, fetchThread, &tail, 0, NULL);
+		fetch(head);
+		if (thread)
+		{
+			WaitForSingleObject(thread, INFINITE);
+			CloseHandle(thread);
+		}
+		else
+			fetch(tail);
+
+		opened = head.ok || tail.ok;
+		length = head.ok ? head.total : tail.total;
+		keep(head);
+		keep(tail);
+		st.requests += 2;
+		st.bytes += head.data.size() + tail.data.size();
+	}
+	st.seconds += now() - start;
+}
+
+HttpAccessor::~HttpAccessor()
+{
+}
+
+DWORD WINAPI HttpAccessor::fetchThread(LPVOID param)
+{
+	Fetch &f = *static_cast<Fetch *>(param);
+	f.owner->fetch(f);
+	return 0;
+}
+
+bool HttpAccessor::fetch(Fetch &f) const
+{
+	f.ok = false;
+	f.start = f.total = 0;
+	f.data.clear();
+
+	std::wstringstream range;
+	range << L"Range: bytes=";
+	if (f.first == suffix)
+		range << L"-" << f.count;
+	else
+		range << f.first << L"-" << f.first + f.count - 1;
+
+	HINTERNET connect = WinHttpConnect(client.session(), host.c_str(), port, 0);
+	HINTERNET req = connect ? WinHttpOpenRequest(connect, L"GET", path.c_str(), NULL, WINHTTP_NO_REFERER,
+		WINHTTP_DEFAULT_ACCEPT_TYPES, secure ? WINHTTP_FLAG_SECURE : 0) : NULL;
+	if (req && WinHttpSendRequest(req, range.str().c_str(), static_cast<DWORD>(-1), WINHTTP_NO_REQUEST_DATA, 0, 0, 0)
+		&& WinHttpReceiveResponse(req, NULL))
+	{
+		DWORD status = 0, len = sizeof(status);
+		WinHttpQueryHeaders(req, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER, WINHTTP_HEADER_NAME_BY_INDEX,
+			&status, &len, WINHTTP_NO_HEADER_INDEX);
+
+		for (DWORD avail; WinHttpQueryDataAvailable(req, &avail) && avail; )
+		{
+			const size_t at = f.data.size();
+			f.data.resize(at + avail);
+			DWORD got = 0;
+			if (!WinHttpReadData(req, &f.data[at], avail, &got))
+				break;
+			f.data.resize(at + got);
+		}
+
+		if (status == 206 || status == 416)
+			f.ok = contentRange(header(req, WINHTTP_QUERY_CONTENT_RANGE), f.start, f.total);
+		else if (status == 200)
+		{
+			// The whole object; keep just what was asked for.
+			f.ok = true;
+			f.total = f.data.size();
+			const ULONGLONG first = f.first == suffix ? f.total - std::min<ULONGLONG>(f.count, f.total) : std::min(f.first, f.total);
+			const ULONGLONG count = std::min(f.count, f.total - first);
+			f.data.erase(f.data.begin() + static_cast<size_t>(first + count), f.data.end());
+			f.data.erase(f.data.begin(), f.data.begin() + static_cast<size_t>(first));
+			f.start = first;
+		}
+		if (status == 416)
+			f.data.clear();
+	}
+	if (req)
+		WinHttpCloseHandle(req);
+	if (connect)
+		WinHttpCloseHandle(connect);
+	return f.ok;
+}
+
+// Caches the whole blocks in what was fetched, and the last block of the object, which may be short.
+void HttpAccessor::keep(const Fetch &f) const
+{
+	// A server that says the object ends before what it sent isn't believed.
+	const ULONGLONG end = f.start + f.data.size();
+	if (!f.ok || opts.naive || end > f.total)
+		return;
+	for (ULONGLONG b = (f.start + opts.block - 1) / opts.block; b * opts.block < end; ++b)
+	{
+		const ULONGLONG from = b * opts.block, to = std::min<ULONGLONG>(from + opts.block, f.total);
+		if (to > end || cache.count(b))
+			continue;
+		lru.push_front(b);
+		std::pair<std::vector<char>, lru_t::iterator> &slot = cache[b];
+		slot.first.assign(f.data.begin() + static_cast<size_t>(from - f.start), f.data.begin() + static_cast<size_t>(to - f.start));
+		slot.second = lru.begin();
+		while (cache.size() > opts.blocks)
+		{
+			cache.erase(lru.back());
+			lru.pop_back();
+		}
+	}
+}
+
+const std::vector<char> *HttpAccessor::block(ULONGLONG n) const
+{
+	const std::map<ULONGLONG, std::pair<std::vector<char>, lru_t::iterator> >::iterator it = cache.find(n);
+	if (it == cache.end())
+		return NULL;
+	lru.splice(lru.begin(), lru, it->second.second);
+	return &it->second.first;
+}
+
+bool HttpAccessor::fill(ULONGLONG first, ULONGLONG last) const
+{
+	// Runs of missing blocks, joined across small gaps.
+	std::vector<std::pair<ULONGLONG, ULONGLONG> > runs;
+	for (ULONGLONG b = first; b <= last; ++b)
+	{
+		if (block(b))
+			continue;
+		if (!runs.empty() && b - runs.back().second <= opts.gap + 1)
+			runs.back().second = b;
+		else
+			runs.push_back(std::make_pair(b, b));
+	}
+
+	bool ok = true;
+	for (size_t i = 0; i < runs.size(); ++i)
+	{
+		const double start = now();
+		const ULONGLONG from = runs[i].first * opts.block;
+		Fetch f = { this, from, std::min<ULONGLONG>((runs[i].second + 1) * opts.block, length) - from };
+		ok = fetch(f) && ok;
+		keep(f);
+		++st.requests;
+		st.bytes += f.data.size();
+		st.seconds += now() - start;
+	}
+	return ok;
+}
+
+bool HttpAccessor::isOpen() const
+{
+	return opened;
+}
+
+size_t HttpAccessor::fread(void *pv, size_t s1, size_t s2) const
+{
+	if (!opened || pos >= length)
+		return 0;
+	const size_t n = static_cast<size_t>(std::min<ULONGLONG>(s1 * s2, length - pos));
+	if (!n)
+		return 0;
+
+	const ULONGLONG first = pos / opts.block, last = (pos + n - 1) / opts.block;
+	if (opts.naive || last - first + 1 > opts.blocks / 2)
+	{
+		// Too big to go through the cache, or not using it.
+		const double start = now();
+		Fetch f = { this, pos, n };
+		fetch(f);
+		++st.requests;
+		st.bytes += f.data.size();
+		st.seconds += now() - start;
+		const size_t got = f.start == pos ? std::min(n, f.data.size()) : 0;
+		if (got)
+			memcpy(pv, &f.data[0], got);
+		pos += got;
+		return got;
+	}
+
+	fill(first, last);
+	char *out = static_cast<char *>(pv);
+	size_t done = 0;
+	while (done < n)
+	{
+		const std::vector<char> *b = block(pos / opts.block);
+		const size_t off = static_cast<size_t>(pos % opts.block);
+		if (!b || off >= b->size())
+			break;
+		const size_t take = std::min(n - done, b->size() - off);
+		memcpy(out + done, &(*b)[off], take);
+		done += take;
+		pos += take;
+	}
+	return done;
+}
+
+size_t HttpAccessor::fwrite(const void *, size_t, size_t)
+{
+	return 0;
+}
+
+int HttpAccessor::fseek(long distance, int direction)
+{
+	const LONGLONG base = direction == SEEK_SET ? 0 : direction == SEEK_CUR ? static_cast<LONGLONG>(pos) : static_cast<LONGLONG>(length);
+	if (base + distance < 0)
+		return -1;
+	pos = base + distance;
+	return 0;
+}
+
+void HttpAccessor::clearError()
+{
+}
+
+long HttpAccessor::tell() const
+{
+	return static_cast<long>(pos);
+}
+
+int HttpAccessor::truncate(long)
+{
+	return -1; // error
+}
+
+TagLib::FileNameHandle HttpAccessor::name() const
+{
+	return TagLib::FileName(leaf.c_str());
+}
+
+bool HttpAccessor::readOnly() const
+{
+	return true;
+}
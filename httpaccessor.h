@@ -0,0 +1,104 @@
+#pragma once
+
+#include <windows.h>
+#include <winhttp.h>
+#include <fileref.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+// === Reading files over HTTP range requests, as from an object store. ===
+// TagLib reads in many small pieces, and over HTTP each would be a request of its own, so an
+//  HttpAccessor reads through a small cache of fixed-size blocks:
+//  - a read fetches whichever of its blocks are missing, in as few requests as it can: runs of
+//    missing blocks are fetched together, and so are runs with only a small gap between them;
+//  - opening fetches the head and the tail at once, on two connections, as that's where every
+//    format keeps its tags; the tail is asked for as a suffix range ("bytes=-n"), so the object's
+//    size comes back with it and needn't be asked for first.
+// The server has to honour Range; one that answers 200 with the whole object still works, slowly.
+
+// A WinHTTP session; its connections are kept alive and shared by every accessor using it.
+class HttpClient
+{
+public:
+	HttpClient();
+	~HttpClient();
+	HINTERNET session() const { return handle; }
+
+private:
+	HINTERNET handle;
+	HttpClient(const HttpClient &);
+	HttpClient &operator=(const HttpClient &);
+};
+
+struct HttpAccessor : public TagLib::FileAccessor
+{
+	struct Options
+	{
+		Options() : block(16 * 1024), blocks(64), gap(2), speculate(64 * 1024), naive(false) {}
+		size_t block;     // bytes.
+		size_t blocks;    // cached, per object.
+		size_t gap;       // missing runs this many blocks apart or less are fetched as one.
+		size_t speculate; // bytes of head and tail fetched on opening; 0 for none.
+		bool naive;       // every read its own request, nothing cached; to compare against.
+	};
+
+	struct Stats
+	{
+		unsigned long long requests, bytes;
+		double seconds;   // waiting on requests; the head and tail, fetched together, count once.
+	};
+
+	HttpAccessor(HttpClient &client, const std::wstring &url, const Options &options = Options());
+	~HttpAccessor();
+
+	const Stats &stats() const { return st; }
+	ULONGLONG size() const { return length; }
+
+	bool isOpen() const;
+	size_t fread(void *pv, size_t s1, size_t s2) const;
+	size_t fwrite(const void *, size_t, size_t);
+	int fseek(long distance, int direction);
+	void clearError();
+	long tell() const;
+	int truncate(long);
+	TagLib::FileNameHandle name() const;
+	bool readOnly() const;
+
+private:
+	// One ranged GET: from `first` for `count` bytes, or the last `count` bytes if first is ~0.
+	//  Fills in the object's length from the response.
+	struct Fetch
+	{
+		const HttpAccessor *owner;
+		ULONGLONG first, count;
+		std::vector<char> data;
+		ULONGLONG start, total; // where data starts in the object, and the object's length.
+		bool ok;
+	};
+	static DWORD WINAPI fetchThread(LPVOID);
+	bool fetch(Fetch &f) const;
+	void keep(const Fetch &f) const;
+	bool fill(ULONGLONG first, ULONGLONG last) const; // blocks.
+	const std::vector<char> *block(ULONGLONG n) const;
+
+	HttpClient &client;
+	std::wstring url, host, path, leaf;
+	INTERNET_PORT port;
+	bool secure;
+	Options opts;
+
+	ULONGLONG length;
+	bool opened;
+	mutable ULONGLONG pos;
+	mutable Stats st;
+
+	typedef std::list<ULONGLONG> lru_t;
+	mutable std::map<ULONGLONG, std::pair<std::vector<char>, lru_t::iterator> > cache;
+	mutable lru_t lru; // most recent first.
+
+	HttpAccessor(const HttpAccessor &);
+	HttpAccessor &operator=(const HttpAccessor &);
+};
@@ -0,0 +1,778 @@
+#define NOMINMAX
+
+#include "id3scan.h"
+#include "accessorutil.h"
+#include "extract.h"
+#include "exttag.h"
+#include "unsync.h"
+
+#include <propkey.h>
+#include <propvarutil.h>
+#include <id3v1genres.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+	const size_t windowSize = 16 * 1024;
+
+	unsigned be16(const unsigned char *p) { return p[0] << 8 | p[1]; }
+	unsigned be24(const unsigned char *p) { return p[0] << 16 | p[1] << 8 | p[2]; }
+	unsigned be32(const unsigned char *p) { return static_cast<unsigned>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+	// Seven bits a byte; false if a byte has the eighth set.
+	bool syncsafe(const unsigned char *p, unsigned &n)
+	{
+		if ((p[0] | p[1] | p[2] | p[3]) & 0x80)
+			return false;
+		n = p[0] << 21 | p[1] << 14 | p[2] << 7 | p[3];
+		return true;
+	}
+
+	class Reader
+	{
+	public:
+		Reader(TagLib::FileAccessor &file, ULONGLONG size) : file(file), size(size), read(0) {}
+
+		// Exactly n bytes at off, or false.
+		bool readAt(ULONGLONG off, void *buf, size_t n)
+		{
+			if (off > size || size - off < n || seekTo(file, off))
+				return false;
+			const size_t got = file.fread(buf, 1, n);
+			read += got;
+			return got == n;
+		}
+
+		TagLib::FileAccessor &file;
+		const ULONGLONG size;
+		ULONGLONG read;
+
+	private:
+		Reader &operator=(const Reader &);
+	};
+
+	// The tag's frames, after its header, a window of them at a time; or all of them, undone, when
+	//  the whole tag is unsynchronised.
+	class Window
+	{
+	public:
+		Window(Reader &r, std::vector<unsigned char> &buf, size_t length) : length(length), r(r), buf(buf), start(0), whole(false)
+		{
+			buf.clear();
+		}
+
+		bool readWhole()
+		{
+			buf.resize(length);
+			if (length && !r.readAt(10, &buf[0], length))
+				return false;
+			length = length ? id3Unsync(&buf[0], length) : 0;
+			whole = true;
+			return true;
+		}
+
+		// [at, at + n) of the frames, or NULL if that's past the end.
+		const unsigned char *get(size_t at, size_t n)
+		{
+			if (at > length || length - at < n)
+				return NULL;
+			if (at >= start && at - start + n <= buf.size())
+				return &buf[0] + (at - start);
+			if (whole)
+				return NULL;
+			buf.resize(std::min(length - at, std::max(n, windowSize)));
+			if (!r.readAt(10 + at, &buf[0], buf.size()))
+				return NULL;
+			start = at;
+			return &buf[0];
+		}
+
+		size_t length;
+
+	private:
+		Reader &r;
+		std::vector<unsigned char> &buf;
+		size_t start;
+		bool whole;
+
+		Window &operator=(const Window &);
+	};
+
+	// ID3v2.2's names for the frames that are kept, and for those TagLib throws away, and so reads
+	//  differently.
+	const char *const v22Names[][2] = {
+		{ "TT2", "TIT2" }, { "TP1", "TPE1" }, { "TP2", "TPE2" }, { "TAL", "TALB" }, { "TCO", "TCON" },
+		{ "TRK", "TRCK" }, { "TYE", "TDRC" }, { "TCM", "TCOM" }, { "TP3", "TPE3" }, { "TPB", "TPUB" },
+		{ "TT3", "TIT3" }, { "TCR", "TCOP" }, { "TPA", "TPOS" }, { "TXX", "TXXX" }, { "COM", "COMM" },
+		{ "POP", "POPM" },
+		{ "CRM", NULL }, { "EQU", NULL }, { "LNK", NULL }, { "RVA", NULL }, { "TIM", NULL }, { "TSI", NULL },
+		{ "TDA", NULL },
+	};
+
+	// Frames TagLib throws away: ID3v2.3's that 2.4 dropped, and 2.4 tags with 2.3's dates in them.
+	const char *const v23Dropped[] = { "EQUA", "RVAD", "TIME", "TRDA", "TSIZ", "TDAT" };
+	const char *const v24Dropped[] = { "TYER", "TDAT" };
+
+	const char *const fieldNames[] = { "TIT2", "TPE1", "TPE2", "TALB", "TCON", "TRCK", "TCOM", "TPE3", "TPUB",
+		"TIT3", "TMOO", "TCOP", "TPOS", "POPM" };
+
+	bool named(const char *id, const char *const *names, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			if (!memcmp(id, names[i], 4))
+				return true;
+		return false;
+	}
+
+	unsigned delimiterWidth(unsigned encoding)
+	{
+		return encoding == 1 || encoding == 2 ? 2 : 1;
+	}
+
+	// The first null in [p, end), two on a boundary for UTF-16; end if none.
+	const unsigned char *findDelimiter(const unsigned char *p, const unsigned char *end, unsigned width)
+	{
+		if (width == 1)
+		{
+			const void *q = memchr(p, 0, end - p);
+			return q ? static_cast<const unsigned char *>(q) : end;
+		}
+		for (; end - p >= 2; p += 2)
+			if (!p[0] && !p[1])
+				return p;
+		return end;
+	}
+
+	// A text frame's fields, as TagLib splits them: after the encoding byte, trailing nulls off
+	//  (and one put back to keep UTF-16 whole), then cut at each delimiter. Empty ones are dropped.
+	class Fields
+	{
+	public:
+		Fields(const unsigned char *body, size_t n)
+			: encoding(n ? body[0] : 0), width(delimiterWidth(encoding)), p(body), end(body)
+		{
+			if (n < 2)
+				return;
+			++p;
+			size_t length = n - 1;
+			while (length > 0 && !body[length])
+				--length;
+			while (length % width)
+				++length;
+			end = p + std::min(length, n - 1);
+		}
+
+		bool next(const unsigned char *&field, size_t &n)
+		{
+			while (p < end)
+			{
+				const unsigned char *d = findDelimiter(p, end, width);
+				field = p;
+				n = d - p;
+				p = d == end ? end : d + width;
+				if (n)
+					return true;
+			}
+			return false;
+		}
+
+		const unsigned encoding, width;
+
+	private:
+		const unsigned char *p, *end;
+	};
+
+	// UTF-16 code units, big-endian unless a byte order mark says otherwise, up to a null.
+	struct Utf16
+	{
+		Utf16(const unsigned char *p, size_t n, unsigned encoding) : p(p), end(p + (n & ~static_cast<size_t>(1))), swap(false), valid(true)
+		{
+			if (encoding != 1)
+				return;
+			// TagLib wants a byte order mark, and takes the text as nothing without one.
+			const unsigned bom = this->end - p >= 2 ? be16(p) : 0;
+			valid = bom == 0xFEFF || bom == 0xFFFE;
+			swap = bom == 0xFFFE;
+			this->p += 2;
+		}
+
+		bool next(wchar_t &c)
+		{
+			if (!valid || p == end || !(p[0] | p[1]))
+				return false;
+			c = static_cast<wchar_t>(swap ? p[1] << 8 | p[0] : p[0] << 8 | p[1]);
+			p += 2;
+			return true;
+		}
+
+		const unsigned char *p, *end;
+		bool swap, valid;
+	};
+
+	// A field as TagLib's String would take it, added to out: up to the first null.
+	void appendText(std::wstring &out, const unsigned char *p, size_t n, unsigned encoding)
+	{
+		if (encoding == 1 || encoding == 2)
+		{
+			Utf16 u(p, n, encoding);
+			for (wchar_t c; u.next(c); )
+				out += c;
+			return;
+		}
+		const unsigned char *end = findDelimiter(p, p + n, 1);
+		if (encoding == 0)
+		{
+			out.append(p, end);
+			return;
+		}
+		const int chars = MultiByteToWideChar(CP_UTF8, 0, reinterpret_cast<const char *>(p), static_cast<int>(end - p), NULL, 0);
+		if (chars <= 0)
+			return;
+		const size_t at = out.size();
+		out.resize(at + chars);
+		MultiByteToWideChar(CP_UTF8, 0, reinterpret_cast<const char *>(p), static_cast<int>(end - p), &out[at], chars);
+	}
+
+	// Whether a field is name, ignoring ASCII case, without building a string for it.
+	bool fieldIs(const unsigned char *p, size_t n, unsigned encoding, const char *name)
+	{
+		if (encoding == 1 || encoding == 2)
+		{
+			Utf16 u(p, n, encoding);
+			wchar_t c;
+			for (; *name; ++name)
+				if (!u.next(c) || c > 0x7F || tolower(c) != *name)
+					return false;
+			return !u.next(c);
+		}
+		for (; *name; ++name, ++p, --n)
+			if (!n || tolower(*p) != *name)
+				return false;
+		return !n || !*p;
+	}
+
+	// Whether TagLib would decode every field, or stop.
+	bool textReadable(const unsigned char *p, size_t n)
+	{
+		if (!n || p[0] > 3)
+			return false;
+		if (p[0] != 3 || n == 1)
+			return true;
+		return MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, reinterpret_cast<const char *>(p + 1), static_cast<int>(n - 1), NULL, 0) > 0;
+	}
+
+	// A TXXX with a value, and its description: 0 if not one of those kept.
+	Id3Field userField(const unsigned char *p, size_t n)
+	{
+		Fields f(p, n);
+		const unsigned char *description, *value;
+		size_t length, valueLength;
+		if (!f.next(description, length) || !f.next(value, valueLength))
+			return ID3_FIELDS;
+		if (fieldIs(description, length, f.encoding, "rating"))
+			return ID3_TXXX_RATING;
+		if (fieldIs(description, length, f.encoding, "keywords"))
+			return ID3_TXXX_KEYWORDS;
+		return ID3_FIELDS;
+	}
+
+	// COMM: the encoding, the language, then the description and the text, split at the first
+	//  delimiter. Without both, TagLib has neither.
+	bool splitComment(const unsigned char *p, size_t n, const unsigned char *&text, size_t &textLength, size_t &descriptionLength)
+	{
+		if (n < 5)
+			return false;
+		const unsigned char *const start = p + 4, *const end = p + n;
+		const unsigned width = delimiterWidth(p[0]);
+		const unsigned char *d = findDelimiter(start, end, width);
+		if (d == end || end - d == static_cast<ptrdiff_t>(width))
+			return false;
+		descriptionLength = d - start;
+		text = d + width;
+		textLength = end - text;
+		return true;
+	}
+
+	bool plainComment(const unsigned char *p, size_t n)
+	{
+		const unsigned char *text;
+		size_t textLength, descriptionLength;
+		if (!splitComment(p, n, text, textLength, descriptionLength))
+			return true;
+		std::wstring description;
+		appendText(description, p + 4, descriptionLength, p[0]);
+		return description.empty();
+	}
+
+	bool keep(Id3Tags &tags, Id3Tags::Frame &frame, const unsigned char *p, size_t n, bool unsync)
+	{
+		frame.offset = static_cast<unsigned>(tags.data.size());
+		tags.data.insert(tags.data.end(), p, p + n);
+		if (unsync)
+		{
+			n = id3Unsync(&tags.data[frame.offset], n);
+			tags.data.resize(frame.offset + n);
+		}
+		frame.size = static_cast<unsigned>(n);
+		return n != 0;
+	}
+
+	bool frames(Reader &r, const unsigned char *h, Id3Tags &tags)
+	{
+		const unsigned version = h[3], flags = h[5];
+		unsigned length;
+		// Extended headers, footers and ID3v2.2's compression are TagLib's.
+		if (version < 2 || version > 4 || h[4] == 0xFF || (flags & 0x40) || (version == 4 && (flags & 0x10))
+			|| !syncsafe(h + 6, length) || !length || r.size - 10 < length)
+			return false;
+		tags.version = version;
+
+		Window w(r, tags.window, length);
+		if (version < 4 && (flags & 0x80) && !w.readWhole())
+			return false;
+
+		const size_t header = version == 2 ? 6 : 10;
+		bool plain = false; // whether the COMM kept has no description.
+		for (size_t pos = 0; pos + header < w.length; )
+		{
+			const unsigned char *f = w.get(pos, header);
+			if (!f)
+				return false;
+			if (!f[0])
+				break; // padding.
+
+			char id[4];
+			unsigned size, frameFlags = 0;
+			if (version == 2)
+			{
+				const char *name = "";
+				size_t i = 0;
+				for (; i < sizeof(v22Names) / sizeof(*v22Names); ++i)
+					if (!memcmp(f, v22Names[i][0], 3))
+					{
+						if (!(name = v22Names[i][1]))
+							return false;
+						break;
+					}
+				memcpy(id, f, 3);
+				id[3] = ' ';
+				if (*name)
+					memcpy(id, name, 4);
+				size = be24(f + 3);
+			}
+			else
+			{
+				memcpy(id, f, 4);
+				if (version == 3)
+					size = be32(f + 4);
+				else if (!syncsafe(f + 4, size))
+					return false;
+				frameFlags = be16(f + 8);
+			}
+			// TagLib stops at a name it doesn't take to be one; it takes no '0's, either.
+			for (size_t i = 0; i < static_cast<size_t>(version == 2 ? 3 : 4); ++i)
+				if ((id[i] < 'A' || id[i] > 'Z') && (id[i] < '1' || id[i] > '9'))
+					return false;
+			if (!size || size > w.length - pos - header)
+				return false;
+			if (version == 3 && ((frameFlags & 0xE0) || named(id, v23Dropped, sizeof(v23Dropped) / sizeof(*v23Dropped))))
+				return false; // compressed, encrypted or grouped, or dropped.
+			if (version == 4 && ((frameFlags & 0x4C) || named(id, v24Dropped, sizeof(v24Dropped) / sizeof(*v24Dropped))))
+				return false;
+
+			Id3Field field = ID3_FIELDS;
+			for (size_t i = 0; i < sizeof(fieldNames) / sizeof(*fieldNames); ++i)
+				if (!memcmp(id, fieldNames[i], 4))
+					field = static_cast<Id3Field>(i);
+			const bool date = !memcmp(id, "TDRC", 4) || !memcmp(id, "TYER", 4);
+			const bool involved = !memcmp(id, "TIPL", 4), comment = !memcmp(id, "COMM", 4), user = !memcmp(id, "TXXX", 4);
+
+			if (field != ID3_FIELDS || date || involved || comment || user)
+			{
+				const unsigned char *body = w.get(pos + header, size);
+				if (!body)
+					return false;
+				size_t n = size;
+				if (frameFlags & 0x01 && version == 4)
+				{
+					// The data length indicator: syncsafe, so never part of an FF 00.
+					if (n <= 4)
+						return false;
+					body += 4;
+					n -= 4;
+				}
+
+				Id3Tags::Frame kept;
+				if (!keep(tags, kept, body, n, version == 4 && (frameFlags & 0x02)))
+					return false;
+				const unsigned char *p = &tags.data[kept.offset];
+				if (id[0] == 'T' || comment)
+					if (!textReadable(p, kept.size))
+						return false;
+
+				if (date || involved)
+				{
+					Id3Tags::Frame *list = date ? tags.dates : tags.people;
+					unsigned &count = date ? tags.dateCount : tags.peopleCount;
+					if (count == Id3Tags::listSize)
+						return false;
+					list[count++] = kept;
+				}
+				else if (user)
+					field = userField(p, kept.size);
+				else if (comment)
+				{
+					field = ID3_COMM;
+					if (tags.fields[field].size && !plain && plainComment(p, kept.size))
+						tags.fields[field].size = 0;
+					if (!tags.fields[field].size)
+						plain = plainComment(p, kept.size);
+				}
+				if (field != ID3_FIELDS && !tags.fields[field].size)
+					tags.fields[field] = kept;
+				else if (!date && !involved)
+					tags.data.resize(kept.offset);
+			}
+			pos += header + size;
+		}
+		return true;
+	}
+
+	bool scan(Reader &r, Id3Tags &tags)
+	{
+		unsigned char h[10];
+		if (!r.readAt(0, h, sizeof(h)))
+			return false;
+		if (!memcmp(h, "ID3", 3))
+		{
+			if (!frames(r, h, tags))
+				return false;
+		}
+		// Without a tag at the start, TagLib looks on for one up to the audio; audio straight
+		//  away is the only case sure to have none.
+		else if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0)
+			return false;
+
+		tags.v1 = r.size >= 128 && r.readAt(r.size - 128, tags.v1tag, 128) && !memcmp(tags.v1tag, "TAG", 3);
+		unsigned char ape[8];
+		const ULONGLONG apeAt = r.size - (tags.v1 ? 128 : 0);
+		return apeAt < 32 || !r.readAt(apeAt - 32, ape, sizeof(ape)) || memcmp(ape, "APETAGEX", 8);
+	}
+
+	// --- Reading the kept frames as TagLib would. ---
+
+	const unsigned char *body(const Id3Tags &tags, const Id3Tags::Frame &f)
+	{
+		return f.size ? &tags.data[f.offset] : NULL;
+	}
+
+	// A text frame's fields, each in its own string.
+	wstrvec_t fieldList(const Id3Tags &tags, const Id3Tags::Frame &frame)
+	{
+		wstrvec_t ret;
+		Fields f(body(tags, frame), frame.size);
+		const unsigned char *p;
+		for (size_t n; f.next(p, n); )
+		{
+			ret.push_back(std::wstring());
+			appendText(ret.back(), p, n, f.encoding);
+		}
+		return ret;
+	}
+
+	// A text frame as its toString() gives it: the fields, with spaces between.
+	std::wstring text(const Id3Tags &tags, const Id3Tags::Frame &frame)
+	{
+		std::wstring ret;
+		Fields f(body(tags, frame), frame.size);
+		const unsigned char *p;
+		for (size_t n; f.next(p, n); )
+		{
+			if (!ret.empty())
+				ret += L' ';
+			appendText(ret, p, n, f.encoding);
+		}
+		return ret;
+	}
+
+	// TagLib's String::toInt(): leading digits, after an optional minus.
+	int toInt(const std::wstring &s)
+	{
+		const bool negative = !s.empty() && s[0] == L'-';
+		int value = 0;
+		for (size_t i = negative ? 1 : 0; i < s.size() && s[i] >= L'0' && s[i] <= L'9'; ++i)
+			value = value * 10 + (s[i] - L'0');
+		return negative ? -value : value;
+	}
+
+	// TCON: TagLib first takes "(n)" prefixes as fields of their own, as ID3v2.3 writes ID3v1
+	//  genre numbers, then swaps numbers for the ID3v1 genre names, dropping repeats.
+	std::wstring genre(const Id3Tags &tags)
+	{
+		std::wstring s = text(tags, tags.fields[ID3_TCON]);
+		wstrvec_t fields;
+		while (!s.empty() && s[0] == L'(')
+		{
+			const std::wstring::size_type closing = s.find(L')');
+			if (closing == std::wstring::npos)
+				break;
+			fields.push_back(s.substr(1, closing - 1));
+			s = s.substr(closing + 1);
+		}
+		if (!s.empty())
+			fields.push_back(s);
+
+		wstrvec_t genres;
+		for (wstrvec_t::iterator it = fields.begin(); it != fields.end(); ++it)
+		{
+			if (it->empty())
+				continue;
+			if (it->find_first_not_of(L"0123456789") == std::wstring::npos)
+			{
+				int number = 0;
+				for (std::wstring::const_iterator c = it->begin(); c != it->end(); ++c)
+					number = std::min(number * 10 + (*c - L'0'), 256);
+				if (number <= 255)
+					*it = TagLib::ID3v1::genre(number).toWString();
+			}
+			if (std::find(genres.begin(), genres.end(), *it) == genres.end())
+				genres.push_back(*it);
+		}
+		std::wstring ret;
+		for (wstrvec_t::const_iterator it = genres.begin(); it != genres.end(); ++it)
+			ret += (it == genres.begin() ? L"" : L" ") + *it;
+		return ret;
+	}
+
+	std::wstring comment(const Id3Tags &tags)
+	{
+		const Id3Tags::Frame &f = tags.fields[ID3_COMM];
+		const unsigned char *p = body(tags, f), *t;
+		size_t n, descriptionLength;
+		std::wstring ret;
+		if (p && splitComment(p, f.size, t, n, descriptionLength))
+			appendText(ret, t, n, p[0]);
+		return ret;
+	}
+
+	// ID3v1's text: Latin-1 up to a null, without the spaces around it.
+	std::wstring v1Text(const unsigned char *p, size_t n)
+	{
+		std::wstring s;
+		appendText(s, p, n, 0);
+		const wchar_t *const space = L" \t\n\f\r";
+		const std::wstring::size_type first = s.find_first_not_of(space);
+		return first == std::wstring::npos ? std::wstring() : s.substr(first, s.find_last_not_of(space) - first + 1);
+	}
+
+	// The tag the handler sees: ID3v2's value, else ID3v1's.
+	struct Basic
+	{
+		std::wstring title, artist, album, comment, genre;
+		unsigned year, track;
+
+		Basic(const Id3Tags &tags) : year(0), track(0)
+		{
+			if (tags.version)
+			{
+				title = text(tags, tags.fields[ID3_TIT2]);
+				artist = text(tags, tags.fields[ID3_TPE1]);
+				album = text(tags, tags.fields[ID3_TALB]);
+				comment = ::comment(tags);
+				genre = ::genre(tags);
+				if (tags.dateCount)
+					year = toInt(text(tags, tags.dates[0]).substr(0, 4));
+				track = toInt(text(tags, tags.fields[ID3_TRCK]));
+			}
+			if (!tags.v1)
+				return;
+			const unsigned char *v1 = tags.v1tag;
+			const bool v11 = !v1[125] && v1[126];
+			if (title.empty())
+				title = v1Text(v1 + 3, 30);
+			if (artist.empty())
+				artist = v1Text(v1 + 33, 30);
+			if (album.empty())
+				album = v1Text(v1 + 63, 30);
+			if (!year)
+				year = toInt(v1Text(v1 + 93, 4));
+			if (comment.empty())
+				comment = v1Text(v1 + 97, v11 ? 28 : 30);
+			if (!track && v11)
+				track = v1[126];
+			if (genre.empty())
+				genre = TagLib::ID3v1::genre(v1[127]).toWString();
+		}
+
+		bool empty() const
+		{
+			return title.empty() && artist.empty() && album.empty() && comment.empty() && genre.empty() && !year && !track;
+		}
+	};
+
+	unsigned char rating(const Id3Tags &tags)
+	{
+		// As PopularimeterFrame reads it: the byte after the email address, or the first byte if
+		//  there's no end to the address.
+		const Id3Tags::Frame &popm = tags.fields[ID3_POPM];
+		if (const unsigned char *p = body(tags, popm))
+		{
+			const unsigned char *end = p + popm.size, *email = findDelimiter(p, end, 1);
+			const unsigned char *at = email == end ? p : email + 1;
+			return static_cast<unsigned char>((at < end ? *at : 0) * 100 / 255.f);
+		}
+		const wstrvec_t fields = fieldList(tags, tags.fields[ID3_TXXX_RATING]);
+		return normaliseRating(fields.size() >= 2 ? toInt(fields[1]) : 0);
+	}
+
+	SYSTEMTIME releaseDate(const Id3Tags &tags)
+	{
+		wstrvec_t dates;
+		for (unsigned i = 0; i < tags.dateCount; ++i)
+			dates.push_back(text(tags, tags.dates[i]));
+		const SYSTEMTIME date = parseDate(dates);
+		return date.wYear ? date : SYSTEMTIME();
+	}
+
+	std::wstring producer(const Id3Tags &tags)
+	{
+		for (unsigned i = 0; i + 1 < tags.peopleCount; i += 2)
+			if (text(tags, tags.people[i]) == L"producer")
+				return text(tags, tags.people[i + 1]);
+		throw std::domain_error("no producer");
+	}
+
+	// The first of that frame, as TRY_BSTR would give it.
+	void frameValue(const Id3Tags &tags, Id3Field field, PROPVARIANT *pv)
+	{
+		if (tags.fields[field].size)
+			InitPropVariantFromString(text(tags, tags.fields[field]).c_str(), pv);
+	}
+
+	void numberValue(unsigned n, PROPVARIANT *pv)
+	{
+		if (n)
+		{
+			pv->uintVal = n;
+			pv->vt = VT_UI4;
+		}
+	}
+}
+
+Id3Tags::Id3Tags() : version(0), dateCount(0), peopleCount(0), v1(false)
+{
+	data.reserve(4096);
+}
+
+bool scanId3(TagLib::FileAccessor &file, ULONGLONG size, Id3Tags &tags, ULONGLONG *bytesRead)
+{
+	tags.version = tags.dateCount = tags.peopleCount = 0;
+	memset(tags.fields, 0, sizeof(tags.fields));
+	tags.v1 = false;
+	tags.data.clear();
+
+	Reader r(file, size);
+	const bool ok = scan(r, tags);
+	if (bytesRead)
+		*bytesRead = r.read;
+	return ok;
+}
+
+bool readId3File(TagLib::FileAccessor &file, ULONGLONG size, const std::wstring &name, Id3Tags &tags, MpegInfo &mpeg)
+{
+	return mpegFileName(name) && scanId3(file, size, tags) && readMpegInfo(file, size, mpeg);
+}
+
+HRESULT readId3Property(const Id3Tags &tags, const MpegInfo &mpeg, REFPROPERTYKEY key, PROPVARIANT *pv)
+{
+	try
+	{
+		if (IsEqualPropertyKey(key, PKEY_Audio_ChannelCount))
+			numberValue(mpeg.channels, pv);
+		else if (IsEqualPropertyKey(key, PKEY_Media_Duration))
+		{
+			pv->uhVal.QuadPart = mpeg.duration();
+			pv->vt = VT_UI8;
+		}
+		else if (IsEqualPropertyKey(key, PKEY_Audio_EncodingBitrate))
+			numberValue(mpeg.bitrate, pv);
+		else if (IsEqualPropertyKey(key, PKEY_Audio_SampleRate))
+			numberValue(mpeg.sampleRate, pv);
+		else
+		{
+			// If the tag is empty, treat it as if it doesn't exist.
+			const Basic basic(tags);
+			if (basic.empty())
+				return S_FALSE;
+			if (IsEqualPropertyKey(key, PKEY_Music_AlbumTitle))
+				InitPropVariantFromString(basic.album.c_str(), pv);
+			else if (IsEqualPropertyKey(key, PKEY_Music_Artist))
+				InitPropVariantFromString(basic.artist.c_str(), pv);
+			else if (IsEqualPropertyKey(key, PKEY_Music_Genre))
+				InitPropVariantFromString(basic.genre.c_str(), pv);
+			else if (IsEqualPropertyKey(key, PKEY_Title))
+				InitPropVariantFromString(basic.title.c_str(), pv);
+			else if (IsEqualPropertyKey(key, PKEY_Comment))
+				InitPropVariantFromString(basic.comment.c_str(), pv);
+			else if (IsEqualPropertyKey(key, PKEY_Music_TrackNumber))
+				numberValue(basic.track, pv);
+			else if (IsEqualPropertyKey(key, PKEY_Media_Year))
+				numberValue(basic.year, pv);
+			// The rest only come from ID3v2.
+			else if (IsEqualPropertyKey(key, PKEY_Rating))
+			{
+				pv->uintVal = tags.version ? rating(tags) : RATING_UNRATED_SET;
+				pv->vt = VT_UI4;
+			}
+			else if (IsEqualPropertyKey(key, PKEY_Keywords))
+			{
+				wstrvec_t keywords = fieldList(tags, tags.fields[ID3_TXXX_KEYWORDS]);
+				if (!keywords.empty())
+					keywords.erase(keywords.begin());
+				return keywordsValue(keywords, pv);
+			}
+			else if (IsEqualPropertyKey(key, PKEY_Media_DateReleased))
+				releaseDateValue(releaseDate(tags), basic.year, pv);
+			else if (IsEqualPropertyKey(key, PKEY_Music_AlbumArtist))
+				frameValue(tags, ID3_TPE2, pv);
+			else if (IsEqualPropertyKey(key, PKEY_Music_Composer))
+				frameValue(tags, ID3_TCOM, pv);
+			else if (IsEqualPropertyKey(key, PKEY_Music_Conductor))
+				frameValue(tags, ID3_TPE3, pv);
+			else if (IsEqualPropertyKey(key, PKEY_Media_SubTitle))
+				frameValue(tags, ID3_TIT3, pv);
+			else if (IsEqualPropertyKey(key, PKEY_Media_Publisher))
+				frameValue(tags, ID3_TPUB, pv);
+			else if (IsEqualPropertyKey(key, PKEY_Music_Mood))
+				frameValue(tags, ID3_TMOO, pv);
+			else if (IsEqualPropertyKey(key, PKEY_Copyright))
+				frameValue(tags, ID3_TCOP, pv);
+			else if (IsEqualPropertyKey(key, PKEY_Music_PartOfSet))
+				frameValue(tags, ID3_TPOS, pv);
+			else if (IsEqualPropertyKey(key, PKEY_Media_Producer))
+			{
+				try
+				{
+					InitPropVariantFromString(producer(tags).c_str(), pv);
+				}
+				catch (std::domain_error &)
+				{
+					pv->vt = VT_EMPTY;
+				}
+			}
+			else
+				return S_FALSE;
+		}
+		return S_OK;
+	}
+	catch (std::exception &e)
+	{
+		OutputDebugStringA(e.what());
+		pv->vt = VT_EMPTY;
+		return ERROR_INTERNAL_ERROR;
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <windows.h>
+#include <fileref.h>
+#include <propsys.h>
+
+#include <string>
+#include <vector>
+
+#include "mpegscan.h"
+
+// === The handler's ID3 fields from an MP3, without TagLib. ===
+// TagLib builds every frame of an ID3v2 tag into an object, pictures and all, and then the handler
+//  asks for a dozen of them. Here the frame headers are walked in a flat buffer and only the bodies
+//  of the frames the handler reads are kept, copied one after another into a buffer that's reused
+//  from file to file; everything else, the audio included, is seeked over. Text is only decoded
+//  when a property is asked for, following TagLib's rules for splitting and decoding fields, so the
+//  values come out as readProperty() would give them.
+// ID3v2.2, 2.3 and 2.4 are read, with unsynchronisation undone, and ID3v1 at the end. Anything
+//  TagLib might read differently is left to TagLib: compressed, encrypted or grouped frames,
+//  extended headers and footers, frames TagLib drops or stops at, an APE tag, a tag that isn't at
+//  the start, text in an unknown encoding or invalid UTF-8, and more frames of a kind than there are
+//  places for.
+
+// The frames kept, by the ID3v2.4 name of each; the first of each is kept.
+enum Id3Field
+{
+	ID3_TIT2, ID3_TPE1, ID3_TPE2, ID3_TALB, ID3_TCON, ID3_TRCK, ID3_TCOM, ID3_TPE3, ID3_TPUB,
+	ID3_TIT3, ID3_TMOO, ID3_TCOP, ID3_TPOS, ID3_POPM,
+	ID3_COMM,         // the first with no description, else the first.
+	ID3_TXXX_RATING,  // the first TXXX with a value, described as "rating", or "keywords".
+	ID3_TXXX_KEYWORDS,
+	ID3_FIELDS
+};
+
+struct Id3Tags
+{
+	// A frame's body, in data; empty if there wasn't one.
+	struct Frame
+	{
+		unsigned offset, size;
+	};
+
+	Id3Tags();
+
+	enum { listSize = 8 };
+
+	unsigned version;   // ID3v2's major version; 0 if there's no ID3v2 tag.
+	Frame fields[ID3_FIELDS];
+	Frame dates[listSize];     // TDRC, and TYER and TYE, which TagLib reads as TDRC.
+	unsigned dateCount;
+	Frame people[listSize];    // TIPL.
+	unsigned peopleCount;
+	bool v1;
+	unsigned char v1tag[128];
+
+	std::vector<unsigned char> data;    // the frames' bodies, one after another.
+	std::vector<unsigned char> window;  // the tag, as it's read.
+};
+
+// False if TagLib should read it. bytesRead counts the file's bytes read.
+bool scanId3(TagLib::FileAccessor &file, ULONGLONG size, Id3Tags &tags, ULONGLONG *bytesRead = NULL);
+
+// scanId3() and readMpegInfo() together, for a name that's MPEG audio's.
+bool readId3File(TagLib::FileAccessor &file, ULONGLONG size, const std::wstring &name, Id3Tags &tags, MpegInfo &mpeg);
+
+// readProperty(), as it would be for the file; the audio's from the frame headers.
+HRESULT readId3Property(const Id3Tags &tags, const MpegInfo &mpeg, REFPROPERTYKEY key, PROPVARIANT *pv);
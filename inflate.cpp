@@ -0,0 +1,314 @@
+#include "inflate.h"
+
+#include <cstring>
+
+namespace
+{
+	const unsigned short lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	const unsigned char lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	const unsigned short distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	const unsigned char distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	const unsigned windowMask = 32767;
+}
+
+Inflater::Inflater(OnePassAccessor::Source &in, bool gzip)
+	: in(in), input(64 * 1024), inPos(0), inEnd(0), inDone(false), bitbuf(0), bitcnt(0),
+	state(gzip ? GZIP : HEADER), last(false), stored(0), copyLen(0), copyDist(0), window(windowMask + 1), total(0)
+{
+	unsigned char lengths[288];
+	for (unsigned i = 0; i < 288; ++i)
+		lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+	build(fixedLit, lengths, 288);
+	memset(lengths, 5, 30);
+	build(fixedDist, lengths, 30);
+}
+
+// Canonical codes from their lengths. Incomplete codes are allowed (a lone distance code is
+//  common); over-subscribed ones aren't.
+bool Inflater::build(Huffman &h, const unsigned char *lengths, unsigned n)
+{
+	memset(h.count, 0, sizeof(h.count));
+	for (unsigned i = 0; i < n; ++i)
+		++h.count[lengths[i]];
+	h.count[0] = 0;
+
+	int left = 1;
+	for (unsigned len = 1; len < 16; ++len)
+	{
+		left = (left << 1) - h.count[len];
+		if (left < 0)
+			return false;
+	}
+
+	unsigned short offs[16], next[16];
+	offs[1] = 0;
+	for (unsigned len = 1; len < 15; ++len)
+		offs[len + 1] = offs[len] + h.count[len];
+	unsigned code = 0;
+	for (unsigned len = 1; len < 16; ++len)
+	{
+		code = (code + h.count[len - 1]) << 1;
+		next[len] = static_cast<unsigned short>(code);
+	}
+
+	memset(h.fast, 0, sizeof(h.fast));
+	for (unsigned sym = 0; sym < n; ++sym)
+	{
+		const unsigned len = lengths[sym];
+		if (!len)
+			continue;
+		h.symbol[offs[len]++] = static_cast<unsigned short>(sym);
+		const unsigned c = next[len]++;
+		if (len > 9)
+			continue;
+		// Codes go into the stream first bit first, so the table is by the reversed code.
+		unsigned rev = 0;
+		for (unsigned b = 0; b < len; ++b)
+			rev |= ((c >> b) & 1) << (len - 1 - b);
+		for (unsigned k = rev; k < 512; k += 1 << len)
+			h.fast[k] = static_cast<unsigned short>(sym | len << 12);
+	}
+	return true;
+}
+
+// At least n bits in the buffer, if the input has them.
+bool Inflater::fill(unsigned n)
+{
+	while (bitcnt < n)
+	{
+		if (inPos == inEnd)
+		{
+			ULONG got = 0;
+			if (inDone || !in.read(&input[0], static_cast<ULONG>(input.size()), &got) || !got)
+			{
+				inDone = true;
+				return false;
+			}
+			inPos = 0;
+			inEnd = got;
+		}
+		bitbuf |= static_cast<unsigned long>(input[inPos++]) << bitcnt;
+		bitcnt += 8;
+	}
+	return true;
+}
+
+unsigned Inflater::bits(unsigned n)
+{
+	if (!fill(n))
+	{
+		state = BAD;
+		return 0;
+	}
+	const unsigned v = bitbuf & ((1UL << n) - 1);
+	bitbuf >>= n;
+	bitcnt -= n;
+	return v;
+}
+
+int Inflater::decode(const Huffman &h)
+{
+	// Near the end there may be fewer than 9 bits left; the table entry says how many it needs.
+	fill(9);
+	const unsigned e = h.fast[bitbuf & 511];
+	if (e && (e >> 12) <= bitcnt)
+	{
+		bitbuf >>= e >> 12;
+		bitcnt -= e >> 12;
+		return e & 0xfff;
+	}
+
+	// A bit at a time, as puff does.
+	int code = 0, first = 0, index = 0;
+	for (unsigned len = 1; len < 16; ++len)
+	{
+		code |= bits(1);
+		if (state == BAD)
+			return -1;
+		const int count = h.count[len];
+		if (code - count < first)
+			return h.symbol[index + (code - first)];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+// The next block's header, and its code tables.
+bool Inflater::header()
+{
+	last = bits(1) != 0;
+	switch (bits(2))
+	{
+	case 0:
+	{
+		bitbuf >>= bitcnt & 7;
+		bitcnt -= bitcnt & 7;
+		const unsigned len = bits(16), nlen = bits(16);
+		if (len != (~nlen & 0xffff))
+			return false;
+		stored = len;
+		state = STORED;
+		break;
+	}
+	case 1:
+		lit = fixedLit;
+		dist = fixedDist;
+		state = CODES;
+		break;
+	case 2:
+		if (!dynamic())
+			return false;
+		state = CODES;
+		break;
+	default:
+		return false;
+	}
+	return state != BAD;
+}
+
+bool Inflater::dynamic()
+{
+	static const unsigned char order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+	const unsigned nlen = bits(5) + 257, ndist = bits(5) + 1, ncode = bits(4) + 4;
+	if (nlen > 286 || ndist > 30)
+		return false;
+
+	unsigned char lengths[286 + 30];
+	for (unsigned i = 0; i < 19; ++i)
+		lengths[order[i]] = static_cast<unsigned char>(i < ncode ? bits(3) : 0);
+	Huffman lencode;
+	if (!build(lencode, lengths, 19))
+		return false;
+
+	for (unsigned index = 0; index < nlen + ndist; )
+	{
+		int sym = decode(lencode);
+		if (sym < 0)
+			return false;
+		if (sym < 16)
+		{
+			lengths[index++] = static_cast<unsigned char>(sym);
+			continue;
+		}
+		unsigned char len = 0;
+		if (sym == 16)
+		{
+			if (!index)
+				return false;
+			len = lengths[index - 1];
+			sym = 3 + bits(2);
+		}
+		else if (sym == 17)
+			sym = 3 + bits(3);
+		else
+			sym = 11 + bits(7);
+		if (index + sym > nlen + ndist)
+			return false;
+		while (sym--)
+			lengths[index++] = len;
+	}
+
+	// Without an end-of-block code there'd be no end.
+	return lengths[256] && build(lit, lengths, nlen) && build(dist, lengths + nlen, ndist) && state != BAD;
+}
+
+void Inflater::put(unsigned char b, unsigned char *out, ULONG &at)
+{
+	out[at++] = b;
+	window[static_cast<size_t>(total++) & windowMask] = b;
+}
+
+bool Inflater::read(void *buf, ULONG size, ULONG *got)
+{
+	unsigned char *out = static_cast<unsigned char *>(buf);
+	ULONG at = 0;
+	while (at < size && state != DONE && state != BAD)
+	{
+		if (copyLen)
+		{
+			for (; copyLen && at < size; --copyLen)
+				put(window[static_cast<size_t>(total - copyDist) & windowMask], out, at);
+			continue;
+		}
+
+		switch (state)
+		{
+		case GZIP:
+		{
+			// ID1 ID2 CM FLG, MTIME, XFL OS, then what FLG says is there.
+			const unsigned id1 = bits(8), id2 = bits(8), cm = bits(8), flags = bits(8);
+			if (id1 != 0x1f || id2 != 0x8b || cm != 8)
+			{
+				state = BAD;
+				break;
+			}
+			for (int i = 0; i < 6; ++i)
+				bits(8);
+			if (flags & 4) // FEXTRA
+				for (unsigned n = bits(16); n && state != BAD; --n)
+					bits(8);
+			if (flags & 8) // FNAME
+				while (bits(8) && state != BAD)
+					;
+			if (flags & 16) // FCOMMENT
+				while (bits(8) && state != BAD)
+					;
+			if (flags & 2) // FHCRC
+				bits(16);
+			if (state != BAD)
+				state = HEADER;
+			break;
+		}
+		case HEADER:
+			if (last)
+				state = DONE;
+			else if (!header())
+				state = BAD;
+			break;
+		case STORED:
+			for (; stored && at < size && state != BAD; --stored)
+				put(static_cast<unsigned char>(bits(8)), out, at);
+			if (!stored && state != BAD)
+				state = HEADER;
+			break;
+		case CODES:
+		{
+			int sym = decode(lit);
+			if (sym < 0)
+				state = BAD;
+			else if (sym < 256)
+				put(static_cast<unsigned char>(sym), out, at);
+			else if (sym == 256)
+				state = HEADER;
+			else if ((sym -= 257) >= 29)
+				state = BAD;
+			else
+			{
+				const unsigned len = lengthBase[sym] + bits(lengthExtra[sym]);
+				const int d = decode(dist);
+				if (d < 0 || d >= 30)
+				{
+					state = BAD;
+					break;
+				}
+				const unsigned distance = distBase[d] + bits(distExtra[d]);
+				if (distance > total || state == BAD)
+				{
+					state = BAD;
+					break;
+				}
+				copyLen = len;
+				copyDist = distance;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	*got = at;
+	return state != BAD;
+}
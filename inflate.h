@@ -0,0 +1,59 @@
+#pragma once
+
+#include "onepass.h"
+
+#include <vector>
+
+// === Deflate (RFC 1951), decompressed as it's read. ===
+// For ZIP members and .tar.gz, where the alternative is to unpack to disk first. It holds the 32KB
+//  window and an input buffer, and nothing else, however much passes through, so it can feed a
+//  OnePassAccessor directly. Code lengths of up to 9 bits, nearly all of them, are decoded by table.
+
+class Inflater : public OnePassAccessor::Source
+{
+public:
+	// Reads raw deflate from `in`, which must outlive it; with `gzip`, skips a gzip header (RFC 1952)
+	//  first. Only the first gzip member is read.
+	Inflater(OnePassAccessor::Source &in, bool gzip = false);
+
+	// 0 bytes once the last block is done; false if the data is corrupt or cut short.
+	bool read(void *buf, ULONG size, ULONG *got);
+
+	ULONGLONG produced() const { return total; }
+
+private:
+	struct Huffman
+	{
+		unsigned short count[16];   // codes of each length.
+		unsigned short symbol[320]; // by code.
+		unsigned short fast[512];   // by the next 9 bits: symbol | length << 12, or 0 if longer.
+	};
+
+	bool build(Huffman &h, const unsigned char *lengths, unsigned n);
+	bool fill(unsigned n);
+	unsigned bits(unsigned n);
+	int decode(const Huffman &h);
+	bool header();
+	bool dynamic();
+	void put(unsigned char b, unsigned char *out, ULONG &at);
+
+	OnePassAccessor::Source &in;
+	std::vector<unsigned char> input;
+	size_t inPos, inEnd;
+	bool inDone;
+	unsigned long bitbuf;
+	unsigned bitcnt;
+
+	enum State { GZIP, HEADER, STORED, CODES, DONE, BAD } state;
+	bool last;
+	unsigned stored;           // bytes left in a stored block.
+	unsigned copyLen, copyDist;
+
+	Huffman lit, dist, fixedLit, fixedDist;
+
+	std::vector<unsigned char> window;
+	ULONGLONG total;
+
+	Inflater(const Inflater &);
+	Inflater &operator=(const Inflater &);
+};
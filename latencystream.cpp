@@ -0,0 +1,166 @@
+#include "latencystream.h"
+
+#include <shlwapi.h> // SHCreateStreamOnFileEx
+
+LatencyStream *LatencyStream::open(const std::wstring &path, const Link &link)
+{
+	IStream *inner = NULL;
+	if (FAILED(SHCreateStreamOnFileEx(path.c_str(), STGM_READ | STGM_SHARE_DENY_NONE, FILE_ATTRIBUTE_NORMAL,
+			FALSE, NULL, &inner)))
+		return NULL;
+	return new LatencyStream(inner, link);
+}
+
+LatencyStream::LatencyStream(IStream *inner, const Link &link)
+	: inner(inner), link(link), clock(0), owed(0), refs(1)
+{
+}
+
+LatencyStream::~LatencyStream()
+{
+	inner->Release();
+}
+
+size_t LatencyStream::count(Call::Op op) const
+{
+	size_t n = 0;
+	for (std::vector<Call>::const_iterator it = log.begin(); it != log.end(); ++it)
+		n += it->op == op;
+	return n;
+}
+
+ULONGLONG LatencyStream::bytesRead() const
+{
+	ULONGLONG n = 0;
+	for (std::vector<Call>::const_iterator it = log.begin(); it != log.end(); ++it)
+		n += it->bytes;
+	return n;
+}
+
+void LatencyStream::charge(Call::Op op, ULONGLONG offset, ULONG bytes)
+{
+	const Call c = { op, offset, bytes };
+	log.push_back(c);
+
+	double cost = link.latency;
+	if (link.bytesPerSec > 0)
+		cost += bytes / link.bytesPerSec;
+	clock += cost;
+
+	if (link.sleep)
+	{
+		owed += cost;
+		if (owed >= 0.001)
+		{
+			const DWORD ms = static_cast<DWORD>(owed * 1000);
+			Sleep(ms);
+			owed -= ms / 1000.0;
+		}
+	}
+}
+
+HRESULT LatencyStream::QueryInterface(REFIID riid, void **ppv)
+{
+	if (!ppv)
+		return E_POINTER;
+	if (IsEqualIID(riid, IID_IUnknown) || IsEqualIID(riid, IID_ISequentialStream) || IsEqualIID(riid, IID_IStream))
+	{
+		*ppv = static_cast<IStream *>(this);
+		AddRef();
+		return S_OK;
+	}
+	*ppv = NULL;
+	return E_NOINTERFACE;
+}
+
+ULONG LatencyStream::AddRef()
+{
+	return InterlockedIncrement(&refs);
+}
+
+ULONG LatencyStream::Release()
+{
+	const ULONG n = InterlockedDecrement(&refs);
+	if (!n)
+		delete this;
+	return n;
+}
+
+HRESULT LatencyStream::Read(void *pv, ULONG cb, ULONG *pcbRead)
+{
+	// Where it starts is asked of the local stream, for the log; that's not a round trip.
+	LARGE_INTEGER zero = {};
+	ULARGE_INTEGER pos = {};
+	inner->Seek(zero, STREAM_SEEK_CUR, &pos);
+
+	ULONG read = 0;
+	const HRESULT hr = inner->Read(pv, cb, &read);
+	charge(Call::READ, pos.QuadPart, read);
+	if (pcbRead)
+		*pcbRead = read;
+	return hr;
+}
+
+HRESULT LatencyStream::Write(const void *, ULONG, ULONG *)
+{
+	charge(Call::OTHER, 0, 0);
+	return STG_E_ACCESSDENIED;
+}
+
+HRESULT LatencyStream::Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER *newPosition)
+{
+	ULARGE_INTEGER pos = {};
+	const HRESULT hr = inner->Seek(move, origin, &pos);
+	charge(Call::SEEK, pos.QuadPart, 0);
+	if (newPosition)
+		*newPosition = pos;
+	return hr;
+}
+
+HRESULT LatencyStream::Stat(STATSTG *stat, DWORD flags)
+{
+	charge(Call::STAT, 0, 0);
+	return inner->Stat(stat, flags);
+}
+
+HRESULT LatencyStream::SetSize(ULARGE_INTEGER)
+{
+	charge(Call::OTHER, 0, 0);
+	return STG_E_ACCESSDENIED;
+}
+
+HRESULT LatencyStream::CopyTo(IStream *, ULARGE_INTEGER, ULARGE_INTEGER *, ULARGE_INTEGER *)
+{
+	charge(Call::OTHER, 0, 0);
+	return E_NOTIMPL;
+}
+
+HRESULT LatencyStream::Commit(DWORD)
+{
+	charge(Call::OTHER, 0, 0);
+	return S_OK;
+}
+
+HRESULT LatencyStream::Revert()
+{
+	charge(Call::OTHER, 0, 0);
+	return S_OK;
+}
+
+HRESULT LatencyStream::LockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD)
+{
+	charge(Call::OTHER, 0, 0);
+	return STG_E_INVALIDFUNCTION;
+}
+
+HRESULT LatencyStream::UnlockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD)
+{
+	charge(Call::OTHER, 0, 0);
+	return STG_E_INVALIDFUNCTION;
+}
+
+HRESULT LatencyStream::Clone(IStream **)
+{
+	charge(Call::OTHER, 0, 0);
+	return E_NOTIMPL;
+}
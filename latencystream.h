@@ -0,0 +1,76 @@
+#pragma once
+
+#include <windows.h>
+#include <objidl.h> // IStream
+
+#include <string>
+#include <vector>
+
+// === A stand-in for a stream on the far end of a slow link. ===
+// On a network share or a cloud placeholder, every call the handler makes on its IStream is a
+//  round trip. A LatencyStream wraps a local file's stream, charges each call a fixed latency,
+//  and each read its bytes at a given bandwidth, and records every call. The time is kept on a
+//  simulated clock, so a benchmark can price thousands of files in seconds; with `sleep`, the
+//  calls really take that long, for watching from outside.
+// Hand it to IStreamAccessor in place of the stream the shell would give; that way what's
+//  measured is what the handler really asks for.
+
+class LatencyStream : public IStream
+{
+public:
+	struct Link
+	{
+		double latency;     // seconds per call.
+		double bytesPerSec; // 0 is unlimited.
+		bool sleep;
+	};
+
+	struct Call
+	{
+		enum Op { READ, SEEK, STAT, OTHER } op;
+		ULONGLONG offset;   // where a read started, or a seek ended.
+		ULONG bytes;        // read.
+	};
+
+	// NULL if the file can't be opened. The stream starts with one reference.
+	static LatencyStream *open(const std::wstring &path, const Link &link);
+
+	const std::vector<Call> &calls() const { return log; }
+	size_t count(Call::Op op) const;
+	ULONGLONG bytesRead() const;
+	double simulated() const { return clock; } // seconds.
+
+	// IUnknown
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppv);
+	ULONG STDMETHODCALLTYPE AddRef();
+	ULONG STDMETHODCALLTYPE Release();
+
+	// ISequentialStream
+	HRESULT STDMETHODCALLTYPE Read(void *pv, ULONG cb, ULONG *pcbRead);
+	HRESULT STDMETHODCALLTYPE Write(const void *pv, ULONG cb, ULONG *pcbWritten);
+
+	// IStream; read only.
+	HRESULT STDMETHODCALLTYPE Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER *newPosition);
+	HRESULT STDMETHODCALLTYPE SetSize(ULARGE_INTEGER);
+	HRESULT STDMETHODCALLTYPE CopyTo(IStream *, ULARGE_INTEGER, ULARGE_INTEGER *, ULARGE_INTEGER *);
+	HRESULT STDMETHODCALLTYPE Commit(DWORD);
+	HRESULT STDMETHODCALLTYPE Revert();
+	HRESULT STDMETHODCALLTYPE LockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD);
+	HRESULT STDMETHODCALLTYPE UnlockRegion(ULARGE_INTEGER, ULARGE_INTEGER, DWORD);
+	HRESULT STDMETHODCALLTYPE Stat(STATSTG *stat, DWORD flags);
+	HRESULT STDMETHODCALLTYPE Clone(IStream **);
+
+private:
+	LatencyStream(IStream *inner, const Link &link);
+	~LatencyStream();
+	void charge(Call::Op op, ULONGLONG offset, ULONG bytes);
+
+	IStream *inner;
+	Link link;
+	std::vector<Call> log;
+	double clock, owed; // owed: sleep not yet taken, under Sleep's resolution.
+	LONG refs;
+
+	LatencyStream(const LatencyStream &);
+	LatencyStream &operator=(const LatencyStream &);
+};
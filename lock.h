@@ -0,0 +1,13 @@
+#pragma once
+
+#include <windows.h>
+
+// Holds a critical section for the lifetime of the scope.
+struct Lock
+{
+	Lock(CRITICAL_SECTION &cs) : cs(cs) { EnterCriticalSection(&cs); }
+	~Lock() { LeaveCriticalSection(&cs); }
+private:
+	CRITICAL_SECTION &cs;
+	Lock &operator=(const Lock &);
+};
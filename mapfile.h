@@ -0,0 +1,42 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+
+// A whole file mapped read-only; data is NULL if it couldn't be opened or is empty.
+struct MappedFile
+{
+	MappedFile(const std::wstring &path) : data(NULL), size(0), file(INVALID_HANDLE_VALUE), mapping(NULL)
+	{
+		file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER li;
+		if (!GetFileSizeEx(file, &li) || !li.QuadPart || static_cast<ULONGLONG>(li.QuadPart) > static_cast<SIZE_T>(-1))
+			return;
+		mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping)
+			return;
+		data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data)
+			size = static_cast<size_t>(li.QuadPart);
+	}
+
+	~MappedFile()
+	{
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+	}
+
+	const void *data;
+	size_t size;
+
+private:
+	HANDLE file, mapping;
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <fileref.h>
+#include <cstring>
+#include <cstdio>
+#include <string>
+
+// A read-only TagLib::FileAccessor over bytes that are already in memory.
+// The buffer isn't copied, so it must outlive the FileRef.
+// TagLib picks the format from the extension of name(), so pass something like L"x.mp3".
+struct MemoryAccessor : public TagLib::FileAccessor
+{
+	MemoryAccessor(const void *data, size_t size, const std::wstring &name)
+		: data(static_cast<const char *>(data)), size(size), pos(0), fname(name) {}
+
+	const char *data;
+	size_t size;
+	mutable size_t pos;
+	std::wstring fname;
+
+	bool isOpen() const
+	{
+		return true;
+	}
+
+	size_t fread(void *pv, size_t s1, size_t s2) const
+	{
+		if (!s1 || pos >= size)
+			return 0;
+		size_t want = s1*s2;
+		// Overflow in the multiplication; TagLib never asks for this much anyway.
+		if (want / s1 != s2)
+			want = size;
+		const size_t avail = size - pos;
+		if (want > avail)
+			want = avail;
+		memcpy(pv, data + pos, want);
+		pos += want;
+		return want;
+	}
+
+	size_t fwrite(const void *,size_t,size_t)
+	{
+		return 0;
+	}
+
+	int fseek(long distance, int direction)
+	{
+		long long target;
+		switch (direction)
+		{
+			case SEEK_SET: target = distance; break;
+			case SEEK_CUR: target = static_cast<long long>(pos) + distance; break;
+			case SEEK_END: target = static_cast<long long>(size) + distance; break;
+			default: return -1;
+		}
+		if (target < 0)
+			return -1;
+		// Seeking past the end is fine, as with a real file; reads there just return nothing.
+		pos = static_cast<size_t>(target);
+		return 0;
+	}
+
+	void clearError()
+	{
+	}
+
+	long tell() const
+	{
+		return static_cast<long>(pos);
+	}
+
+	int truncate(long)
+	{
+		return -1; // error
+	}
+
+	TagLib::FileNameHandle name() const
+	{
+		return TagLib::FileName(fname.c_str());
+	}
+
+	bool readOnly() const
+	{
+		return true;
+	}
+};
@@ -0,0 +1,390 @@
+#define NOMINMAX
+
+#include "mpegscan.h"
+#include "accessorutil.h"
+
+#include <emmintrin.h>
+#include <intrin.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	// kbps, by row: v1 layer I, v1 layer II, v1 layer III, v2 layer I, v2 layers II and III.
+	const unsigned short bitrates[5][16] =
+	{
+		{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0 },
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0 },
+		{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 },
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0 },
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 },
+	};
+
+	// By the version bits: 2.5, reserved, 2, 1.
+	const unsigned rates[4][3] = { { 11025, 12000, 8000 }, { 0, 0, 0 }, { 22050, 24000, 16000 }, { 44100, 48000, 32000 } };
+
+	const ULONGLONG junkLimit = 16 * 1024 * 1024; // searched for the first frame.
+	const unsigned probes = 32;                   // places MPEG_SAMPLED reads frames at.
+	const size_t probeSize = 16 * 1024;
+	const unsigned maxFrame = 2881;               // MPEG 2.5 layer II, 160kbps at 8kHz, padded.
+
+	unsigned be32(const unsigned char *p)
+	{
+		return (static_cast<unsigned>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+
+	unsigned le32(const unsigned char *p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned>(p[3]) << 24);
+	}
+
+	// The same version, layer and rate: a file doesn't change those, but junk that looks like a
+	//  header rarely agrees with the one before it.
+	bool sameStream(const unsigned char *a, const unsigned char *b)
+	{
+		return (a[1] & 0xFE) == (b[1] & 0xFE) && (a[2] & 0x0C) == (b[2] & 0x0C);
+	}
+
+	const unsigned char *findSyncPlain(const unsigned char *p, const unsigned char *end)
+	{
+		for (; end - p >= 2; ++p)
+			if (p[0] == 0xFF && (p[1] & 0xE0) == 0xE0)
+				return p;
+		return end;
+	}
+
+	// Each byte against 0xFF, and the one after it masked against 0xE0, sixteen at once.
+	const unsigned char *findSyncSse2(const unsigned char *p, const unsigned char *end)
+	{
+		const __m128i ff = _mm_set1_epi8(static_cast<char>(0xFF)), e0 = _mm_set1_epi8(static_cast<char>(0xE0));
+		for (; end - p >= 17; p += 16)
+		{
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1));
+			const int hits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, ff), _mm_cmpeq_epi8(_mm_and_si128(b, e0), e0)));
+			if (hits)
+			{
+				unsigned long bit;
+				_BitScanForward(&bit, hits);
+				return p + bit;
+			}
+		}
+		return findSyncPlain(p, end);
+	}
+
+	bool detectSse2()
+	{
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+		return true;
+#else
+		return IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) != FALSE;
+#endif
+	}
+
+	const bool sse2 = detectSse2();
+
+	class Reader
+	{
+	public:
+		Reader(TagLib::FileAccessor &file, ULONGLONG size) : file(file), size(size), read(0) {}
+
+		// Up to n bytes at off; how many there were.
+		size_t readAt(ULONGLONG off, void *buf, size_t n)
+		{
+			if (off >= size || seekTo(file, off))
+				return 0;
+			const size_t got = file.fread(buf, 1, static_cast<size_t>(std::min<ULONGLONG>(n, size - off)));
+			read += got;
+			return got;
+		}
+
+		TagLib::FileAccessor &file;
+		const ULONGLONG size;
+		ULONGLONG read;
+
+	private:
+		Reader &operator=(const Reader &);
+	};
+
+	// A frame in [p, end) whose length leads to the header of another of the same stream, or exactly
+	//  to the end of the audio, which is at `end` if atEnd. Headers past the buffer aren't checked
+	//  here; such a candidate is returned with *unsure set, for the caller to check in the file.
+	const unsigned char *findFrame(const unsigned char *p, const unsigned char *end, bool atEnd, MpegFrame &f, bool *unsure)
+	{
+		*unsure = false;
+		for (; (p = findMpegSync(p, end)) != end; ++p)
+		{
+			if (end - p < 4 || !parseMpegFrame(p, f))
+				continue;
+			const unsigned char *next = p + f.length;
+			if (atEnd && next == end)
+				return p;
+			if (end - next >= 4)
+			{
+				MpegFrame g;
+				if (parseMpegFrame(next, g) && sameStream(p, next))
+					return p;
+				continue;
+			}
+			if (!atEnd)
+			{
+				*unsure = true;
+				return p;
+			}
+		}
+		return end;
+	}
+
+	// The first frame at or after `from`, checked against the header after it, searching no further than limit.
+	bool firstFrame(Reader &r, ULONGLONG from, ULONGLONG limit, ULONGLONG end, ULONGLONG &at, MpegFrame &f, unsigned char header[4])
+	{
+		// Usually the frame is right at the start; if not, the reads grow to 64KB.
+		std::vector<unsigned char> buf(64 * 1024);
+		for (size_t chunk = 4096; from < limit && from + 4 <= end; chunk = std::min(chunk * 2, buf.size()))
+		{
+			const size_t n = r.readAt(from, &buf[0], static_cast<size_t>(std::min<ULONGLONG>(chunk, end - from)));
+			if (n < 4)
+				return false;
+			const unsigned char *p = &buf[0], *const bufEnd = p + n;
+			const bool atEnd = from + n == end;
+			for (bool unsure; (p = findFrame(p, bufEnd, atEnd, f, &unsure)) != bufEnd; ++p)
+			{
+				const ULONGLONG candidate = from + (p - &buf[0]);
+				if (unsure)
+				{
+					// The next header is past the buffer; look for it in the file.
+					unsigned char next[4];
+					MpegFrame g;
+					const ULONGLONG nextAt = candidate + f.length;
+					if (!(nextAt == end || (r.readAt(nextAt, next, 4) == 4 && parseMpegFrame(next, g) && sameStream(p, next))))
+						continue;
+				}
+				at = candidate;
+				memcpy(header, p, 4);
+				return true;
+			}
+			// The last three bytes could start a header that runs into the next read.
+			from += atEnd ? n : n - 3;
+		}
+		return false;
+	}
+
+	// Consecutive frames of the stream from p, each starting before stop. Stopping where a frame
+	//  starts, rather than where one no longer fits, doesn't leave out the longer ones more often.
+	void walk(const unsigned char *p, const unsigned char *stop, const unsigned char *end, const unsigned char *header,
+		ULONGLONG &bytes, ULONGLONG &samples)
+	{
+		MpegFrame f;
+		while (p < stop && end - p >= 4 && parseMpegFrame(p, f) && sameStream(p, header) && static_cast<size_t>(end - p) >= f.length)
+		{
+			bytes += f.length;
+			samples += f.samples;
+			p += f.length;
+		}
+	}
+
+	// MPEG_EXACT: every frame, in 64KB reads; anything that isn't a frame is searched past.
+	void count(Reader &r, ULONGLONG at, ULONGLONG end, const unsigned char *header, ULONGLONG &frames, ULONGLONG &samples)
+	{
+		std::vector<unsigned char> buf(64 * 1024);
+		ULONGLONG bufAt = 0;
+		size_t n = 0;
+		while (at + 4 <= end)
+		{
+			if (at < bufAt || at + 4 > bufAt + n)
+			{
+				bufAt = at;
+				n = r.readAt(at, &buf[0], static_cast<size_t>(std::min<ULONGLONG>(buf.size(), end - at)));
+				if (n < 4)
+					return;
+			}
+			const unsigned char *p = &buf[0] + (at - bufAt);
+			MpegFrame f;
+			if (parseMpegFrame(p, f) && sameStream(p, header))
+			{
+				if (at + f.length > end)
+					return;
+				++frames;
+				samples += f.samples;
+				at += f.length;
+				continue;
+			}
+			const unsigned char *next = findMpegSync(p + 1, &buf[0] + n);
+			at = next == &buf[0] + n ? std::max(at + 1, bufAt + n - 3) : bufAt + (next - &buf[0]);
+		}
+	}
+}
+
+bool parseMpegFrame(const unsigned char *h, MpegFrame &f)
+{
+	if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0)
+		return false;
+	const unsigned version = (h[1] >> 3) & 3, layer = (h[1] >> 1) & 3;
+	const unsigned br = h[2] >> 4, sr = (h[2] >> 2) & 3, pad = (h[2] >> 1) & 1;
+	if (version == 1 || !layer || !br || br == 15 || sr == 3)
+		return false;
+	const bool v1 = version == 3;
+	f.bitrate = bitrates[v1 ? 3 - layer : layer == 3 ? 3 : 4][br] * 1000;
+	f.rate = rates[version][sr];
+	f.channels = (h[3] >> 6) == 3 ? 1 : 2;
+	if (layer == 3) // I
+	{
+		f.samples = 384;
+		f.length = (12 * f.bitrate / f.rate + pad) * 4;
+	}
+	else
+	{
+		const bool half = layer == 1 && !v1; // layer III, MPEG 2 and 2.5.
+		f.samples = half ? 576 : 1152;
+		f.length = (half ? 72 : 144) * f.bitrate / f.rate + pad;
+	}
+	return true;
+}
+
+const unsigned char *findMpegSync(const unsigned char *p, const unsigned char *end)
+{
+	return sse2 ? findSyncSse2(p, end) : findSyncPlain(p, end);
+}
+
+bool mpegSyncVectorised()
+{
+	return sse2;
+}
+
+bool mpegFileName(const std::wstring &name)
+{
+	const std::wstring::size_type dot = name.rfind(L'.');
+	const wchar_t *ext = dot == std::wstring::npos ? L"" : name.c_str() + dot + 1;
+	static const wchar_t *mpeg[] = { L"mp3", L"mp2", L"mp1", L"mpga" };
+	for (size_t i = 0; i < sizeof(mpeg) / sizeof(*mpeg); ++i)
+		if (!_wcsicmp(ext, mpeg[i]))
+			return true;
+	return false;
+}
+
+ULONGLONG MpegInfo::duration() const
+{
+	return sampleRate ? samples * 10000000 / sampleRate : 0;
+}
+
+bool readMpegInfo(TagLib::FileAccessor &file, ULONGLONG size, MpegInfo &info, MpegAccuracy accuracy, ULONGLONG *bytesRead)
+{
+	Reader r(file, size);
+	unsigned char b[32];
+
+	// Tags at the end: ID3v1, and an APE tag before it or in its place.
+	ULONGLONG end = size;
+	if (end >= 128 && r.readAt(end - 128, b, 3) == 3 && !memcmp(b, "TAG", 3))
+		end -= 128;
+	if (end >= 32 && r.readAt(end - 32, b, 32) == 32 && !memcmp(b, "APETAGEX", 8))
+	{
+		// The size counts the footer, not the header.
+		const ULONGLONG ape = le32(b + 12) + (le32(b + 20) & 0x80000000 ? 32 : 0);
+		if (ape <= end)
+			end -= ape;
+	}
+
+	// An ID3v2 tag is skipped by its size; anything after it, by searching.
+	ULONGLONG from = 0;
+	if (r.readAt(0, b, 10) == 10 && !memcmp(b, "ID3", 3))
+		from = 10 + ((b[6] & 0x7f) << 21 | (b[7] & 0x7f) << 14 | (b[8] & 0x7f) << 7 | (b[9] & 0x7f)) + (b[5] & 0x10 ? 10 : 0);
+
+	ULONGLONG start;
+	MpegFrame f;
+	unsigned char header[4];
+	const bool found = firstFrame(r, from, from + junkLimit, end, start, f, header);
+	if (bytesRead)
+		*bytesRead = r.read;
+	if (!found)
+		return false;
+
+	info.sampleRate = f.rate;
+	info.channels = f.channels;
+	info.start = start;
+	info.end = end;
+
+	// Xing and Info are where the audio would start, after the side information; VBRI is always 32 bytes in.
+	unsigned char first[512];
+	const size_t n = r.readAt(start, first, std::min<size_t>(f.length, sizeof(first)));
+	const bool v1 = (header[1] >> 3 & 3) == 3, layer3 = (header[1] >> 1 & 3) == 1;
+	const size_t side = 4 + (v1 ? (f.channels == 1 ? 17 : 32) : (f.channels == 1 ? 9 : 17));
+	ULONGLONG frames = 0, bytes = 0, padding = 0;
+	if (layer3 && n >= side + 8 && (!memcmp(first + side, "Xing", 4) || !memcmp(first + side, "Info", 4)))
+	{
+		info.method = first[side] == 'X' ? MpegInfo::XING : MpegInfo::INFO;
+		const unsigned flags = be32(first + side + 4);
+		size_t p = side + 8;
+		if ((flags & 1) && p + 4 <= n)
+			frames = be32(first + p), p += 4;
+		if ((flags & 2) && p + 4 <= n)
+			bytes = be32(first + p), p += 4;
+		if (flags & 4) // seek table
+			p += 100;
+		if (flags & 8) // quality
+			p += 4;
+		// LAME's tag has the delay the encoder added at the start, and the padding at the end.
+		if (p + 24 <= n && (!memcmp(first + p, "LAME", 4) || !memcmp(first + p, "Lavc", 4) || !memcmp(first + p, "Lavf", 4)))
+			padding = (first[p + 21] << 4 | first[p + 22] >> 4) + ((first[p + 22] & 0x0F) << 8 | first[p + 23]);
+	}
+	else if (n >= 4 + 32 + 18 && !memcmp(first + 4 + 32, "VBRI", 4))
+	{
+		info.method = MpegInfo::VBRI;
+		bytes = be32(first + 4 + 32 + 10);
+		frames = be32(first + 4 + 32 + 14);
+	}
+
+	if (frames)
+	{
+		// The header's own frame isn't counted; it holds no audio.
+		info.frames = frames;
+		const ULONGLONG samples = frames * f.samples;
+		info.samples = padding < samples ? samples - padding : samples;
+		info.bitrate = static_cast<unsigned>((bytes ? bytes : end - start) * 8 * f.rate / samples);
+	}
+	else if (accuracy == MPEG_EXACT || (accuracy == MPEG_SAMPLED && end - start <= probes * probeSize))
+	{
+		// Small enough that sampling would read most of it anyway.
+		info.method = MpegInfo::COUNTED;
+		info.frames = info.samples = 0;
+		count(r, start, end, header, info.frames, info.samples);
+		info.bitrate = info.samples ? static_cast<unsigned>((end - start) * 8 * f.rate / info.samples) : f.bitrate;
+	}
+	else if (accuracy == MPEG_SAMPLED)
+	{
+		// A run of frames at each of a number of points through the audio; their bytes per sample
+		//  go for the whole.
+		info.method = MpegInfo::SAMPLED;
+		std::vector<unsigned char> buf(probeSize);
+		ULONGLONG walked = 0, samples = 0;
+		for (unsigned i = 0; i < probes; ++i)
+		{
+			const ULONGLONG at = start + (end - start) * i / probes;
+			const size_t got = r.readAt(at, &buf[0], static_cast<size_t>(std::min<ULONGLONG>(probeSize, end - at)));
+			MpegFrame g;
+			bool unsure;
+			const bool last = at + got == end;
+			const unsigned char *p = findFrame(&buf[0], &buf[0] + got, last, g, &unsure);
+			if (p != &buf[0] + got && sameStream(p, header))
+				walk(p, &buf[0] + (last || got <= maxFrame ? got : got - maxFrame), &buf[0] + got, header, walked, samples);
+		}
+		if (!samples)
+		{
+			walked = f.length;
+			samples = f.samples;
+		}
+		info.samples = (end - start) * samples / walked;
+		info.frames = info.samples / f.samples;
+		info.bitrate = static_cast<unsigned>(walked * 8 * f.rate / samples);
+	}
+	else
+	{
+		info.method = MpegInfo::FIRST_FRAME;
+		info.bitrate = f.bitrate;
+		info.samples = (end - start) * 8 * f.rate / f.bitrate;
+		info.frames = info.samples / f.samples;
+	}
+	if (bytesRead)
+		*bytesRead = r.read;
+	return true;
+}
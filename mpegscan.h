@@ -0,0 +1,59 @@
+#pragma once
+
+#include <windows.h>
+#include <fileref.h>
+
+#include <string>
+
+// === MPEG audio length and bitrate from the frame headers, without TagLib's search. ===
+// The first frame is found by looking for sync words 16 bytes at a time (SSE2, when the CPU has
+//  it), and a candidate is only taken if another frame header of the same version, layer and rate
+//  starts where its length says. Junk or padding before the audio costs a memory scan, not a byte
+//  by byte parse. Then, in order of preference:
+//  - a Xing or Info header in the first frame (LAME, and most encoders since) gives the frame count,
+//    and a LAME tag after it the encoder delay and padding, which aren't audio;
+//  - a VBRI header (Fraunhofer) gives the frame count;
+//  - otherwise it's estimated, as accuracy says.
+
+struct MpegFrame
+{
+	unsigned length, samples, rate, bitrate, channels;
+};
+
+// A frame header, from its four bytes; free-format frames, with no bitrate to size them by, aren't taken.
+bool parseMpegFrame(const unsigned char *h, MpegFrame &f);
+
+// The first place in [p, end) a frame header could start: 0xFF, then three set bits. end if none.
+const unsigned char *findMpegSync(const unsigned char *p, const unsigned char *end);
+
+// Whether findMpegSync() is using SSE2 on this machine.
+bool mpegSyncVectorised();
+
+// Whether the name's extension is one of MPEG audio's.
+bool mpegFileName(const std::wstring &name);
+
+// What's done when the first frame has no Xing or VBRI header.
+enum MpegAccuracy
+{
+	MPEG_FIRST_FRAME, // the first frame's bitrate over all the audio, as TagLib does; exact for CBR only.
+	MPEG_SAMPLED,     // runs of frames read at points through the file; within a percent or so for VBR.
+	MPEG_EXACT,       // every frame counted; reads the whole file.
+};
+
+struct MpegInfo
+{
+	enum Method { XING, INFO, VBRI, FIRST_FRAME, SAMPLED, COUNTED };
+	Method method;
+	unsigned sampleRate, channels;
+	ULONGLONG start, end; // of the audio: after any ID3v2 tag and junk, before ID3v1 and APE tags.
+	ULONGLONG frames;     // estimated, for FIRST_FRAME and SAMPLED.
+	ULONGLONG samples;    // less the encoder delay and padding, when a LAME tag gives them.
+	unsigned bitrate;     // average, in bits per second.
+
+	// In 100ns units.
+	ULONGLONG duration() const;
+};
+
+// False if there's no run of frames to be found in the file (or its first 16MB).
+bool readMpegInfo(TagLib::FileAccessor &file, ULONGLONG size, MpegInfo &info,
+	MpegAccuracy accuracy = MPEG_SAMPLED, ULONGLONG *bytesRead = NULL);
@@ -0,0 +1,259 @@
+#define NOMINMAX
+
+#include "oggscan.h"
+#include "accessorutil.h"
+
+#include <emmintrin.h>
+#include <intrin.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+	const size_t firstWindow = 64 * 1024;   // a page is never more than 65307 bytes.
+	const size_t tailLimit = 1024 * 1024;
+
+	unsigned le16(const unsigned char *p) { return p[0] | p[1] << 8; }
+	unsigned le32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | static_cast<unsigned>(p[3]) << 24; }
+	unsigned be32(const unsigned char *p) { return static_cast<unsigned>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+	// t[k][b]: the CRC of byte b followed by k zero bytes.
+	struct CrcTables
+	{
+		CrcTables()
+		{
+			for (unsigned b = 0; b < 256; ++b)
+			{
+				unsigned r = b << 24;
+				for (int i = 0; i < 8; ++i)
+					r = r & 0x80000000 ? r << 1 ^ 0x04C11DB7 : r << 1;
+				t[0][b] = r;
+			}
+			for (int k = 1; k < 8; ++k)
+				for (unsigned b = 0; b < 256; ++b)
+					t[k][b] = t[k - 1][b] << 8 ^ t[0][t[k - 1][b] >> 24];
+		}
+		unsigned t[8][256];
+	};
+
+	const CrcTables crc;
+
+	bool isCapture(const unsigned char *p)
+	{
+		return p[0] == 'O' && p[1] == 'g' && p[2] == 'g' && p[3] == 'S';
+	}
+
+	// Positions [p, last) are candidates; each needs the three bytes after it too.
+	const unsigned char *findLastPlain(const unsigned char *p, const unsigned char *last, const unsigned char *notFound)
+	{
+		while (last > p)
+			if (isCapture(--last))
+				return last;
+		return notFound;
+	}
+
+	// Sixteen positions at a time, from the top down: a byte compare for each letter of the pattern,
+	//  at four offsets, anded together.
+	const unsigned char *findLastSse2(const unsigned char *p, const unsigned char *last, const unsigned char *notFound)
+	{
+		const __m128i o = _mm_set1_epi8('O'), g = _mm_set1_epi8('g'), s = _mm_set1_epi8('S');
+		// Singly, until what's left is whole blocks.
+		while ((last - p) % 16)
+			if (isCapture(--last))
+				return last;
+		while (last > p)
+		{
+			last -= 16;
+			const __m128i m = _mm_and_si128(
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(last)), o),
+					_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(last + 1)), g)),
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(last + 2)), g),
+					_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(last + 3)), s)));
+			const int hits = _mm_movemask_epi8(m);
+			if (hits)
+			{
+				unsigned long bit;
+				_BitScanReverse(&bit, hits);
+				return last + bit;
+			}
+		}
+		return notFound;
+	}
+
+	bool detectSse2()
+	{
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+		return true;
+#else
+		return IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) != FALSE;
+#endif
+	}
+
+	const bool sse2 = detectSse2();
+
+	// A whole page at p, before end, that checks: its length, from the segment table, and its CRC,
+	//  taken with the CRC field as zeros.
+	bool validPage(const unsigned char *p, const unsigned char *end)
+	{
+		if (end - p < 27 || p[4] != 0 || end - p < 27 + p[26])
+			return false;
+		size_t length = 27 + p[26];
+		for (unsigned i = 0; i < p[26]; ++i)
+			length += p[27 + i];
+		if (static_cast<size_t>(end - p) < length)
+			return false;
+		static const unsigned char zeros[4] = {};
+		unsigned c = oggCrc(0, p, 22);
+		c = oggCrc(c, zeros, 4);
+		c = oggCrc(c, p + 26, length - 26);
+		return c == le32(p + 22);
+	}
+
+	class Reader
+	{
+	public:
+		Reader(TagLib::FileAccessor &file, ULONGLONG size) : file(file), size(size), read(0) {}
+
+		// Up to n bytes at off; how many there were.
+		size_t readAt(ULONGLONG off, void *buf, size_t n)
+		{
+			if (off >= size || seekTo(file, off))
+				return 0;
+			const size_t got = file.fread(buf, 1, static_cast<size_t>(std::min<ULONGLONG>(n, size - off)));
+			read += got;
+			return got;
+		}
+
+		TagLib::FileAccessor &file;
+		const ULONGLONG size;
+		ULONGLONG read;
+
+	private:
+		Reader &operator=(const Reader &);
+	};
+}
+
+bool parseOggIdentification(const unsigned char *p, size_t n, OggCodec &c)
+{
+	c.preSkip = 0;
+	if (n >= 16 && !memcmp(p, "\x01vorbis", 7))
+	{
+		c.channels = p[11];
+		c.sampleRate = le32(p + 12);
+	}
+	else if (n >= 12 && !memcmp(p, "OpusHead", 8))
+	{
+		// Granules count at 48kHz, whatever the input was, from before the pre-skip.
+		c.channels = p[9];
+		c.sampleRate = 48000;
+		c.preSkip = le16(p + 10);
+	}
+	else if (n >= 52 && !memcmp(p, "Speex   ", 8))
+	{
+		c.sampleRate = le32(p + 36);
+		c.channels = le32(p + 48);
+	}
+	else if (n >= 30 && !memcmp(p, "\x7F" "FLAC", 5))
+	{
+		// STREAMINFO, after the mapping header.
+		c.sampleRate = p[27] << 12 | p[28] << 4 | p[29] >> 4;
+		c.channels = ((p[29] >> 1) & 7) + 1;
+	}
+	else
+		return false;
+	return c.sampleRate != 0;
+}
+
+const unsigned char *findLastOggPage(const unsigned char *p, const unsigned char *end)
+{
+	if (end - p < 4)
+		return end;
+	return sse2 ? findLastSse2(p, end - 3, end) : findLastPlain(p, end - 3, end);
+}
+
+bool oggSearchVectorised()
+{
+	return sse2;
+}
+
+unsigned oggCrc(unsigned c, const void *data, size_t n)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	for (; n >= 8; n -= 8, p += 8)
+	{
+		const unsigned a = c ^ be32(p), b = be32(p + 4);
+		c = crc.t[7][a >> 24] ^ crc.t[6][(a >> 16) & 0xFF] ^ crc.t[5][(a >> 8) & 0xFF] ^ crc.t[4][a & 0xFF]
+			^ crc.t[3][b >> 24] ^ crc.t[2][(b >> 16) & 0xFF] ^ crc.t[1][(b >> 8) & 0xFF] ^ crc.t[0][b & 0xFF];
+	}
+	for (; n; --n, ++p)
+		c = c << 8 ^ crc.t[0][(c >> 24) ^ *p];
+	return c;
+}
+
+bool oggFileName(const std::wstring &name)
+{
+	const std::wstring::size_type dot = name.rfind(L'.');
+	const wchar_t *ext = dot == std::wstring::npos ? L"" : name.c_str() + dot + 1;
+	static const wchar_t *ogg[] = { L"ogg", L"oga", L"opus", L"spx" };
+	for (size_t i = 0; i < sizeof(ogg) / sizeof(*ogg); ++i)
+		if (!_wcsicmp(ext, ogg[i]))
+			return true;
+	return false;
+}
+
+ULONGLONG OggInfo::duration() const
+{
+	return codec.sampleRate ? samples * 10000000 / codec.sampleRate : 0;
+}
+
+bool readOggInfo(TagLib::FileAccessor &file, ULONGLONG size, OggInfo &info, ULONGLONG *bytesRead)
+{
+	Reader r(file, size);
+
+	// The first page: its serial, and the start of its packet, the identification header.
+	unsigned char first[27 + 255 + 64];
+	const size_t n = r.readAt(0, first, sizeof(first));
+	if (bytesRead)
+		*bytesRead = r.read;
+	if (n < 27 || !isCapture(first) || n < 27u + first[26])
+		return false;
+	const size_t body = 27 + first[26];
+	if (!parseOggIdentification(first + body, n - body, info.codec))
+		return false;
+	info.serial = le32(first + 14);
+
+	// Then the tail, a window at a time, each search going on from where the last left off.
+	std::vector<unsigned char> buf;
+	ULONGLONG at = size; // where the window starts.
+	for (size_t window = firstWindow; window <= tailLimit && at > 0; window *= 4)
+	{
+		const ULONGLONG from = size > window ? size - window : 0;
+		const size_t added = static_cast<size_t>(at - from);
+		buf.insert(buf.begin(), added, 0);
+		if (r.readAt(from, &buf[0], added) != added)
+			break;
+		at = from;
+
+		// Pages starting in what was added; the rest were looked at already.
+		const unsigned char *const base = &buf[0], *const end = base + buf.size();
+		const unsigned char *limit = std::min<const unsigned char *>(base + added + 3, end);
+		for (const unsigned char *p; (p = findLastOggPage(base, limit)) != limit; limit = p + 3)
+		{
+			if (end - p < 27 || le32(p + 14) != info.serial || !validPage(p, end))
+				continue;
+			const ULONGLONG granule = le32(p + 6) | static_cast<ULONGLONG>(le32(p + 10)) << 32;
+			if (granule == ~0ULL)
+				continue;
+			info.lastPage = at + (p - base);
+			info.granule = granule;
+			info.samples = granule > info.codec.preSkip ? granule - info.codec.preSkip : 0;
+			if (bytesRead)
+				*bytesRead = r.read;
+			return true;
+		}
+	}
+	if (bytesRead)
+		*bytesRead = r.read;
+	return false;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <windows.h>
+#include <fileref.h>
+
+#include <string>
+
+// === Ogg length from the last page, found from the end. ===
+// An Ogg stream's length is the granule position of its last page. Walking the pages forward to
+//  find it reads the whole file, a page header at a time. Here the first page gives the stream and
+//  its codec, and then only the tail is read: 64KB, then 256KB, then 1MB, each searched backwards
+//  for the "OggS" capture pattern (SSE2, when the CPU has it). A candidate is only taken if its
+//  page CRC checks, it belongs to the first page's stream, and a packet ends on it. Nothing between
+//  the first page and the last 1MB is read.
+
+// What the identification header, the first packet, says.
+struct OggCodec
+{
+	unsigned sampleRate; // that granules count in.
+	unsigned channels;
+	unsigned preSkip;    // Opus: granules before the audio starts.
+};
+
+// Vorbis, Opus, Speex and FLAC; false for anything else.
+bool parseOggIdentification(const unsigned char *packet, size_t n, OggCodec &codec);
+
+// The last place in [p, end) "OggS" starts, or end if none.
+const unsigned char *findLastOggPage(const unsigned char *p, const unsigned char *end);
+
+// Whether findLastOggPage() is using SSE2 on this machine.
+bool oggSearchVectorised();
+
+// Ogg's page checksum: CRC-32, polynomial 0x04C11DB7, not reflected, starting from 0. Sliced by
+//  eight: eight table lookups for every eight bytes, rather than one for each.
+unsigned oggCrc(unsigned crc, const void *data, size_t n);
+
+// Whether the name's extension is one of Ogg audio's.
+bool oggFileName(const std::wstring &name);
+
+struct OggInfo
+{
+	OggCodec codec;
+	unsigned serial;
+	ULONGLONG lastPage, granule; // where the last page is, and its granule position.
+	ULONGLONG samples;           // less any pre-skip.
+
+	// In 100ns units.
+	ULONGLONG duration() const;
+};
+
+// False if the first page isn't a codec's identification header, or no last page of its stream
+//  turns up in the last 1MB (a chained file, say).
+bool readOggInfo(TagLib::FileAccessor &file, ULONGLONG size, OggInfo &info, ULONGLONG *bytesRead = NULL);
@@ -0,0 +1,400 @@
+#include "onepass.h"
+#include "extract.h"
+#include "mpegscan.h"
+#include "oggscan.h"
+
+#include <propkey.h>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	// Fed the whole stream in order, a piece at a time, holding no more than a header.
+	struct Walker
+	{
+		virtual ~Walker() {}
+		virtual void feed(const unsigned char *p, size_t n) = 0;
+		virtual void finish(OnePassAccessor::Streamed &s) const = 0;
+	};
+
+	// MPEG audio: an ID3v2 tag at the start is skipped by its size, then frames by theirs. Anything
+	//  that isn't a frame, or is a frame of another version, layer or rate than the first, is
+	//  stepped over a byte at a time until one turns up again.
+	class MpegWalker : public Walker
+	{
+	public:
+		MpegWalker() : have(0), need(10), skip(0), frames(0), samples(0), rate(0) {}
+
+		void feed(const unsigned char *p, size_t n)
+		{
+			while (n)
+			{
+				if (skip)
+				{
+					const size_t k = static_cast<size_t>(std::min<ULONGLONG>(skip, n));
+					p += k;
+					n -= k;
+					skip -= k;
+					continue;
+				}
+				window[have++] = *p++;
+				--n;
+				if (have == need)
+					step();
+			}
+		}
+
+		void finish(OnePassAccessor::Streamed &s) const
+		{
+			s.frames = frames;
+			s.samples = samples;
+			s.sampleRate = rate;
+		}
+
+	private:
+		void step()
+		{
+			if (need == 10)
+			{
+				need = 4;
+				if (!memcmp(window, "ID3", 3))
+				{
+					// Syncsafe size, not counting the header, or the footer if there is one.
+					skip = ((window[6] & 0x7f) << 21 | (window[7] & 0x7f) << 14 | (window[8] & 0x7f) << 7 | (window[9] & 0x7f))
+						+ (window[5] & 0x10 ? 10 : 0);
+					have = 0;
+					return;
+				}
+			}
+			// The first window is 10 bytes, so there can be more than one header's worth to try.
+			while (have >= 4)
+			{
+				MpegFrame f;
+				if (parseMpegFrame(window, f) && f.length >= have
+					&& (!frames || ((window[1] & 0xFE) == lock[0] && (window[2] & 0x0C) == lock[1])))
+				{
+					if (!frames)
+					{
+						lock[0] = window[1] & 0xFE;
+						lock[1] = window[2] & 0x0C;
+						rate = f.rate;
+					}
+					++frames;
+					samples += f.samples;
+					skip = f.length - have;
+					have = 0;
+					return;
+				}
+				memmove(window, window + 1, --have);
+			}
+		}
+
+		unsigned char window[10];
+		size_t have, need;
+		ULONGLONG skip;
+		unsigned char lock[2]; // version and layer, and rate, of the first frame.
+		ULONGLONG frames, samples;
+		unsigned rate;
+	};
+
+	unsigned le32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | static_cast<unsigned>(p[3]) << 24; }
+
+	// Ogg: page headers and their segment tables are read, bodies skipped by their size. The first
+	//  page's serial picks the stream whose granules are followed, and the start of its body, the
+	//  codec's identification header, gives the rate they count in.
+	class OggWalker : public Walker
+	{
+	public:
+		OggWalker() : have(0), need(27), skip(0), pages(0), serial(0), granule(0), identHave(0), capturing(false) {}
+
+		void feed(const unsigned char *p, size_t n)
+		{
+			while (n)
+			{
+				if (skip)
+				{
+					const size_t k = static_cast<size_t>(std::min<ULONGLONG>(skip, n));
+					if (capturing)
+					{
+						const size_t c = std::min(k, sizeof(ident) - identHave);
+						memcpy(ident + identHave, p, c);
+						identHave += c;
+					}
+					p += k;
+					n -= k;
+					skip -= k;
+					continue;
+				}
+				capturing = false;
+				header[have++] = *p++;
+				--n;
+				if (have == need)
+					step();
+			}
+		}
+
+		void finish(OnePassAccessor::Streamed &s) const
+		{
+			OggCodec codec;
+			s.frames = 0;
+			s.samples = granule;
+			s.sampleRate = 0;
+			if (parseOggIdentification(ident, identHave, codec))
+			{
+				s.sampleRate = codec.sampleRate;
+				s.samples = granule > codec.preSkip ? granule - codec.preSkip : 0;
+			}
+		}
+
+	private:
+		void step()
+		{
+			if (need == 27)
+			{
+				if (memcmp(header, "OggS", 4))
+				{
+					// Lost; look for the next capture pattern.
+					memmove(header, header + 1, --have);
+					return;
+				}
+				need += header[26];
+				if (have < need)
+					return;
+			}
+
+			ULONGLONG body = 0;
+			for (size_t i = 27; i < need; ++i)
+				body += header[i];
+			const unsigned pageSerial = le32(header + 14);
+			const ULONGLONG pageGranule = le32(header + 6) | static_cast<ULONGLONG>(le32(header + 10)) << 32;
+			if (!pages++)
+			{
+				serial = pageSerial;
+				capturing = true;
+			}
+			if (pageSerial == serial && pageGranule != ~0ULL)
+				granule = pageGranule;
+			skip = body;
+			have = 0;
+			need = 27;
+		}
+
+		unsigned char header[27 + 255];
+		size_t have, need;
+		ULONGLONG skip, pages;
+		unsigned serial;
+		ULONGLONG granule;
+		unsigned char ident[64];
+		size_t identHave;
+		bool capturing;
+	};
+
+	struct StreamSource : OnePassAccessor::Source
+	{
+		StreamSource(ISequentialStream *stream) : stream(stream) {}
+		ISequentialStream *stream;
+		bool read(void *buf, ULONG size, ULONG *got)
+		{
+			return SUCCEEDED(stream->Read(buf, size, got));
+		}
+	};
+
+	struct HandleSource : OnePassAccessor::Source
+	{
+		HandleSource(HANDLE handle) : handle(handle) {}
+		HANDLE handle;
+		bool read(void *buf, ULONG size, ULONG *got)
+		{
+			if (ReadFile(handle, buf, size, got, NULL))
+				return true;
+			// The writer closing a pipe is its end, not an error.
+			*got = 0;
+			return GetLastError() == ERROR_BROKEN_PIPE;
+		}
+	};
+
+	Walker *walkerFor(const std::wstring &name)
+	{
+		if (mpegFileName(name))
+			return new MpegWalker;
+		if (oggFileName(name))
+			return new OggWalker;
+		return NULL;
+	}
+}
+
+ULONGLONG OnePassAccessor::Streamed::duration() const
+{
+	return sampleRate ? samples * 10000000 / sampleRate : 0;
+}
+
+OnePassAccessor::OnePassAccessor(ISequentialStream *source, const std::wstring &name, const Limits &limits)
+	: fname(name), limits(limits), tailKept(0), length(0), opened(false), pos(0)
+{
+	StreamSource s(source);
+	consume(s);
+}
+
+OnePassAccessor::OnePassAccessor(HANDLE source, const std::wstring &name, const Limits &limits)
+	: fname(name), limits(limits), tailKept(0), length(0), opened(false), pos(0)
+{
+	HandleSource s(source);
+	consume(s);
+}
+
+OnePassAccessor::OnePassAccessor(Source &source, const std::wstring &name, const Limits &limits)
+	: fname(name), limits(limits), tailKept(0), length(0), opened(false), pos(0)
+{
+	consume(source);
+}
+
+OnePassAccessor::~OnePassAccessor()
+{
+}
+
+void OnePassAccessor::consume(Source &source)
+{
+	const Streamed zero = {};
+	counted = zero;
+	Walker *walker = walkerFor(fname);
+
+	std::vector<char> buf(64 * 1024);
+	head.reserve(limits.head);
+	tail.resize(limits.tail);
+	size_t ring = 0; // where the next byte goes in the tail.
+	for (;;)
+	{
+		ULONG got = 0;
+		if (!source.read(&buf[0], static_cast<ULONG>(buf.size()), &got))
+			break;
+		opened = true;
+		if (!got)
+			break;
+		length += got;
+		if (walker)
+			walker->feed(reinterpret_cast<const unsigned char *>(&buf[0]), got);
+
+		const char *p = &buf[0];
+		size_t n = got;
+		const size_t h = std::min(n, limits.head - head.size());
+		head.insert(head.end(), p, p + h);
+		p += h;
+		n -= h;
+		if (!n || !limits.tail)
+			continue;
+		if (n >= limits.tail)
+		{
+			memcpy(&tail[0], p + n - limits.tail, limits.tail);
+			ring = 0;
+		}
+		else
+		{
+			const size_t first = std::min(n, limits.tail - ring);
+			memcpy(&tail[ring], p, first);
+			memcpy(&tail[0], p + first, n - first);
+			ring = (ring + n) % limits.tail;
+		}
+		tailKept = static_cast<size_t>(std::min<ULONGLONG>(tailKept + static_cast<ULONGLONG>(n), limits.tail));
+	}
+
+	// Oldest first; a ring that never filled never wrapped.
+	if (tailKept == limits.tail)
+		std::rotate(tail.begin(), tail.begin() + ring, tail.end());
+	else
+		tail.resize(tailKept);
+
+	if (walker)
+		walker->finish(counted);
+	delete walker;
+}
+
+bool OnePassAccessor::isOpen() const
+{
+	return opened;
+}
+
+size_t OnePassAccessor::fread(void *pv, size_t s1, size_t s2) const
+{
+	if (!opened || pos >= length)
+		return 0;
+	const size_t n = static_cast<size_t>(std::min<ULONGLONG>(s1 * s2, length - pos));
+	char *out = static_cast<char *>(pv);
+	size_t done = 0;
+
+	if (pos < head.size())
+	{
+		const size_t k = std::min(n, static_cast<size_t>(head.size() - pos));
+		memcpy(out, &head[static_cast<size_t>(pos)], k);
+		done += k;
+		pos += k;
+	}
+
+	// What was dropped reads as nothing, but a read that reaches into the tail gets it, with zeros
+	//  before it, so that a search back from the end isn't cut short.
+	const ULONGLONG tailStart = length - tailKept;
+	if (done < n && pos + (n - done) > tailStart)
+	{
+		if (pos < tailStart)
+		{
+			const size_t gap = static_cast<size_t>(tailStart - pos);
+			memset(out + done, 0, gap);
+			done += gap;
+			pos += gap;
+		}
+		const size_t k = n - done;
+		memcpy(out + done, &tail[static_cast<size_t>(pos - tailStart)], k);
+		done += k;
+		pos += k;
+	}
+	return done;
+}
+
+size_t OnePassAccessor::fwrite(const void *, size_t, size_t)
+{
+	return 0;
+}
+
+int OnePassAccessor::fseek(long distance, int direction)
+{
+	const LONGLONG base = direction == SEEK_SET ? 0 : direction == SEEK_CUR ? static_cast<LONGLONG>(pos) : static_cast<LONGLONG>(length);
+	if (base + distance < 0)
+		return -1;
+	pos = base + distance;
+	return 0;
+}
+
+void OnePassAccessor::clearError()
+{
+}
+
+long OnePassAccessor::tell() const
+{
+	return static_cast<long>(pos);
+}
+
+int OnePassAccessor::truncate(long)
+{
+	return -1; // error
+}
+
+TagLib::FileNameHandle OnePassAccessor::name() const
+{
+	return TagLib::FileName(fname.c_str());
+}
+
+bool OnePassAccessor::readOnly() const
+{
+	return true;
+}
+
+HRESULT readStreamedProperty(const TagLib::FileRef &file, const OnePassAccessor &source, REFPROPERTYKEY key, PROPVARIANT *pv)
+{
+	const HRESULT hr = readProperty(file, key, pv);
+	const ULONGLONG duration = source.streamed().duration();
+	if (!IsEqualPropertyKey(key, PKEY_Media_Duration) || !duration || file.isNull())
+		return hr;
+	PropVariantClear(pv);
+	pv->uhVal.QuadPart = duration;
+	pv->vt = VT_UI8;
+	return S_OK;
+}
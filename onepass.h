@@ -0,0 +1,86 @@
+#pragma once
+
+#include <windows.h>
+#include <objidl.h> // ISequentialStream
+#include <fileref.h>
+#include <propsys.h>
+
+#include <string>
+#include <vector>
+
+// === Reading a stream that can't seek: pipes, stdin, decompressors, sockets. ===
+// The source is read once, start to end, when the accessor is made, and only two parts are kept:
+//  the head, for the tags that come first (ID3v2, Vorbis comments, FLAC metadata, MP4 atoms), and,
+//  in a ring, the tail, for the ones that come last (ID3v1, APE). TagLib is then given a file of
+//  the real length in which the middle reads as nothing. Memory is the two buffers whatever the size.
+// What TagLib would have worked out from the middle is worked out on the way through instead: MPEG
+//  frames are counted, header to header, and the last granule position of an Ogg stream is kept.
+//  readStreamedProperty() uses those for the duration in place of TagLib's estimate.
+// The format is taken from the name's extension, as TagLib takes it.
+
+struct OnePassAccessor : public TagLib::FileAccessor
+{
+	struct Limits
+	{
+		Limits() : head(1024 * 1024), tail(256 * 1024) {}
+		size_t head, tail; // bytes.
+	};
+
+	// What was counted on the way through; all 0 where nothing was.
+	struct Streamed
+	{
+		ULONGLONG frames;     // MPEG.
+		ULONGLONG samples;    // MPEG: frames times their length; Ogg: the last granule, less any pre-skip.
+		unsigned sampleRate;
+		// In 100ns units, as PKEY_Media_Duration; 0 if unknown.
+		ULONGLONG duration() const;
+	};
+
+	// Anything else that can be read through once: read() gives 0 bytes at the end, and false on an error.
+	struct Source
+	{
+		virtual ~Source() {}
+		virtual bool read(void *buf, ULONG size, ULONG *got) = 0;
+	};
+
+	// The source isn't AddRef'd or closed; it's all been read by the time this returns.
+	OnePassAccessor(ISequentialStream *source, const std::wstring &name, const Limits &limits = Limits());
+	OnePassAccessor(HANDLE source, const std::wstring &name, const Limits &limits = Limits());
+	OnePassAccessor(Source &source, const std::wstring &name, const Limits &limits = Limits());
+	~OnePassAccessor();
+
+	ULONGLONG size() const { return length; }
+	const Streamed &streamed() const { return counted; }
+	// The bytes held, which the limits cap however long the source.
+	size_t kept() const { return head.size() + tail.size(); }
+	// Whether the head and tail met, so that nothing was dropped.
+	bool whole() const { return length <= head.size() + tailKept; }
+
+	bool isOpen() const;
+	size_t fread(void *pv, size_t s1, size_t s2) const;
+	size_t fwrite(const void *, size_t, size_t);
+	int fseek(long distance, int direction);
+	void clearError();
+	long tell() const;
+	int truncate(long);
+	TagLib::FileNameHandle name() const;
+	bool readOnly() const;
+
+private:
+	void consume(Source &source);
+
+	std::wstring fname;
+	Limits limits;
+	std::vector<char> head, tail; // tail: a ring until consume() is done, then in order.
+	size_t tailKept;
+	ULONGLONG length;
+	bool opened;
+	mutable ULONGLONG pos;
+	Streamed counted;
+
+	OnePassAccessor(const OnePassAccessor &);
+	OnePassAccessor &operator=(const OnePassAccessor &);
+};
+
+// readProperty(), but with the duration the source counted, where it counted one.
+HRESULT readStreamedProperty(const TagLib::FileRef &file, const OnePassAccessor &source, REFPROPERTYKEY key, PROPVARIANT *pv);
@@ -0,0 +1,249 @@
+#include "prefetch.h"
+#include "extract.h" // handledExtension
+#include "lock.h"
+
+#include <shlwapi.h> // StrCmpLogicalW
+
+#include <algorithm>
+
+namespace
+{
+	const size_t keptDirs = 8;
+	const unsigned slack = 2;       // files a walk may skip, or open out of turn, as parallel callers do.
+	const unsigned pauseOpens = 256;
+
+	// Explorer's order: "2" before "10".
+	struct Logical
+	{
+		bool operator()(const std::wstring &a, const std::wstring &b) const
+		{
+			return StrCmpLogicalW(a.c_str(), b.c_str()) < 0;
+		}
+	};
+
+	std::vector<std::wstring> list(const std::wstring &dir)
+	{
+		std::vector<std::wstring> names;
+		WIN32_FIND_DATA fd;
+		HANDLE h = FindFirstFile((dir + L"\\*").c_str(), &fd);
+		if (h == INVALID_HANDLE_VALUE)
+			return names;
+		do
+			if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && handledExtension(fd.cFileName))
+				names.push_back(fd.cFileName);
+		while (FindNextFile(h, &fd));
+		FindClose(h);
+		std::sort(names.begin(), names.end(), Logical());
+		return names;
+	}
+
+	// names.size() if it isn't there.
+	size_t indexOf(const std::vector<std::wstring> &names, const std::wstring &name)
+	{
+		const std::vector<std::wstring>::const_iterator it = std::lower_bound(names.begin(), names.end(), name, Logical());
+		return it != names.end() && !StrCmpLogicalW(it->c_str(), name.c_str()) ? it - names.begin() : names.size();
+	}
+
+	void readAt(HANDLE h, ULONGLONG offset, DWORD length, std::vector<char> &buf)
+	{
+		buf.resize(length);
+		OVERLAPPED at = {};
+		at.Offset = static_cast<DWORD>(offset);
+		at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		DWORD got;
+		if (length)
+			ReadFile(h, &buf[0], length, &got, &at);
+	}
+}
+
+Prefetcher::Prefetcher(unsigned ahead, DWORD head, DWORD tail)
+	: ahead(ahead), head(head), tail(tail), running(false), work(CreateThreadpoolWork(drain, this, NULL)),
+	recent(0), scored(0), pausedFor(0)
+{
+	InitializeCriticalSection(&cs);
+	Stats zero = {};
+	counts = zero;
+}
+
+Prefetcher::~Prefetcher()
+{
+	if (work)
+	{
+		WaitForThreadpoolWorkCallbacks(work, FALSE);
+		CloseThreadpoolWork(work);
+	}
+	DeleteCriticalSection(&cs);
+}
+
+Prefetcher::Stats Prefetcher::stats()
+{
+	Lock lock(cs);
+	Stats s = counts;
+	s.paused = pausedFor != 0;
+	return s;
+}
+
+Prefetcher::Dir &Prefetcher::find(const std::wstring &dir)
+{
+	for (dirs_t::iterator it = dirs.begin(); it != dirs.end(); ++it)
+		if (it->first == dir)
+		{
+			dirs.splice(dirs.begin(), dirs, it);
+			return dirs.front().second;
+		}
+
+	dirs.push_front(std::make_pair(dir, Dir()));
+	if (dirs.size() > keptDirs)
+	{
+		// Whatever was fetched for a folder that's been left wasn't wanted.
+		for (size_t n = dirs.back().second.outstanding.size(); n; --n)
+			score(false);
+		dirs.pop_back();
+	}
+	return dirs.front().second;
+}
+
+void Prefetcher::score(bool hit)
+{
+	++(hit ? counts.hits : counts.wasted);
+	recent = (recent << 1) | (hit ? 1 : 0);
+	if (scored < 32)
+		++scored;
+
+	unsigned hits = 0;
+	for (unsigned i = 0; i < scored; ++i)
+		hits += (recent >> i) & 1;
+	if (scored >= 16 && hits * 2 < scored)
+	{
+		pausedFor = pauseOpens;
+		recent = scored = 0;
+		++counts.pauses;
+	}
+}
+
+void Prefetcher::opened(const std::wstring &path)
+{
+	const std::wstring::size_type slash = path.rfind(L'\\');
+	if (!ahead || slash == std::wstring::npos)
+		return;
+	const std::wstring dir = path.substr(0, slash), name = path.substr(slash + 1);
+
+	// A folder's listed when a second file in it is opened; one look at a folder is no walk.
+	{
+		Lock lock(cs);
+		Dir &d = find(dir);
+		if (!d.listed && (d.first.empty() || d.first == name))
+		{
+			d.first = name;
+			return;
+		}
+	}
+	std::vector<std::wstring> names;
+	bool listing = false;
+	{
+		Lock lock(cs);
+		listing = !find(dir).listed;
+	}
+	if (listing)
+		names = list(dir);
+
+	Lock lock(cs);
+	Dir &d = find(dir);
+	if (!d.listed)
+	{
+		d.names.swap(names);
+		d.listed = true;
+		d.last = indexOf(d.names, d.first);
+	}
+
+	const size_t i = indexOf(d.names, name);
+	if (i == d.names.size())
+		return;
+
+	for (std::set<size_t>::iterator it = d.outstanding.begin(); it != d.outstanding.end() && *it <= i; )
+		if (*it == i || *it + slack < i)
+		{
+			score(*it == i);
+			d.outstanding.erase(it++);
+		}
+		else
+			++it;
+
+	d.streak = i > d.last && i <= d.last + slack ? d.streak + 1 : 0;
+	d.last = i;
+	if (pausedFor)
+	{
+		--pausedFor;
+		return;
+	}
+	if (!d.streak)
+		return;
+
+	const size_t end = std::min(d.names.size(), i + 1 + ahead);
+	for (size_t j = std::max(d.queued, i + 1); j < end; ++j)
+	{
+		d.outstanding.insert(j);
+		queue.push_back(dir + L"\\" + d.names[j]);
+		++counts.issued;
+	}
+	d.queued = std::max(d.queued, end);
+
+	if (running || queue.empty() || !work)
+		return;
+
+	// The drain keeps the module loaded until it's finished, so that a DLL can't be unloaded under it.
+	HMODULE module;
+	if (!GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, reinterpret_cast<LPCWSTR>(&drain), &module))
+		return;
+	running = true;
+	SubmitThreadpoolWork(work);
+}
+
+// One file at a time: the reads are for a disk that's already busy with the caller's.
+VOID CALLBACK Prefetcher::drain(PTP_CALLBACK_INSTANCE instance, PVOID param, PTP_WORK)
+{
+	Prefetcher &p = *static_cast<Prefetcher *>(param);
+	for (;;)
+	{
+		std::wstring path;
+		{
+			Lock lock(p.cs);
+			if (p.queue.empty())
+			{
+				p.running = false;
+				break;
+			}
+			path = p.queue.front();
+			p.queue.pop_front();
+		}
+		p.warm(path);
+	}
+
+	HMODULE module;
+	if (GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+			reinterpret_cast<LPCWSTR>(&drain), &module))
+		FreeLibraryWhenCallbackReturns(instance, module);
+}
+
+// Plain buffered reads of the head and tail; it's the copy left in the cache that's wanted.
+void Prefetcher::warm(const std::wstring &path)
+{
+	HANDLE h = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return;
+	LARGE_INTEGER size;
+	std::vector<char> buf;
+	if (GetFileSizeEx(h, &size))
+	{
+		const ULONGLONG n = size.QuadPart;
+		if (n <= static_cast<ULONGLONG>(head) + tail)
+			readAt(h, 0, static_cast<DWORD>(n), buf);
+		else
+		{
+			readAt(h, 0, head, buf);
+			readAt(h, n - tail, tail, buf);
+		}
+	}
+	CloseHandle(h);
+}
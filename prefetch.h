@@ -0,0 +1,73 @@
+#pragma once
+
+#include <windows.h>
+
+#include <deque>
+#include <list>
+#include <set>
+#include <string>
+#include <vector>
+
+// === Reading ahead through a folder that's being opened in order. ===
+// A folder view, or an album-at-a-time indexer, opens tracks 01..NN of a folder one after another,
+//  and each waits out a cold read of its head and tail. Told of each file as it's opened, a
+//  Prefetcher spots a walk forward through a folder (in name order, as Explorer sorts it) and
+//  reads the heads and tails of the next `ahead` files into the cache on a pool thread, one file
+//  at a time, so that by the time they're opened there's nothing to wait for.
+// It keeps score: a prefetched file that's opened is a hit; one that's walked past, or whose
+//  folder is left, is wasted. When fewer than half of the recent ones are hits, it stops
+//  prefetching for a while, then tries again.
+// Reads don't go through any I/O budget (ratelimit.h), so tell it only of interactive opens.
+
+class Prefetcher
+{
+public:
+	struct Stats
+	{
+		unsigned long long issued, hits, wasted;
+		unsigned long long pauses; // times it's stopped for a poor hit rate.
+		bool paused;
+	};
+
+	Prefetcher(unsigned ahead = 4, DWORD head = 64 * 1024, DWORD tail = 64 * 1024);
+	~Prefetcher(); // waits for the reads in flight. Not to be destroyed at process exit from a DLL.
+
+	// A file is about to be read; path must be a full path.
+	void opened(const std::wstring &path);
+	Stats stats();
+
+private:
+	struct Dir
+	{
+		Dir() : listed(false), last(0), streak(0), queued(0) {}
+		bool listed;
+		std::wstring first;            // the first opened, until it's listed.
+		std::vector<std::wstring> names;
+		size_t last;                   // index of the last opened.
+		unsigned streak;               // opens in a row that stepped forward.
+		size_t queued;                 // everything before this index has been prefetched, or passed.
+		std::set<size_t> outstanding;  // prefetched, not yet opened.
+	};
+	typedef std::list<std::pair<std::wstring, Dir> > dirs_t;
+
+	static VOID CALLBACK drain(PTP_CALLBACK_INSTANCE instance, PVOID param, PTP_WORK);
+	void warm(const std::wstring &path);
+	void score(bool hit);
+	Dir &find(const std::wstring &dir);
+
+	const unsigned ahead;
+	const DWORD head, tail;
+
+	CRITICAL_SECTION cs;
+	dirs_t dirs;                       // most recent first.
+	std::deque<std::wstring> queue;
+	bool running;                      // a drain is submitted, or running.
+	PTP_WORK work;
+
+	unsigned recent, scored;           // the last few outcomes, as bits, and how many.
+	unsigned pausedFor;                // opens left before trying again.
+	Stats counts;
+
+	Prefetcher(const Prefetcher &);
+	Prefetcher &operator=(const Prefetcher &);
+};
@@ -0,0 +1,88 @@
+#include "ratelimit.h"
+#include "lock.h"
+
+#include <algorithm>
+
+TokenBucket::TokenBucket(double bytesPerSec, double opsPerSec)
+	: byteRate(bytesPerSec), opRate(opsPerSec), byteTokens(bytesPerSec), opTokens(opsPerSec)
+{
+	LARGE_INTEGER f, now;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&now);
+	freq = static_cast<double>(f.QuadPart);
+	last = now.QuadPart;
+
+	st.bytesPerSec = bytesPerSec;
+	st.opsPerSec = opsPerSec;
+	st.reads = st.bytes = st.throttled = 0;
+	st.waitedMs = 0;
+
+	InitializeCriticalSection(&cs);
+}
+
+TokenBucket::~TokenBucket()
+{
+	DeleteCriticalSection(&cs);
+}
+
+// Called with cs held.
+void TokenBucket::refill()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	const double secs = (now.QuadPart - last) / freq;
+	last = now.QuadPart;
+
+	byteTokens = std::min(byteRate, byteTokens + secs * byteRate);
+	opTokens = std::min(opRate, opTokens + secs * opRate);
+}
+
+void TokenBucket::setRate(double bytesPerSec, double opsPerSec)
+{
+	Lock l(cs);
+	refill();
+	byteRate = st.bytesPerSec = bytesPerSec;
+	opRate = st.opsPerSec = opsPerSec;
+	byteTokens = std::min(byteTokens, byteRate);
+	opTokens = std::min(opTokens, opRate);
+}
+
+void TokenBucket::take(size_t bytes)
+{
+	double wait = 0; // seconds
+	{
+		Lock l(cs);
+		++st.reads;
+		st.bytes += bytes;
+
+		refill();
+		if (byteRate > 0)
+		{
+			byteTokens -= bytes;
+			if (byteTokens < 0)
+				wait = std::max(wait, -byteTokens / byteRate);
+		}
+		if (opRate > 0)
+		{
+			opTokens -= 1;
+			if (opTokens < 0)
+				wait = std::max(wait, -opTokens / opRate);
+		}
+
+		if (wait > 0)
+		{
+			++st.throttled;
+			st.waitedMs += wait * 1000;
+		}
+	}
+
+	// Sleep outside the lock; the debt is already recorded, so other readers queue up behind us.
+	if (wait > 0)
+		Sleep(static_cast<DWORD>(wait * 1000 + 0.5));
+}
+
+TokenBucket::Stats TokenBucket::stats()
+{
+	Lock l(cs);
+	return st;
+}
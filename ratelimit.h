@@ -0,0 +1,102 @@
+#pragma once
+
+#include <windows.h>
+#include <fileref.h>
+#include <memory>
+
+// === I/O budgets for background scans. ===
+// A token bucket on both bytes/s and reads/s (IOPS). Each read takes its bytes and one operation
+//  up front, and the caller then sleeps off any debt, so a read larger than the bucket still gets
+//  through, just late. The bucket holds at most a second's worth of either, which is the largest
+//  burst a scan can make after sitting idle.
+// Thread safe; the rates can be changed while reads are in flight.
+class TokenBucket
+{
+public:
+	// 0 for either rate means unlimited.
+	TokenBucket(double bytesPerSec = 0, double opsPerSec = 0);
+	~TokenBucket();
+
+	void setRate(double bytesPerSec, double opsPerSec);
+
+	// Account for one read of `bytes`, sleeping until it fits in the budget.
+	void take(size_t bytes);
+
+	struct Stats
+	{
+		double bytesPerSec, opsPerSec;
+		unsigned long long reads, bytes;
+		unsigned long long throttled; // reads that had to wait.
+		double waitedMs;
+	};
+	Stats stats();
+
+private:
+	void refill();
+
+	double byteRate, opRate;
+	double byteTokens, opTokens;
+	LONGLONG last;
+	double freq;
+	Stats st;
+	CRITICAL_SECTION cs;
+
+	TokenBucket(const TokenBucket &);
+	TokenBucket &operator=(const TokenBucket &);
+};
+
+// Wraps another accessor (ie. an IStreamAccessor), charging every read to a bucket.
+// Seeks are free; they don't touch the disk until the next read.
+struct ThrottledAccessor : public TagLib::FileAccessor
+{
+	ThrottledAccessor(TagLib::FileAccessor *inner, TokenBucket *bucket) : inner(inner), bucket(bucket) {}
+
+	std::auto_ptr<TagLib::FileAccessor> inner;
+	TokenBucket *bucket;
+
+	bool isOpen() const
+	{
+		return inner->isOpen();
+	}
+
+	size_t fread(void *pv, size_t s1, size_t s2) const
+	{
+		bucket->take(s1*s2);
+		return inner->fread(pv, s1, s2);
+	}
+
+	size_t fwrite(const void *pv, size_t s1, size_t s2)
+	{
+		return inner->fwrite(pv, s1, s2);
+	}
+
+	int fseek(long distance, int direction)
+	{
+		return inner->fseek(distance, direction);
+	}
+
+	void clearError()
+	{
+		inner->clearError();
+	}
+
+	long tell() const
+	{
+		return inner->tell();
+	}
+
+	int truncate(long length)
+	{
+		return inner->truncate(length);
+	}
+
+	TagLib::FileNameHandle name() const
+	{
+		return inner->name();
+	}
+
+	bool readOnly() const
+	{
+		return inner->readOnly();
+	}
+};
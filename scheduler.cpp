@@ -0,0 +1,195 @@
+#include "scheduler.h"
+#include "lock.h"
+
+#include <cmath>
+
+Scheduler::Job::Job() : done(CreateEvent(NULL, TRUE, FALSE, NULL))
+{
+	queued.QuadPart = 0;
+}
+
+Scheduler::Job::~Job()
+{
+	CloseHandle(done);
+}
+
+void Scheduler::Job::wait()
+{
+	WaitForSingleObject(done, INFINITE);
+}
+
+Scheduler::Scheduler(unsigned nthreads, unsigned burst, bool fifo)
+	: burst(burst), run(0), backgroundRunning(0), backgroundLimit(nthreads > 1 ? nthreads - 1 : 1), deferred(0),
+	fifo(fifo), stopping(false)
+{
+	LARGE_INTEGER f;
+	QueryPerformanceFrequency(&f);
+	freq = static_cast<double>(f.QuadPart);
+
+	for (int c = 0; c < CLASSES; ++c)
+	{
+		queues[c].maxDepth = 0;
+		queues[c].completed = 0;
+		queues[c].max = 0;
+		for (int b = 0; b < BUCKETS; ++b)
+			queues[c].histogram[b] = 0;
+	}
+
+	InitializeCriticalSection(&cs);
+	available = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+	for (unsigned i = 0; i < nthreads; ++i)
+		if (HANDLE h = CreateThread(NULL, 0, worker, this, 0, NULL))
+			threads.push_back(h);
+}
+
+Scheduler::~Scheduler()
+{
+	{
+		Lock l(cs);
+		stopping = true;
+	}
+	ReleaseSemaphore(available, static_cast<LONG>(threads.size()), NULL);
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+	CloseHandle(available);
+	DeleteCriticalSection(&cs);
+}
+
+void Scheduler::submit(Class c, Job *job)
+{
+	if (fifo)
+		c = INTERACTIVE;
+
+	ResetEvent(job->done);
+	QueryPerformanceCounter(&job->queued);
+	{
+		Lock l(cs);
+		Queue &q = queues[c];
+		q.jobs.push_back(job);
+		if (q.jobs.size() > q.maxDepth)
+			q.maxDepth = q.jobs.size();
+	}
+	ReleaseSemaphore(available, 1, NULL);
+}
+
+// Pick the next job; called with cs held.
+Scheduler::Job *Scheduler::next(Class &c)
+{
+	Queue &fg = queues[INTERACTIVE], &bg = queues[BACKGROUND];
+	const bool backgroundReady = !bg.jobs.empty() && backgroundRunning < backgroundLimit;
+	const bool letBackground = backgroundReady && run >= burst;
+
+	if (!fg.jobs.empty() && !letBackground)
+	{
+		c = INTERACTIVE;
+		++run;
+	}
+	else if (backgroundReady)
+	{
+		c = BACKGROUND;
+		run = 0;
+		++backgroundRunning;
+	}
+	else
+		return NULL;
+
+	Job *job = queues[c].jobs.front();
+	queues[c].jobs.pop_front();
+	return job;
+}
+
+void Scheduler::finished(Class c, Job *job)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	const double us = (now.QuadPart - job->queued.QuadPart) * 1e6 / freq;
+
+	int bucket = 0;
+	while (bucket < BUCKETS - 1 && (1ull << bucket) < us)
+		++bucket;
+
+	bool wake = false;
+	{
+		Lock l(cs);
+		Queue &q = queues[c];
+		++q.completed;
+		++q.histogram[bucket];
+		if (us > q.max)
+			q.max = us;
+
+		// A background slot is free; hand back a wakeup a worker gave up on.
+		if (c == BACKGROUND)
+		{
+			--backgroundRunning;
+			if (deferred)
+			{
+				--deferred;
+				wake = true;
+			}
+		}
+	}
+	if (wake)
+		ReleaseSemaphore(available, 1, NULL);
+}
+
+DWORD WINAPI Scheduler::worker(LPVOID param)
+{
+	Scheduler &s = *static_cast<Scheduler *>(param);
+	for (;;)
+	{
+		WaitForSingleObject(s.available, INFINITE);
+
+		Class c;
+		Job *job;
+		{
+			Lock l(s.cs);
+			if (s.stopping)
+				return 0;
+			job = s.next(c);
+			// Only background work is waiting, and it's at its limit; finished() will wake us again.
+			if (!job)
+				++s.deferred;
+		}
+		if (!job)
+			continue;
+
+		job->run();
+		s.finished(c, job);
+		SetEvent(job->done);
+	}
+}
+
+Scheduler::Stats Scheduler::stats(Class c)
+{
+	Lock l(cs);
+	const Queue &q = queues[c];
+
+	Stats st;
+	st.depth = q.jobs.size();
+	st.maxDepth = q.maxDepth;
+	st.completed = q.completed;
+	st.max = q.max;
+	st.p50 = st.p99 = 0;
+
+	// Report the upper bound of the bucket the percentile falls into.
+	unsigned long long seen = 0;
+	bool have50 = false;
+	for (int b = 0; b < BUCKETS && q.completed; ++b)
+	{
+		seen += q.histogram[b];
+		if (!have50 && seen * 2 >= q.completed)
+		{
+			st.p50 = std::ldexp(1.0, b);
+			have50 = true;
+		}
+		if (seen * 100 >= q.completed * 99)
+		{
+			st.p99 = std::ldexp(1.0, b);
+			break;
+		}
+	}
+	return st;
+}
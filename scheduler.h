@@ -0,0 +1,79 @@
+#pragma once
+
+#include <windows.h>
+#include <deque>
+#include <vector>
+
+// === A two-class priority scheduler for extraction work. ===
+//  - Interactive work (someone is looking at a folder) always runs before queued background work
+//    (an indexer's backlog), but running jobs are never interrupted; a job is one file.
+//  - Starvation is bounded: while background work is waiting, at most `burst` interactive jobs
+//    are dispatched in a row before one background job is let through.
+//  - Background jobs never occupy every worker (unless there's only one), so that interactive
+//    work has a thread even when background reads are sleeping off an I/O budget (ratelimit.h).
+//  - Each class keeps its queue depth and a histogram of latency (queued to finished).
+
+class Scheduler
+{
+public:
+	enum Class { INTERACTIVE, BACKGROUND, CLASSES };
+
+	// A unit of work. The submitter owns it, and must wait() before destroying it.
+	struct Job
+	{
+		Job();
+		virtual ~Job();
+		virtual void run() = 0;
+		void wait();
+
+	private:
+		friend class Scheduler;
+		HANDLE done;
+		LARGE_INTEGER queued;
+		Job(const Job &);
+		Job &operator=(const Job &);
+	};
+
+	struct Stats
+	{
+		size_t depth, maxDepth;
+		unsigned long long completed;
+		// Latency, in microseconds, estimated from a log2 histogram.
+		double p50, p99, max;
+	};
+
+	// fifo disables the priorities (everything is treated as interactive), for comparison.
+	Scheduler(unsigned threads, unsigned burst = 8, bool fifo = false);
+	~Scheduler();
+
+	void submit(Class c, Job *job);
+	Stats stats(Class c);
+
+private:
+	static DWORD WINAPI worker(LPVOID);
+	Job *next(Class &c);
+	void finished(Class c, Job *job);
+
+	enum { BUCKETS = 40 };
+	struct Queue
+	{
+		std::deque<Job *> jobs;
+		size_t maxDepth;
+		unsigned long long completed;
+		unsigned long long histogram[BUCKETS];
+		double max;
+	};
+
+	Queue queues[CLASSES];
+	unsigned burst, run;
+	unsigned backgroundRunning, backgroundLimit;
+	unsigned deferred; // wakeups swallowed while background work was at its limit.
+	bool fifo, stopping;
+	double freq;
+	CRITICAL_SECTION cs;
+	HANDLE available; // semaphore, counts queued jobs.
+	std::vector<HANDLE> threads;
+
+	Scheduler(const Scheduler &);
+	Scheduler &operator=(const Scheduler &);
+};
@@ -0,0 +1,262 @@
+#include "sharedcache.h"
+
+#include <cstddef>
+#include <cstring>
+
+struct SharedSnapshotCache::Header
+{
+	// Whoever gets there first sets these; everyone else checks they agree.
+	volatile LONG slots, arena;
+	volatile LONGLONG cursor;
+	volatile LONGLONG hits, misses, torn, inserts, replaced;
+	LONGLONG reserved[1];
+};
+
+struct SharedSnapshotCache::Slot
+{
+	volatile LONGLONG hash, pos;
+};
+
+// Followed by the identity (UTF-16, no NUL) and the snapshot, then padding to 8 bytes.
+struct SharedSnapshotCache::Record
+{
+	unsigned length; // of the whole record.
+	unsigned identityLength, snapshotLength;
+	unsigned reserved;
+	ULONGLONG hash, size, mtime;
+	ULONGLONG check; // of everything else; see sum().
+};
+
+namespace
+{
+	// Interlocked, as a plain 64-bit read tears on x86.
+	inline LONGLONG load(volatile LONGLONG *p)
+	{
+		return InterlockedCompareExchange64(p, 0, 0);
+	}
+
+	inline void count(volatile LONGLONG *p)
+	{
+		InterlockedExchangeAdd64(p, 1);
+	}
+
+	// FNV-1a.
+	ULONGLONG fnv(const void *data, size_t size, ULONGLONG h = 14695981039346656037ULL)
+	{
+		const unsigned char *p = static_cast<const unsigned char *>(data);
+		for (size_t i = 0; i < size; ++i)
+			h = (h ^ p[i]) * 1099511628211ULL;
+		return h;
+	}
+
+	// Never 0, which marks an empty slot.
+	ULONGLONG hashOf(const std::wstring &identity)
+	{
+		const ULONGLONG h = fnv(identity.data(), identity.size() * sizeof(wchar_t));
+		return h ? h : 1;
+	}
+
+	// How many slots a lookup or insert looks at.
+	const unsigned probes = 8;
+}
+
+SharedSnapshotCache::SharedSnapshotCache(const wchar_t *name, unsigned slotCount, unsigned arenaBytes)
+	: mapping(NULL), header(NULL), slots(NULL), arena(NULL), mask(slotCount - 1), arenaSize(arenaBytes)
+{
+	if (!slotCount || (slotCount & mask) || !arenaBytes || arenaBytes % 8)
+		return;
+
+	const ULONGLONG total = sizeof(Header) + static_cast<ULONGLONG>(slotCount) * sizeof(Slot) + arenaBytes;
+	if (total > static_cast<SIZE_T>(-1))
+		return;
+
+	// Backed by the page file, so a new segment is all zeros: an empty table at cursor 0.
+	mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		static_cast<DWORD>(total >> 32), static_cast<DWORD>(total), name);
+	if (!mapping)
+		return;
+
+	void *view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, static_cast<SIZE_T>(total));
+	if (!view)
+		return;
+
+	Header *h = static_cast<Header *>(view);
+	const LONG s = InterlockedCompareExchange(&h->slots, static_cast<LONG>(slotCount), 0);
+	const LONG a = InterlockedCompareExchange(&h->arena, static_cast<LONG>(arenaBytes), 0);
+	if ((s && s != static_cast<LONG>(slotCount)) || (a && a != static_cast<LONG>(arenaBytes)))
+	{
+		UnmapViewOfFile(view);
+		return;
+	}
+
+	header = h;
+	slots = reinterpret_cast<Slot *>(h + 1);
+	arena = reinterpret_cast<unsigned char *>(slots + slotCount);
+}
+
+SharedSnapshotCache::~SharedSnapshotCache()
+{
+	if (header)
+		UnmapViewOfFile(header);
+	if (mapping)
+		CloseHandle(mapping);
+}
+
+// Whether a record at pos hasn't been written over yet.
+bool SharedSnapshotCache::live(ULONGLONG pos) const
+{
+	return static_cast<ULONGLONG>(load(&header->cursor)) <= pos + arenaSize;
+}
+
+// Somewhere in the arena to put a record, which never straddles the end.
+ULONGLONG SharedSnapshotCache::reserve(unsigned length)
+{
+	for (;;)
+	{
+		const LONGLONG cursor = load(&header->cursor);
+		const unsigned offset = static_cast<unsigned>(cursor % arenaSize);
+		const ULONGLONG start = offset + length > arenaSize ? cursor + (arenaSize - offset) : cursor;
+		if (InterlockedCompareExchange64(&header->cursor, start + length, cursor) == cursor)
+			return start;
+	}
+}
+
+// A writer that stalls for a whole trip round the ring writes over newer records when it wakes,
+//  which the cursor can't show; this can.
+ULONGLONG SharedSnapshotCache::sum(const Record &r, const void *body)
+{
+	ULONGLONG h = fnv(&r, offsetof(Record, check));
+	return fnv(body, r.identityLength * sizeof(wchar_t) + r.snapshotLength, h);
+}
+
+bool SharedSnapshotCache::read(ULONGLONG pos, ULONGLONG hash, const std::wstring &identity, ULONGLONG size, ULONGLONG mtime, std::string &snapshot)
+{
+	if (!live(pos))
+		return false;
+
+	const unsigned offset = static_cast<unsigned>(pos % arenaSize);
+	if (arenaSize - offset < sizeof(Record))
+		return false;
+
+	Record r;
+	memcpy(&r, arena + offset, sizeof(r));
+	const unsigned long long body = static_cast<unsigned long long>(r.identityLength) * sizeof(wchar_t) + r.snapshotLength;
+	if (r.hash != hash || r.size != size || r.mtime != mtime || r.identityLength != identity.size()
+		|| r.length > arenaSize - offset || sizeof(Record) + body > r.length)
+		return false;
+
+	std::string copy(reinterpret_cast<const char *>(arena + offset + sizeof(Record)), static_cast<size_t>(body));
+
+	// Everything above may have been read while someone wrote over it.
+	MemoryBarrier();
+	if (!live(pos) || sum(r, copy.data()) != r.check)
+	{
+		count(&header->torn);
+		return false;
+	}
+	const size_t id = identity.size() * sizeof(wchar_t);
+	if (memcmp(copy.data(), identity.data(), id))
+		return false;
+	copy.erase(0, id);
+	snapshot.swap(copy);
+	return true;
+}
+
+bool SharedSnapshotCache::find(const std::wstring &identity, ULONGLONG size, ULONGLONG mtime, std::string &snapshot)
+{
+	if (!header)
+		return false;
+
+	const ULONGLONG hash = hashOf(identity);
+	for (unsigned i = 0; i < probes; ++i)
+	{
+		Slot &s = slots[(hash + i) & mask];
+		if (static_cast<ULONGLONG>(load(&s.hash)) != hash)
+			continue;
+		const ULONGLONG pos = load(&s.pos);
+		if (pos && read(pos - 1, hash, identity, size, mtime, snapshot))
+		{
+			count(&header->hits);
+			return true;
+		}
+	}
+	count(&header->misses);
+	return false;
+}
+
+void SharedSnapshotCache::insert(const std::wstring &identity, ULONGLONG size, ULONGLONG mtime, const std::string &snapshot)
+{
+	if (!header)
+		return;
+
+	const unsigned long long body = identity.size() * sizeof(wchar_t) + snapshot.size();
+	if (body > arenaSize / 4)
+		return;
+	const unsigned length = static_cast<unsigned>((sizeof(Record) + body + 7) & ~7ULL);
+
+	const ULONGLONG hash = hashOf(identity);
+	const ULONGLONG pos = reserve(length);
+	unsigned char *p = arena + pos % arenaSize;
+
+	Record r = {};
+	r.length = length;
+	r.identityLength = static_cast<unsigned>(identity.size());
+	r.snapshotLength = static_cast<unsigned>(snapshot.size());
+	r.hash = hash;
+	r.size = size;
+	r.mtime = mtime;
+	std::string b(reinterpret_cast<const char *>(identity.data()), identity.size() * sizeof(wchar_t));
+	b += snapshot;
+	r.check = sum(r, b.data());
+	memcpy(p, &r, sizeof(r));
+	memcpy(p + sizeof(r), b.data(), b.size());
+	count(&header->inserts);
+	if (!live(pos))
+		return; // stalled, and already written over.
+
+	// The slot already ours, else an empty one, else the one pointing at the oldest record.
+	Slot *victim = NULL;
+	ULONGLONG oldest = ~0ULL;
+	for (unsigned i = 0; i < probes; ++i)
+	{
+		Slot &s = slots[(hash + i) & mask];
+		LONGLONG seen = load(&s.hash);
+		if (!seen)
+			seen = InterlockedCompareExchange64(&s.hash, hash, 0);
+		if (!seen || static_cast<ULONGLONG>(seen) == hash)
+		{
+			// The exchange is a full barrier: the record is written before anyone can find it.
+			InterlockedExchange64(&s.pos, pos + 1);
+			return;
+		}
+		const ULONGLONG at = load(&s.pos);
+		if (at < oldest)
+		{
+			oldest = at;
+			victim = &s;
+		}
+	}
+
+	// Readers that see the new hash before the new position find a record for another identity,
+	//  and miss. Losing the race to another inserter just leaves this record unreachable.
+	const LONGLONG was = load(&victim->hash);
+	if (InterlockedCompareExchange64(&victim->hash, hash, was) == was)
+	{
+		if (oldest && live(oldest - 1))
+			count(&header->replaced);
+		InterlockedExchange64(&victim->pos, pos + 1);
+	}
+}
+
+SharedSnapshotCache::Stats SharedSnapshotCache::stats() const
+{
+	Stats s = {};
+	if (!header)
+		return s;
+	s.hits = load(&header->hits);
+	s.misses = load(&header->misses);
+	s.torn = load(&header->torn);
+	s.inserts = load(&header->inserts);
+	s.replaced = load(&header->replaced);
+	return s;
+}
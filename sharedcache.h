@@ -0,0 +1,69 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+
+// === Snapshots shared between processes, in a named shared-memory segment. ===
+// Explorer, the search indexer, the preview host and tlhd all load the handler, and without this
+// each of them parses every file itself.
+//
+// The segment is a hash table of slots followed by an arena. Nothing in it is ever locked:
+//  - A slot is (u64 hash of the identity, u64 position of its newest record + 1). Lookups probe a
+//    few slots from the hash. Inserts claim an empty slot, or take over the oldest one they see.
+//  - The arena is a ring that records are appended to, at a 64-bit cursor that only ever grows.
+//    A record is reclaimed by being written over once the cursor has gone all the way round.
+//    That is the eviction, and it needs no state from readers. A process that dies mid-read
+//    holds nothing up.
+//  - A reader copies a record out, then checks the cursor again. If the cursor has come round as
+//    far as the record since, the copy may be torn and is thrown away. So is a copy that doesn't
+//    match the record's checksum.
+//  - A record holds the whole identity, size and mtime. A slot that points at someone else's
+//    record, or at a stale one, is a miss.
+// A writer that dies after appending but before publishing leaves a gap that the ring reuses
+//  anyway. Anything that reads like a record is bounds-checked before it's used.
+class SharedSnapshotCache
+{
+public:
+	// Maps the segment, creating it if this is the first process. Every process must ask for the same
+	//  size: slots must be a power of two, and arena a multiple of 8. Check ok() afterwards.
+	// The name changes whenever what an identity means does, so that processes still running an
+	//  older handler keep to a segment of their own.
+	SharedSnapshotCache(const wchar_t *name = L"Local\\tlh.snapcache.2", unsigned slots = 16384, unsigned arena = 8 << 20);
+	~SharedSnapshotCache();
+
+	// false if the segment couldn't be mapped, or was made with other sizes.
+	bool ok() const { return header != NULL; }
+
+	bool find(const std::wstring &identity, ULONGLONG size, ULONGLONG mtime, std::string &snapshot);
+	// Snapshots bigger than a quarter of the arena aren't kept.
+	void insert(const std::wstring &identity, ULONGLONG size, ULONGLONG mtime, const std::string &snapshot);
+
+	// Counted across every process using the segment.
+	struct Stats
+	{
+		unsigned long long hits, misses;
+		unsigned long long torn;     // records that were written over while being read.
+		unsigned long long inserts;
+		unsigned long long replaced; // slots taken over from another identity's live record.
+	};
+	Stats stats() const;
+
+private:
+	struct Header;
+	struct Slot;
+	struct Record;
+
+	ULONGLONG reserve(unsigned length);
+	static ULONGLONG sum(const Record &r, const void *body);
+	bool read(ULONGLONG pos, ULONGLONG hash, const std::wstring &identity, ULONGLONG size, ULONGLONG mtime, std::string &snapshot);
+	bool live(ULONGLONG pos) const;
+
+	HANDLE mapping;
+	Header *header;
+	Slot *slots;
+	unsigned char *arena;
+	unsigned mask, arenaSize;
+
+	SharedSnapshotCache(const SharedSnapshotCache &);
+	SharedSnapshotCache &operator=(const SharedSnapshotCache &);
+};
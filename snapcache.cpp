@@ -0,0 +1,165 @@
+#include "snapcache.h"
+
+#include <boost/functional/hash.hpp>
+
+SnapshotCache::SnapshotCache(size_t capacity, unsigned count)
+	: shards(new Shard[count]), nshards(count), perShard(capacity / count ? capacity / count : 1)
+{
+	for (unsigned i = 0; i < nshards; ++i)
+	{
+		InitializeCriticalSection(&shards[i].cs);
+		Stats zero = {};
+		shards[i].st = zero;
+	}
+}
+
+SnapshotCache::~SnapshotCache()
+{
+	for (unsigned i = 0; i < nshards; ++i)
+		DeleteCriticalSection(&shards[i].cs);
+	delete[] shards;
+}
+
+SnapshotCache::Shard &SnapshotCache::shardFor(const std::wstring &identity)
+{
+	return shards[boost::hash<std::wstring>()(identity) % nshards];
+}
+
+// Take the shard's lock, counting it if someone else has it.
+void SnapshotCache::lock(Shard &s)
+{
+	if (TryEnterCriticalSection(&s.cs))
+		return;
+	EnterCriticalSection(&s.cs);
+	++s.st.contended;
+}
+
+void SnapshotCache::release(Flight *f)
+{
+	if (!InterlockedDecrement(&f->refs))
+	{
+		CloseHandle(f->done);
+		delete f;
+	}
+}
+
+bool SnapshotCache::get(const std::wstring &identity, ULONGLONG size, ULONGLONG mtime, Loader &loader, std::string &snapshot)
+{
+	Shard &s = shardFor(identity);
+	lock(s);
+
+	std::map<std::wstring, order_t::iterator>::iterator it = s.index.find(identity);
+	if (it != s.index.end())
+	{
+		if (it->second->size == size && it->second->mtime == mtime)
+		{
+			++s.st.hits;
+			s.order.splice(s.order.begin(), s.order, it->second);
+			snapshot = it->second->snapshot;
+			LeaveCriticalSection(&s.cs);
+			return true;
+		}
+		// Stale; the file has changed since.
+		s.order.erase(it->second);
+		s.index.erase(it);
+	}
+
+	std::map<std::wstring, Flight *>::iterator fl = s.flights.find(identity);
+	if (fl != s.flights.end() && fl->second->size == size && fl->second->mtime == mtime)
+	{
+		++s.st.coalesced;
+		Flight *f = fl->second;
+		InterlockedIncrement(&f->refs);
+		LeaveCriticalSection(&s.cs);
+
+		WaitForSingleObject(f->done, INFINITE);
+		const bool ok = f->ok;
+		if (ok)
+			snapshot = f->snapshot;
+		release(f);
+		return ok;
+	}
+
+	// Ours to load. A load of an older version of the file may still be running; it'll find
+	//  it isn't the flight on record when it finishes, and leave the cache alone.
+	++s.st.misses;
+	HANDLE done = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!done)
+	{
+		// Nothing for anyone else to wait on, so no flight for them to join; just load it.
+		LeaveCriticalSection(&s.cs);
+		try
+		{
+			return loader.load(snapshot);
+		}
+		catch (...)
+		{
+			return false;
+		}
+	}
+	Flight *f = new Flight;
+	f->size = size;
+	f->mtime = mtime;
+	f->done = done;
+	f->ok = false;
+	f->refs = 1;
+	s.flights[identity] = f;
+	LeaveCriticalSection(&s.cs);
+
+	try
+	{
+		f->ok = loader.load(f->snapshot);
+	}
+	catch (...)
+	{
+		f->ok = false;
+	}
+
+	lock(s);
+	fl = s.flights.find(identity);
+	if (fl != s.flights.end() && fl->second == f)
+	{
+		s.flights.erase(fl);
+		if (f->ok)
+		{
+			Item item = { identity, size, mtime, f->snapshot };
+			s.order.push_front(item);
+			s.index[identity] = s.order.begin();
+			while (s.order.size() > perShard)
+			{
+				s.index.erase(s.order.back().identity);
+				s.order.pop_back();
+				++s.st.evictions;
+			}
+		}
+	}
+	if (!f->ok)
+		++s.st.failures;
+	LeaveCriticalSection(&s.cs);
+
+	// Waiters only read the result once this is set, and it's never written again.
+	const bool ok = f->ok;
+	if (ok)
+		snapshot = f->snapshot;
+	SetEvent(f->done);
+	release(f);
+	return ok;
+}
+
+SnapshotCache::Stats SnapshotCache::stats()
+{
+	Stats total = {};
+	for (unsigned i = 0; i < nshards; ++i)
+	{
+		Shard &s = shards[i];
+		EnterCriticalSection(&s.cs);
+		total.hits += s.st.hits;
+		total.misses += s.st.misses;
+		total.coalesced += s.st.coalesced;
+		total.contended += s.st.contended;
+		total.evictions += s.st.evictions;
+		total.failures += s.st.failures;
+		LeaveCriticalSection(&s.cs);
+	}
+	return total;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <windows.h>
+#include <list>
+#include <map>
+#include <string>
+
+// === A process-wide cache of snapshots, shared by every property store in the process. ===
+// The shell opens one file through several stores in quick succession (preview, details pane,
+// search, thumbnails), each of which would otherwise parse the same bytes again.
+//  - Entries are keyed by the file's identity, and only used while its size and mtime still match.
+//  - If a file is being loaded already, other callers wait for that load rather than start their own.
+//  - Split into shards, each with its own lock and its own share of the capacity, so that unrelated
+//    lookups rarely meet.
+class SnapshotCache
+{
+public:
+	// Produces the snapshot on a miss; called with no lock held.
+	struct Loader
+	{
+		virtual bool load(std::string &snapshot) = 0;
+	};
+
+	SnapshotCache(size_t capacity, unsigned shards = 16);
+	~SnapshotCache();
+
+	// The snapshot for a file, from the cache, someone else's load, or the loader.
+	// false if the loader failed, which isn't cached.
+	bool get(const std::wstring &identity, ULONGLONG size, ULONGLONG mtime, Loader &loader, std::string &snapshot);
+
+	struct Stats
+	{
+		unsigned long long hits, misses;
+		unsigned long long coalesced; // lookups that waited for another's load instead of loading.
+		unsigned long long contended; // lookups that found their shard's lock taken.
+		unsigned long long evictions, failures;
+	};
+	Stats stats();
+
+private:
+	// A load in progress. Shared by the loader and its waiters; the last one out deletes it.
+	struct Flight
+	{
+		ULONGLONG size, mtime;
+		HANDLE done;
+		bool ok;
+		std::string snapshot;
+		volatile LONG refs;
+	};
+
+	struct Item
+	{
+		std::wstring identity;
+		ULONGLONG size, mtime;
+		std::string snapshot;
+	};
+
+	typedef std::list<Item> order_t;
+
+	struct Shard
+	{
+		CRITICAL_SECTION cs;
+		order_t order; // most recently used first.
+		std::map<std::wstring, order_t::iterator> index;
+		std::map<std::wstring, Flight *> flights;
+		Stats st;
+	};
+
+	Shard &shardFor(const std::wstring &identity);
+	void lock(Shard &s);
+	static void release(Flight *f);
+
+	Shard *shards;
+	unsigned nshards;
+	size_t perShard;
+
+	SnapshotCache(const SnapshotCache &);
+	SnapshotCache &operator=(const SnapshotCache &);
+};
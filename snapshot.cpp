@@ -0,0 +1,332 @@
+#include "snapshot.h"
+#include "extract.h"
+
+#include <propvarutil.h>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include <boost/static_assert.hpp>
+
+BOOST_STATIC_ASSERT(sizeof(PROPERTYKEY) == 20 && sizeof(WCHAR) == 2);
+
+namespace
+{
+	const char magic[4] = { 'T', 'L', 'H', 'S' };
+
+	// Offsets of the fields in an entry.
+	const size_t keyAt = 0, typeAt = 20, itemsAt = 22, valueAt = 24;
+
+	template <typename T> void putAt(std::string &s, size_t pos, T v)
+	{
+		memcpy(&s[pos], &v, sizeof(v));
+	}
+
+	template <typename T> T at(const unsigned char *p)
+	{
+		T v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	unsigned typeOf(const PROPVARIANT &pv)
+	{
+		switch (pv.vt)
+		{
+			case VT_UI4: return SnapshotReader::U32;
+			case VT_UI8: return SnapshotReader::U64;
+			case VT_LPWSTR: return pv.pwszVal ? SnapshotReader::STRING : 0;
+			case VT_BSTR: return SnapshotReader::BSTRING;
+			case VT_ARRAY | VT_BSTR: return pv.parray ? SnapshotReader::LIST : 0;
+		}
+		return 0;
+	}
+
+	// Append a string to the blob, returning its offset.
+	unsigned appendString(std::string &out, const WCHAR *s, size_t len)
+	{
+		const size_t pos = out.size();
+		out.resize(pos + 2 * (len + 1));
+		if (len)
+			memcpy(&out[pos], s, 2 * len);
+		return static_cast<unsigned>(pos);
+	}
+
+	// (offset, length) of a string in the blob, as entries and list tables hold them.
+	unsigned long long stringRef(unsigned offset, size_t len)
+	{
+		return offset | static_cast<unsigned long long>(len) << 32;
+	}
+}
+
+std::string encodeSnapshot(const PROPERTYKEY *keys, const PROPVARIANT *values, size_t count)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < count; ++i)
+		if (typeOf(values[i]))
+			++n;
+
+	std::string out(SnapshotReader::headerSize + n * SnapshotReader::entrySize, '\0');
+	out.replace(0, sizeof(magic), magic, sizeof(magic));
+	putAt<unsigned char>(out, 4, SnapshotReader::major);
+	putAt<unsigned char>(out, 5, SnapshotReader::minor);
+	putAt<unsigned short>(out, 6, static_cast<unsigned short>(SnapshotReader::entrySize));
+	putAt<unsigned>(out, 8, static_cast<unsigned>(n));
+
+	size_t e = SnapshotReader::headerSize;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const PROPVARIANT &pv = values[i];
+		const unsigned type = typeOf(pv);
+		if (!type)
+			continue;
+
+		unsigned short items = 0;
+		unsigned long long value = 0;
+		switch (type)
+		{
+			case SnapshotReader::U32:
+				value = pv.ulVal;
+				break;
+			case SnapshotReader::U64:
+				value = pv.uhVal.QuadPart;
+				break;
+			case SnapshotReader::STRING:
+				{
+					const size_t len = lstrlenW(pv.pwszVal);
+					value = stringRef(appendString(out, pv.pwszVal, len), len);
+				}
+				break;
+			case SnapshotReader::BSTRING:
+				{
+					const size_t len = SysStringLen(pv.bstrVal);
+					value = stringRef(appendString(out, pv.bstrVal, len), len);
+				}
+				break;
+			case SnapshotReader::LIST:
+				{
+					long lo = 0, hi = -1;
+					SafeArrayGetLBound(pv.parray, 1, &lo);
+					SafeArrayGetUBound(pv.parray, 1, &hi);
+					items = static_cast<unsigned short>(std::min(hi - lo + 1, 0xffffL));
+
+					out.resize((out.size() + 3) & ~static_cast<size_t>(3));
+					const size_t table = out.size();
+					out.resize(table + 8 * items);
+					value = table;
+
+					BSTR *strings = NULL;
+					if (items && SUCCEEDED(SafeArrayAccessData(pv.parray, reinterpret_cast<void **>(&strings))))
+					{
+						for (unsigned short j = 0; j < items; ++j)
+						{
+							const size_t len = SysStringLen(strings[j]);
+							const unsigned offset = appendString(out, strings[j], len);
+							putAt<unsigned long long>(out, table + 8 * j, stringRef(offset, len));
+						}
+						SafeArrayUnaccessData(pv.parray);
+					}
+				}
+				break;
+		}
+
+		putAt<PROPERTYKEY>(out, e + keyAt, keys[i]);
+		putAt<unsigned short>(out, e + typeAt, static_cast<unsigned short>(type));
+		putAt<unsigned short>(out, e + itemsAt, items);
+		putAt<unsigned long long>(out, e + valueAt, value);
+		e += SnapshotReader::entrySize;
+	}
+
+	putAt<unsigned>(out, 12, static_cast<unsigned>(out.size()));
+	return out;
+}
+
+std::string takeSnapshot(const TagLib::FileRef &file)
+{
+	std::vector<PROPVARIANT> values(keyCount);
+	for (size_t i = 0; i < keyCount; ++i)
+	{
+		PropVariantInit(&values[i]);
+		if (readProperty(file, keys[i], &values[i]) != S_OK)
+			PropVariantClear(&values[i]);
+	}
+	const std::string ret = encodeSnapshot(keys, &values[0], keyCount);
+	for (size_t i = 0; i < keyCount; ++i)
+		PropVariantClear(&values[i]);
+	return ret;
+}
+
+bool takeSnapshotFrom(TagLib::FileAccessor *accessor, ULONGLONG size, const std::wstring &name, std::string &snapshot)
+{
+	std::vector<PROPVARIANT> values;
+	if (!readFileProperties(accessor, size, name, values))
+		return false;
+	snapshot = encodeSnapshot(keys, &values[0], keyCount);
+	for (size_t i = 0; i < keyCount; ++i)
+		PropVariantClear(&values[i]);
+	return true;
+}
+
+// === Reading. ===
+
+namespace
+{
+	// Whether a string reference lies inside the blob, and is terminated.
+	bool validString(const unsigned char *base, size_t blob, size_t total, unsigned long long ref)
+	{
+		const size_t offset = static_cast<unsigned>(ref), len = static_cast<unsigned>(ref >> 32);
+		return offset >= blob && !(offset % 2) && offset <= total && len < (total - offset) / 2
+			&& !at<WCHAR>(base + offset + 2 * len);
+	}
+}
+
+SnapshotReader::SnapshotReader(const void *data, size_t size) : base(static_cast<const unsigned char *>(data))
+{
+	if (size < headerSize || memcmp(base, magic, sizeof(magic)))
+		throw std::invalid_argument("not a snapshot");
+	if (base[4] != major)
+		throw std::invalid_argument("unsupported snapshot version");
+
+	stride = at<unsigned short>(base + 6);
+	n = at<unsigned>(base + 8);
+	total = at<unsigned>(base + 12);
+	if (stride < entrySize || total > size || total < headerSize || n > (total - headerSize) / stride)
+		throw std::invalid_argument("truncated snapshot");
+
+	const size_t blob = headerSize + n * stride;
+	for (size_t i = 0; i < n; ++i)
+	{
+		const unsigned char *e = entry(i);
+		const unsigned long long value = at<unsigned long long>(e + valueAt);
+		bool ok = true;
+		switch (type(i))
+		{
+			case STRING:
+			case BSTRING:
+				ok = validString(base, blob, total, value);
+				break;
+			case LIST:
+				{
+					const size_t table = static_cast<size_t>(value), items = at<unsigned short>(e + itemsAt);
+					ok = table >= blob && !(table % 4) && table <= total && items <= (total - table) / 8;
+					for (size_t j = 0; ok && j < items; ++j)
+						ok = validString(base, blob, total, at<unsigned long long>(base + table + 8 * j));
+				}
+				break;
+		}
+		if (!ok)
+			throw std::invalid_argument("corrupt snapshot");
+	}
+}
+
+const unsigned char *SnapshotReader::entry(size_t i) const
+{
+	return base + headerSize + i * stride;
+}
+
+unsigned char SnapshotReader::minorVersion() const
+{
+	return base[5];
+}
+
+PROPERTYKEY SnapshotReader::key(size_t i) const
+{
+	return at<PROPERTYKEY>(entry(i) + keyAt);
+}
+
+SnapshotReader::Type SnapshotReader::type(size_t i) const
+{
+	const unsigned short t = at<unsigned short>(entry(i) + typeAt);
+	return t >= U32 && t <= LIST ? static_cast<Type>(t) : static_cast<Type>(0);
+}
+
+int SnapshotReader::find(REFPROPERTYKEY k) const
+{
+	for (size_t i = 0; i < n; ++i)
+		if (!memcmp(entry(i) + keyAt, &k, sizeof(k)))
+			return static_cast<int>(i);
+	return -1;
+}
+
+unsigned SnapshotReader::u32(size_t i) const
+{
+	return static_cast<unsigned>(at<unsigned long long>(entry(i) + valueAt));
+}
+
+unsigned long long SnapshotReader::u64(size_t i) const
+{
+	return at<unsigned long long>(entry(i) + valueAt);
+}
+
+const wchar_t *SnapshotReader::text(size_t i) const
+{
+	return reinterpret_cast<const wchar_t *>(base + at<unsigned>(entry(i) + valueAt));
+}
+
+size_t SnapshotReader::length(size_t i) const
+{
+	return at<unsigned>(entry(i) + valueAt + 4);
+}
+
+size_t SnapshotReader::items(size_t i) const
+{
+	return at<unsigned short>(entry(i) + itemsAt);
+}
+
+const wchar_t *SnapshotReader::item(size_t i, size_t j) const
+{
+	const unsigned table = at<unsigned>(entry(i) + valueAt);
+	return reinterpret_cast<const wchar_t *>(base + at<unsigned>(base + table + 8 * j));
+}
+
+HRESULT SnapshotReader::value(REFPROPERTYKEY k, PROPVARIANT *pv) const
+{
+	PropVariantInit(pv);
+	const int i = find(k);
+	if (i < 0)
+		return S_FALSE;
+
+	switch (type(i))
+	{
+		case U32:
+			pv->ulVal = u32(i);
+			pv->vt = VT_UI4;
+			break;
+		case U64:
+			pv->uhVal.QuadPart = u64(i);
+			pv->vt = VT_UI8;
+			break;
+		case STRING:
+			return InitPropVariantFromString(text(i), pv);
+		case BSTRING:
+			pv->bstrVal = SysAllocStringLen(text(i), static_cast<UINT>(length(i)));
+			if (!pv->bstrVal)
+				return E_OUTOFMEMORY;
+			pv->vt = VT_BSTR;
+			break;
+		case LIST:
+			{
+				SAFEARRAYBOUND bound = {};
+				bound.cElements = static_cast<ULONG>(items(i));
+				SAFEARRAY *sa = SafeArrayCreate(VT_BSTR, 1, &bound);
+				if (!sa)
+					return E_OUTOFMEMORY;
+				BSTR *strings = NULL;
+				SafeArrayAccessData(sa, reinterpret_cast<void **>(&strings));
+				const unsigned table = at<unsigned>(entry(i) + valueAt);
+				for (size_t j = 0; j < items(i); ++j)
+				{
+					const unsigned long long ref = at<unsigned long long>(base + table + 8 * j);
+					strings[j] = SysAllocStringLen(reinterpret_cast<const wchar_t *>(base + static_cast<unsigned>(ref)),
+						static_cast<UINT>(ref >> 32));
+				}
+				SafeArrayUnaccessData(sa);
+				pv->parray = sa;
+				pv->vt = VT_ARRAY | VT_BSTR;
+			}
+			break;
+		default:
+			return S_FALSE;
+	}
+	return S_OK;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <windows.h>
+#include <propsys.h>
+#include <fileref.h>
+#include <string>
+
+// === Snapshots: every property of one file, in one flat buffer. ===
+// For anything that keeps or moves extracted properties around (caches, daemons, streams), so
+//  that none of them need their own format. A snapshot is read in place: values come straight out
+//  of the buffer, strings as pointers into it, and nothing is allocated until a PROPVARIANT is asked for.
+//
+// Everything is little-endian. Strings are handed out in place, so the buffer must be 2-byte aligned:
+//   header:  "TLHS", u8 major, u8 minor, u16 entrySize, u32 count, u32 size (of the whole snapshot)
+//   entries: count of them, each entrySize bytes:
+//              PROPERTYKEY key (GUID fmtid, u32 pid), u16 type, u16 items, u64 value
+//   blob:    the strings, UTF-16 and NUL-terminated, and the item tables of lists.
+// Values by type:
+//   U32, U64:        inline.
+//   STRING, BSTRING: u32 offset of the string, from the start of the snapshot, u32 length in characters.
+//   LIST:            u32 offset of a table of `items` (u32 offset, u32 length) pairs, one per string.
+//
+// Compatibility:
+//  - The minor version goes up when something is added that an older reader can skip: a new type,
+//    or more bytes on the end of each entry (entrySize says how far to step). Readers take any minor.
+//  - The major version goes up for anything else, and readers refuse a major they don't know.
+class SnapshotReader
+{
+public:
+	enum Type
+	{
+		U32 = 1,     // VT_UI4
+		U64 = 2,     // VT_UI8
+		STRING = 3,  // VT_LPWSTR
+		BSTRING = 4, // VT_BSTR
+		LIST = 5     // VT_ARRAY | VT_BSTR
+	};
+
+	// 2: EncodingBitrate is in bits per second, where 1.x had TagLib's kbps times 1024.
+	static const unsigned char major = 2, minor = 0;
+	static const size_t headerSize = 16, entrySize = 32;
+
+	// A snapshot in place; the buffer must outlive the reader.
+	// Checked here, so that nothing below reads outside the buffer: one that isn't a snapshot, or is
+	//  truncated, corrupt or of an unknown major version, gets std::invalid_argument.
+	SnapshotReader(const void *data, size_t size);
+
+	// The minor version it was written with.
+	unsigned char minorVersion() const;
+	size_t count() const { return n; }
+	PROPERTYKEY key(size_t i) const;
+	// 0 for a type this reader doesn't know.
+	Type type(size_t i) const;
+	// The entry for a key, or -1.
+	int find(REFPROPERTYKEY key) const;
+
+	unsigned u32(size_t i) const;
+	unsigned long long u64(size_t i) const;
+	// STRING and BSTRING; NUL-terminated.
+	const wchar_t *text(size_t i) const;
+	size_t length(size_t i) const;
+	// LIST.
+	size_t items(size_t i) const;
+	const wchar_t *item(size_t i, size_t j) const;
+
+	// The value for a key, exactly as readProperty gave it: S_OK, or S_FALSE and VT_EMPTY if the
+	//  snapshot doesn't have it. E_OUTOFMEMORY.
+	HRESULT value(REFPROPERTYKEY key, PROPVARIANT *pv) const;
+
+	// The bytes the snapshot takes, which may be less than the buffer.
+	size_t size() const { return total; }
+
+private:
+	const unsigned char *entry(size_t i) const;
+
+	const unsigned char *base;
+	size_t n, stride, total;
+};
+
+// Build a snapshot from values as readProperty produces them. VT_EMPTY values are left out, as
+//  are any of a type a snapshot can't hold.
+std::string encodeSnapshot(const PROPERTYKEY *keys, const PROPVARIANT *values, size_t count);
+
+// Read every key the handler offers from a file into a snapshot.
+std::string takeSnapshot(const TagLib::FileRef &file);
+
+// The same, read as readFileProperties() reads them; false if TagLib can't read the file. Takes the accessor.
+bool takeSnapshotFrom(TagLib::FileAccessor *accessor, ULONGLONG size, const std::wstring &name, std::string &snapshot);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <windows.h>
+#include <objidl.h> // IStream
+#include <fileref.h>
+
+// Presents an IStream to TagLib as a file. The stream isn't AddRef'd; the caller keeps it alive.
+// Each call on the stream can be a round trip (see latencystream.h), so the position is tracked
+//  here: tell(), and seeks to where the stream already is, are answered without asking.
+struct IStreamAccessor : public TagLib::FileAccessor
+{
+	IStreamAccessor(IStream *stream) : stream(stream), pos(0), known(false) {}
+	IStream *stream;
+	mutable ULONGLONG pos;
+	mutable bool known;
+	bool isOpen() const
+	{
+		return true;
+	}
+
+	size_t fread(void *pv, size_t s1, size_t s2) const
+	{
+		ULONG read = 0;
+		stream->Read(pv, s1*s2, &read);
+		pos += read;
+		return read;
+	}
+
+	size_t fwrite(const void *,size_t,size_t)
+	{
+		return 0;
+	}
+
+	int fseek(long distance, int direction)
+	{
+		if (known && ((direction == SEEK_SET && distance >= 0 && static_cast<ULONGLONG>(distance) == pos)
+				|| (direction == SEEK_CUR && !distance)))
+			return 0;
+		LARGE_INTEGER dist;
+		dist.QuadPart = distance;
+		ULARGE_INTEGER newpos = {};
+		known = SUCCEEDED(stream->Seek(dist, direction, &newpos));
+		pos = newpos.QuadPart;
+		return !known; // 0 on success.
+	}
+
+	void clearError()
+	{
+		// Uh oh.
+	}
+
+	long tell() const
+	{
+		if (!known)
+		{
+			ULARGE_INTEGER newpos = {};
+			LARGE_INTEGER dist = {};
+			known = SUCCEEDED(stream->Seek(dist, STREAM_SEEK_CUR, &newpos));
+			pos = newpos.QuadPart;
+		}
+		return static_cast<long>(pos);
+	}
+
+	int truncate(long length)
+	{
+		return -1; // error
+	}
+
+	TagLib::FileNameHandle name() const
+	{
+		STATSTG a;
+		if (FAILED(stream->Stat(&a, STATFLAG_DEFAULT)))
+			return TagLib::FileName("");
+		return TagLib::FileName(a.pwcsName);
+	}
+
+	bool readOnly() const
+	{
+		return true;
+	}
+};
@@ -0,0 +1,64 @@
+#include "strpool.h"
+#include "lock.h"
+
+#include <stdexcept>
+#include <boost/functional/hash.hpp>
+
+StringPool::StringPool() : chunks(new std::wstring *volatile[MAX_CHUNKS]), count(0)
+{
+	for (int i = 0; i < SHARDS; ++i)
+		InitializeCriticalSection(&shards[i].cs);
+	for (int i = 0; i < MAX_CHUNKS; ++i)
+		chunks[i] = NULL;
+}
+
+StringPool::~StringPool()
+{
+	for (int i = 0; i < SHARDS; ++i)
+		DeleteCriticalSection(&shards[i].cs);
+	for (int i = 0; i < MAX_CHUNKS; ++i)
+		delete[] chunks[i];
+	delete[] chunks;
+}
+
+std::wstring &StringPool::slot(unsigned id)
+{
+	const unsigned c = id >> CHUNK_BITS;
+	if (c >= MAX_CHUNKS)
+		throw std::length_error("string pool full");
+
+	if (!chunks[c])
+	{
+		// Whoever loses the race throws theirs away.
+		std::wstring *fresh = new std::wstring[CHUNK];
+		if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile *>(&chunks[c]), fresh, NULL))
+			delete[] fresh;
+	}
+	return chunks[c][id & (CHUNK - 1)];
+}
+
+unsigned StringPool::intern(const std::wstring &s)
+{
+	Shard &shard = shards[boost::hash<std::wstring>()(s) % SHARDS];
+	Lock l(shard.cs);
+
+	boost::unordered_map<std::wstring, unsigned>::const_iterator it = shard.ids.find(s);
+	if (it != shard.ids.end())
+		return it->second;
+
+	// The string is in place before the id is published (by leaving the lock), so get() is safe.
+	const unsigned id = static_cast<unsigned>(InterlockedIncrement(&count) - 1);
+	slot(id) = s;
+	shard.ids[s] = id;
+	return id;
+}
+
+const std::wstring &StringPool::get(unsigned id) const
+{
+	return chunks[id >> CHUNK_BITS][id & (CHUNK - 1)];
+}
+
+unsigned StringPool::size() const
+{
+	return static_cast<unsigned>(count);
+}
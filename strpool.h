@@ -0,0 +1,43 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+#include <boost/unordered_map.hpp>
+
+// === An append-only pool of strings, handing out small, dense ids. ===
+// Artist, album, genre and so on repeat thousands of times across a library; interning them keeps
+//  one copy of each, and lets a serialiser write each distinct value once and refer to it by id.
+//  - intern() may be called from any number of threads; the pool is sharded by hash so they
+//    rarely meet on a lock.
+//  - Ids count up from 0 in the order values were first seen.
+//  - A string never moves or changes once interned, so get() takes no lock, for any id that
+//    has been handed out.
+class StringPool
+{
+public:
+	StringPool();
+	~StringPool();
+
+	unsigned intern(const std::wstring &s);
+	const std::wstring &get(unsigned id) const;
+	unsigned size() const;
+
+private:
+	enum { SHARDS = 16, CHUNK_BITS = 12, CHUNK = 1 << CHUNK_BITS, MAX_CHUNKS = 1 << 16 };
+
+	struct Shard
+	{
+		CRITICAL_SECTION cs;
+		boost::unordered_map<std::wstring, unsigned> ids;
+	};
+
+	std::wstring &slot(unsigned id);
+
+	Shard shards[SHARDS];
+	// Strings by id, in fixed-size chunks which are allocated as needed and never moved.
+	std::wstring *volatile *chunks;
+	volatile LONG count;
+
+	StringPool(const StringPool &);
+	StringPool &operator=(const StringPool &);
+};
@@ -0,0 +1,203 @@
+#include "sweep.h"
+#include "lock.h"
+
+#include <winioctl.h>
+
+#include <algorithm>
+
+namespace
+{
+	const ULONGLONG unplaced = ~0ULL;
+	const size_t none = static_cast<size_t>(-1);
+
+	// The cluster holding the first byte and the last; false if either isn't on the disk as such.
+	bool extents(HANDLE h, ULONGLONG &first, ULONGLONG &last)
+	{
+		STARTING_VCN_INPUT_BUFFER in;
+		in.StartingVcn.QuadPart = 0;
+		union
+		{
+			RETRIEVAL_POINTERS_BUFFER rp;
+			char space[4096];
+		} out;
+
+		first = last = unplaced;
+		for (;;)
+		{
+			DWORD bytes;
+			const BOOL ok = DeviceIoControl(h, FSCTL_GET_RETRIEVAL_POINTERS, &in, sizeof(in), &out, sizeof(out), &bytes, NULL);
+			const DWORD err = ok ? ERROR_SUCCESS : GetLastError();
+			if ((err != ERROR_SUCCESS && err != ERROR_MORE_DATA) || !out.rp.ExtentCount)
+				return false;
+
+			if (first == unplaced)
+			{
+				if (out.rp.Extents[0].Lcn.QuadPart < 0)
+					return false;
+				first = out.rp.Extents[0].Lcn.QuadPart;
+			}
+
+			// Each extent runs from the previous one's NextVcn; an Lcn of -1 is a hole, or compressed away.
+			const DWORD n = out.rp.ExtentCount;
+			const LONGLONG lcn = out.rp.Extents[n - 1].Lcn.QuadPart;
+			const LONGLONG from = n > 1 ? out.rp.Extents[n - 2].NextVcn.QuadPart : out.rp.StartingVcn.QuadPart;
+			last = lcn < 0 ? unplaced : lcn + (out.rp.Extents[n - 1].NextVcn.QuadPart - from - 1);
+
+			if (err == ERROR_SUCCESS)
+				return last != unplaced;
+			in.StartingVcn = out.rp.Extents[n - 1].NextVcn;
+		}
+	}
+
+	struct ByPlace
+	{
+		bool operator()(const Sweep::Read &a, const Sweep::Read &b) const
+		{
+			if (a.located != b.located)
+				return a.located;
+			if (a.lcn != b.lcn)
+				return a.lcn < b.lcn;
+			if (a.file != b.file)
+				return a.file < b.file;
+			return a.offset < b.offset;
+		}
+	};
+
+	struct ByRank
+	{
+		ByRank(const std::vector<size_t> &last) : last(last) {}
+		bool operator()(size_t a, size_t b) const { return last[a] + 1 < last[b] + 1; } // none, with nothing to read, first.
+		const std::vector<size_t> &last;
+	};
+}
+
+Sweep::Sweep(const std::vector<std::wstring> &paths, DWORD head, DWORD tail, size_t window)
+	: paths(paths), ranks(paths.size()), last(paths.size(), none), placed(0), window(window), done(0), taken(0), thread(NULL)
+{
+	InitializeCriticalSection(&cs);
+	InitializeConditionVariable(&changed);
+
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		index[paths[i]] = i;
+		HANDLE h = CreateFile(paths[i].c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, 0, NULL);
+		if (h == INVALID_HANDLE_VALUE)
+			continue;
+		BY_HANDLE_FILE_INFORMATION info;
+		ULONGLONG firstLcn, lastLcn;
+		const bool known = GetFileInformationByHandle(h, &info) != 0;
+		const bool located = known && extents(h, firstLcn, lastLcn);
+		CloseHandle(h);
+		if (!known)
+			continue;
+
+		const ULONGLONG size = (static_cast<ULONGLONG>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+		const ULONGLONG id = (static_cast<ULONGLONG>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+		if (!size)
+			continue;
+		placed += located;
+
+		// Small files are read whole, in one go.
+		const bool whole = size <= static_cast<ULONGLONG>(head) + tail;
+		Read r = { i, 0, whole ? static_cast<DWORD>(size) : head, located, located ? firstLcn : id };
+		plan.push_back(r);
+		if (!whole)
+		{
+			r.offset = size - tail;
+			r.length = tail;
+			r.lcn = located ? lastLcn : id;
+			plan.push_back(r);
+		}
+	}
+	std::sort(plan.begin(), plan.end(), ByPlace());
+
+	// A file is ready once its last read is done.
+	for (size_t i = 0; i < plan.size(); ++i)
+		last[plan[i].file] = i;
+	for (size_t i = 0; i < paths.size(); ++i)
+		ready.push_back(i);
+	std::stable_sort(ready.begin(), ready.end(), ByRank(last));
+	for (size_t i = 0; i < ready.size(); ++i)
+	{
+		ranks[ready[i]] = i;
+		if (last[ready[i]] == none)
+			++done;
+	}
+}
+
+Sweep::~Sweep()
+{
+	if (thread)
+	{
+		{
+			Lock lock(cs);
+			taken = ready.size(); // nobody else is waiting now; don't hold the sweep back.
+			WakeAllConditionVariable(&changed);
+		}
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+	}
+	DeleteCriticalSection(&cs);
+}
+
+size_t Sweep::rank(const std::wstring &path) const
+{
+	const std::map<std::wstring, size_t>::const_iterator it = index.find(path);
+	return it == index.end() ? ready.size() : ranks[it->second];
+}
+
+void Sweep::start()
+{
+	if (!thread)
+		thread = CreateThread(NULL, 0, run, this, 0, NULL);
+}
+
+void Sweep::wait(const std::wstring &path)
+{
+	const size_t r = rank(path);
+	if (r == ready.size())
+		return;
+	Lock lock(cs);
+	while (done <= r)
+		SleepConditionVariableCS(&changed, &cs, INFINITE);
+	++taken;
+	WakeAllConditionVariable(&changed);
+}
+
+DWORD WINAPI Sweep::run(LPVOID param)
+{
+	Sweep &s = *static_cast<Sweep *>(param);
+	std::vector<char> buf;
+	for (size_t i = 0; i < s.plan.size(); ++i)
+	{
+		const Read &r = s.plan[i];
+		{
+			Lock lock(s.cs);
+			while (s.done >= s.taken + s.window)
+				SleepConditionVariableCS(&s.changed, &s.cs, INFINITE);
+		}
+
+		// A plain buffered read; it's the copy left in the cache that's wanted.
+		HANDLE h = CreateFile(s.paths[r.file].c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (h != INVALID_HANDLE_VALUE)
+		{
+			buf.resize(r.length);
+			OVERLAPPED at = {};
+			at.Offset = static_cast<DWORD>(r.offset);
+			at.OffsetHigh = static_cast<DWORD>(r.offset >> 32);
+			DWORD got;
+			ReadFile(h, &buf[0], r.length, &got, &at);
+			CloseHandle(h);
+		}
+
+		if (s.last[r.file] == i)
+		{
+			Lock lock(s.cs);
+			++s.done;
+			WakeAllConditionVariable(&s.changed);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <windows.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// === Reading a batch of files in the order they lie on the disk. ===
+// On a rotating disk, a scan that reads files in directory order spends most of its time seeking.
+//  What the handler reads of a file is mostly its head (ID3v2, FLAC metadata, an MP4's ftyp/moov)
+//  and its tail (ID3v1, APE, an Ogg's last page, a moov written at the end), so a Sweep plans those
+//  two reads for every file, sorts them by the cluster (LCN) each starts in, as reported by
+//  FSCTL_GET_RETRIEVAL_POINTERS, and reads them on one thread in a single pass across the disk,
+//  which leaves them in the cache for the parsers.
+// Files the filesystem won't place (small ones held in the MFT, compressed or sparse ones, anything
+//  not on NTFS) are read afterwards, in file id order, which is roughly MFT order.
+// The files are parsed in the order their reads finish: order() gives it, and wait() blocks a
+//  parser until its file is ready. The sweep keeps at most `window` files ready but not yet
+//  waited for, so that it doesn't read so far ahead that the cache throws its work away.
+
+class Sweep
+{
+public:
+	struct Read
+	{
+		size_t file;         // index into the paths given.
+		ULONGLONG offset;
+		DWORD length;
+		bool located;
+		ULONGLONG lcn;       // where the read starts, if located; otherwise the file id.
+	};
+
+	// Opens each file to find where it is; nothing is read until start().
+	Sweep(const std::vector<std::wstring> &paths, DWORD head = 64 * 1024, DWORD tail = 64 * 1024, size_t window = 1024);
+	~Sweep(); // waits for the sweep to finish.
+
+	// The reads, in the order they'll be made.
+	const std::vector<Read> &reads() const { return plan; }
+	// Indices into the paths, in the order they'll be ready.
+	const std::vector<size_t> &order() const { return ready; }
+	// Where path comes in order(); order().size() if it isn't one of the paths.
+	size_t rank(const std::wstring &path) const;
+	// Files placed by their extents.
+	size_t located() const { return placed; }
+
+	void start();
+	// Blocks until the reads for path are done. Each path should be waited for once, roughly in order().
+	void wait(const std::wstring &path);
+
+private:
+	static DWORD WINAPI run(LPVOID);
+
+	std::vector<std::wstring> paths;
+	std::vector<Read> plan;
+	std::vector<size_t> ready;
+	std::vector<size_t> ranks;      // by file.
+	std::vector<size_t> last;       // by file: its last read in the plan.
+	std::map<std::wstring, size_t> index;
+	size_t placed, window;
+
+	CRITICAL_SECTION cs;
+	CONDITION_VARIABLE changed;
+	size_t done, taken;             // files whose reads are done, and files waited for.
+	HANDLE thread;
+
+	Sweep(const Sweep &);
+	Sweep &operator=(const Sweep &);
+};
@@ -0,0 +1,857 @@
+#define NOMINMAX
+
+#include <windows.h>
+#include <propsys.h>
+#include <propvarutil.h>
+#include <shlwapi.h> // SHCreateStreamOnFileEx
+
+#include <algorithm>
+#include <iostream>
+#include <list>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fileref.h>
+
+#include "../adsstore.h"
+#include "../extract.h"
+#include "../fileaccessor.h"
+#include "../lock.h"
+#include "../prefetch.h"
+#include "../ratelimit.h"
+#include "../scheduler.h"
+#include "../snapshot.h"
+#include "../streamaccessor.h"
+#include "../utf8.h"
+
+// === tlhd: the handler's extraction, kept warm in a long-running process. ===
+//
+// Serves a named pipe (default \\.\pipe\tlhd). The protocol is lines of UTF-8:
+//
+//   request  := keys TAB path (TAB path)* LF
+//   keys     := "*" | name (";" name)*       -- canonical names, ie. System.Music.Artist
+//   response := path (TAB name "=" value)* LF  -- one line per path, in request order
+//             | path TAB "!" error LF
+//
+// Clients may pipeline as many requests as they like without waiting; several paths on one
+//  line is a batch. Values have \, TAB, CR and LF escaped as \\, \t, \r and \n.
+//
+// The server opens any path it's asked for, and with -streams writes to it, so the pipe is this
+//  machine's and this user's: remote clients are refused, only the user's SID is in its DACL, and
+//  the first instance is created as the first, so that another process can't already hold the
+//  name. A line longer than 64KB is answered with "\t!line too long" and the client cut off.
+//
+// Lookups run on a pool of worker threads (scheduler.h). A request starting with ~ is background
+//  work, ie. an indexer's; anything else is interactive and is served first. The line "!stats"
+//  answers with each class's queue depth and latency.
+//
+// Each connection's background work reads through its own I/O budget (ratelimit.h), so a
+//  scan can be limited in bytes/s and reads/s; "!rate <bytes/s> <iops>" changes it at any time
+//  (0 is unlimited), and "!stats" reports how often the scan has been throttled.
+//
+// Every key is read the first time a file is opened, so later requests for different keys
+//  are served from the cache, which is validated against the file's size and mtime.
+//
+// Interactive lookups that walk forward through a folder, as a folder view or an album-at-a-time
+//  client does, have the heads and tails of the next few files read ahead of them (prefetch.h);
+//  "-prefetch n" sets how many (0 turns it off), and "!stats" reports how many were used.
+//
+// With -streams, what's read is also kept with the file, in an alternate data stream (adsstore.h),
+//  and a file that's been seen before, by any run, is answered from there without being parsed.
+//
+// tlhd -load runs a load generator against a running server instead; tlhd -mix measures
+//  interactive latency while a background scan is running.
+
+const wchar_t default_pipe[] = L"\\\\.\\pipe\\tlhd";
+
+static std::string escape(const std::string &s)
+{
+	std::string ret;
+	ret.reserve(s.size());
+	for (std::string::const_iterator it = s.begin(); it != s.end(); ++it)
+		switch (*it)
+		{
+			case '\\': ret += "\\\\"; break;
+			case '\t': ret += "\\t"; break;
+			case '\r': ret += "\\r"; break;
+			case '\n': ret += "\\n"; break;
+			default: ret += *it;
+		}
+	return ret;
+}
+
+static std::vector<std::string> split(const std::string &s, char sep)
+{
+	std::vector<std::string> ret;
+	std::string::size_type start = 0, end;
+	while ((end = s.find(sep, start)) != std::string::npos)
+	{
+		ret.push_back(s.substr(start, end - start));
+		start = end + 1;
+	}
+	ret.push_back(s.substr(start));
+	return ret;
+}
+
+// === The result cache. ===
+
+struct Entry
+{
+	ULONGLONG size;
+	FILETIME mtime;
+	std::vector<std::string> values; // utf-8, escaped, one per keys[]; empty if not present.
+};
+
+class ResultCache
+{
+public:
+	ResultCache(size_t capacity) : capacity(capacity)
+	{
+		InitializeCriticalSection(&cs);
+	}
+
+	~ResultCache()
+	{
+		DeleteCriticalSection(&cs);
+	}
+
+	// Fill e with the cached entry for path if it still matches size and mtime.
+	bool get(const std::wstring &path, ULONGLONG size, const FILETIME &mtime, Entry &e)
+	{
+		Lock l(cs);
+		index_t::iterator it = index.find(path);
+		if (it == index.end()
+			|| it->second->second.size != size
+			|| CompareFileTime(&it->second->second.mtime, &mtime))
+			return false;
+		// Move to the front; the back is the least recently used.
+		order.splice(order.begin(), order, it->second);
+		e = it->second->second;
+		return true;
+	}
+
+	void put(const std::wstring &path, const Entry &e)
+	{
+		Lock l(cs);
+		index_t::iterator it = index.find(path);
+		if (it != index.end())
+			order.erase(it->second);
+		order.push_front(std::make_pair(path, e));
+		index[path] = order.begin();
+		while (order.size() > capacity)
+		{
+			index.erase(order.back().first);
+			order.pop_back();
+		}
+	}
+
+private:
+	typedef std::list<std::pair<std::wstring, Entry> > order_t;
+	typedef std::map<std::wstring, order_t::iterator> index_t;
+	order_t order;
+	index_t index;
+	size_t capacity;
+	CRITICAL_SECTION cs;
+};
+
+static ResultCache *cache;
+
+static bool stamp(const std::wstring &path, ULONGLONG &size, FILETIME &mtime)
+{
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+	if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &fad))
+		return false;
+	size = (static_cast<ULONGLONG>(fad.nFileSizeHigh) << 32) | fad.nFileSizeLow;
+	mtime = fad.ftLastWriteTime;
+	return true;
+}
+
+static bool streamSnapshots;
+
+// The values, one per keys[], as readProperty gives them or a snapshot gives them back.
+static void fill(std::vector<PROPVARIANT> &values, Entry &e)
+{
+	e.values.assign(keyCount, std::string());
+	for (size_t i = 0; i < keyCount; ++i)
+	{
+		if (values[i].vt != VT_EMPTY)
+			e.values[i] = escape(toUtf8(propertyText(values[i])));
+		PropVariantClear(&values[i]);
+	}
+}
+
+// Values read from the file itself, also kept as a stream snapshot if those are on.
+static void fillRead(std::vector<PROPVARIANT> &values, const std::wstring &path, Entry &e)
+{
+	if (streamSnapshots)
+		saveStreamSnapshot(path, e.size, e.mtime, encodeSnapshot(keys, &values[0], keyCount));
+	fill(values, e);
+}
+
+// Values read as the handler reads them (see readFileProperties()); false if TagLib can't read the file.
+static bool fillFrom(TagLib::FileAccessor *accessor, const std::wstring &path, Entry &e)
+{
+	std::vector<PROPVARIANT> values;
+	if (!readFileProperties(accessor, e.size, path, values))
+		return false;
+	fillRead(values, path, e);
+	return true;
+}
+
+static bool fromStream(const std::wstring &path, Entry &e)
+{
+	std::string snap;
+	if (!streamSnapshots || !loadStreamSnapshot(path, e.size, e.mtime, snap))
+		return false;
+	try
+	{
+		const SnapshotReader r(snap.data(), snap.size());
+		std::vector<PROPVARIANT> values(keyCount);
+		for (size_t i = 0; i < keyCount; ++i)
+			r.value(keys[i], &values[i]);
+		fill(values, e);
+		return true;
+	}
+	catch (std::invalid_argument &)
+	{
+		// Damaged, or from a newer major version; parse the file, and replace it.
+		return false;
+	}
+}
+
+static Prefetcher *prefetcher;
+
+// Background work reads through the connection's token bucket, via the same accessor the handler uses.
+static bool extract(const std::wstring &path, Entry &e, TokenBucket *bucket)
+{
+	if (!bucket && prefetcher)
+		prefetcher->opened(path);
+	if (fromStream(path, e))
+		return true;
+
+	if (!bucket)
+	{
+		return fillFrom(new Win32FileAccessor(path), path, e);
+	}
+
+	IStream *stream = NULL;
+	if (FAILED(SHCreateStreamOnFileEx(path.c_str(), STGM_READ | STGM_SHARE_DENY_NONE, FILE_ATTRIBUTE_NORMAL,
+			FALSE, NULL, &stream)))
+		return false;
+
+	const bool ok = fillFrom(new ThrottledAccessor(new IStreamAccessor(stream), bucket), path, e);
+	stream->Release();
+	return ok;
+}
+
+// Look up (or extract) path, appending its response line to out.
+static void answer(const std::vector<std::pair<std::string, size_t> > &wanted, const std::string &upath, std::string &out,
+	TokenBucket *bucket)
+{
+	const std::wstring path = fromUtf8(upath);
+	out += upath;
+
+	Entry e;
+	if (!stamp(path, e.size, e.mtime))
+	{
+		out += "\t!not found\n";
+		return;
+	}
+
+	if (!cache->get(path, e.size, e.mtime, e))
+	{
+		if (!extract(path, e, bucket))
+		{
+			out += "\t!unsupported\n";
+			return;
+		}
+		cache->put(path, e);
+	}
+
+	for (std::vector<std::pair<std::string, size_t> >::const_iterator it = wanted.begin(); it != wanted.end(); ++it)
+		if (!e.values[it->second].empty())
+			out += "\t" + it->first + "=" + e.values[it->second];
+	out += "\n";
+}
+
+// Resolve the key list of a request to (name, index into keys[]) pairs.
+static bool parseKeys(const std::string &spec, std::vector<std::pair<std::string, size_t> > &wanted)
+{
+	if (spec == "*")
+	{
+		for (size_t i = 0; i < keyCount; ++i)
+		{
+			WCHAR *name = NULL;
+			if (SUCCEEDED(PSGetNameFromPropertyKey(keys[i], &name)))
+			{
+				wanted.push_back(std::make_pair(toUtf8(name), i));
+				CoTaskMemFree(name);
+			}
+		}
+		return true;
+	}
+
+	const std::vector<std::string> names = split(spec, ';');
+	for (std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); ++it)
+	{
+		PROPERTYKEY pk;
+		if (FAILED(PSGetPropertyKeyFromName(fromUtf8(*it).c_str(), &pk)))
+			return false;
+		size_t i = 0;
+		while (i < keyCount && !IsEqualPropertyKey(keys[i], pk))
+			++i;
+		if (i == keyCount)
+			return false;
+		wanted.push_back(std::make_pair(*it, i));
+	}
+	return true;
+}
+
+typedef std::vector<std::pair<std::string, size_t> > wanted_t;
+
+// One path of a request, run on the scheduler; or, for requests that need no work, just the reply.
+struct Lookup : public Scheduler::Job
+{
+	Lookup(const wanted_t &wanted, const std::string &path, TokenBucket *bucket)
+		: wanted(wanted), path(path), bucket(bucket), queued(true) {}
+	Lookup(const std::string &reply) : bucket(NULL), out(reply), queued(false) {}
+
+	void run()
+	{
+		answer(wanted, path, out, bucket);
+	}
+
+	const wanted_t wanted;
+	const std::string path;
+	TokenBucket *bucket; // NULL for interactive work, which is never throttled.
+	std::string out;
+	const bool queued;
+};
+
+static Scheduler *scheduler;
+
+// The starting I/O budget of each connection's background work; see "!rate".
+static double defaultBytesPerSec = 0, defaultOpsPerSec = 0;
+
+static std::string statsLine(TokenBucket &bucket)
+{
+	static const char *names[] = { "interactive", "background" };
+	std::stringstream ss;
+	ss << "!stats";
+	for (int c = 0; c < Scheduler::CLASSES; ++c)
+	{
+		const Scheduler::Stats st = scheduler->stats(static_cast<Scheduler::Class>(c));
+		ss << "\t" << names[c] << " depth=" << st.depth << " max_depth=" << st.maxDepth
+			<< " done=" << st.completed << " p50_us=" << st.p50 << " p99_us=" << st.p99 << " max_us=" << st.max;
+	}
+	const TokenBucket::Stats bs = bucket.stats();
+	ss << "\tthrottle bytes_per_sec=" << bs.bytesPerSec << " iops=" << bs.opsPerSec << " reads=" << bs.reads
+		<< " bytes=" << bs.bytes << " throttled=" << bs.throttled << " waited_ms=" << bs.waitedMs;
+	const Prefetcher::Stats ps = prefetcher->stats();
+	ss << "\tprefetch issued=" << ps.issued << " hits=" << ps.hits << " wasted=" << ps.wasted
+		<< " pauses=" << ps.pauses << " paused=" << ps.paused;
+	ss << "\n";
+	return ss.str();
+}
+
+// Queue the work for a request line. A leading ~ marks it as background (bulk) work.
+static void request(std::string line, std::vector<Lookup *> &pending, TokenBucket &bucket)
+{
+	if (line == "!stats")
+	{
+		pending.push_back(new Lookup(statsLine(bucket)));
+		return;
+	}
+
+	if (line.compare(0, 6, "!rate ") == 0)
+	{
+		double bytes = 0, ops = 0;
+		std::stringstream(line.substr(6)) >> bytes >> ops;
+		bucket.setRate(bytes, ops);
+		pending.push_back(new Lookup(line + "\n"));
+		return;
+	}
+
+	Scheduler::Class c = Scheduler::INTERACTIVE;
+	if (line[0] == '~')
+	{
+		c = Scheduler::BACKGROUND;
+		line.erase(0, 1);
+	}
+
+	const std::vector<std::string> fields = split(line, '\t');
+	wanted_t wanted;
+	if (fields.size() < 2 || !parseKeys(fields[0], wanted))
+	{
+		pending.push_back(new Lookup(line + "\t!bad request\n"));
+		return;
+	}
+	for (size_t i = 1; i < fields.size(); ++i)
+	{
+		Lookup *l = new Lookup(wanted, fields[i], c == Scheduler::BACKGROUND ? &bucket : NULL);
+		pending.push_back(l);
+		scheduler->submit(c, l);
+	}
+}
+
+// The longest request line taken, with its LF.
+static const size_t maxLine = 64 * 1024;
+
+static DWORD WINAPI serveClient(LPVOID param)
+{
+	HANDLE pipe = static_cast<HANDLE>(param);
+	TokenBucket bucket(defaultBytesPerSec, defaultOpsPerSec);
+	std::string in, out;
+	char buf[64 * 1024];
+	DWORD read;
+
+	while (ReadFile(pipe, buf, sizeof(buf), &read, NULL) && read)
+	{
+		in.append(buf, read);
+
+		// Queue every complete line we have, so a pipelining client's requests run in parallel...
+		std::vector<Lookup *> pending;
+		std::string::size_type start = 0, end;
+		while ((end = in.find('\n', start)) != std::string::npos)
+		{
+			std::string line = in.substr(start, end - start);
+			if (!line.empty() && line[line.size() - 1] == '\r')
+				line.erase(line.size() - 1);
+			if (!line.empty())
+				request(line, pending, bucket);
+			start = end + 1;
+		}
+		in.erase(0, start);
+		const bool tooLong = in.size() >= maxLine;
+
+		// ...then collect the answers in order, and send the lot in one write.
+		for (std::vector<Lookup *>::iterator it = pending.begin(); it != pending.end(); ++it)
+		{
+			if ((*it)->queued)
+				(*it)->wait();
+			out += (*it)->out;
+			delete *it;
+		}
+		if (tooLong)
+			out += "\t!line too long\n";
+
+		DWORD written;
+		if ((!out.empty() && !WriteFile(pipe, out.data(), static_cast<DWORD>(out.size()), &written, NULL)) || tooLong)
+			break;
+		out.clear();
+	}
+
+	FlushFileBuffers(pipe);
+	DisconnectNamedPipe(pipe);
+	CloseHandle(pipe);
+	return 0;
+}
+
+// A security descriptor whose DACL lets only the process's user in; the buffers hold it.
+static bool userOnly(SECURITY_ATTRIBUTES &sa, SECURITY_DESCRIPTOR &sd, std::vector<char> &user, std::vector<char> &acl)
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+		return false;
+	DWORD size = 0;
+	GetTokenInformation(token, TokenUser, NULL, 0, &size);
+	user.resize(size ? size : 1);
+	const bool got = size && GetTokenInformation(token, TokenUser, &user[0], size, &size);
+	CloseHandle(token);
+	if (!got)
+		return false;
+
+	PSID sid = reinterpret_cast<TOKEN_USER *>(&user[0])->User.Sid;
+	acl.resize(sizeof(ACL) + sizeof(ACCESS_ALLOWED_ACE) - sizeof(DWORD) + GetLengthSid(sid));
+	PACL dacl = reinterpret_cast<PACL>(&acl[0]);
+	if (!InitializeAcl(dacl, static_cast<DWORD>(acl.size()), ACL_REVISION)
+		|| !AddAccessAllowedAce(dacl, ACL_REVISION, GENERIC_ALL, sid)
+		|| !InitializeSecurityDescriptor(&sd, SECURITY_DESCRIPTOR_REVISION)
+		|| !SetSecurityDescriptorDacl(&sd, TRUE, dacl, FALSE))
+		return false;
+	sa.nLength = sizeof(sa);
+	sa.lpSecurityDescriptor = &sd;
+	sa.bInheritHandle = FALSE;
+	return true;
+}
+
+static int serve(const std::wstring &name, size_t capacity, unsigned threads, bool fifo, unsigned ahead)
+{
+	CoInitializeEx(NULL, COINIT_MULTITHREADED);
+	ResultCache rc(capacity);
+	cache = &rc;
+	Prefetcher pf(ahead);
+	prefetcher = &pf;
+	Scheduler sched(threads, 8, fifo);
+	scheduler = &sched;
+
+	SECURITY_ATTRIBUTES sa;
+	SECURITY_DESCRIPTOR sd;
+	std::vector<char> user, acl;
+	if (!userOnly(sa, sd, user, acl))
+	{
+		std::wcerr << L"tlhd: can't make the pipe's security descriptor: " << GetLastError() << std::endl;
+		return 1;
+	}
+
+	std::wcout << L"tlhd: serving " << name << std::endl;
+	for (bool first = true;; first = false)
+	{
+		HANDLE pipe = CreateNamedPipe(name.c_str(), PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+			PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES,
+			64 * 1024, 64 * 1024, 0, &sa);
+		if (pipe == INVALID_HANDLE_VALUE)
+		{
+			std::wcerr << L"tlhd: CreateNamedPipe failed: " << GetLastError() << std::endl;
+			return 1;
+		}
+
+		if (!ConnectNamedPipe(pipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+		{
+			CloseHandle(pipe);
+			continue;
+		}
+
+		HANDLE thread = CreateThread(NULL, 0, serveClient, pipe, 0, NULL);
+		if (thread)
+			CloseHandle(thread);
+		else
+			CloseHandle(pipe);
+	}
+}
+
+// === The load generator. ===
+
+struct LoadWorker
+{
+	std::wstring pipe;
+	std::string keys;
+	const std::vector<std::string> *files;
+	size_t first, requests, batch;
+	std::vector<double> latencies; // microseconds, per request line.
+	size_t errors;
+};
+
+static HANDLE openPipe(const std::wstring &name)
+{
+	for (;;)
+	{
+		HANDLE h = CreateFile(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+		if (h != INVALID_HANDLE_VALUE)
+			return h;
+		if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipe(name.c_str(), 5000))
+			return INVALID_HANDLE_VALUE;
+	}
+}
+
+// Read until `lines` response lines have arrived, counting the errors among them.
+static bool receive(HANDLE pipe, std::string &in, size_t lines, size_t &errors)
+{
+	char buf[64 * 1024];
+	while (lines)
+	{
+		std::string::size_type nl = in.find('\n');
+		if (nl != std::string::npos)
+		{
+			if (in.find("\t!") < nl)
+				++errors;
+			in.erase(0, nl + 1);
+			--lines;
+			continue;
+		}
+		DWORD done;
+		if (!ReadFile(pipe, buf, sizeof(buf), &done, NULL) || !done)
+			return false;
+		in.append(buf, done);
+	}
+	return true;
+}
+
+static bool send(HANDLE pipe, const std::string &data)
+{
+	DWORD done;
+	return WriteFile(pipe, data.data(), static_cast<DWORD>(data.size()), &done, NULL) && done == data.size();
+}
+
+static double elapsedUs(const LARGE_INTEGER &start)
+{
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (now.QuadPart - start.QuadPart) * 1e6 / freq.QuadPart;
+}
+
+static DWORD WINAPI loadWorker(LPVOID param)
+{
+	LoadWorker &w = *static_cast<LoadWorker *>(param);
+	HANDLE pipe = openPipe(w.pipe);
+	if (pipe == INVALID_HANDLE_VALUE)
+	{
+		w.errors = w.requests;
+		return 1;
+	}
+
+	std::string in;
+	size_t next = w.first;
+	for (size_t r = 0; r < w.requests; ++r)
+	{
+		std::string line = w.keys;
+		for (size_t b = 0; b < w.batch; ++b)
+			line += "\t" + (*w.files)[next++ % w.files->size()];
+		line += "\n";
+
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
+		if (!send(pipe, line) || !receive(pipe, in, w.batch, w.errors))
+			break;
+		w.latencies.push_back(elapsedUs(start));
+	}
+
+	CloseHandle(pipe);
+	return 0;
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+static int load(const std::wstring &pipe, const std::string &keys, const std::vector<std::string> &files,
+	const std::vector<size_t> &levels, size_t requests, size_t batch)
+{
+	std::wcout << L"clients\treq/s\tp50 us\tp99 us\terrors" << std::endl;
+	for (std::vector<size_t>::const_iterator lit = levels.begin(); lit != levels.end(); ++lit)
+	{
+		const size_t clients = std::min<size_t>(*lit, MAXIMUM_WAIT_OBJECTS);
+		std::vector<LoadWorker> workers(clients);
+		std::vector<HANDLE> threads;
+
+		LARGE_INTEGER freq, start, end;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&start);
+
+		for (size_t i = 0; i < clients; ++i)
+		{
+			LoadWorker &w = workers[i];
+			w.pipe = pipe;
+			w.keys = keys;
+			w.files = &files;
+			w.first = i * files.size() / clients;
+			w.requests = requests / clients;
+			w.batch = batch;
+			w.errors = 0;
+			threads.push_back(CreateThread(NULL, 0, loadWorker, &w, 0, NULL));
+		}
+		WaitForMultipleObjects(static_cast<DWORD>(threads.size()), &threads[0], TRUE, INFINITE);
+		QueryPerformanceCounter(&end);
+		for (size_t i = 0; i < threads.size(); ++i)
+			CloseHandle(threads[i]);
+
+		std::vector<double> all;
+		size_t errors = 0;
+		for (size_t i = 0; i < clients; ++i)
+		{
+			all.insert(all.end(), workers[i].latencies.begin(), workers[i].latencies.end());
+			errors += workers[i].errors;
+		}
+		std::sort(all.begin(), all.end());
+
+		const double secs = static_cast<double>(end.QuadPart - start.QuadPart) / freq.QuadPart;
+		std::wcout << clients << L"\t" << static_cast<unsigned>(all.size() * batch / secs) << L"\t"
+			<< percentile(all, 0.5) << L"\t" << percentile(all, 0.99) << L"\t" << errors << std::endl;
+	}
+	return 0;
+}
+
+// === The mixed-priority benchmark. ===
+// A steady background scan, as an indexer would make, one file at a time per connection, while bursts
+//  of interactive lookups arrive, as opening a folder would. Run it against a server started with
+//  -cache 0, so every lookup parses, and compare against one started with -fifo.
+
+struct MixShared
+{
+	std::wstring pipe;
+	const std::vector<std::string> *files;
+	volatile LONG stop;
+	volatile LONG backgroundDone;
+};
+
+static DWORD WINAPI backgroundScan(LPVOID param)
+{
+	MixShared &m = *static_cast<MixShared *>(param);
+	HANDLE pipe = openPipe(m.pipe);
+	if (pipe == INVALID_HANDLE_VALUE)
+		return 1;
+
+	std::string in;
+	size_t errors = 0;
+	for (size_t next = GetCurrentThreadId(); !m.stop; ++next)
+	{
+		if (!send(pipe, "~*\t" + (*m.files)[next % m.files->size()] + "\n") || !receive(pipe, in, 1, errors))
+			break;
+		InterlockedIncrement(&m.backgroundDone);
+	}
+	CloseHandle(pipe);
+	return 0;
+}
+
+static int mix(const std::wstring &pipeName, const std::vector<std::string> &files,
+	size_t scanners, size_t burst, DWORD every, DWORD secs)
+{
+	MixShared m;
+	m.pipe = pipeName;
+	m.files = &files;
+	m.stop = 0;
+	m.backgroundDone = 0;
+
+	std::vector<HANDLE> threads;
+	for (size_t i = 0; i < std::min<size_t>(scanners, MAXIMUM_WAIT_OBJECTS); ++i)
+		threads.push_back(CreateThread(NULL, 0, backgroundScan, &m, 0, NULL));
+
+	HANDLE pipe = openPipe(pipeName);
+	if (pipe == INVALID_HANDLE_VALUE)
+	{
+		std::wcerr << L"tlhd: can't connect to " << pipeName << std::endl;
+		return 1;
+	}
+
+	std::vector<double> latencies;
+	std::string in;
+	size_t errors = 0, next = 0;
+	const DWORD until = GetTickCount() + secs * 1000;
+	while (static_cast<LONG>(until - GetTickCount()) > 0)
+	{
+		Sleep(every);
+
+		// Walk the list from the other end to the scanners, so we aren't just asking for what they've cached.
+		std::string lines;
+		for (size_t b = 0; b < burst; ++b)
+			lines += "*\t" + files[files.size() - 1 - next++ % files.size()] + "\n";
+
+		LARGE_INTEGER start;
+		QueryPerformanceCounter(&start);
+		if (!send(pipe, lines))
+			break;
+		for (size_t b = 0; b < burst; ++b)
+		{
+			if (!receive(pipe, in, 1, errors))
+				break;
+			latencies.push_back(elapsedUs(start));
+		}
+	}
+	CloseHandle(pipe);
+
+	InterlockedExchange(&m.stop, 1);
+	WaitForMultipleObjects(static_cast<DWORD>(threads.size()), &threads[0], TRUE, INFINITE);
+	for (size_t i = 0; i < threads.size(); ++i)
+		CloseHandle(threads[i]);
+
+	std::sort(latencies.begin(), latencies.end());
+	std::wcout << L"interactive: " << latencies.size() << L" lookups, p50 " << percentile(latencies, 0.5)
+		<< L"us, p99 " << percentile(latencies, 0.99) << L"us, max "
+		<< (latencies.empty() ? 0 : latencies.back()) << L"us, " << errors << L" errors" << std::endl;
+	std::wcout << L"background: " << m.backgroundDone / static_cast<double>(secs) << L" files/s" << std::endl;
+	return 0;
+}
+
+static void usage()
+{
+	std::wcerr << L"usage: tlhd [-p pipe] [-cache entries] [-threads n] [-fifo] [-rate bytes/s,iops] [-streams] [-prefetch n]\n"
+		L"       tlhd -load [-p pipe] [-n requests] [-c 1,2,4,...] [-b batch] [-k keys] file...\n"
+		L"       tlhd -mix [-p pipe] [-scanners n] [-burst n] [-every ms] [-secs s] file..." << std::endl;
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+	enum { SERVE, LOAD, MIX } mode = SERVE;
+	std::wstring pipe = default_pipe;
+	size_t capacity = 100000, requests = 10000, batch = 1, scanners = 4, burst = 20;
+	unsigned ahead = 4;
+	DWORD every = 500, secs = 30;
+	bool fifo = false;
+	std::string keys = "*";
+	std::vector<size_t> levels;
+	std::vector<std::string> files;
+
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	unsigned threads = si.dwNumberOfProcessors;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::wstring arg = argv[i];
+		const bool more = i + 1 < argc;
+		if (arg == L"-load")
+			mode = LOAD;
+		else if (arg == L"-mix")
+			mode = MIX;
+		else if (arg == L"-fifo")
+			fifo = true;
+		else if (arg == L"-streams")
+			streamSnapshots = true;
+		else if (arg == L"-p" && more)
+			pipe = argv[++i];
+		else if (arg == L"-cache" && more)
+			capacity = _wtoi(argv[++i]);
+		else if (arg == L"-rate" && more)
+		{
+			const std::vector<std::string> rate = split(toUtf8(argv[++i]), ',');
+			defaultBytesPerSec = atof(rate[0].c_str());
+			if (rate.size() > 1)
+				defaultOpsPerSec = atof(rate[1].c_str());
+		}
+		else if (arg == L"-prefetch" && more)
+			ahead = _wtoi(argv[++i]);
+		else if (arg == L"-threads" && more)
+			threads = std::max(1, _wtoi(argv[++i]));
+		else if (arg == L"-n" && more)
+			requests = _wtoi(argv[++i]);
+		else if (arg == L"-b" && more)
+			batch = std::max(1, _wtoi(argv[++i]));
+		else if (arg == L"-k" && more)
+			keys = toUtf8(argv[++i]);
+		else if (arg == L"-c" && more)
+		{
+			const std::vector<std::string> ls = split(toUtf8(argv[++i]), ',');
+			for (std::vector<std::string>::const_iterator it = ls.begin(); it != ls.end(); ++it)
+				levels.push_back(std::max(1, atoi(it->c_str())));
+		}
+		else if (arg == L"-scanners" && more)
+			scanners = std::max(1, _wtoi(argv[++i]));
+		else if (arg == L"-burst" && more)
+			burst = std::max(1, _wtoi(argv[++i]));
+		else if (arg == L"-every" && more)
+			every = _wtoi(argv[++i]);
+		else if (arg == L"-secs" && more)
+			secs = std::max(1, _wtoi(argv[++i]));
+		else if (arg[0] == L'-')
+		{
+			usage();
+			return 2;
+		}
+		else
+			files.push_back(toUtf8(arg));
+	}
+
+	if (mode == SERVE)
+		return serve(pipe, capacity, threads, fifo, ahead);
+
+	if (files.empty())
+	{
+		usage();
+		return 2;
+	}
+
+	if (mode == MIX)
+		return mix(pipe, files, scanners, burst, every, secs);
+
+	if (levels.empty())
+		for (size_t c = 1; c <= 32; c *= 2)
+			levels.push_back(c);
+	return load(pipe, keys, files, levels, requests, batch);
+}
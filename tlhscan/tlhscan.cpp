@@ -0,0 +1,1523 @@
+#define NOMINMAX
+
+#include <windows.h>
+#include <propkey.h>
+#include <propsys.h>
+#include <propvarutil.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fileref.h>
+#include <psapi.h>
+
+#include "../archive.h"
+#include "../audiohash.h"
+#include "../columnar.h"
+#include "../extract.h"
+#include "../fileaccessor.h"
+#include "../fingerprint.h"
+#include "../lock.h"
+#include "../mapfile.h"
+#include "../onepass.h"
+#include "../strpool.h"
+#include "../sweep.h"
+#include "../utf8.h"
+
+// === tlhscan: batch extraction over a library, as NDJSON. ===
+//
+//   tlhscan [-o out] [-intern] [-audio-hash] [-locality] [-manifest file [-fingerprint] [-watch]] root...
+//   tlhscan -o out [-locality] -columnar root...
+//
+// Without a manifest, every file the handler supports is written out, one JSON object per line:
+//   {"path":"...","System.Title":"...","System.Media.Duration":1234,...}
+//
+// With -intern, the artist, album artist, album, genre, composer and publisher are written as
+//  numbers, each defined once by a line before the first object to use it:
+//   {"string":3,"value":"Pink Floyd"}
+//   {"path":"...","System.Music.Artist":3,...}
+// With -manifest as well, the strings are kept beside it, in file.strings, and ids carry on from
+//  run to run: a change set only defines the strings that are new, and its ids mean what earlier
+//  runs' definitions said.
+//
+// With -audio-hash, each file read also gets an "audioHash", the same for any two files holding the
+//  same audio whatever their tags (see audiohash.h). It reads the whole file, so is much slower.
+//
+// With -columnar, a full dump is written as a column file instead (see columnar.h), for loading
+//  in bulk; it's a fraction of the size, and can be read straight from a mapping.
+//
+// With -manifest, the scan is incremental. The manifest records (path, size, mtime, file id and
+//  volume) for every file seen; the next run walks the tree, which needs no file to be opened, and
+//  only files that were added or changed are read again. The output is then a change set, each
+//  object carrying an "op" of "add", "change", "remove" or "move" (a rename, found by file id and
+//  volume, which isn't read again; files a filesystem gives no id are never taken for moves). With
+//  -watch, tlhscan then stays running, waits on ReadDirectoryChangesW for every root, and writes a
+//  change set whenever the trees have settled.
+//
+// With -fingerprint, the manifest also keeps a fingerprint of each file's tags (see fingerprint.h),
+//  and a file whose size and mtime haven't changed is still read again if its fingerprint has.
+//  That costs a few KB of reads per file, for trees where mtimes can't be trusted.
+//
+// With -locality, the heads and tails of the files to be read are first read in the order they
+//  lie on the disk (see sweep.h), and each file is parsed as soon as its reads are done, still on
+//  every core. Output comes in that order rather than the tree's. It's for rotating disks, where a
+//  cold scan is otherwise mostly seeks; on an SSD it only adds a pass.
+//
+//   tlhscan [-o out] -stdin name
+// reads one file from standard input, as from a pipe or a decompressor, in a single pass that keeps
+//  only its head and tail (see onepass.h), and writes its object. name gives the format, by its
+//  extension, and is written as the path.
+//
+//   tlhscan [-o out] -archive archive...
+// reads the audio files inside ZIP and TAR (or .tar.gz) archives without unpacking them (see
+//  archive.h), on every core, and writes an object for each, with a path of archive\member.
+//
+//   tlhscan -bench template count dir
+// fills dir with count copies of template, and times a full scan against an incremental one
+//  after 0.1% of the files have been touched.
+//
+//   tlhscan -bench-locality dir
+// times a cold full scan of dir in tree order against one with -locality, and works out how long
+//  each order's head and tail reads would spend seeking on a 7200rpm disk, from where they lie.
+//
+//   tlhscan -bench-intern count
+// builds a synthetic library of count tracks in memory, with and without interning, and reports
+//  the memory each takes and the size of the output each would write.
+//
+//   tlhscan -bench-columnar count file
+// writes a synthetic library of count tracks as NDJSON and as a column file, comparing sizes and
+//  write throughput, then reads a couple of columns back from a mapping.
+
+struct FileInfo
+{
+	FileInfo() : size(0), mtime(0), id(0), volume(0), print(0) {}
+	std::wstring path;
+	ULONGLONG size, mtime, id;
+	DWORD volume;    // serial number; ids are only unique on a volume.
+	ULONGLONG print; // with -fingerprint; 0 if not known.
+};
+
+typedef std::map<std::wstring, FileInfo> Manifest;
+
+// === Walking the tree. ===
+// FileIdBothDirectoryInfo hands back size, times and file id with the names, so nothing is opened.
+
+static void walk(const std::wstring &dir, std::vector<FileInfo> &files)
+{
+	HANDLE h = CreateFile(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return;
+	BY_HANDLE_FILE_INFORMATION bhfi;
+	const DWORD volume = GetFileInformationByHandle(h, &bhfi) ? bhfi.dwVolumeSerialNumber : 0;
+
+	std::vector<LONGLONG> buf(64 * 1024 / sizeof(LONGLONG)); // 8-byte aligned, as the records need.
+	std::vector<std::wstring> subdirs;
+	for (FILE_INFO_BY_HANDLE_CLASS cls = FileIdBothDirectoryRestartInfo;
+		GetFileInformationByHandleEx(h, cls, &buf[0], static_cast<DWORD>(buf.size() * sizeof(LONGLONG)));
+		cls = FileIdBothDirectoryInfo)
+	{
+		const char *p = reinterpret_cast<const char *>(&buf[0]);
+		for (;;)
+		{
+			const FILE_ID_BOTH_DIR_INFO *e = reinterpret_cast<const FILE_ID_BOTH_DIR_INFO *>(p);
+			const std::wstring name(e->FileName, e->FileNameLength / sizeof(WCHAR));
+			if (e->FileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				// Don't follow junctions; they can loop, or lead off the volume.
+				if (name != L"." && name != L".." && !(e->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+					subdirs.push_back(dir + L"\\" + name);
+			}
+			else if (handledExtension(name))
+			{
+				FileInfo fi;
+				fi.path = dir + L"\\" + name;
+				fi.size = e->EndOfFile.QuadPart;
+				fi.mtime = e->LastWriteTime.QuadPart;
+				fi.id = e->FileId.QuadPart;
+				fi.volume = volume;
+				files.push_back(fi);
+			}
+			if (!e->NextEntryOffset)
+				break;
+			p += e->NextEntryOffset;
+		}
+	}
+	CloseHandle(h);
+
+	for (std::vector<std::wstring>::const_iterator it = subdirs.begin(); it != subdirs.end(); ++it)
+		walk(*it, files);
+}
+
+// The same as walk() finds, for a single file.
+static bool statFile(const std::wstring &path, FileInfo &fi)
+{
+	HANDLE h = CreateFile(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, 0, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+	BY_HANDLE_FILE_INFORMATION bhfi;
+	const bool ok = GetFileInformationByHandle(h, &bhfi) != FALSE;
+	CloseHandle(h);
+	if (!ok)
+		return false;
+
+	fi.path = path;
+	fi.size = (static_cast<ULONGLONG>(bhfi.nFileSizeHigh) << 32) | bhfi.nFileSizeLow;
+	fi.mtime = (static_cast<ULONGLONG>(bhfi.ftLastWriteTime.dwHighDateTime) << 32) | bhfi.ftLastWriteTime.dwLowDateTime;
+	fi.id = (static_cast<ULONGLONG>(bhfi.nFileIndexHigh) << 32) | bhfi.nFileIndexLow;
+	fi.volume = bhfi.dwVolumeSerialNumber;
+	return true;
+}
+
+// === Fingerprints. ===
+
+static bool fingerprinting;
+
+struct Prints
+{
+	std::vector<FileInfo> *files;
+	volatile LONG next;
+};
+
+static DWORD WINAPI printWorker(LPVOID param)
+{
+	Prints &p = *static_cast<Prints *>(param);
+	const LONG n = static_cast<LONG>(p.files->size());
+	for (LONG i; (i = InterlockedIncrement(&p.next) - 1) < n; )
+	{
+		FileInfo &fi = (*p.files)[i];
+		Win32FileAccessor file(fi.path);
+		if (file.isOpen())
+			fi.print = tagFingerprint(file, file.size());
+	}
+	return 0;
+}
+
+// Fingerprint every file, a few at a time on each core, as it's mostly waiting on reads.
+static void fingerprint(std::vector<FileInfo> &files)
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	const DWORD nthreads = std::min<DWORD>(si.dwNumberOfProcessors * 4, MAXIMUM_WAIT_OBJECTS);
+	Prints p = { &files, 0 };
+	std::vector<HANDLE> threads;
+	for (DWORD i = 0; i < nthreads; ++i)
+		threads.push_back(CreateThread(NULL, 0, printWorker, &p, 0, NULL));
+	WaitForMultipleObjects(static_cast<DWORD>(threads.size()), &threads[0], TRUE, INFINITE);
+	for (size_t i = 0; i < threads.size(); ++i)
+		CloseHandle(threads[i]);
+}
+
+// === Extraction. ===
+
+static std::vector<std::string> keyNames;
+
+// With -intern: the pool, which of keys[] go through it, and which ids have been written out.
+static StringPool *pool;
+static std::vector<bool> interned;
+static std::vector<bool> defined;
+
+static bool internedKey(REFPROPERTYKEY key)
+{
+	const PROPERTYKEY which[] = { PKEY_Music_Artist, PKEY_Music_AlbumArtist, PKEY_Music_AlbumTitle,
+		PKEY_Music_Genre, PKEY_Music_Composer, PKEY_Media_Publisher };
+	for (size_t i = 0; i < sizeof(which) / sizeof(*which); ++i)
+		if (IsEqualPropertyKey(key, which[i]))
+			return true;
+	return false;
+}
+
+static void appendJson(std::string &out, const std::wstring &ws)
+{
+	const std::string s = toUtf8(ws);
+	out += '"';
+	for (std::string::const_iterator it = s.begin(); it != s.end(); ++it)
+	{
+		const unsigned char c = *it;
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if (c < 0x20)
+		{
+			char esc[8];
+			sprintf(esc, "\\u%04x", c);
+			out += esc;
+		}
+		else
+			out += c;
+	}
+	out += '"';
+}
+
+static void appendJson(std::string &out, REFPROPVARIANT pv)
+{
+	std::stringstream ss;
+	switch (pv.vt)
+	{
+		case VT_UI4: ss << pv.ulVal; out += ss.str(); break;
+		case VT_UI8: ss << pv.uhVal.QuadPart; out += ss.str(); break;
+		case VT_ARRAY | VT_BSTR:
+			{
+				out += '[';
+				long lo = 0, hi = -1;
+				SafeArrayGetLBound(pv.parray, 1, &lo);
+				SafeArrayGetUBound(pv.parray, 1, &hi);
+				for (long i = lo; i <= hi; ++i)
+				{
+					BSTR b = NULL;
+					SafeArrayGetElement(pv.parray, &i, &b);
+					if (i != lo)
+						out += ',';
+					appendJson(out, b ? std::wstring(b) : std::wstring());
+					SysFreeString(b);
+				}
+				out += ']';
+			}
+			break;
+		default:
+			appendJson(out, propertyText(pv));
+	}
+}
+
+static void appendDefinition(std::string &out, unsigned id, const std::wstring &value)
+{
+	char num[16];
+	sprintf(num, "%u", id);
+	out += std::string("{\"string\":") + num + ",\"value\":";
+	appendJson(out, value);
+	out += "}\n";
+}
+
+// Read every key from a file into values, as the handler does; VT_EMPTY where there's nothing to read.
+static bool extract(const std::wstring &path, std::vector<PROPVARIANT> &values)
+{
+	Win32FileAccessor *accessor = new Win32FileAccessor(path);
+	return readFileProperties(accessor, accessor->size(), path, values);
+}
+
+static bool audioHashing;
+
+static void appendAudioHash(std::string &out, const std::wstring &path)
+{
+	Win32FileAccessor f(path, FILE_FLAG_SEQUENTIAL_SCAN);
+	AudioHash ah;
+	if (!f.isOpen() || !audioHash(f, f.size(), ah))
+		return;
+	char hex[32];
+	sprintf(hex, "%016I64x", ah.hash);
+	out += std::string(",\"audioHash\":\"") + hex + "\"";
+}
+
+static void clear(std::vector<PROPVARIANT> &values)
+{
+	for (std::vector<PROPVARIANT>::iterator it = values.begin(); it != values.end(); ++it)
+		PropVariantClear(&*it);
+	values.clear();
+}
+
+// The values extract() read, as JSON fields.
+// Ids of any interned strings they refer to are added to refs.
+static void appendValues(std::string &out, const std::vector<PROPVARIANT> &values, std::vector<unsigned> &refs)
+{
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		const PROPVARIANT &pv = values[i];
+		if (pv.vt == VT_EMPTY)
+			continue;
+		out += ",\"" + keyNames[i] + "\":";
+		if (pool && interned[i] && pv.vt == VT_LPWSTR)
+		{
+			const unsigned id = pool->intern(pv.pwszVal);
+			char num[16];
+			sprintf(num, "%u", id);
+			out += num;
+			refs.push_back(id);
+		}
+		else
+			appendJson(out, pv);
+	}
+}
+
+// One line of output for a file; op may be NULL for a full dump.
+static std::string record(const char *op, const FileInfo &fi, bool read, std::vector<unsigned> &refs)
+{
+	std::string out = "{";
+	if (op)
+		out += std::string("\"op\":\"") + op + "\",";
+	out += "\"path\":";
+	appendJson(out, fi.path);
+
+	if (read)
+	{
+		std::vector<PROPVARIANT> values;
+		if (extract(fi.path, values))
+		{
+			appendValues(out, values, refs);
+			if (audioHashing)
+				appendAudioHash(out, fi.path);
+		}
+		else
+			out += ",\"error\":\"unsupported\"";
+		clear(values);
+	}
+	out += "}\n";
+	return out;
+}
+
+// A member's values, or the stdin's, as JSON fields.
+static void appendMember(std::string &out, const std::vector<PROPVARIANT> *values)
+{
+	if (!values)
+	{
+		out += ",\"error\":\"unsupported\"";
+		return;
+	}
+	std::vector<unsigned> refs;
+	appendValues(out, *values, refs);
+}
+
+// With -stdin.
+static void scanStdin(const std::wstring &name, FILE *out)
+{
+	OnePassAccessor *source = new OnePassAccessor(GetStdHandle(STD_INPUT_HANDLE), name);
+	std::vector<PROPVARIANT> values;
+	const bool ok = readMemberProperties(source, source, 0, name, values);
+	std::string line = "{\"path\":";
+	appendJson(line, name);
+	appendMember(line, ok ? &values : NULL);
+	line += "}\n";
+	fputs(line.c_str(), out);
+	clear(values);
+}
+
+// With -archive. Members are parsed on every core, and their lines written in archive order.
+struct ArchiveLines
+{
+	std::wstring path;
+	CRITICAL_SECTION cs;
+	std::map<size_t, std::string> lines;
+};
+
+static void memberFound(void *context, size_t index, const Archive::Member &m, const std::vector<PROPVARIANT> *values)
+{
+	ArchiveLines &a = *static_cast<ArchiveLines *>(context);
+	std::wstring path = a.path + L"\\" + m.name;
+	std::replace(path.begin() + a.path.size(), path.end(), L'/', L'\\');
+
+	std::string line = "{\"path\":";
+	appendJson(line, path);
+	appendMember(line, values);
+	line += "}\n";
+	Lock lock(a.cs);
+	a.lines[index].swap(line);
+}
+
+static bool scanArchives(const std::vector<std::wstring> &archives, FILE *out)
+{
+	bool ok = true;
+	for (std::vector<std::wstring>::const_iterator it = archives.begin(); it != archives.end(); ++it)
+	{
+		ArchiveLines a;
+		a.path = *it;
+		InitializeCriticalSection(&a.cs);
+		if (!scanArchive(*it, memberFound, &a))
+		{
+			std::wcerr << L"tlhscan: " << *it << L" isn't a ZIP or TAR archive, or is damaged" << std::endl;
+			ok = false;
+		}
+		DeleteCriticalSection(&a.cs);
+		for (std::map<size_t, std::string>::const_iterator line = a.lines.begin(); line != a.lines.end(); ++line)
+			fwrite(line->second.data(), 1, line->second.size(), out);
+	}
+	fflush(out);
+	return ok;
+}
+
+struct Work
+{
+	const char *op;
+	FileInfo fi;
+	bool read;
+	std::wstring from; // for moves.
+};
+
+// With -columnar, output goes here instead, and the workers hand back values rather than text.
+static ColumnWriter *columns;
+
+struct Line
+{
+	std::string text;
+	std::vector<unsigned> refs;
+	std::vector<PROPVARIANT> values;
+	bool read;
+};
+
+// With -locality, the sweep the workers wait on.
+static Sweep *sweep;
+
+struct Batch
+{
+	const std::vector<Work> *work;
+	std::vector<Line> *out;
+	volatile LONG next;
+};
+
+static DWORD WINAPI extractWorker(LPVOID param)
+{
+	Batch &b = *static_cast<Batch *>(param);
+	const LONG n = static_cast<LONG>(b.work->size());
+	for (LONG i; (i = InterlockedIncrement(&b.next) - 1) < n; )
+	{
+		const Work &w = (*b.work)[i];
+		Line &line = (*b.out)[i];
+		if (sweep && w.read)
+			sweep->wait(w.fi.path);
+		if (columns)
+		{
+			line.read = extract(w.fi.path, line.values);
+			continue;
+		}
+		line.text = record(w.op, w.fi, w.read, line.refs);
+		if (!w.from.empty())
+		{
+			std::string from = ",\"from\":";
+			appendJson(from, w.from);
+			line.text.insert(line.text.size() - 2, from);
+		}
+	}
+	return 0;
+}
+
+// Produce the lines for the work on every core, then write them out in order.
+// Done a slice at a time, so a full scan of a huge library doesn't hold all of its output.
+// Interned strings are defined as they're written, so they come out in order too.
+static void run(const std::vector<Work> &work, FILE *out)
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	const DWORD nthreads = std::min<DWORD>(si.dwNumberOfProcessors, MAXIMUM_WAIT_OBJECTS);
+	const size_t slice = 4096;
+
+	for (size_t first = 0; first < work.size(); first += slice)
+	{
+		const std::vector<Work> part(work.begin() + first, work.begin() + std::min(work.size(), first + slice));
+		std::vector<Line> lines(part.size());
+		Batch b = { &part, &lines, 0 };
+
+		std::vector<HANDLE> threads;
+		for (DWORD i = 0; i < nthreads; ++i)
+			threads.push_back(CreateThread(NULL, 0, extractWorker, &b, 0, NULL));
+		WaitForMultipleObjects(static_cast<DWORD>(threads.size()), &threads[0], TRUE, INFINITE);
+		for (size_t i = 0; i < threads.size(); ++i)
+			CloseHandle(threads[i]);
+
+		for (std::vector<Line>::iterator it = lines.begin(); it != lines.end(); ++it)
+		{
+			if (columns)
+			{
+				columns->add(part[it - lines.begin()].fi.path, it->read ? &it->values[0] : NULL);
+				clear(it->values);
+				continue;
+			}
+
+			std::string defs;
+			for (std::vector<unsigned>::const_iterator id = it->refs.begin(); id != it->refs.end(); ++id)
+			{
+				if (*id >= defined.size())
+					defined.resize(pool->size());
+				if (!defined[*id])
+				{
+					appendDefinition(defs, *id, pool->get(*id));
+					defined[*id] = true;
+				}
+			}
+			fwrite(defs.data(), 1, defs.size(), out);
+			fwrite(it->text.data(), 1, it->text.size(), out);
+		}
+	}
+	fflush(out);
+}
+
+// Work with nothing to read first, then the rest in the order the sweep will have it ready.
+struct BySweep
+{
+	BySweep(const Sweep &s) : s(s) {}
+	bool operator()(const Work &a, const Work &b) const
+	{
+		return (a.read ? s.rank(a.fi.path) + 1 : 0) < (b.read ? s.rank(b.fi.path) + 1 : 0);
+	}
+	const Sweep &s;
+};
+
+// As run(), with the files' heads and tails read ahead of the parsers, in the order they lie on the disk.
+static void runSwept(std::vector<Work> &work, FILE *out)
+{
+	std::vector<std::wstring> paths;
+	for (std::vector<Work>::const_iterator it = work.begin(); it != work.end(); ++it)
+		if (it->read)
+			paths.push_back(it->fi.path);
+	Sweep s(paths);
+	std::stable_sort(work.begin(), work.end(), BySweep(s));
+	s.start();
+	sweep = &s;
+	run(work, out);
+	sweep = NULL;
+}
+
+// === Diffing against the manifest. ===
+
+static Work work(const char *op, const FileInfo &fi, bool read)
+{
+	Work w;
+	w.op = op;
+	w.fi = fi;
+	w.read = read;
+	return w;
+}
+
+static bool underPrefix(const std::wstring &path, const std::wstring &prefix)
+{
+	return path.size() > prefix.size() && !path.compare(0, prefix.size(), prefix) && path[prefix.size()] == L'\\';
+}
+
+typedef std::pair<DWORD, ULONGLONG> FileId; // volume, id.
+
+// Compare what's on disk now (`now`, everything under any of `prefixes`) against the manifest,
+//  updating it, and return the work to bring a consumer of the previous output up to date.
+// Diffing everything at once lets a file that went from under one prefix to under another be
+//  seen as a move.
+static std::vector<Work> diff(Manifest &manifest, const std::vector<std::wstring> &prefixes, std::vector<FileInfo> &now)
+{
+	if (fingerprinting && !now.empty())
+		fingerprint(now);
+
+	std::vector<Work> ret;
+	std::set<std::wstring> seen;
+	std::vector<FileInfo> added;
+	std::multimap<FileId, size_t> addedIds; // into added, to spot renames; hard links share an id.
+
+	for (std::vector<FileInfo>::const_iterator it = now.begin(); it != now.end(); ++it)
+	{
+		// Prefixes can overlap, a directory and a file in it, so a file can be here twice.
+		if (!seen.insert(it->path).second)
+			continue;
+		Manifest::iterator old = manifest.find(it->path);
+		if (old == manifest.end())
+		{
+			if (it->id)
+				addedIds.insert(std::make_pair(FileId(it->volume, it->id), added.size()));
+			added.push_back(*it);
+		}
+		else if (old->second.size != it->size || old->second.mtime != it->mtime || old->second.id != it->id
+			|| (old->second.print && it->print != old->second.print))
+		{
+			ret.push_back(work("change", *it, true));
+			old->second = *it;
+		}
+		else
+		{
+			old->second.print = it->print;
+			old->second.volume = it->volume;
+		}
+	}
+
+	// Everything starting with a prefix is contiguous in the map, but not everything there is under it.
+	std::set<std::wstring> removed;
+	for (std::vector<std::wstring>::const_iterator prefix = prefixes.begin(); prefix != prefixes.end(); ++prefix)
+		for (Manifest::iterator it = manifest.lower_bound(*prefix); it != manifest.end()
+			&& !it->first.compare(0, prefix->size(), *prefix); ++it)
+			if ((it->first == *prefix || underPrefix(it->first, *prefix)) && !seen.count(it->first))
+				removed.insert(it->first);
+
+	std::vector<bool> moved(added.size());
+	for (std::set<std::wstring>::const_iterator it = removed.begin(); it != removed.end(); ++it)
+	{
+		const FileInfo &gone = manifest[*it];
+		size_t to = added.size();
+		typedef std::multimap<FileId, size_t>::const_iterator Id;
+		const std::pair<Id, Id> same = addedIds.equal_range(FileId(gone.volume, gone.id));
+		for (Id c = same.first; c != same.second && to == added.size(); ++c)
+			if (!moved[c->second] && added[c->second].size == gone.size && added[c->second].mtime == gone.mtime)
+				to = c->second;
+		if (to != added.size())
+		{
+			Work w = work("move", added[to], false);
+			w.from = gone.path;
+			ret.push_back(w);
+			manifest[added[to].path] = added[to];
+			moved[to] = true;
+		}
+		else
+			ret.push_back(work("remove", gone, false));
+		manifest.erase(*it);
+	}
+
+	for (size_t i = 0; i < added.size(); ++i)
+		if (!moved[i])
+		{
+			ret.push_back(work("add", added[i], true));
+			manifest[added[i].path] = added[i];
+		}
+	return ret;
+}
+
+// === The manifest file: one "size TAB mtime TAB id@volume TAB path" line per file, in UTF-8. ===
+// The volume is a serial number, in hex; manifests from before it was kept have none, and their
+//  files aren't taken for moves until they've been seen again. With -fingerprint, "#fingerprint TAB"
+//  (in hex) comes before the path; paths never start with '#'.
+
+// A line of any length, without its newline; false at the end of the file.
+static bool readLine(FILE *f, std::string &line)
+{
+	line.clear();
+	char buf[4096];
+	while (fgets(buf, sizeof(buf), f))
+	{
+		line += buf;
+		if (line[line.size() - 1] == '\n')
+		{
+			line.erase(line.size() - 1);
+			return true;
+		}
+	}
+	return !line.empty();
+}
+
+static bool loadManifest(const std::wstring &name, Manifest &manifest)
+{
+	FILE *f = _wfopen(name.c_str(), L"rb");
+	if (!f)
+		return false;
+
+	std::string line;
+	while (readLine(f, line))
+	{
+		FileInfo fi;
+		char *p = const_cast<char *>(line.c_str());
+		fi.size = _strtoui64(p, &p, 10);
+		if (*p)
+			fi.mtime = _strtoui64(p + 1, &p, 10);
+		if (*p)
+			fi.id = _strtoui64(p + 1, &p, 10);
+		if (*p == '@')
+			fi.volume = strtoul(p + 1, &p, 16);
+		if (p[0] && p[1] == '#')
+			fi.print = _strtoui64(p + 2, &p, 16);
+		if (*p != '\t' || !p[1])
+			continue;
+		fi.path = fromUtf8(p + 1);
+		manifest[fi.path] = fi;
+	}
+	fclose(f);
+	return true;
+}
+
+// === The strings file, with -intern: each string, in id order, as its length in UTF-8 bytes, a TAB,
+//  the string and a newline; strings can hold newlines of their own. ===
+
+// Interns the strings an earlier run handed out, with the same ids, as already defined.
+static void loadStrings(const std::wstring &name)
+{
+	FILE *f = _wfopen(name.c_str(), L"rb");
+	if (!f)
+		return;
+	std::string s;
+	for (unsigned long len; fscanf(f, "%lu", &len) == 1 && fgetc(f) == '\t'; )
+	{
+		s.resize(len);
+		if ((len && fread(&s[0], 1, len, f) != len) || fgetc(f) != '\n' || pool->intern(fromUtf8(s)) != pool->size() - 1)
+			break;
+	}
+	fclose(f);
+	defined.assign(pool->size(), true);
+}
+
+static void saveStrings(const std::wstring &name)
+{
+	const std::wstring tmp = name + L".new";
+	FILE *f = _wfopen(tmp.c_str(), L"wb");
+	if (!f)
+		return;
+	for (unsigned id = 0; id < pool->size(); ++id)
+	{
+		const std::string s = toUtf8(pool->get(id));
+		fprintf(f, "%lu\t", static_cast<unsigned long>(s.size()));
+		fwrite(s.data(), 1, s.size(), f);
+		fputc('\n', f);
+	}
+	fclose(f);
+	MoveFileEx(tmp.c_str(), name.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+static void saveManifest(const std::wstring &name, const Manifest &manifest)
+{
+	// The ids in the output written against this manifest are the pool's.
+	if (pool)
+		saveStrings(name + L".strings");
+
+	// Written aside and swapped in, so an interrupted save leaves the old manifest.
+	const std::wstring tmp = name + L".new";
+	FILE *f = _wfopen(tmp.c_str(), L"wb");
+	if (!f)
+		return;
+	for (Manifest::const_iterator it = manifest.begin(); it != manifest.end(); ++it)
+	{
+		fprintf(f, "%I64u\t%I64u\t%I64u@%lx\t", it->second.size, it->second.mtime, it->second.id, it->second.volume);
+		if (it->second.print)
+			fprintf(f, "#%I64x\t", it->second.print);
+		fprintf(f, "%s\n", toUtf8(it->second.path).c_str());
+	}
+	fclose(f);
+	MoveFileEx(tmp.c_str(), name.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+// === Watching. ===
+
+// A root being watched, with its read outstanding.
+struct Watched
+{
+	std::wstring root;
+	HANDLE dir;
+	OVERLAPPED ov;
+	std::vector<DWORD> buf;
+	bool pending;
+};
+
+static void watch(const std::vector<std::wstring> &roots, Manifest &manifest, const std::wstring &manifestName, FILE *out)
+{
+	// Sized once: the reads write into the buffers and OVERLAPPEDs, so they mustn't move.
+	std::vector<Watched> watched(std::min<size_t>(roots.size(), MAXIMUM_WAIT_OBJECTS));
+	std::vector<HANDLE> events;
+	for (size_t i = 0; i < watched.size(); ++i)
+	{
+		Watched &w = watched[i];
+		w.root = roots[i];
+		w.dir = CreateFile(w.root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+		if (w.dir == INVALID_HANDLE_VALUE)
+			std::wcerr << L"tlhscan: can't watch " << w.root << std::endl;
+		memset(&w.ov, 0, sizeof(w.ov));
+		w.ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		w.buf.resize(64 * 1024 / sizeof(DWORD));
+		w.pending = false;
+		events.push_back(w.ov.hEvent);
+	}
+	if (roots.size() > watched.size())
+		std::wcerr << L"tlhscan: only the first " << watched.size() << L" roots are watched" << std::endl;
+
+	std::set<std::wstring> dirty, overflowed;
+	const DWORD settle = 1000;
+
+	for (;;)
+	{
+		bool any = false;
+		for (std::vector<Watched>::iterator w = watched.begin(); w != watched.end(); ++w)
+		{
+			if (w->dir != INVALID_HANDLE_VALUE && !w->pending)
+			{
+				ResetEvent(w->ov.hEvent);
+				if (ReadDirectoryChangesW(w->dir, &w->buf[0], static_cast<DWORD>(w->buf.size() * sizeof(DWORD)), TRUE,
+					FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE
+					| FILE_NOTIFY_CHANGE_LAST_WRITE, NULL, &w->ov, NULL))
+					w->pending = true;
+				else
+				{
+					std::wcerr << L"tlhscan: stopped watching " << w->root << std::endl;
+					CloseHandle(w->dir);
+					w->dir = INVALID_HANDLE_VALUE;
+				}
+			}
+			any = any || w->pending;
+		}
+		if (!any)
+			break;
+
+		// Collect events until nothing has happened for a while, then act on them all at once, so a
+		//  rename from one directory, or root, to another is seen whole.
+		const bool quiet = dirty.empty() && overflowed.empty();
+		const DWORD woken = WaitForMultipleObjects(static_cast<DWORD>(events.size()), &events[0], FALSE,
+			quiet ? INFINITE : settle);
+		if (woken >= WAIT_OBJECT_0 && woken < WAIT_OBJECT_0 + events.size())
+		{
+			Watched &w = watched[woken - WAIT_OBJECT_0];
+			w.pending = false;
+			DWORD bytes = 0;
+			if (!GetOverlappedResult(w.dir, &w.ov, &bytes, FALSE) || !bytes)
+			{
+				// The buffer overflowed and events were lost; walk everything under the root again.
+				overflowed.insert(w.root);
+				continue;
+			}
+			const char *p = reinterpret_cast<const char *>(&w.buf[0]);
+			for (;;)
+			{
+				const FILE_NOTIFY_INFORMATION *n = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(p);
+				dirty.insert(w.root + L"\\" + std::wstring(n->FileName, n->FileNameLength / sizeof(WCHAR)));
+				if (!n->NextEntryOffset)
+					break;
+				p += n->NextEntryOffset;
+			}
+			continue;
+		}
+		if (woken != WAIT_TIMEOUT)
+			break;
+
+		// A directory is walked again as a whole, as its children may have moved with it; a file, or
+		//  something that has gone, is checked on its own.
+		std::vector<std::wstring> prefixes(overflowed.begin(), overflowed.end());
+		std::vector<FileInfo> now;
+		for (std::vector<std::wstring>::const_iterator it = prefixes.begin(); it != prefixes.end(); ++it)
+			walk(*it, now);
+		for (std::set<std::wstring>::const_iterator it = dirty.begin(); it != dirty.end(); ++it)
+		{
+			prefixes.push_back(*it);
+			WIN32_FILE_ATTRIBUTE_DATA fad;
+			FileInfo fi;
+			if (GetFileAttributesEx(it->c_str(), GetFileExInfoStandard, &fad)
+				&& (fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+				walk(*it, now);
+			else if (handledExtension(*it) && statFile(*it, fi))
+				now.push_back(fi);
+		}
+		dirty.clear();
+		overflowed.clear();
+
+		const std::vector<Work> changes = diff(manifest, prefixes, now);
+		if (!changes.empty())
+		{
+			run(changes, out);
+			saveManifest(manifestName, manifest);
+		}
+	}
+
+	for (std::vector<Watched>::iterator w = watched.begin(); w != watched.end(); ++w)
+	{
+		if (w->dir != INVALID_HANDLE_VALUE)
+		{
+			// The read mustn't finish into the buffer once it's gone.
+			DWORD bytes;
+			if (w->pending && CancelIo(w->dir))
+				GetOverlappedResult(w->dir, &w->ov, &bytes, TRUE);
+			CloseHandle(w->dir);
+		}
+		CloseHandle(w->ov.hEvent);
+	}
+}
+
+// === The benchmark. ===
+
+static double seconds(const LARGE_INTEGER &start)
+{
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return static_cast<double>(now.QuadPart - start.QuadPart) / freq.QuadPart;
+}
+
+static int bench(const std::wstring &templ, size_t count, const std::wstring &dir)
+{
+	const std::wstring::size_type dot = templ.rfind(L'.');
+	const std::wstring ext = dot == std::wstring::npos ? L"" : templ.substr(dot);
+
+	std::wcout << L"populating " << dir << L" with " << count << L" files..." << std::endl;
+	CreateDirectory(dir.c_str(), NULL);
+	for (size_t i = 0; i < count; ++i)
+	{
+		std::wstringstream sub, name;
+		sub << dir << L"\\" << i / 1000;
+		name << sub.str() << L"\\" << i % 1000 << ext;
+		if (i % 1000 == 0)
+			CreateDirectory(sub.str().c_str(), NULL);
+		CopyFile(templ.c_str(), name.str().c_str(), TRUE);
+	}
+
+	FILE *nul = _wfopen(L"NUL", L"wb");
+	LARGE_INTEGER start;
+
+	// Full: walk and read everything.
+	QueryPerformanceCounter(&start);
+	std::vector<FileInfo> files;
+	walk(dir, files);
+	const double walkTime = seconds(start);
+	std::vector<Work> all;
+	for (std::vector<FileInfo>::const_iterator it = files.begin(); it != files.end(); ++it)
+		all.push_back(work(NULL, *it, true));
+	run(all, nul);
+	const double full = seconds(start);
+
+	Manifest manifest;
+	for (std::vector<FileInfo>::const_iterator it = files.begin(); it != files.end(); ++it)
+		manifest[it->path] = *it;
+
+	// Touch 0.1% of the files, spread through the tree.
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	const size_t step = 1000;
+	size_t touched = 0;
+	for (size_t i = 0; i < files.size(); i += step, ++touched)
+	{
+		HANDLE h = CreateFile(files[i].path.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+		SetFileTime(h, NULL, NULL, &now);
+		CloseHandle(h);
+	}
+
+	// Incremental: walk, diff, read only what changed.
+	QueryPerformanceCounter(&start);
+	std::vector<FileInfo> again;
+	walk(dir, again);
+	const std::vector<Work> changes = diff(manifest, std::vector<std::wstring>(1, dir), again);
+	run(changes, nul);
+	const double incremental = seconds(start);
+	fclose(nul);
+
+	std::wcout << files.size() << L" files, " << touched << L" touched, " << changes.size() << L" changes found\n"
+		<< L"walk:        " << walkTime << L"s\n"
+		<< L"full:        " << full << L"s\n"
+		<< L"incremental: " << incremental << L"s (" << full / incremental << L"x)" << std::endl;
+	return 0;
+}
+
+// Opening a file unbuffered makes the cache manager throw away what it holds of it.
+static void evict(const std::vector<Work> &work)
+{
+	for (std::vector<Work>::const_iterator it = work.begin(); it != work.end(); ++it)
+	{
+		HANDLE h = CreateFile(it->fi.path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+			FILE_FLAG_NO_BUFFERING, NULL);
+		if (h != INVALID_HANDLE_VALUE)
+			CloseHandle(h);
+	}
+}
+
+// A 7200rpm disk, roughly: a read that carries straight on from the last costs nothing; anything
+//  else settles, moves the heads by the square root of the distance, then waits half a turn.
+//  Clusters are taken to be 4KB, NTFS's default.
+static double simulateSeeks(const std::vector<Sweep::Read> &reads)
+{
+	ULONGLONG lo = ~0ULL, hi = 0;
+	for (std::vector<Sweep::Read>::const_iterator it = reads.begin(); it != reads.end(); ++it)
+		if (it->located)
+		{
+			lo = std::min(lo, it->lcn);
+			hi = std::max(hi, it->lcn);
+		}
+	const double span = hi > lo ? static_cast<double>(hi - lo) : 1;
+
+	double total = 0;
+	ULONGLONG head = lo;
+	for (std::vector<Sweep::Read>::const_iterator it = reads.begin(); it != reads.end(); ++it)
+	{
+		if (!it->located)
+			continue;
+		if (it->lcn != head)
+		{
+			const double d = it->lcn > head ? static_cast<double>(it->lcn - head) : static_cast<double>(head - it->lcn);
+			total += 0.002 + 0.008 * sqrt(std::min(1.0, d / span)) + 0.00417;
+		}
+		head = it->lcn + (it->length + 4095) / 4096;
+	}
+	return total;
+}
+
+struct ByFile
+{
+	bool operator()(const Sweep::Read &a, const Sweep::Read &b) const
+	{
+		return a.file != b.file ? a.file < b.file : a.offset < b.offset;
+	}
+};
+
+static int benchLocality(const std::wstring &dir)
+{
+	std::vector<FileInfo> files;
+	walk(dir, files);
+	std::vector<Work> all;
+	std::vector<std::wstring> paths;
+	for (std::vector<FileInfo>::const_iterator it = files.begin(); it != files.end(); ++it)
+	{
+		all.push_back(work(NULL, *it, true));
+		paths.push_back(it->path);
+	}
+
+	FILE *nul = _wfopen(L"NUL", L"wb");
+	LARGE_INTEGER start;
+
+	evict(all);
+	QueryPerformanceCounter(&start);
+	run(all, nul);
+	const double tree = seconds(start);
+
+	evict(all);
+	QueryPerformanceCounter(&start);
+	std::vector<Work> swept = all;
+	runSwept(swept, nul);
+	const double locality = seconds(start);
+	fclose(nul);
+
+	// Both orders of the same reads, from where they lie; the MFT stays cached, which flatters the tree order.
+	const Sweep plan(paths);
+	std::vector<Sweep::Read> inTree = plan.reads();
+	std::sort(inTree.begin(), inTree.end(), ByFile());
+	const double seekTree = simulateSeeks(inTree), seekSwept = simulateSeeks(plan.reads());
+
+	std::wcout << files.size() << L" files, " << plan.located() << L" placed by their extents, "
+		<< plan.reads().size() << L" reads\n"
+		<< L"cold, tree order:     " << tree << L"s\n"
+		<< L"cold, -locality:      " << locality << L"s (" << tree / locality << L"x)\n"
+		<< L"simulated seeks, tree order: " << seekTree << L"s\n"
+		<< L"simulated seeks, swept:      " << seekSwept << L"s (" << seekTree / seekSwept << L"x)" << std::endl;
+	return 0;
+}
+
+// A made-up library, shaped roughly like a real one: ten tracks to an album, and artists, genres
+//  and so on shared between many albums.
+struct SyntheticTrack
+{
+	std::wstring path, title, artist, albumArtist, album, genre, composer, publisher;
+};
+
+static SyntheticTrack synthesise(size_t i)
+{
+	const size_t album = i / 10;
+	SyntheticTrack t;
+	std::wstringstream ss;
+	ss << L"D:\\Music\\" << album / 1000 << L"\\" << album << L"\\" << i % 10 << L".mp3";
+	t.path = ss.str();
+	ss.str(L"");
+	ss << L"Track " << i;
+	t.title = ss.str();
+	ss.str(L"");
+	ss << L"Artist " << album * 7919 % 20000;
+	t.artist = t.albumArtist = ss.str();
+	ss.str(L"");
+	ss << L"Album " << album;
+	t.album = ss.str();
+	ss.str(L"");
+	ss << L"Genre " << album % 300;
+	t.genre = ss.str();
+	ss.str(L"");
+	ss << L"Composer " << album * 104729 % 5000;
+	t.composer = ss.str();
+	ss.str(L"");
+	ss << L"Publisher " << album % 1000;
+	t.publisher = ss.str();
+	return t;
+}
+
+struct InternedTrack
+{
+	std::wstring path, title;
+	unsigned artist, albumArtist, album, genre, composer, publisher;
+};
+
+static SIZE_T privateBytes()
+{
+	PROCESS_MEMORY_COUNTERS_EX pmc = {};
+	GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS *>(&pmc), sizeof(pmc));
+	return pmc.PrivateUsage;
+}
+
+static void appendField(std::string &out, const char *name, const std::wstring &value)
+{
+	out += std::string(",\"") + name + "\":";
+	appendJson(out, value);
+}
+
+static void appendField(std::string &out, const char *name, unsigned id, std::vector<bool> &seen, std::string &defs)
+{
+	char num[16];
+	sprintf(num, "%u", id);
+	out += std::string(",\"") + name + "\":" + num;
+	if (id >= seen.size())
+		seen.resize(pool->size());
+	if (!seen[id])
+	{
+		appendDefinition(defs, id, pool->get(id));
+		seen[id] = true;
+	}
+}
+
+static int benchIntern(size_t count)
+{
+	StringPool strings;
+	pool = &strings;
+	LARGE_INTEGER start;
+
+	// Interned first, as memory the plain run frees may not go back to the system.
+	SIZE_T before = privateBytes();
+	QueryPerformanceCounter(&start);
+	unsigned long long internedOut = 0;
+	{
+		std::vector<InternedTrack> lib(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			const SyntheticTrack t = synthesise(i);
+			InternedTrack &it = lib[i];
+			it.path = t.path;
+			it.title = t.title;
+			it.artist = strings.intern(t.artist);
+			it.albumArtist = strings.intern(t.albumArtist);
+			it.album = strings.intern(t.album);
+			it.genre = strings.intern(t.genre);
+			it.composer = strings.intern(t.composer);
+			it.publisher = strings.intern(t.publisher);
+		}
+		const SIZE_T held = privateBytes() - before;
+
+		std::vector<bool> seen;
+		for (size_t i = 0; i < count; ++i)
+		{
+			std::string line = "{\"path\":", defs;
+			appendJson(line, lib[i].path);
+			appendField(line, "System.Title", lib[i].title);
+			appendField(line, "System.Music.Artist", lib[i].artist, seen, defs);
+			appendField(line, "System.Music.AlbumArtist", lib[i].albumArtist, seen, defs);
+			appendField(line, "System.Music.AlbumTitle", lib[i].album, seen, defs);
+			appendField(line, "System.Music.Genre", lib[i].genre, seen, defs);
+			appendField(line, "System.Music.Composer", lib[i].composer, seen, defs);
+			appendField(line, "System.Media.Publisher", lib[i].publisher, seen, defs);
+			internedOut += defs.size() + line.size() + 2;
+		}
+		std::wcout << L"interned: " << held / (1024 * 1024) << L" MB held, " << internedOut / (1024 * 1024)
+			<< L" MB written, " << strings.size() << L" distinct strings, " << seconds(start) << L"s" << std::endl;
+	}
+
+	before = privateBytes();
+	QueryPerformanceCounter(&start);
+	unsigned long long plainOut = 0;
+	{
+		std::vector<SyntheticTrack> lib(count);
+		for (size_t i = 0; i < count; ++i)
+			lib[i] = synthesise(i);
+		const SIZE_T held = privateBytes() - before;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			std::string line = "{\"path\":";
+			appendJson(line, lib[i].path);
+			appendField(line, "System.Title", lib[i].title);
+			appendField(line, "System.Music.Artist", lib[i].artist);
+			appendField(line, "System.Music.AlbumArtist", lib[i].albumArtist);
+			appendField(line, "System.Music.AlbumTitle", lib[i].album);
+			appendField(line, "System.Music.Genre", lib[i].genre);
+			appendField(line, "System.Music.Composer", lib[i].composer);
+			appendField(line, "System.Media.Publisher", lib[i].publisher);
+			plainOut += line.size() + 2;
+		}
+		std::wcout << L"plain:    " << held / (1024 * 1024) << L" MB held, " << plainOut / (1024 * 1024)
+			<< L" MB written, " << seconds(start) << L"s" << std::endl;
+	}
+
+	std::wcout << L"output:   " << 100.0 * internedOut / plainOut << L"% of plain" << std::endl;
+	pool = NULL;
+	return 0;
+}
+
+// The synthetic library again, as readProperty would produce it.
+static void setValue(std::vector<PROPVARIANT> &values, REFPROPERTYKEY key, const std::wstring &s)
+{
+	for (size_t i = 0; i < keyCount; ++i)
+		if (IsEqualPropertyKey(keys[i], key))
+			InitPropVariantFromString(s.c_str(), &values[i]);
+}
+
+static void setValue(std::vector<PROPVARIANT> &values, REFPROPERTYKEY key, unsigned long long n)
+{
+	for (size_t i = 0; i < keyCount; ++i)
+		if (IsEqualPropertyKey(keys[i], key))
+		{
+			if (columnType(key) == ColumnWriter::U64)
+			{
+				values[i].vt = VT_UI8;
+				values[i].uhVal.QuadPart = n;
+			}
+			else
+			{
+				values[i].vt = VT_UI4;
+				values[i].ulVal = static_cast<ULONG>(n);
+			}
+		}
+}
+
+static std::wstring synthesiseValues(size_t i, std::vector<PROPVARIANT> &values)
+{
+	values.resize(keyCount);
+	for (size_t k = 0; k < keyCount; ++k)
+		PropVariantInit(&values[k]);
+
+	const SyntheticTrack t = synthesise(i);
+	const size_t album = i / 10;
+	setValue(values, PKEY_Title, t.title);
+	setValue(values, PKEY_Music_Artist, t.artist);
+	setValue(values, PKEY_Music_AlbumArtist, t.albumArtist);
+	setValue(values, PKEY_Music_AlbumTitle, t.album);
+	setValue(values, PKEY_Music_Genre, t.genre);
+	setValue(values, PKEY_Music_Composer, t.composer);
+	setValue(values, PKEY_Media_Publisher, t.publisher);
+	setValue(values, PKEY_Music_TrackNumber, i % 10 + 1);
+	setValue(values, PKEY_Media_Year, 1960 + album % 60);
+	setValue(values, PKEY_Media_Duration, (120 + i * 37 % 300) * 10000000ULL);
+	setValue(values, PKEY_Audio_EncodingBitrate, (128 + album % 3 * 96) * 1000);
+	setValue(values, PKEY_Audio_SampleRate, 44100);
+	setValue(values, PKEY_Audio_ChannelCount, 2);
+	if (i % 7 == 0)
+		setValue(values, PKEY_Rating, i % 5 * 25);
+	return t.path;
+}
+
+static int benchColumnar(size_t count, const std::wstring &name)
+{
+	const std::wstring ndjsonName = name + L".ndjson";
+	std::vector<PROPVARIANT> values;
+	std::vector<unsigned> refs;
+	LARGE_INTEGER start;
+
+	// Making up the rows has a cost of its own, which is taken off both.
+	QueryPerformanceCounter(&start);
+	for (size_t i = 0; i < count; ++i)
+	{
+		synthesiseValues(i, values);
+		clear(values);
+	}
+	const double making = seconds(start);
+
+	FILE *f = _wfopen(ndjsonName.c_str(), L"wb");
+	if (!f)
+		return 1;
+	QueryPerformanceCounter(&start);
+	unsigned long long ndjsonSize = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		std::string line = "{\"path\":";
+		appendJson(line, synthesiseValues(i, values));
+		appendValues(line, values, refs);
+		line += "}\n";
+		clear(values);
+		fwrite(line.data(), 1, line.size(), f);
+		ndjsonSize += line.size();
+	}
+	fclose(f);
+	const double ndjson = seconds(start) - making;
+
+	f = _wfopen(name.c_str(), L"wb");
+	if (!f)
+		return 1;
+	QueryPerformanceCounter(&start);
+	unsigned long long columnarSize;
+	{
+		ColumnWriter w(f);
+		for (size_t i = 0; i < count; ++i)
+		{
+			const std::wstring path = synthesiseValues(i, values);
+			w.add(path, &values[0]);
+			clear(values);
+		}
+		w.finish();
+		columnarSize = w.size();
+	}
+	fclose(f);
+	const double columnar = seconds(start) - making;
+
+	// Total duration, and the most common genre of each group, straight from the mapping.
+	QueryPerformanceCounter(&start);
+	MappedFile m(name);
+	const ColumnReader r(m.data, m.size);
+	const int duration = r.find(PKEY_Media_Duration), genre = r.find(PKEY_Music_Genre);
+	unsigned long long total = 0, rows = 0;
+	for (unsigned g = 0; g < r.groups(); ++g)
+	{
+		std::vector<unsigned> counts(r.dictionarySize(g, genre));
+		for (unsigned row = 0; row < r.rows(g); ++row, ++rows)
+		{
+			if (r.present(g, duration, row))
+				total += r.u64(g, duration, row);
+			++counts[r.index(g, genre, row)];
+		}
+	}
+	const double reading = seconds(start);
+
+	const double mb = 1024 * 1024;
+	std::wcout << count << L" tracks\n"
+		<< L"ndjson:   " << ndjsonSize / mb << L" MB, " << count / ndjson << L" rows/s, " << ndjsonSize / mb / ndjson << L" MB/s\n"
+		<< L"columnar: " << columnarSize / mb << L" MB, " << count / columnar << L" rows/s, " << columnarSize / mb / columnar
+			<< L" MB/s (" << 100.0 * columnarSize / ndjsonSize << L"% of the size, " << ndjson / columnar << L"x the speed)\n"
+		<< L"read two columns of " << rows << L" rows from the mapping in " << reading << L"s (" << total / 10000000 / 3600
+			<< L" hours of audio)" << std::endl;
+	return 0;
+}
+
+static void usage()
+{
+	std::wcerr << L"usage: tlhscan [-o out] [-intern] [-audio-hash] [-locality] [-manifest file [-fingerprint] [-watch]] root...\n"
+		L"       tlhscan -o out [-locality] -columnar root...\n"
+		L"       tlhscan [-o out] -stdin name\n"
+		L"       tlhscan [-o out] -archive archive...\n"
+		L"       tlhscan -bench template count dir\n"
+		L"       tlhscan -bench-locality dir\n"
+		L"       tlhscan -bench-intern count\n"
+		L"       tlhscan -bench-columnar count file" << std::endl;
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+	for (size_t i = 0; i < keyCount; ++i)
+	{
+		WCHAR *name = NULL;
+		PSGetNameFromPropertyKey(keys[i], &name);
+		keyNames.push_back(name ? toUtf8(name) : std::string());
+		CoTaskMemFree(name);
+		interned.push_back(internedKey(keys[i]));
+	}
+
+	StringPool strings;
+
+	std::wstring outName, manifestName, stdinName;
+	bool watching = false, columnar = false, locality = false, archives = false;
+	std::vector<std::wstring> roots;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::wstring arg = argv[i];
+		const bool more = i + 1 < argc;
+		if (arg == L"-bench" && i + 3 < argc)
+			return bench(argv[i + 1], _wtoi(argv[i + 2]), argv[i + 3]);
+		else if (arg == L"-bench-locality" && more)
+			return benchLocality(argv[i + 1]);
+		else if (arg == L"-bench-intern" && more)
+			return benchIntern(_wtoi(argv[i + 1]));
+		else if (arg == L"-bench-columnar" && i + 2 < argc)
+			return benchColumnar(_wtoi(argv[i + 1]), argv[i + 2]);
+		else if (arg == L"-intern")
+			pool = &strings;
+		else if (arg == L"-columnar")
+			columnar = true;
+		else if (arg == L"-o" && more)
+			outName = argv[++i];
+		else if (arg == L"-manifest" && more)
+			manifestName = argv[++i];
+		else if (arg == L"-watch")
+			watching = true;
+		else if (arg == L"-fingerprint")
+			fingerprinting = true;
+		else if (arg == L"-audio-hash")
+			audioHashing = true;
+		else if (arg == L"-locality")
+			locality = true;
+		else if (arg == L"-stdin" && more)
+			stdinName = argv[++i];
+		else if (arg == L"-archive")
+			archives = true;
+		else if (arg[0] == L'-')
+		{
+			usage();
+			return 2;
+		}
+		else
+		{
+			// Manifest paths are compared as strings, so the roots need to be spelt the same each run.
+			std::wstring root = arg;
+			while (root.size() > 1 && (root[root.size() - 1] == L'\\' || root[root.size() - 1] == L'/'))
+				root.erase(root.size() - 1);
+			roots.push_back(root);
+		}
+	}
+
+	// -stdin is the one file, and on its own; -archive's roots are archives, and only ever dumped whole.
+	if (!stdinName.empty() && (!roots.empty() || !manifestName.empty() || columnar || pool || audioHashing || locality))
+	{
+		usage();
+		return 2;
+	}
+	if (archives && (!stdinName.empty() || !manifestName.empty() || columnar || pool || audioHashing || locality))
+	{
+		usage();
+		return 2;
+	}
+
+	// A column file is a full dump; it has nowhere to put a change set, and isn't text.
+	if ((roots.empty() && stdinName.empty()) || ((watching || fingerprinting) && manifestName.empty())
+		|| (columnar && (outName.empty() || !manifestName.empty() || audioHashing)))
+	{
+		usage();
+		return 2;
+	}
+
+	FILE *out = outName.empty() ? stdout : _wfopen(outName.c_str(), L"wb");
+	if (!out)
+	{
+		std::wcerr << L"tlhscan: can't write " << outName << std::endl;
+		return 1;
+	}
+
+	if (!stdinName.empty())
+	{
+		scanStdin(stdinName, out);
+		if (out != stdout)
+			fclose(out);
+		return 0;
+	}
+
+	if (archives)
+	{
+		const bool ok = scanArchives(roots, out);
+		if (out != stdout)
+			fclose(out);
+		return ok ? 0 : 1;
+	}
+
+	std::auto_ptr<ColumnWriter> writer;
+	if (columnar)
+	{
+		writer.reset(new ColumnWriter(out));
+		columns = writer.get();
+	}
+
+	Manifest manifest;
+	const bool incremental = !manifestName.empty() && loadManifest(manifestName, manifest);
+	if (incremental && pool)
+		loadStrings(manifestName + L".strings");
+
+	// The roots are walked, and diffed, together, so a file moved from one to another is a move.
+	std::vector<FileInfo> files;
+	for (std::vector<std::wstring>::const_iterator root = roots.begin(); root != roots.end(); ++root)
+		walk(*root, files);
+	std::vector<Work> todo;
+	if (incremental)
+		todo = diff(manifest, roots, files);
+	else
+	{
+		if (fingerprinting)
+			fingerprint(files);
+		for (std::vector<FileInfo>::const_iterator it = files.begin(); it != files.end(); ++it)
+		{
+			todo.push_back(work(NULL, *it, true));
+			manifest[it->path] = *it;
+		}
+	}
+	if (locality)
+		runSwept(todo, out);
+	else
+		run(todo, out);
+	if (columns)
+		columns->finish();
+
+	if (!manifestName.empty())
+		saveManifest(manifestName, manifest);
+
+	if (watching)
+		watch(roots, manifest, manifestName, out);
+
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
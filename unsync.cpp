@@ -0,0 +1,77 @@
+#include "unsync.h"
+
+#include <windows.h>
+#include <emmintrin.h>
+
+namespace
+{
+	size_t unsyncSse2(unsigned char *p, size_t n)
+	{
+		const __m128i ff = _mm_set1_epi8(-1), zero = _mm_setzero_si128();
+		size_t in = 0, out = 0;
+		unsigned prev = 0; // whether the byte before the block was FF.
+		for (; n - in >= 16; in += 16)
+		{
+			const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + in));
+			const unsigned ffs = _mm_movemask_epi8(_mm_cmpeq_epi8(x, ff));
+			const unsigned drops = (ffs << 1 | prev) & _mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) & 0xFFFF;
+			prev = ffs >> 15;
+			if (!drops)
+			{
+				if (out != in)
+					_mm_storeu_si128(reinterpret_cast<__m128i *>(p + out), x);
+				out += 16;
+				continue;
+			}
+			// Every byte is written and only those kept are counted, so there's no branch to mispredict.
+			//  Writes stay behind the reads, so what's read is still the block as it was.
+			const unsigned keeps = ~drops;
+			for (unsigned j = 0; j < 16; ++j)
+			{
+				p[out] = p[in + j];
+				out += keeps >> j & 1;
+			}
+		}
+		for (; in < n; ++in)
+		{
+			const unsigned char c = p[in];
+			if (c || !prev)
+				p[out++] = c;
+			prev = c == 0xFF;
+		}
+		return out;
+	}
+
+	bool detectSse2()
+	{
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+		return true;
+#else
+		return IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) != FALSE;
+#endif
+	}
+
+	const bool sse2 = detectSse2();
+}
+
+size_t id3Unsync(unsigned char *p, size_t n)
+{
+	return sse2 ? unsyncSse2(p, n) : id3UnsyncPlain(p, n);
+}
+
+size_t id3UnsyncPlain(unsigned char *p, size_t n)
+{
+	size_t out = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		p[out++] = p[i];
+		if (p[i] == 0xFF && i + 1 < n && !p[i + 1])
+			++i;
+	}
+	return out;
+}
+
+bool id3UnsyncVectorised()
+{
+	return sse2;
+}
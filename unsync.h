@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+
+// === ID3v2's unsynchronisation, undone. ===
+// An unsynchronised tag has a 00 put after every FF that could be taken for a frame sync, and the
+//  reader takes them out again: FF 00 becomes FF. Tags with pictures are mostly picture, and a
+//  JPEG's FFs are many, so this is a pass over most of the tag. Here it's done sixteen bytes at a
+//  time (SSE2, when the CPU has it): a 00 goes if the byte before it is FF, so a block's pairs are
+//  found with two compares, and blocks with none are moved whole, or, before the first pair, not
+//  touched at all. Blocks with pairs are copied a byte at a time, as the plain decoder does.
+
+// In place; the length after.
+size_t id3Unsync(unsigned char *p, size_t n);
+
+// The same, a byte at a time, whatever the CPU.
+size_t id3UnsyncPlain(unsigned char *p, size_t n);
+
+// Whether id3Unsync() is using SSE2 on this machine.
+bool id3UnsyncVectorised();
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+
+inline std::string toUtf8(const std::wstring &s)
+{
+	if (s.empty())
+		return std::string();
+	const int len = WideCharToMultiByte(CP_UTF8, 0, s.c_str(), static_cast<int>(s.size()), NULL, 0, NULL, NULL);
+	std::string ret(len, 0);
+	WideCharToMultiByte(CP_UTF8, 0, s.c_str(), static_cast<int>(s.size()), &ret[0], len, NULL, NULL);
+	return ret;
+}
+
+inline std::wstring fromUtf8(const std::string &s)
+{
+	if (s.empty())
+		return std::wstring();
+	const int len = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), static_cast<int>(s.size()), NULL, 0);
+	std::wstring ret(len, 0);
+	MultiByteToWideChar(CP_UTF8, 0, s.c_str(), static_cast<int>(s.size()), &ret[0], len);
+	return ret;
+}
@@ -0,0 +1,622 @@
+#define NOMINMAX
+
+#include "xiphscan.h"
+#include "accessorutil.h"
+#include "extract.h"
+#include "exttag.h"
+
+#include <propkey.h>
+#include <propvarutil.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	const size_t windowSize = 8 * 1024;
+	const unsigned maxBlocks = 1024;
+	// Enough of a comment to have the longest name kept, and its '='.
+	const size_t headLength = 16;
+
+	unsigned be24(const unsigned char *p) { return p[0] << 16 | p[1] << 8 | p[2]; }
+	unsigned be32(const unsigned char *p) { return static_cast<unsigned>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+	unsigned le32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | static_cast<unsigned>(p[3]) << 24; }
+
+	class Reader
+	{
+	public:
+		Reader(TagLib::FileAccessor &file, ULONGLONG size, std::vector<unsigned char> &buf)
+			: file(file), size(size), read(0), buf(buf), start(0)
+		{
+			buf.clear();
+		}
+
+		// Exactly n bytes at off, or false.
+		bool readAt(ULONGLONG off, void *out, size_t n)
+		{
+			if (off > size || size - off < n || seekTo(file, off))
+				return false;
+			const size_t got = file.fread(out, 1, n);
+			read += got;
+			return got == n;
+		}
+
+		// The same, through a window of the file, for the run of small reads headers and comments make.
+		bool readCached(ULONGLONG off, void *out, size_t n)
+		{
+			if (n > windowSize)
+				return readAt(off, out, n);
+			if (!n)
+				return true;
+			if (off < start || off - start > buf.size() || buf.size() - (off - start) < n)
+			{
+				if (off > size || size - off < n)
+					return false;
+				buf.resize(static_cast<size_t>(std::min<ULONGLONG>(windowSize, size - off)));
+				if (!readAt(off, &buf[0], buf.size()))
+				{
+					buf.clear();
+					return false;
+				}
+				start = off;
+			}
+			memcpy(out, &buf[0] + (off - start), n);
+			return true;
+		}
+
+		TagLib::FileAccessor &file;
+		const ULONGLONG size;
+		ULONGLONG read;
+
+	private:
+		std::vector<unsigned char> &buf;
+		ULONGLONG start;
+
+		Reader &operator=(const Reader &);
+	};
+
+	// Where a comment list's bytes come from: a FLAC block, or an Ogg packet.
+	class Source
+	{
+	public:
+		virtual bool read(unsigned char *p, size_t n) = 0;
+		virtual bool skip(size_t n) = 0;
+
+	protected:
+		~Source() {}
+	};
+
+	class Block : public Source
+	{
+	public:
+		Block(Reader &r, ULONGLONG pos, ULONGLONG end) : r(r), pos(pos), end(end) {}
+
+		bool read(unsigned char *p, size_t n)
+		{
+			if (end - pos < n || !r.readCached(pos, p, n))
+				return false;
+			pos += n;
+			return true;
+		}
+
+		bool skip(size_t n)
+		{
+			if (end - pos < n)
+				return false;
+			pos += n;
+			return true;
+		}
+
+	private:
+		Reader &r;
+		ULONGLONG pos;
+		const ULONGLONG end;
+
+		Block &operator=(const Block &);
+	};
+
+	// The first stream's packets, through its pages. A page of another stream is TagLib's, which
+	//  reads pages in order, whoever's they are.
+	class Packets : public Source
+	{
+	public:
+		Packets(Reader &r) : r(r), next(0), pos(0), segments(0), segment(0), left(0), ends(true), started(false), serial(0) {}
+
+		// On to the start of the next packet, past what's left of this one; at first, to the first.
+		bool nextPacket()
+		{
+			while (left || !ends)
+			{
+				pos += left;
+				left = 0;
+				if (!ends && !advance(false))
+					return false;
+			}
+			return advance(true);
+		}
+
+		bool read(unsigned char *p, size_t n)
+		{
+			return take(p, n);
+		}
+
+		bool skip(size_t n)
+		{
+			return take(NULL, n);
+		}
+
+	private:
+		// Skipped bytes aren't read; nor are the pages they span, past their headers.
+		bool take(unsigned char *p, size_t n)
+		{
+			while (n)
+			{
+				if (!left && (ends || !advance(p != NULL)))
+					return false; // the packet ended first.
+				const size_t k = std::min<size_t>(n, left);
+				if (p)
+				{
+					if (!r.readCached(pos, p, k))
+						return false;
+					p += k;
+				}
+				pos += k;
+				left -= k;
+				n -= k;
+			}
+			return true;
+		}
+
+		// The next segment, from the next page if this one's done.
+		bool advance(bool cached)
+		{
+			if (segment + 1 < segments)
+				++segment;
+			else if (page(!ends, cached))
+				segment = 0;
+			else
+				return false;
+			left = lacing[segment];
+			ends = left < 255;
+			return true;
+		}
+
+		bool page(bool continued, bool cached)
+		{
+			unsigned char h[27 + 255];
+			if (next > r.size || r.size - next < 27)
+				return false;
+			const size_t n = static_cast<size_t>(std::min<ULONGLONG>(sizeof(h), r.size - next));
+			if (!(cached ? r.readCached(next, h, n) : r.readAt(next, h, n)))
+				return false;
+			if (memcmp(h, "OggS", 4) || h[4] || !h[26] || n < 27u + h[26] || ((h[5] & 1) != 0) != continued)
+				return false;
+			if (started && le32(h + 14) != serial)
+				return false;
+			started = true;
+			serial = le32(h + 14);
+			segments = h[26];
+			memcpy(lacing, h + 27, segments);
+			pos = next + 27 + segments;
+			next = pos;
+			for (unsigned i = 0; i < segments; ++i)
+				next += lacing[i];
+			return true;
+		}
+
+		Reader &r;
+		ULONGLONG next, pos; // the next page, and the next byte of this segment.
+		unsigned char lacing[255];
+		unsigned segments, segment, left;
+		bool ends;           // whether the packet ends with this segment.
+		bool started;
+		unsigned serial;
+
+		Packets &operator=(const Packets &);
+	};
+
+	const char *const fieldNames[] = { "TITLE", "ARTIST", "ALBUM", "DESCRIPTION", "COMMENT", "GENRE", "DATE",
+		"TRACKNUMBER", "ALBUMARTIST", "COMPOSER", "CONDUCTOR", "LABEL", "SUBTITLE", "PRODUCER", "MOOD",
+		"COPYRIGHT", "DISCNUMBER", "RATING", "KEYWORDS" };
+
+	// Names some TagLibs read in place of DATE and TRACKNUMBER; files with them are left to TagLib.
+	const char *const fallbackNames[] = { "YEAR", "TRACKNUM" };
+
+	// Whether a comment's name is name: TagLib upper-cases names, ASCII only, before it looks.
+	bool nameIs(const unsigned char *p, size_t n, const char *name)
+	{
+		for (; *name; ++name, ++p, --n)
+			if (!n || (*p >= 'a' && *p <= 'z' ? *p - 'a' + 'A' : *p) != *name)
+				return false;
+		return !n;
+	}
+
+	// The field, XIPH_FIELDS if it isn't kept, or -1 if it's TagLib's.
+	int fieldNamed(const unsigned char *p, size_t n)
+	{
+		for (size_t i = 0; i < sizeof(fieldNames) / sizeof(*fieldNames); ++i)
+			if (nameIs(p, n, fieldNames[i]))
+				return static_cast<int>(i);
+		for (size_t i = 0; i < sizeof(fallbackNames) / sizeof(*fallbackNames); ++i)
+			if (nameIs(p, n, fallbackNames[i]))
+				return -1;
+		return XIPH_FIELDS;
+	}
+
+	bool listed(XiphField field)
+	{
+		return field == XIPH_DATE || field == XIPH_RATING || field == XIPH_KEYWORDS;
+	}
+
+	// A comment list, as XiphComment::parse() reads one: the vendor, a count, then each comment
+	//  "NAME=value", up to a null; without an '=', the whole comment is both.
+	bool comments(Source &s, XiphTags &tags)
+	{
+		unsigned char n[4];
+		if (!s.read(n, 4) || !s.skip(le32(n)) || !s.read(n, 4))
+			return false;
+		const unsigned count = le32(n);
+		for (unsigned i = 0; i < count; ++i)
+		{
+			unsigned char head[headLength];
+			if (!s.read(n, 4))
+				return false;
+			const size_t length = le32(n), got = std::min(length, sizeof(head));
+			if (!s.read(head, got))
+				return false;
+			++tags.count;
+
+			const unsigned char *const first = head, *const end = std::find(first, first + got, 0);
+			const unsigned char *const eq = std::find(first, end, '=');
+			const int field = fieldNamed(head, eq - head);
+			if (field < 0)
+				return false;
+			if (field == XIPH_FIELDS)
+			{
+				if (!s.skip(length - got))
+					return false;
+				continue;
+			}
+
+			XiphTags::Value v;
+			v.offset = static_cast<unsigned>(tags.data.size());
+			v.set = true;
+			tags.data.insert(tags.data.end(), eq == end ? head : eq + 1, end);
+			if (end != head + got)
+			{
+				if (!s.skip(length - got))
+					return false;
+			}
+			else if (length > got)
+			{
+				const size_t at = tags.data.size();
+				tags.data.resize(at + length - got);
+				if (!s.read(&tags.data[at], length - got))
+					return false;
+				tags.data.resize(std::find(tags.data.begin() + at, tags.data.end(), 0) - tags.data.begin());
+			}
+			v.size = static_cast<unsigned>(tags.data.size() - v.offset);
+			if (v.size && MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS,
+					reinterpret_cast<const char *>(&tags.data[v.offset]), v.size, NULL, 0) <= 0)
+				return false;
+
+			if (!tags.fields[field].set)
+				tags.fields[field] = v;
+			else if (listed(static_cast<XiphField>(field)))
+			{
+				if (tags.moreCount == XiphTags::listSize)
+					return false;
+				tags.more[tags.moreCount] = static_cast<XiphField>(field);
+				tags.moreValues[tags.moreCount++] = v;
+			}
+			else
+				tags.data.resize(v.offset);
+		}
+		return true;
+	}
+
+	// FLAC's metadata blocks from start: STREAMINFO, and, with tags, the first VORBIS_COMMENT.
+	bool blocks(Reader &r, ULONGLONG start, FlacInfo &info, XiphTags *tags)
+	{
+		unsigned char h[34];
+		if (!r.readCached(start, h, 4) || memcmp(h, "fLaC", 4))
+			return false;
+		bool commented = false;
+		ULONGLONG pos = start + 4;
+		for (unsigned i = 0; i < maxBlocks; ++i)
+		{
+			if (!r.readCached(pos, h, 4))
+				return false;
+			const unsigned type = h[0] & 0x7F, length = be24(h + 1);
+			const bool last = (h[0] & 0x80) != 0;
+			pos += 4;
+			if (r.size - pos < length)
+				return false;
+			if (!i)
+			{
+				if (type || length < 34 || !r.readCached(pos, h, 34))
+					return false;
+				info.sampleRate = h[10] << 12 | h[11] << 4 | h[12] >> 4;
+				info.channels = ((h[12] >> 1) & 7) + 1;
+				info.samples = static_cast<ULONGLONG>(h[13] & 0x0F) << 32 | be32(h + 14);
+			}
+			else if (type == 4 && tags && !commented)
+			{
+				Block b(r, pos, pos + length);
+				if (!comments(b, *tags))
+					return false;
+				commented = true;
+			}
+			pos += length;
+			if (last)
+			{
+				info.audio = r.size - pos;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool hasId3v1(Reader &r)
+	{
+		unsigned char tag[3];
+		return r.size >= 128 && r.readAt(r.size - 128, tag, 3) && !memcmp(tag, "TAG", 3);
+	}
+
+	// A FLAC with no ID3 tags, as TagLib would read it with only the comments.
+	bool flac(Reader &r, XiphTags &tags, HeaderInfo &header)
+	{
+		FlacInfo info;
+		if (!blocks(r, 0, info, &tags) || !info.samples || !info.sampleRate || hasId3v1(r))
+			return false;
+		tags.sampleRate = info.sampleRate;
+		tags.channels = info.channels;
+		header.duration = info.duration();
+		header.bitrate = info.bitrate();
+		return header.bitrate != 0;
+	}
+
+	// The identification header, and the comment header after it; false if the first packet isn't
+	//  Vorbis's, as an .oga's needn't be.
+	bool vorbis(Reader &r, XiphTags &tags)
+	{
+		Packets p(r);
+		unsigned char id[28];
+		if (!p.nextPacket() || !p.read(id, sizeof(id)) || memcmp(id, "\x01vorbis", 7))
+			return false;
+		tags.channels = id[11];
+		tags.sampleRate = le32(id + 12);
+		// TagLib's kilobits, rounded, as the handler scales them.
+		tags.bitrate = static_cast<unsigned>(static_cast<int>(static_cast<int>(le32(id + 20)) / 1000.f + 0.5f)) * 1000;
+		unsigned char c[7];
+		return p.nextPacket() && p.read(c, sizeof(c)) && !memcmp(c, "\x03vorbis", 7) && comments(p, tags);
+	}
+
+	bool named(const std::wstring &name, const wchar_t *ext)
+	{
+		const std::wstring::size_type dot = name.rfind(L'.');
+		return dot != std::wstring::npos && !_wcsicmp(name.c_str() + dot + 1, ext);
+	}
+
+	// --- Reading the kept comments as TagLib would. ---
+
+	// TagLib's String::toInt(), on the UTF-8: leading digits, after an optional minus.
+	int toInt(const XiphTags &tags, const XiphTags::Value &v)
+	{
+		const unsigned char *p = v.size ? &tags.data[v.offset] : NULL, *const end = p + v.size;
+		const bool negative = p != end && *p == '-';
+		int value = 0;
+		for (p += negative; p < end && *p >= '0' && *p <= '9'; ++p)
+			value = value * 10 + (*p - '0');
+		return negative ? -value : value;
+	}
+
+	std::wstring text(const XiphTags &tags, const XiphTags::Value &v)
+	{
+		std::wstring ret;
+		if (!v.size)
+			return ret;
+		const char *p = reinterpret_cast<const char *>(&tags.data[v.offset]);
+		const int chars = MultiByteToWideChar(CP_UTF8, 0, p, v.size, NULL, 0);
+		if (chars <= 0)
+			return ret;
+		ret.resize(chars);
+		MultiByteToWideChar(CP_UTF8, 0, p, v.size, &ret[0], chars);
+		return ret;
+	}
+
+	// Every value of field, in order.
+	wstrvec_t values(const XiphTags &tags, XiphField field)
+	{
+		wstrvec_t ret;
+		if (!tags.fields[field].set)
+			return ret;
+		ret.push_back(text(tags, tags.fields[field]));
+		for (unsigned i = 0; i < tags.moreCount; ++i)
+			if (tags.more[i] == field)
+				ret.push_back(text(tags, tags.moreValues[i]));
+		return ret;
+	}
+
+	// XiphComment::comment(): DESCRIPTION, if there is one, else COMMENT.
+	const XiphTags::Value &commentValue(const XiphTags &tags)
+	{
+		return tags.fields[tags.fields[XIPH_DESCRIPTION].set ? XIPH_DESCRIPTION : XIPH_COMMENT];
+	}
+
+	bool basicEmpty(const XiphTags &tags)
+	{
+		return !tags.fields[XIPH_TITLE].size && !tags.fields[XIPH_ARTIST].size && !tags.fields[XIPH_ALBUM].size
+			&& !commentValue(tags).size && !tags.fields[XIPH_GENRE].size
+			&& !toInt(tags, tags.fields[XIPH_DATE]) && !toInt(tags, tags.fields[XIPH_TRACKNUMBER]);
+	}
+
+	unsigned char rating(const XiphTags &tags)
+	{
+		if (tags.fields[XIPH_RATING].set)
+		{
+			if (const int i = toInt(tags, tags.fields[XIPH_RATING]))
+				return normaliseRating(i);
+			for (unsigned m = 0; m < tags.moreCount; ++m)
+				if (tags.more[m] == XIPH_RATING)
+					if (const int i = toInt(tags, tags.moreValues[m]))
+						return normaliseRating(i);
+		}
+		return RATING_UNRATED_SET;
+	}
+
+	// The first of that comment, as TRY_BSTR would give it.
+	void fieldValue(const XiphTags &tags, XiphField field, PROPVARIANT *pv)
+	{
+		if (tags.fields[field].set)
+			InitPropVariantFromString(text(tags, tags.fields[field]).c_str(), pv);
+	}
+
+	void numberValue(unsigned n, PROPVARIANT *pv)
+	{
+		if (n)
+		{
+			pv->uintVal = n;
+			pv->vt = VT_UI4;
+		}
+	}
+}
+
+ULONGLONG FlacInfo::duration() const
+{
+	return sampleRate ? samples / sampleRate * 10000000 + samples % sampleRate * 10000000 / sampleRate : 0;
+}
+
+unsigned FlacInfo::bitrate() const
+{
+	return samples ? static_cast<unsigned>(audio * 8 * sampleRate / samples) : 0;
+}
+
+bool flacFileName(const std::wstring &name)
+{
+	return named(name, L"flac");
+}
+
+bool readFlacInfo(TagLib::FileAccessor &file, ULONGLONG size, FlacInfo &info, ULONGLONG *bytesRead)
+{
+	std::vector<unsigned char> buf;
+	Reader r(file, size, buf);
+	// TagLib looks for an ID3v2 tag only at the start.
+	ULONGLONG start = 0;
+	unsigned char h[10];
+	if (r.readAt(0, h, sizeof(h)) && !memcmp(h, "ID3", 3))
+		start = 10 + (h[5] & 0x10 ? 10 : 0) + ((h[6] & 0x7F) << 21 | (h[7] & 0x7F) << 14 | (h[8] & 0x7F) << 7 | (h[9] & 0x7F));
+	bool ok = blocks(r, start, info, NULL) && info.samples && info.sampleRate;
+	if (ok && hasId3v1(r))
+		info.audio = info.audio >= 128 ? info.audio - 128 : 0;
+	if (bytesRead)
+		*bytesRead = r.read;
+	return ok;
+}
+
+XiphTags::XiphTags() : moreCount(0), count(0), sampleRate(0), channels(0), bitrate(0)
+{
+	data.reserve(4096);
+}
+
+bool readXiphFile(TagLib::FileAccessor &file, ULONGLONG size, const std::wstring &name, XiphTags &tags,
+	HeaderInfo &header, ULONGLONG *bytesRead)
+{
+	memset(tags.fields, 0, sizeof(tags.fields));
+	tags.moreCount = tags.count = 0;
+	tags.sampleRate = tags.channels = tags.bitrate = 0;
+	tags.data.clear();
+
+	Reader r(file, size, tags.window);
+	ULONGLONG tail = 0;
+	bool ok = false;
+	if (flacFileName(name))
+		ok = flac(r, tags, header);
+	else if (named(name, L"ogg") || named(name, L"oga"))
+		ok = vorbis(r, tags) && readHeaderInfo(file, size, name, header, &tail);
+	// Comments but none of the basic tag's: TagLib's tags differ on whether that's empty.
+	ok = ok && !(tags.count && basicEmpty(tags));
+	if (bytesRead)
+		*bytesRead = r.read + tail;
+	return ok;
+}
+
+HRESULT readXiphProperty(const XiphTags &tags, const HeaderInfo &header, REFPROPERTYKEY key, PROPVARIANT *pv)
+{
+	try
+	{
+		if (IsEqualPropertyKey(key, PKEY_Audio_ChannelCount))
+		{
+			pv->uintVal = tags.channels;
+			pv->vt = VT_UI4;
+		}
+		else if (IsEqualPropertyKey(key, PKEY_Media_Duration))
+		{
+			pv->uhVal.QuadPart = header.duration;
+			pv->vt = VT_UI8;
+		}
+		else if (IsEqualPropertyKey(key, PKEY_Audio_EncodingBitrate))
+		{
+			pv->uintVal = header.bitrate ? header.bitrate : tags.bitrate;
+			pv->vt = VT_UI4;
+		}
+		else if (IsEqualPropertyKey(key, PKEY_Audio_SampleRate))
+		{
+			pv->uintVal = tags.sampleRate;
+			pv->vt = VT_UI4;
+		}
+		// If the tag is empty, treat it as if it doesn't exist.
+		else if (!tags.count)
+			return S_FALSE;
+		else if (IsEqualPropertyKey(key, PKEY_Music_AlbumTitle))
+			InitPropVariantFromString(text(tags, tags.fields[XIPH_ALBUM]).c_str(), pv);
+		else if (IsEqualPropertyKey(key, PKEY_Music_Artist))
+			InitPropVariantFromString(text(tags, tags.fields[XIPH_ARTIST]).c_str(), pv);
+		else if (IsEqualPropertyKey(key, PKEY_Music_Genre))
+			InitPropVariantFromString(text(tags, tags.fields[XIPH_GENRE]).c_str(), pv);
+		else if (IsEqualPropertyKey(key, PKEY_Title))
+			InitPropVariantFromString(text(tags, tags.fields[XIPH_TITLE]).c_str(), pv);
+		else if (IsEqualPropertyKey(key, PKEY_Comment))
+			InitPropVariantFromString(text(tags, commentValue(tags)).c_str(), pv);
+		else if (IsEqualPropertyKey(key, PKEY_Music_TrackNumber))
+			numberValue(toInt(tags, tags.fields[XIPH_TRACKNUMBER]), pv);
+		else if (IsEqualPropertyKey(key, PKEY_Media_Year))
+			numberValue(toInt(tags, tags.fields[XIPH_DATE]), pv);
+		else if (IsEqualPropertyKey(key, PKEY_Rating))
+		{
+			pv->uintVal = rating(tags);
+			pv->vt = VT_UI4;
+		}
+		else if (IsEqualPropertyKey(key, PKEY_Keywords))
+			return keywordsValue(values(tags, XIPH_KEYWORDS), pv);
+		else if (IsEqualPropertyKey(key, PKEY_Media_DateReleased))
+			releaseDateValue(parseDate(values(tags, XIPH_DATE)), toInt(tags, tags.fields[XIPH_DATE]), pv);
+		else if (IsEqualPropertyKey(key, PKEY_Music_AlbumArtist))
+			fieldValue(tags, XIPH_ALBUMARTIST, pv);
+		else if (IsEqualPropertyKey(key, PKEY_Music_Composer))
+			fieldValue(tags, XIPH_COMPOSER, pv);
+		else if (IsEqualPropertyKey(key, PKEY_Music_Conductor))
+			fieldValue(tags, XIPH_CONDUCTOR, pv);
+		else if (IsEqualPropertyKey(key, PKEY_Media_SubTitle))
+			fieldValue(tags, XIPH_SUBTITLE, pv);
+		else if (IsEqualPropertyKey(key, PKEY_Media_Publisher))
+			fieldValue(tags, XIPH_LABEL, pv);
+		else if (IsEqualPropertyKey(key, PKEY_Media_Producer))
+			fieldValue(tags, XIPH_PRODUCER, pv);
+		else if (IsEqualPropertyKey(key, PKEY_Music_Mood))
+			fieldValue(tags, XIPH_MOOD, pv);
+		else if (IsEqualPropertyKey(key, PKEY_Copyright))
+			fieldValue(tags, XIPH_COPYRIGHT, pv);
+		else if (IsEqualPropertyKey(key, PKEY_Music_PartOfSet))
+			fieldValue(tags, XIPH_DISCNUMBER, pv);
+		else
+			return S_FALSE;
+		return S_OK;
+	}
+	catch (std::exception &e)
+	{
+		OutputDebugStringA(e.what());
+		pv->vt = VT_EMPTY;
+		return ERROR_INTERNAL_ERROR;
+	}
+}
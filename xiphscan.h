@@ -0,0 +1,87 @@
+#pragma once
+
+#include <windows.h>
+#include <fileref.h>
+#include <propsys.h>
+
+#include <string>
+#include <vector>
+
+#include "headerinfo.h"
+
+// === The handler's Vorbis comments from FLAC and Ogg Vorbis, without TagLib. ===
+// TagLib reads every FLAC metadata block into memory, pictures and all, and puts every comment
+//  into a map of lists, and then the handler asks for a dozen of them. Here FLAC's block headers
+//  are walked: STREAMINFO and the VORBIS_COMMENT block are read, PICTURE, PADDING and the rest are
+//  seeked over, and the walk stops at the first audio frame. In Ogg Vorbis the comment packet is
+//  read through its pages' headers; a comment that isn't wanted (an embedded picture, say) is
+//  skipped over a page at a time. Only the values of the comments the handler reads are kept,
+//  copied into a buffer that's reused from file to file, and decoded when they're asked for.
+// .flac and .ogg are read, as TagLib picks a FLAC or a Vorbis reader for them, and .oga when its
+//  first packet is Vorbis's: TagLib tries Ogg FLAC on an .oga first, and falls back to Vorbis. Ogg
+//  FLAC itself is left to TagLib, whose bitrate for it can't be had from the headers. Anything else TagLib
+//  might read differently is left to TagLib too: an ID3 tag in a FLAC, an Ogg page of another stream
+//  among the headers, invalid UTF-8 in a value, YEAR or TRACKNUM comments, comments none of which
+//  are the basic tag's, and more values of a kind than there are places for.
+
+struct FlacInfo
+{
+	unsigned sampleRate, channels;
+	ULONGLONG samples;   // 0 if STREAMINFO doesn't say.
+	ULONGLONG audio;     // bytes of audio frames: after the last metadata block, before any ID3v1 tag.
+
+	// In 100ns units.
+	ULONGLONG duration() const;
+	// Average, in bits per second.
+	unsigned bitrate() const;
+};
+
+// Whether the name's extension is FLAC's.
+bool flacFileName(const std::wstring &name);
+
+// STREAMINFO, and where the audio starts, after any ID3v2 tag; false if the blocks are broken.
+bool readFlacInfo(TagLib::FileAccessor &file, ULONGLONG size, FlacInfo &info, ULONGLONG *bytesRead = NULL);
+
+// The comments kept, by name.
+enum XiphField
+{
+	XIPH_TITLE, XIPH_ARTIST, XIPH_ALBUM, XIPH_DESCRIPTION, XIPH_COMMENT, XIPH_GENRE, XIPH_DATE,
+	XIPH_TRACKNUMBER, XIPH_ALBUMARTIST, XIPH_COMPOSER, XIPH_CONDUCTOR, XIPH_LABEL, XIPH_SUBTITLE,
+	XIPH_PRODUCER, XIPH_MOOD, XIPH_COPYRIGHT, XIPH_DISCNUMBER, XIPH_RATING, XIPH_KEYWORDS,
+	XIPH_FIELDS
+};
+
+struct XiphTags
+{
+	// A comment's value, UTF-8 in data, up to where TagLib would stop at a null.
+	struct Value
+	{
+		unsigned offset, size;
+		bool set;
+	};
+
+	XiphTags();
+
+	enum { listSize = 8 };
+
+	Value fields[XIPH_FIELDS];  // the first of each.
+	XiphField more[listSize];   // and after it, the other DATEs, RATINGs and KEYWORDS, in order.
+	Value moreValues[listSize];
+	unsigned moreCount;
+	unsigned count;             // comments in the file, kept or not.
+
+	// The audio, as TagLib's properties give it.
+	unsigned sampleRate, channels;
+	unsigned bitrate;           // Vorbis's nominal bitrate, as the handler gives TagLib's.
+
+	std::vector<unsigned char> data;    // the values, one after another.
+	std::vector<unsigned char> window;  // the headers and comments, as they're read.
+};
+
+// The comments, and the length as readHeaderInfo() would give it, for a .flac, .ogg or .oga name;
+//  false if TagLib should read it. bytesRead counts the file's bytes read.
+bool readXiphFile(TagLib::FileAccessor &file, ULONGLONG size, const std::wstring &name, XiphTags &tags,
+	HeaderInfo &header, ULONGLONG *bytesRead = NULL);
+
+// readHeaderProperty(), as it would be for the file.
+HRESULT readXiphProperty(const XiphTags &tags, const HeaderInfo &header, REFPROPERTYKEY key, PROPVARIANT *pv);